@@ -544,6 +544,8 @@ state_ptr new_state(int memlen)
     result->r = init_reg();
     result->m = init_mem(memlen);
     result->cc = DEFAULT_CC;
+    result->stored = FALSE;
+    result->store_addr = 0;
     return result;
 }
 
@@ -560,6 +562,8 @@ state_ptr copy_state(state_ptr s) {
     result->r = copy_reg(s->r);
     result->m = copy_mem(s->m);
     result->cc = s->cc;
+    result->stored = s->stored;
+    result->store_addr = s->store_addr;
     return result;
 }
 
@@ -641,6 +645,7 @@ stat_t step_state(state_ptr s, FILE *error_file)
     bool_t need_imm;
     word_t ftpc = s->pc;  /* Fall-through PC */
 
+    s->stored = FALSE;
     if (!get_byte_val(s->m, ftpc, &byte0)) {
 	if (error_file)
 	    fprintf(error_file,
@@ -760,6 +765,8 @@ stat_t step_state(state_ptr s, FILE *error_file)
 			s->pc, cval);
 	    return STAT_ADR;
 	}
+	s->stored = TRUE;
+	s->store_addr = cval;
 	s->pc = ftpc;
 	break;
     case I_MRMOVQ:
@@ -842,6 +849,8 @@ stat_t step_state(state_ptr s, FILE *error_file)
 			"PC = 0x%llx, Invalid stack address 0x%llx\n", s->pc, val);
 	    return STAT_ADR;
 	}
+	s->stored = TRUE;
+	s->store_addr = val;
 	s->pc = cval;
 	break;
     case I_RET:
@@ -879,6 +888,8 @@ stat_t step_state(state_ptr s, FILE *error_file)
 			"PC = 0x%llx, Invalid stack address 0x%llx\n", s->pc, dval);
 	    return STAT_ADR;
 	}
+	s->stored = TRUE;
+	s->store_addr = dval;
 	s->pc = ftpc;
 	break;
     case I_POPQ:
@@ -941,3 +952,359 @@ stat_t step_state(state_ptr s, FILE *error_file)
     }
     return STAT_AOK;
 }
+
+/*
+ * Block cache for run_state.  Instructions are decoded once into
+ * blocks that end with a jump, call, ret, or halt.  Operand fields are
+ * checked when a block is decoded.  An instruction that would fail
+ * those checks ends its block, and runs through step_state so that it
+ * fails the same way.
+ */
+
+/* Most instructions decoded into one block */
+#define BLOCK_LEN 16
+/* Blocks cached, indexed by the low bits of their address */
+#define BLOCK_SLOTS 512
+
+typedef struct {
+    byte_t icode;
+    byte_t ifun;
+    byte_t ra;		/* REG_NONE only for an unused field */
+    byte_t rb;		/* REG_NONE only for a missing base register */
+    word_t valc;
+    word_t valp;	/* Address of the following instruction */
+} dinstr_t;
+
+typedef struct {
+    word_t tag;		/* Address of the first instruction + 1, 0 if empty */
+    int len;		/* Instructions decoded */
+    bool_t slow;	/* Last one must run through step_state */
+    dinstr_t instr[BLOCK_LEN];
+} block_t;
+
+typedef struct {
+    block_t blocks[BLOCK_SLOTS];
+    /* Addresses of all decoded bytes are in [code_lo, code_hi) */
+    word_t code_lo;
+    word_t code_hi;
+} block_cache_t;
+
+static void flush_blocks(block_cache_t *bc)
+{
+    int i;
+    for (i = 0; i < BLOCK_SLOTS; i++)
+	bc->blocks[i].tag = 0;
+    bc->code_lo = bc->code_hi = 0;
+}
+
+/* Decode the instruction at pc into d.  Return FALSE if step_state
+   would report an error before executing it */
+static bool_t decode_instr(mem_t m, word_t pc, dinstr_t *d)
+{
+    byte_t byte0, byte1 = HPACK(REG_NONE, REG_NONE);
+    bool_t need_regids, need_imm;
+    word_t ftpc = pc + 1;
+
+    if (!get_byte_val(m, pc, &byte0))
+	return FALSE;
+    d->icode = HI4(byte0);
+    d->ifun = LO4(byte0);
+    d->valc = 0;
+    need_regids =
+	(d->icode == I_RRMOVQ || d->icode == I_ALU || d->icode == I_PUSHQ ||
+	 d->icode == I_POPQ || d->icode == I_IRMOVQ || d->icode == I_RMMOVQ ||
+	 d->icode == I_MRMOVQ || d->icode == I_IADDQ);
+    need_imm =
+	(d->icode == I_IRMOVQ || d->icode == I_RMMOVQ || d->icode == I_MRMOVQ ||
+	 d->icode == I_JMP || d->icode == I_CALL || d->icode == I_IADDQ);
+    if (need_regids) {
+	if (!get_byte_val(m, ftpc, &byte1))
+	    return FALSE;
+	ftpc++;
+    }
+    if (need_imm) {
+	if (!get_word_val(m, ftpc, &d->valc))
+	    return FALSE;
+	ftpc += 8;
+    }
+    d->ra = HI4(byte1);
+    d->rb = LO4(byte1);
+    d->valp = ftpc;
+
+    switch (d->icode) {
+    case I_NOP:
+    case I_HALT:
+    case I_JMP:
+    case I_CALL:
+    case I_RET:
+	return TRUE;
+    case I_RRMOVQ:
+    case I_ALU:
+	/* step_state ignores a missing register of an ALU operation,
+	   which is simplest to leave to it */
+	return reg_valid(d->ra) && reg_valid(d->rb);
+    case I_RMMOVQ:
+    case I_MRMOVQ:
+    case I_PUSHQ:
+    case I_POPQ:
+	return reg_valid(d->ra);
+    case I_IRMOVQ:
+    case I_IADDQ:
+	return reg_valid(d->rb);
+    default:
+	return FALSE;
+    }
+}
+
+/* Find the block starting at pc, decoding it if needed */
+static block_t *find_block(block_cache_t *bc, mem_t m, word_t pc)
+{
+    block_t *b = &bc->blocks[pc & (BLOCK_SLOTS-1)];
+    word_t end = pc;
+
+    if (b->tag == pc + 1)
+	return b;
+    b->tag = pc + 1;
+    b->len = 0;
+    b->slow = FALSE;
+    while (b->len < BLOCK_LEN) {
+	dinstr_t *d = &b->instr[b->len++];
+	if (!decode_instr(m, end, d)) {
+	    b->slow = TRUE;
+	    break;
+	}
+	end = d->valp;
+	if (d->icode == I_JMP || d->icode == I_CALL || d->icode == I_RET
+	    || d->icode == I_HALT)
+	    break;
+    }
+    /* The slow instruction is decoded again by step_state */
+    if (bc->code_lo == bc->code_hi) {
+	bc->code_lo = pc;
+	bc->code_hi = end;
+    } else {
+	if (pc < bc->code_lo)
+	    bc->code_lo = pc;
+	if (end > bc->code_hi)
+	    bc->code_hi = end;
+    }
+    return b;
+}
+
+word_t run_state(state_ptr s, word_t max_steps, word_t stop_pc,
+		 stat_t *statusp, FILE *error_file)
+{
+    block_cache_t *bc = (block_cache_t *) calloc(1, sizeof(block_cache_t));
+    mem_t m = s->m;
+    /* Registers are held here while running.  reg[REG_NONE] stays 0, so
+       a missing base register adds nothing */
+    word_t reg[REG_NONE+1];
+    word_t pc = s->pc;
+    cc_t cc = s->cc;
+    word_t steps = 0;
+    stat_t status = STAT_AOK;
+    reg_id_t id;
+
+    if (!bc) {
+	perror("calloc error");
+	exit(1);
+    }
+    for (id = REG_RAX; id < REG_NONE; id++)
+	reg[id] = get_reg_val(s->r, id);
+    reg[REG_NONE] = 0;
+
+    while (status == STAT_AOK && steps < max_steps
+	   && (pc != stop_pc || stop_pc == -1)) {
+	block_t *b = find_block(bc, m, pc);
+	int fast = b->slow ? b->len - 1 : b->len;
+	int i;
+
+	for (i = 0; i < fast; i++) {
+	    dinstr_t *d = &b->instr[i];
+	    word_t addr, val;
+
+	    if (steps >= max_steps || (pc == stop_pc && stop_pc != -1))
+		break;
+	    switch (d->icode) {
+	    case I_NOP:
+		pc = d->valp;
+		break;
+	    case I_HALT:
+		status = STAT_HLT;
+		break;
+	    case I_RRMOVQ:
+		if (cond_holds(cc, d->ifun))
+		    reg[d->rb] = reg[d->ra];
+		pc = d->valp;
+		break;
+	    case I_IRMOVQ:
+		reg[d->rb] = d->valc;
+		pc = d->valp;
+		break;
+	    case I_RMMOVQ:
+		addr = d->valc + reg[d->rb];
+		if (!set_word_val(m, addr, reg[d->ra]))
+		    goto slow;
+		pc = d->valp;
+		if (addr < bc->code_hi && addr + 8 > bc->code_lo)
+		    goto flush;
+		break;
+	    case I_MRMOVQ:
+		if (!get_word_val(m, d->valc + reg[d->rb], &val))
+		    goto slow;
+		reg[d->ra] = val;
+		pc = d->valp;
+		break;
+	    case I_ALU:
+		val = compute_alu(d->ifun, reg[d->ra], reg[d->rb]);
+		cc = compute_cc(d->ifun, reg[d->ra], reg[d->rb]);
+		reg[d->rb] = val;
+		pc = d->valp;
+		break;
+	    case I_JMP:
+		pc = cond_holds(cc, d->ifun) ? d->valc : d->valp;
+		break;
+	    case I_CALL:
+		addr = reg[REG_RSP] - 8;
+		if (!set_word_val(m, addr, d->valp))
+		    goto slow;
+		reg[REG_RSP] = addr;
+		pc = d->valc;
+		if (addr < bc->code_hi && addr + 8 > bc->code_lo)
+		    goto flush;
+		break;
+	    case I_RET:
+		if (!get_word_val(m, reg[REG_RSP], &val))
+		    goto slow;
+		reg[REG_RSP] += 8;
+		pc = val;
+		break;
+	    case I_PUSHQ:
+		addr = reg[REG_RSP] - 8;
+		if (!set_word_val(m, addr, reg[d->ra]))
+		    goto slow;
+		reg[REG_RSP] = addr;
+		pc = d->valp;
+		if (addr < bc->code_hi && addr + 8 > bc->code_lo)
+		    goto flush;
+		break;
+	    case I_POPQ:
+		addr = reg[REG_RSP];
+		if (!get_word_val(m, addr, &val))
+		    goto slow;
+		reg[REG_RSP] = addr + 8;
+		reg[d->ra] = val;
+		pc = d->valp;
+		break;
+	    case I_IADDQ:
+		val = reg[d->rb];
+		reg[d->rb] = val + d->valc;
+		cc = compute_cc(A_ADD, d->valc, val);
+		pc = d->valp;
+		break;
+	    }
+	    steps++;
+	}
+	/* Leave a failing instruction to step_state */
+	if (i < b->len - 1 || !b->slow || steps >= max_steps
+	    || (pc == stop_pc && stop_pc != -1))
+	    continue;
+    slow:
+	s->pc = pc;
+	s->cc = cc;
+	for (id = REG_RAX; id < REG_NONE; id++)
+	    set_reg_val(s->r, id, reg[id]);
+	status = step_state(s, error_file);
+	steps++;
+	pc = s->pc;
+	cc = s->cc;
+	for (id = REG_RAX; id < REG_NONE; id++)
+	    reg[id] = get_reg_val(s->r, id);
+	continue;
+    flush:
+	/* Code has been overwritten */
+	steps++;
+	flush_blocks(bc);
+    }
+
+    s->pc = pc;
+    s->cc = cc;
+    for (id = REG_RAX; id < REG_NONE; id++)
+	set_reg_val(s->r, id, reg[id]);
+    free(bc);
+    if (statusp)
+	*statusp = status;
+    return steps;
+}
+
+bool_t check_retire(state_ptr s, retire_ptr r, FILE *outfile)
+{
+    word_t pc = s->pc;
+    word_t before[REG_NONE];
+    stat_t status;
+    word_t val, rval;
+    int id;
+    bool_t match = TRUE;
+
+    if (r->pc != pc) {
+	if (outfile)
+	    fprintf(outfile, "Retired instruction at 0x%llx, ISA at 0x%llx\n",
+		    r->pc, pc);
+	return FALSE;
+    }
+    for (id = 0; id < REG_NONE; id++)
+	before[id] = get_reg_val(s->r, id);
+    status = step_state(s, NULL);
+    if (r->status != status) {
+	if (outfile)
+	    fprintf(outfile, "PC = 0x%llx, status %s, ISA status %s\n",
+		    pc, stat_name(r->status), stat_name(status));
+	return FALSE;
+    }
+    if (status != STAT_AOK) {
+	/* A faulting instruction has no effect, but step_state may
+	   already have updated %rsp */
+	for (id = 0; id < REG_NONE; id++)
+	    if (get_reg_val(s->r, id) != before[id])
+		set_reg_val(s->r, id, before[id]);
+    }
+    /* Compare every register, so that a write made on one side only is
+       found.  valM is written last, so it wins when both go to one
+       register */
+    for (id = 0; id < REG_NONE; id++) {
+	if (id == r->dstM)
+	    rval = r->valM;
+	else if (id == r->dstE)
+	    rval = r->valE;
+	else
+	    rval = before[id];
+	if ((val = get_reg_val(s->r, id)) != rval) {
+	    match = FALSE;
+	    if (outfile)
+		fprintf(outfile, "PC = 0x%llx, %s = 0x%llx, ISA 0x%llx\n",
+			pc, reg_name(id), rval, val);
+	}
+    }
+    if (r->mem_write) {
+	val = 0;
+	get_word_val(s->m, r->mem_addr, &val);
+	if (val != r->mem_data) {
+	    match = FALSE;
+	    if (outfile)
+		fprintf(outfile,
+			"PC = 0x%llx, M[0x%llx] = 0x%llx, ISA 0x%llx\n",
+			pc, r->mem_addr, r->mem_data, val);
+	}
+    }
+    if (s->stored && !(r->mem_write && r->mem_addr == s->store_addr)) {
+	match = FALSE;
+	if (outfile) {
+	    val = 0;
+	    get_word_val(s->m, s->store_addr, &val);
+	    fprintf(outfile,
+		    "PC = 0x%llx, M[0x%llx] not written, ISA 0x%llx\n",
+		    pc, s->store_addr, val);
+	}
+    }
+    return match;
+}
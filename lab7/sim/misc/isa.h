@@ -23,6 +23,8 @@ typedef enum { REG_RAX, REG_RCX, REG_RDX, REG_RBX,
 reg_id_t find_register(char *name);
 /* Return name of register given its ID */
 char *reg_name(reg_id_t id);
+/* Is ID a program register (not REG_NONE or REG_ERR)? */
+int reg_valid(reg_id_t id);
 
 /**************** Instruction Encoding **************/
 
@@ -187,6 +189,8 @@ typedef struct {
   mem_t r;
   mem_t m;
   cc_t cc;
+  bool_t stored;      /* Did the last step_state write memory? */
+  word_t store_addr;  /* Word it wrote */
 } state_rec, *state_ptr;
 
 state_ptr new_state(int memlen);
@@ -201,6 +205,35 @@ bool_t cond_holds(cc_t cc, cond_t bcond);
 /* Execute single instruction.  Return status. */
 stat_t step_state(state_ptr s, FILE *error_file);
 
+/* Execute up to max_steps instructions, stopping before the one at
+   stop_pc (-1 for none) or after one that fails.  Decoded blocks of
+   instructions are cached by address, so this is much faster than
+   calling step_state repeatedly.  Set *statusp (if nonnull) to the
+   status of the last instruction.  Return number executed. */
+word_t run_state(state_ptr s, word_t max_steps, word_t stop_pc,
+		 stat_t *statusp, FILE *error_file);
+
+/* Instruction retired by a processor simulator */
+typedef struct {
+  word_t pc;
+  stat_t status;
+  reg_id_t dstE;      /* Registers written, REG_NONE if none */
+  word_t valE;
+  reg_id_t dstM;
+  word_t valM;
+  bool_t mem_write;   /* Word written to memory, if any */
+  word_t mem_addr;
+  word_t mem_data;
+} retire_rec, *retire_ptr;
+
+/* Lockstep checking.  Execute single instruction on s and compare it
+   with r: the PC, the status, every register, and the memory words
+   that either of them wrote.  A faulting instruction must write
+   nothing, so any registers s changed before the fault are restored.
+   Print any differences to outfile (if nonnull).  Return TRUE if they
+   agree */
+bool_t check_retire(state_ptr s, retire_ptr r, FILE *outfile);
+
 /************************ Interface Functions *************/
 
 #ifdef HAS_GUI
@@ -19,13 +19,16 @@ void yyserror(const char *str, char *other);
 static char* show_expr(node_ptr expr);
 
 /* The symbol table */
-#define SYM_LIM 100
+#define SYM_LIM 200
 static node_ptr sym_tab[2][SYM_LIM];
 static int sym_count = 0;
 
 /* Optional simulator name */
 char simname[MAXBUF] = "";
 
+/* Pass generated functions the simulator context (-c)? */
+static int use_ctx = 0;
+
 #ifdef UCLID
 int annotate = 0;
 /* Keep list of argument names encountered in node definition */
@@ -48,7 +51,8 @@ static void usage(char *name)
     fprintf(stderr, "Usage: %s [-ah] < HCL_file  > uclid_file\n", name);
     fprintf(stderr, "   -a     Add define/use annotations\n");
 #else /* !UCLID */
-    fprintf(stderr, "Usage: %s [-h][-n NAM] < HCL_file  > C_file\n", name);
+    fprintf(stderr, "Usage: %s [-hc][-n NAM] < HCL_file  > C_file\n", name);
+    fprintf(stderr, "   -c     Generated functions take simulator context ctx\n");
 #endif /* UCLID */
 #endif /* VLOG */
     fprintf(stderr, "   -h     Print this message\n");
@@ -66,11 +70,14 @@ void init_node(int argc, char **argv)
     int other_indents = 2;
 
     /* Parse the command line arguments */
-    while ((c = getopt(argc, argv, "hna")) != -1) {
+    while ((c = getopt(argc, argv, "hnac")) != -1) {
 	switch(c) {
 	case 'h':
 	    usage(argv[0]);
 	    break;
+	case 'c':
+	    use_ctx = 1;
+	    break;
 	case 'n': /* Optional simulator name */
 	    strcpy(simname, argv[optind]);
 	    break;
@@ -92,6 +99,9 @@ void init_node(int argc, char **argv)
 	printf("char simname[] = \"Y86-64 Processor\";\n");
     else
 	printf("char simname[] = \"Y86-64 Processor: %s\";\n", simname);
+    /* Have sim.h map the names used in quoted code to fields of ctx */
+    if (use_ctx)
+	printf("#define HCL_CTX\n");
 #endif
     outgen_init(outfile, max_column, first_indent, other_indents);
 }
@@ -687,7 +697,8 @@ void gen_funct(node_ptr var, node_ptr expr, int isbool)
     outgen_terminate();
 #else /* !UCLID */
     /* Print function header */
-    outgen_print("long long gen_%s()", var->sval);
+    outgen_print("long long gen_%s(%s)", var->sval,
+		 use_ctx ? "sim_ctx_t *ctx" : "");
     outgen_terminate();
     outgen_print("{");
     outgen_terminate();
@@ -11,7 +11,10 @@ void add_symbol(char *, int);
 int find_symbol(char *);
 int instr_size(char *);
 
+/* Used by isa.c.  With YAS_LIB, the program linked with yas defines it */
+#ifndef YAS_LIB
 int gui_mode = 0;
+#endif /* YAS_LIB */
 
 FILE *outfile;
 
@@ -537,7 +540,43 @@ int yywrap()
 
 extern FILE *yyin;
 int yylex();
+void yyrestart(FILE *);
 
+/* Assemble the program read from in, writing object code to out.
+   Both passes read in, so it must be seekable.  Return nonzero if
+   there were errors */
+int assemble(FILE *in, FILE *out)
+{
+    int i;
+    outfile = out;
+    for (i = INIT_CNT; i < symbol_cnt; i++)
+	free(symbol_table[i].name);
+    symbol_cnt = INIT_CNT;
+    hit_error = 0;
+
+    pass = 1;
+    lineno = 1;
+    error_mode = 0;
+    bytepos = 0;
+    tcount = 0;
+    yyrestart(in);
+    yylex();
+
+    if (hit_error)
+	return hit_error;
+
+    pass = 2;
+    lineno = 1;
+    error_mode = 0;
+    bytepos = 0;
+    tcount = 0;
+    rewind(in);
+    yyrestart(in);
+    yylex();
+    return hit_error;
+}
+
+#ifndef YAS_LIB
 static void usage(char *pname)
 {
     printf("Usage: %s [-V[n]] file.ys\n", pname);
@@ -551,6 +590,8 @@ int main(int argc, char *argv[])
     char infname[512];
     char outfname[512];
     int nextarg = 1;
+    FILE *infile;
+    int result;
     if (argc < 2)
 	usage(argv[0]);
     if (argv[nextarg][0] == '-') {
@@ -581,8 +622,8 @@ int main(int argc, char *argv[])
     strncpy(infname, argv[nextarg], rootlen);
     strcpy(infname+rootlen, ".ys");
 
-    yyin = fopen(infname, "r");
-    if (!yyin) {
+    infile = fopen(infname, "r");
+    if (!infile) {
 	fprintf(stderr, "Can't open input file '%s'\n", infname);
 	exit(1);
     }
@@ -599,29 +640,12 @@ int main(int argc, char *argv[])
       }
     }
 
-    pass = 1;
-
-    yylex();
-    fclose(yyin);
-
-    if (hit_error)
-	exit(1);
-
-    pass = 2;
-    lineno = 1;
-    error_mode = 0;
-    bytepos = 0;
-    yyin = fopen(infname, "r");
-    if (!yyin) {
-	fprintf(stderr, "Can't open input file '%s'\n", infname);
-	exit(1);
-    }
-
-    yylex();
-    fclose(yyin);
+    result = assemble(infile, outfile);
+    fclose(infile);
     fclose(outfile);
-    return hit_error;
+    return result;
 }
+#endif /* YAS_LIB */
 
 unsigned long long atollh(const char *p) {
     return strtoull(p, (char **) NULL, 16);
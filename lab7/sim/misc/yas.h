@@ -11,3 +11,6 @@ unsigned long long atollh(const char *);
 
 /* Current line number */
 int lineno;
+
+/* Assemble the program in (seekable) to out.  Return nonzero on error */
+int assemble(FILE *in, FILE *out);
@@ -17,12 +17,12 @@ void usage(char *pname)
 int main(int argc, char *argv[])
 {
     FILE *code_file;
-    int max_steps = 10000;
+    word_t max_steps = 10000;
 
     state_ptr s = new_state(MEM_SIZE);
     mem_t saver = copy_reg(s->r);
     mem_t savem;
-    int step = 0;
+    word_t step = 0;
 
     stat_t e = STAT_AOK;
 
@@ -42,12 +42,11 @@ int main(int argc, char *argv[])
     savem = copy_mem(s->m);
   
     if (argc > 2)
-	max_steps = atoi(argv[2]);
+	max_steps = atoll(argv[2]);
 
-    for (step = 0; step < max_steps && e == STAT_AOK; step++)
-	e = step_state(s, stdout);
+    step = run_state(s, max_steps, -1, &e, stdout);
 
-    printf("Stopped in %d steps at PC = 0x%llx.  Status '%s', CC %s\n",
+    printf("Stopped in %lld steps at PC = 0x%llx.  Status '%s', CC %s\n",
 	   step, s->pc, stat_name(e), cc_name(s->cc));
 
     printf("Changes to registers:\n");
@@ -0,0 +1,954 @@
+/**************************************************************************
+ * osim.c - Out-of-order Y86-64 simulator
+ *
+ * Models a superscalar processor with register renaming, a unified
+ * reservation-station window, a reorder buffer (ROB), and in-order
+ * commit, in the style of Tomasulo's algorithm:
+ *
+ *   fetch    Up to width instructions per cycle along the predicted
+ *            path.  Conditional jumps are predicted backward taken,
+ *            forward not taken.  Fetch waits for ret to compute its
+ *            target.
+ *   dispatch Up to width instructions per cycle are renamed and put
+ *            into both the ROB and the window.
+ *   issue    Any instruction in the window whose operands are ready is
+ *            sent to a free unit, oldest first.  There are ALUs and a
+ *            single load/store unit.  A load waits until the addresses
+ *            of all older stores are known.  It then takes its data
+ *            from the youngest matching store, or from memory.
+ *   complete Results are broadcast to waiting instructions.  A
+ *            mispredicted jump squashes everything younger than it.
+ *   commit   Up to width instructions per cycle leave the ROB in
+ *            program order.  Only now are registers, condition codes,
+ *            and memory updated.  An exception is taken when the
+ *            faulting instruction reaches the head of the ROB.
+ *
+ * With -t, every committed instruction is checked against step_state
+ * from isa.c.
+ **************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "isa.h"
+
+/***************
+ * Begin Globals
+ ***************/
+
+/* osim never runs in GUI mode */
+int gui_mode = FALSE;
+
+/* Parameters modifed by the command line */
+char *object_filename;   /* The input object file name. */
+FILE *object_file;       /* Input file handle */
+int verbosity = 2;       /* Verbosity level (-v) */
+word_t instr_limit = 10000; /* Instruction limit (-l) */
+word_t cycle_limit = 0;  /* Cycle limit (-c), 0 for 5 per instruction */
+bool_t do_check = FALSE; /* Test with ISA simulator? (-t) */
+int width = 2;           /* Fetch, dispatch, and commit width (-w) */
+int rob_size = 32;       /* Number of ROB entries (-r) */
+int window_size = 16;    /* Number of reservation stations (-s) */
+int alu_count = 2;       /* Number of ALUs (-u) */
+int alu_latency = 1;     /* Cycles per ALU operation (-a) */
+int mem_latency = 2;     /* Cycles per load from memory (-m) */
+
+/*************
+ * End Globals
+ *************/
+
+/* Upper bounds on the configurable sizes */
+#define MAX_WIDTH 8
+#define MAX_ROB 256
+
+/* Fields of an instruction that can be renamed */
+typedef enum { F_VALE, F_VALM, F_CC } field_t;
+
+/* Memory access performed by instruction */
+typedef enum { MEM_NONE, MEM_LOAD, MEM_STORE } mem_op_t;
+
+/* Instruction as decoded by fetch */
+typedef struct {
+    word_t pc;
+    byte_t icode;
+    byte_t ifun;
+    reg_id_t ra;
+    reg_id_t rb;
+    word_t valc;
+    word_t valp;
+    byte_t status;	/* Anything but STAT_AOK stops fetch */
+    reg_id_t srca;	/* Registers read */
+    reg_id_t srcb;
+    bool_t read_cc;
+    reg_id_t deste;	/* Registers written, E before M */
+    reg_id_t destm;
+    bool_t set_cc;
+    mem_op_t mem_op;
+    word_t predpc;	/* Where fetch went next */
+} instr_rec;
+
+/* Source operand.  Holds either a value or the producer it waits for */
+typedef struct {
+    bool_t ready;
+    word_t val;
+    int tag;		/* ROB index of producer */
+    field_t field;
+} operand_t;
+
+/* Reorder buffer entry */
+typedef struct {
+    instr_rec in;
+    word_t seq;		/* Program order, for the trace */
+    operand_t opa, opb, opcc;
+    bool_t in_window;	/* Waiting to issue */
+    bool_t issued;
+    bool_t done;
+    word_t done_cycle;
+    word_t vale;
+    word_t valm;
+    cc_t cc;
+    bool_t cnd;
+    word_t addr;	/* Memory address, once issued */
+    word_t nextpc;	/* Actual successor, once done */
+    byte_t status;
+} rob_rec, *rob_ptr;
+
+/* Where a register (or the condition codes) will come from */
+typedef struct {
+    bool_t renamed;
+    int tag;
+    field_t field;
+} map_t;
+
+/* Reasons dispatch did not fill all of its slots */
+typedef enum { STALL_ROB, STALL_WINDOW, STALL_MISPREDICT, STALL_RET,
+	       STALL_FETCH, STALL_DRAIN, STALL_COUNT } stall_t;
+
+static char *stall_names[STALL_COUNT] =
+    { "ROB full", "window full", "mispredict", "ret", "fetch", "drain" };
+
+/* Architectural state, updated at commit */
+static mem_t mem;
+static mem_t reg;
+static cc_t cc = DEFAULT_CC;
+
+/* ISA simulator, stepped at each commit */
+static state_ptr isa_state = NULL;
+static bool_t check_ok = TRUE;
+
+/* Rename tables */
+static map_t reg_map[REG_NONE];
+static map_t cc_map;
+
+/* Reorder buffer, a circular queue from rob_head */
+static rob_rec rob[MAX_ROB];
+static int rob_head = 0;
+static int rob_count = 0;
+static int window_count = 0;
+
+/* Fetch queue between fetch and dispatch */
+static instr_rec fetch_queue[2*MAX_WIDTH];
+static int fq_count = 0;
+static word_t fetch_pc = 0;
+static bool_t fetch_ret = FALSE;	/* Waiting for ret target */
+static bool_t fetch_halt = FALSE;	/* Fetched halt or bad instruction */
+static stall_t fetch_cause = STALL_FETCH;	/* Why fetch last restarted */
+
+/* Statistics */
+static word_t cycles = 0;
+static word_t instructions = 0;
+static word_t seq_next = 0;
+static word_t rob_occupancy = 0;
+static word_t window_occupancy = 0;
+static word_t stall_slots[STALL_COUNT];
+static word_t branches = 0;
+static word_t mispredicts = 0;
+static word_t squashed = 0;
+static word_t loads = 0;
+static word_t forwarded = 0;
+
+/***************************
+ * Begin function prototypes
+ ***************************/
+
+static void usage(char *name);           /* Print helpful usage message */
+static void run_tty_sim();               /* Run simulator in TTY mode */
+
+/*************************
+ * End function prototypes
+ *************************/
+
+static void usage(char *name)
+{
+    printf("Usage: %s [-ht] [-l m] [-c m] [-v n] [-w n] [-r n] [-s n] [-u n] [-a n] [-m n] file.yo\n",
+	   name);
+    printf("file.yo arg optional (default stdin)\n");
+    printf("   -h     Print this message\n");
+    printf("   -l m   Set instruction limit to m (default %lld)\n", instr_limit);
+    printf("   -c m   Set cycle limit to m (default 5 per instruction of limit, plus 100)\n");
+    printf("   -v n   Set verbosity level to 0 <= n <= 2 (default %d)\n", verbosity);
+    printf("   -w n   Fetch, dispatch, and commit n instructions per cycle (default %d)\n",
+	   width);
+    printf("   -r n   Reorder buffer entries (default %d)\n", rob_size);
+    printf("   -s n   Reservation stations in instruction window (default %d)\n",
+	   window_size);
+    printf("   -u n   Number of ALUs (default %d)\n", alu_count);
+    printf("   -a n   ALU latency in cycles (default %d)\n", alu_latency);
+    printf("   -m n   Load latency in cycles (default %d)\n", mem_latency);
+    printf("   -t     Check each committed instruction against ISA simulator\n");
+    exit(0);
+}
+
+/* Parse a numeric option in range [lo, hi] */
+static int int_arg(char *name, char opt, char *arg, int lo, int hi)
+{
+    int val = atoi(arg);
+    if (val < lo || val > hi) {
+	printf("Invalid value %s for -%c (must be between %d and %d)\n",
+	       arg, opt, lo, hi);
+	usage(name);
+    }
+    return val;
+}
+
+int main(int argc, char *argv[])
+{
+    int c;
+
+    /* Parse the command line arguments */
+    while ((c = getopt(argc, argv, "htl:c:v:w:r:s:u:a:m:")) != -1) {
+	switch(c) {
+	case 'h':
+	    usage(argv[0]);
+	    break;
+	case 'l':
+	    instr_limit = atoll(optarg);
+	    break;
+	case 'c':
+	    cycle_limit = atoll(optarg);
+	    break;
+	case 'v':
+	    verbosity = int_arg(argv[0], c, optarg, 0, 2);
+	    break;
+	case 't':
+	    do_check = TRUE;
+	    break;
+	case 'w':
+	    width = int_arg(argv[0], c, optarg, 1, MAX_WIDTH);
+	    break;
+	case 'r':
+	    rob_size = int_arg(argv[0], c, optarg, 1, MAX_ROB);
+	    break;
+	case 's':
+	    window_size = int_arg(argv[0], c, optarg, 1, MAX_ROB);
+	    break;
+	case 'u':
+	    alu_count = int_arg(argv[0], c, optarg, 1, MAX_ROB);
+	    break;
+	case 'a':
+	    alu_latency = int_arg(argv[0], c, optarg, 1, 100);
+	    break;
+	case 'm':
+	    mem_latency = int_arg(argv[0], c, optarg, 1, 1000);
+	    break;
+	default:
+	    printf("Invalid option '%c'\n", c);
+	    usage(argv[0]);
+	    break;
+	}
+    }
+
+    /* Do we have too many arguments? */
+    if (optind < argc - 1) {
+	printf("Too many command line arguments\n");
+	usage(argv[0]);
+    }
+
+    /* The single unflagged argument should be the object file name */
+    object_filename = NULL;
+    object_file = stdin;
+    if (optind < argc) {
+	object_filename = argv[optind];
+	object_file = fopen(object_filename, "r");
+	if (!object_file) {
+	    fprintf(stderr, "Couldn't open object file %s\n", object_filename);
+	    exit(1);
+	}
+    }
+
+    run_tty_sim();
+    return 0;
+}
+
+/*****************************************************************
+ * Fetch and decode.  Decoding follows step_state in isa.c, so that
+ * both agree on which instructions are invalid
+ *****************************************************************/
+
+static void decode(word_t pc, instr_rec *in)
+{
+    byte_t byte0 = 0, byte1 = 0;
+    bool_t ok1 = TRUE, okc = TRUE;
+    byte_t icode;
+    word_t valp = pc;
+
+    memset(in, 0, sizeof(*in));
+    in->pc = pc;
+    in->ra = in->rb = REG_NONE;
+    in->srca = in->srcb = in->deste = in->destm = REG_NONE;
+    in->status = STAT_AOK;
+    in->mem_op = MEM_NONE;
+
+    if (!get_byte_val(mem, valp++, &byte0)) {
+	in->icode = I_NOP;
+	in->status = STAT_ADR;
+	return;
+    }
+    icode = in->icode = HI4(byte0);
+    in->ifun = LO4(byte0);
+    if (icode == I_RRMOVQ || icode == I_ALU || icode == I_PUSHQ ||
+	icode == I_POPQ || icode == I_IRMOVQ || icode == I_RMMOVQ ||
+	icode == I_MRMOVQ || icode == I_IADDQ) {
+	ok1 = get_byte_val(mem, valp++, &byte1);
+	in->ra = HI4(byte1);
+	in->rb = LO4(byte1);
+    }
+    if (icode == I_IRMOVQ || icode == I_RMMOVQ || icode == I_MRMOVQ ||
+	icode == I_JMP || icode == I_CALL || icode == I_IADDQ) {
+	okc = get_word_val(mem, valp, &in->valc);
+	valp += 8;
+    }
+    in->valp = valp;
+
+    switch (icode) {
+    case I_NOP:
+	break;
+    case I_HALT:
+	in->status = STAT_HLT;
+	break;
+    case I_RRMOVQ:
+	if (!ok1)
+	    in->status = STAT_ADR;
+	else if (!reg_valid(in->ra) || !reg_valid(in->rb))
+	    in->status = STAT_INS;
+	in->srca = in->ra;
+	in->deste = in->rb;
+	/* A conditional move passes on the old value when it fails */
+	if (in->ifun != C_YES) {
+	    in->srcb = in->rb;
+	    in->read_cc = TRUE;
+	}
+	break;
+    case I_IRMOVQ:
+	if (!ok1)
+	    in->status = STAT_ADR;
+	else if (!okc || !reg_valid(in->rb))
+	    in->status = STAT_INS;
+	in->deste = in->rb;
+	break;
+    case I_RMMOVQ:
+    case I_MRMOVQ:
+	if (!ok1)
+	    in->status = STAT_ADR;
+	else if (!okc || !reg_valid(in->ra))
+	    in->status = STAT_INS;
+	in->srcb = in->rb;
+	if (icode == I_RMMOVQ) {
+	    in->srca = in->ra;
+	    in->mem_op = MEM_STORE;
+	} else {
+	    in->destm = in->ra;
+	    in->mem_op = MEM_LOAD;
+	}
+	break;
+    case I_ALU:
+	if (!ok1)
+	    in->status = STAT_ADR;
+	in->srca = in->ra;
+	in->srcb = in->rb;
+	in->deste = in->rb;
+	in->set_cc = TRUE;
+	break;
+    case I_JMP:
+	if (!okc)
+	    in->status = STAT_ADR;
+	in->read_cc = in->ifun != C_YES;
+	break;
+    case I_CALL:
+	if (!okc)
+	    in->status = STAT_ADR;
+	in->srcb = in->deste = REG_RSP;
+	in->mem_op = MEM_STORE;
+	break;
+    case I_RET:
+	in->srcb = in->deste = REG_RSP;
+	in->mem_op = MEM_LOAD;
+	break;
+    case I_PUSHQ:
+    case I_POPQ:
+	if (!ok1)
+	    in->status = STAT_ADR;
+	else if (!reg_valid(in->ra))
+	    in->status = STAT_INS;
+	in->srcb = in->deste = REG_RSP;
+	if (icode == I_PUSHQ) {
+	    in->srca = in->ra;
+	    in->mem_op = MEM_STORE;
+	} else {
+	    in->destm = in->ra;
+	    in->mem_op = MEM_LOAD;
+	}
+	break;
+    case I_IADDQ:
+	if (!ok1)
+	    in->status = STAT_ADR;
+	else if (!okc || !reg_valid(in->rb))
+	    in->status = STAT_INS;
+	in->srcb = in->deste = in->rb;
+	in->set_cc = TRUE;
+	break;
+    default:
+	in->status = STAT_INS;
+	break;
+    }
+    /* Faulting instructions do nothing but stop the program */
+    if (in->status != STAT_AOK) {
+	in->srca = in->srcb = in->deste = in->destm = REG_NONE;
+	in->read_cc = in->set_cc = FALSE;
+	in->mem_op = MEM_NONE;
+    }
+}
+
+static void do_fetch()
+{
+    int i;
+    for (i = 0; i < width && !fetch_ret && !fetch_halt
+	     && fq_count < 2*width; i++) {
+	instr_rec *in = &fetch_queue[fq_count++];
+	decode(fetch_pc, in);
+	fetch_cause = STALL_FETCH;
+	if (in->status != STAT_AOK) {
+	    fetch_halt = TRUE;
+	    return;
+	}
+	in->predpc = in->valp;
+	if (in->icode == I_CALL || (in->icode == I_JMP && in->ifun == C_YES)) {
+	    in->predpc = in->valc;
+	} else if (in->icode == I_JMP) {
+	    /* Backward taken, forward not taken */
+	    if (in->valc <= in->pc)
+		in->predpc = in->valc;
+	} else if (in->icode == I_RET) {
+	    fetch_ret = TRUE;
+	}
+	fetch_pc = in->predpc;
+	/* At most one taken branch per cycle */
+	if (in->predpc != in->valp)
+	    return;
+    }
+}
+
+/*****************************************************************
+ * Rename and dispatch
+ *****************************************************************/
+
+static int rob_index(int i)
+{
+    return (rob_head + i) % rob_size;
+}
+
+/* Read source operand through rename table */
+static void read_operand(operand_t *op, map_t *m, word_t arch_val)
+{
+    op->ready = TRUE;
+    op->val = arch_val;
+    if (m && m->renamed) {
+	rob_ptr p = &rob[m->tag];
+	if (p->done) {
+	    op->val = m->field == F_VALE ? p->vale :
+		m->field == F_VALM ? p->valm : p->cc;
+	} else {
+	    op->ready = FALSE;
+	    op->tag = m->tag;
+	    op->field = m->field;
+	}
+    }
+}
+
+static void rename_dest(rob_ptr e, int tag)
+{
+    /* Destination M is written last, so it takes precedence */
+    if (e->in.deste != REG_NONE) {
+	reg_map[e->in.deste].renamed = TRUE;
+	reg_map[e->in.deste].tag = tag;
+	reg_map[e->in.deste].field = F_VALE;
+    }
+    if (e->in.destm != REG_NONE) {
+	reg_map[e->in.destm].renamed = TRUE;
+	reg_map[e->in.destm].tag = tag;
+	reg_map[e->in.destm].field = F_VALM;
+    }
+    if (e->in.set_cc) {
+	cc_map.renamed = TRUE;
+	cc_map.tag = tag;
+	cc_map.field = F_CC;
+    }
+}
+
+static void do_dispatch()
+{
+    int i;
+    stall_t cause = STALL_FETCH;
+    for (i = 0; i < width; i++) {
+	instr_rec *in = &fetch_queue[0];
+	bool_t needs_window;
+	int tag;
+	rob_ptr e;
+
+	if (fq_count == 0) {
+	    cause = fetch_ret ? STALL_RET : fetch_halt ? STALL_DRAIN : fetch_cause;
+	    break;
+	}
+	needs_window = in->status == STAT_AOK && in->icode != I_NOP;
+	if (rob_count == rob_size) {
+	    cause = STALL_ROB;
+	    break;
+	}
+	if (needs_window && window_count == window_size) {
+	    cause = STALL_WINDOW;
+	    break;
+	}
+	tag = rob_index(rob_count++);
+	e = &rob[tag];
+	memset(e, 0, sizeof(*e));
+	e->in = *in;
+	e->seq = seq_next++;
+	e->status = in->status;
+	read_operand(&e->opa, in->srca == REG_NONE ? NULL : &reg_map[in->srca],
+		     get_reg_val(reg, in->srca));
+	read_operand(&e->opb, in->srcb == REG_NONE ? NULL : &reg_map[in->srcb],
+		     get_reg_val(reg, in->srcb));
+	read_operand(&e->opcc, in->read_cc ? &cc_map : NULL, cc);
+	rename_dest(e, tag);
+	if (needs_window) {
+	    e->in_window = TRUE;
+	    window_count++;
+	} else {
+	    e->done = TRUE;
+	    e->nextpc = in->valp;
+	}
+	if (verbosity >= 2)
+	    printf("\tDispatch: #%lld 0x%llx %s into ROB[%d]\n",
+		   e->seq, in->pc, iname(HPACK(in->icode, in->ifun)), tag);
+	fq_count--;
+	memmove(fetch_queue, fetch_queue + 1, fq_count * sizeof(instr_rec));
+    }
+    stall_slots[cause] += width - i;
+}
+
+/*****************************************************************
+ * Issue and execute
+ *****************************************************************/
+
+/* Can load e go ahead?  Set *fwdp to older store it reads from */
+static bool_t load_ready(int pos, rob_ptr e, word_t addr, rob_ptr *fwdp)
+{
+    int i;
+    *fwdp = NULL;
+    for (i = pos - 1; i >= 0; i--) {
+	rob_ptr s = &rob[rob_index(i)];
+	if (s->in.mem_op != MEM_STORE)
+	    continue;
+	if (!s->issued)
+	    return FALSE;
+	if (s->status != STAT_AOK)
+	    continue;
+	if (s->addr == addr) {
+	    *fwdp = s;
+	    return TRUE;
+	}
+	/* Partial overlap waits for the store to commit */
+	if (s->addr < addr + 8 && addr < s->addr + 8)
+	    return FALSE;
+    }
+    return TRUE;
+}
+
+/* Execute instruction e.  Return FALSE if it must wait */
+static bool_t execute(int pos, rob_ptr e)
+{
+    instr_rec *in = &e->in;
+    word_t vala = e->opa.val;
+    word_t valb = e->opb.val;
+    word_t sink;
+    rob_ptr fwd;
+
+    e->cnd = cond_holds(e->opcc.val, in->ifun);
+    e->nextpc = in->valp;
+    switch (in->icode) {
+    case I_RRMOVQ:
+	e->vale = e->cnd ? vala : valb;
+	break;
+    case I_IRMOVQ:
+	e->vale = in->valc;
+	break;
+    case I_ALU:
+	e->vale = compute_alu(in->ifun, vala, valb);
+	e->cc = compute_cc(in->ifun, vala, valb);
+	break;
+    case I_IADDQ:
+	e->vale = valb + in->valc;
+	e->cc = compute_cc(A_ADD, in->valc, valb);
+	break;
+    case I_JMP:
+	e->nextpc = e->cnd ? in->valc : in->valp;
+	break;
+    case I_RMMOVQ:
+    case I_MRMOVQ:
+	e->addr = valb + in->valc;
+	break;
+    case I_CALL:
+    case I_PUSHQ:
+	e->addr = e->vale = valb - 8;
+	if (in->icode == I_CALL) {
+	    vala = in->valp;
+	    e->nextpc = in->valc;
+	}
+	break;
+    case I_RET:
+    case I_POPQ:
+	e->addr = valb;
+	e->vale = valb + 8;
+	break;
+    }
+
+    if (in->mem_op == MEM_STORE) {
+	/* Store data is kept in valm until commit */
+	e->valm = vala;
+	if (!get_word_val(mem, e->addr, &sink))
+	    e->status = STAT_ADR;
+    } else if (in->mem_op == MEM_LOAD) {
+	if (!load_ready(pos, e, e->addr, &fwd))
+	    return FALSE;
+	loads++;
+	if (fwd) {
+	    forwarded++;
+	    e->valm = fwd->valm;
+	} else if (!get_word_val(mem, e->addr, &e->valm)) {
+	    e->status = STAT_ADR;
+	}
+	if (in->icode == I_RET)
+	    e->nextpc = e->valm;
+    }
+    return TRUE;
+}
+
+static void do_issue()
+{
+    int alus = alu_count;
+    bool_t lsu = TRUE;
+    int i;
+
+    for (i = 0; i < rob_count && (alus > 0 || lsu); i++) {
+	rob_ptr e = &rob[rob_index(i)];
+	bool_t mem_op = e->in.mem_op != MEM_NONE;
+	int latency;
+	if (!e->in_window || !e->opa.ready || !e->opb.ready || !e->opcc.ready)
+	    continue;
+	if (mem_op ? !lsu : alus == 0)
+	    continue;
+	if (!execute(i, e))
+	    continue;
+	latency = e->in.mem_op == MEM_LOAD ? mem_latency :
+	    mem_op ? 1 : alu_latency;
+	if (mem_op)
+	    lsu = FALSE;
+	else
+	    alus--;
+	e->in_window = FALSE;
+	window_count--;
+	e->issued = TRUE;
+	e->done_cycle = cycles + latency;
+	if (verbosity >= 2)
+	    printf("\tIssue: #%lld %s, done in %d cycle%s\n",
+		   e->seq, iname(HPACK(e->in.icode, e->in.ifun)),
+		   latency, latency == 1 ? "" : "s");
+    }
+}
+
+/*****************************************************************
+ * Complete: broadcast results and recover from mispredictions
+ *****************************************************************/
+
+static void wake(operand_t *op, int tag, rob_ptr p)
+{
+    if (op->ready || op->tag != tag)
+	return;
+    op->ready = TRUE;
+    op->val = op->field == F_VALE ? p->vale :
+	op->field == F_VALM ? p->valm : p->cc;
+}
+
+/* Discard all entries after position pos and refetch from pc */
+static void squash_after(int pos, word_t pc)
+{
+    int i;
+    for (i = pos + 1; i < rob_count; i++)
+	if (rob[rob_index(i)].in_window)
+	    window_count--;
+    squashed += rob_count - pos - 1 + fq_count;
+    rob_count = pos + 1;
+    fq_count = 0;
+
+    /* Rebuild rename tables from surviving entries */
+    memset(reg_map, 0, sizeof(reg_map));
+    memset(&cc_map, 0, sizeof(cc_map));
+    for (i = 0; i < rob_count; i++)
+	rename_dest(&rob[rob_index(i)], rob_index(i));
+
+    fetch_pc = pc;
+    fetch_ret = FALSE;
+    fetch_halt = FALSE;
+}
+
+static void do_complete()
+{
+    int i, j;
+    for (i = 0; i < rob_count; i++) {
+	int tag = rob_index(i);
+	rob_ptr e = &rob[tag];
+	if (!e->issued || e->done || e->done_cycle > cycles)
+	    continue;
+	e->done = TRUE;
+	for (j = i + 1; j < rob_count; j++) {
+	    rob_ptr w = &rob[rob_index(j)];
+	    wake(&w->opa, tag, e);
+	    wake(&w->opb, tag, e);
+	    wake(&w->opcc, tag, e);
+	}
+	if (e->status != STAT_AOK)
+	    continue;
+	if (e->in.icode == I_JMP && e->in.ifun != C_YES) {
+	    branches++;
+	    if (e->nextpc != e->in.predpc) {
+		mispredicts++;
+		if (verbosity >= 2)
+		    printf("\tComplete: #%lld mispredicted, refetch from 0x%llx\n",
+			   e->seq, e->nextpc);
+		squash_after(i, e->nextpc);
+		fetch_cause = STALL_MISPREDICT;
+	    }
+	} else if (e->in.icode == I_RET) {
+	    squash_after(i, e->nextpc);
+	    fetch_cause = STALL_RET;
+	}
+    }
+}
+
+/*****************************************************************
+ * Commit
+ *****************************************************************/
+
+/* Compare committed instruction e with ISA simulator */
+static void check_commit(rob_ptr e)
+{
+    retire_rec r;
+    r.pc = e->in.pc;
+    r.status = e->status;
+    r.dstE = e->in.deste;
+    r.valE = e->vale;
+    r.dstM = e->in.destm;
+    r.valM = e->valm;
+    r.mem_write = e->in.mem_op == MEM_STORE;
+    r.mem_addr = e->addr;
+    r.mem_data = e->valm;
+    /* Commit writes nothing for a faulting instruction */
+    if (e->status != STAT_AOK) {
+	r.dstE = r.dstM = REG_NONE;
+	r.mem_write = FALSE;
+    }
+    if (!check_retire(isa_state, &r, stdout)) {
+	printf("ISA Check Fails in cycle %lld\n", cycles);
+	check_ok = FALSE;
+    } else if (e->status == STAT_AOK && isa_state->cc != cc) {
+	printf("PC = 0x%llx, CC %s, ISA CC %s\n",
+	       e->in.pc, cc_name(cc), cc_name(isa_state->cc));
+	printf("ISA Check Fails in cycle %lld\n", cycles);
+	check_ok = FALSE;
+    }
+}
+
+/* Has a store to addr overwritten instructions fetched after the head? */
+static bool_t code_modified(word_t addr)
+{
+    int i;
+    for (i = 1; i < rob_count; i++) {
+	instr_rec *in = &rob[rob_index(i)].in;
+	if (in->pc < addr + 8 && addr < in->valp)
+	    return TRUE;
+    }
+    for (i = 0; i < fq_count; i++)
+	if (fetch_queue[i].pc < addr + 8 && addr < fetch_queue[i].valp)
+	    return TRUE;
+    return FALSE;
+}
+
+/* Retire up to width instructions.  Return status of a faulting one */
+static byte_t do_commit()
+{
+    int n;
+    for (n = 0; n < width && rob_count > 0 && instructions < instr_limit; n++) {
+	int tag = rob_head;
+	rob_ptr e = &rob[tag];
+	if (!e->done)
+	    break;
+	instructions++;
+	if (e->status == STAT_AOK) {
+	    if (e->in.deste != REG_NONE)
+		set_reg_val(reg, e->in.deste, e->vale);
+	    if (e->in.destm != REG_NONE)
+		set_reg_val(reg, e->in.destm, e->valm);
+	    if (e->in.set_cc)
+		cc = e->cc;
+	    if (e->in.mem_op == MEM_STORE) {
+		set_word_val(mem, e->addr, e->valm);
+		if (code_modified(e->addr)) {
+		    if (verbosity >= 2)
+			printf("\tCommit: #%lld modified code, refetch from 0x%llx\n",
+			       e->seq, e->nextpc);
+		    squash_after(0, e->nextpc);
+		}
+	    }
+	}
+	/* Rename table entries for e now refer to the register file */
+	if (e->in.deste != REG_NONE && reg_map[e->in.deste].tag == tag)
+	    reg_map[e->in.deste].renamed = FALSE;
+	if (e->in.destm != REG_NONE && reg_map[e->in.destm].tag == tag)
+	    reg_map[e->in.destm].renamed = FALSE;
+	if (e->in.set_cc && cc_map.tag == tag)
+	    cc_map.renamed = FALSE;
+	if (verbosity >= 2)
+	    printf("\tCommit: #%lld 0x%llx %s%s%s\n", e->seq, e->in.pc,
+		   iname(HPACK(e->in.icode, e->in.ifun)),
+		   e->status == STAT_AOK ? "" : ", status ",
+		   e->status == STAT_AOK ? "" : stat_name(e->status));
+	if (do_check && check_ok)
+	    check_commit(e);
+	rob_head = (rob_head + 1) % rob_size;
+	rob_count--;
+	if (e->status != STAT_AOK)
+	    return e->status;
+    }
+    return STAT_AOK;
+}
+
+/*****************************************************************
+ * Simulation driver
+ *****************************************************************/
+
+/* Run until an exception commits or max_instr instructions commit */
+static byte_t sim_run(word_t max_instr, word_t max_cycle)
+{
+    byte_t status = STAT_AOK;
+    while (status == STAT_AOK && instructions < max_instr
+	   && cycles < max_cycle) {
+	if (verbosity >= 2)
+	    printf("\nCycle %lld. CC=%s, ROB %d/%d, window %d/%d\n",
+		   cycles, cc_name(cc), rob_count, rob_size,
+		   window_count, window_size);
+	/* Stages run back to front, so values move one stage a cycle */
+	status = do_commit();
+	do_complete();
+	do_issue();
+	do_dispatch();
+	do_fetch();
+	rob_occupancy += rob_count;
+	window_occupancy += window_count;
+	cycles++;
+    }
+    return status;
+}
+
+static void report(byte_t status)
+{
+    int s;
+    word_t slots = width * cycles;
+    printf("IPC: %lld instructions/%lld cycles = %.2f\n", instructions, cycles,
+	   cycles > 0 ? (double) instructions / cycles : 0.0);
+    printf("ROB: %d entries, %.1f average occupancy\n", rob_size,
+	   cycles > 0 ? (double) rob_occupancy / cycles : 0.0);
+    printf("Window: %d entries, %.1f average occupancy\n", window_size,
+	   cycles > 0 ? (double) window_occupancy / cycles : 0.0);
+    printf("Dispatch stalls (of %lld slots):\n", slots);
+    for (s = 0; s < STALL_COUNT; s++)
+	printf("   %-12s %8lld (%.1f%%)\n", stall_names[s], stall_slots[s],
+	       slots > 0 ? 100.0 * stall_slots[s] / slots : 0.0);
+    printf("Branches: %lld conditional, %lld mispredicted, %lld instructions squashed\n",
+	   branches, mispredicts, squashed);
+    printf("Loads: %lld, %lld forwarded from stores\n", loads, forwarded);
+}
+
+static void run_tty_sim()
+{
+    word_t byte_cnt;
+    byte_t status;
+    mem_t mem0, reg0;
+    word_t max_cycle = cycle_limit > 0 ? cycle_limit : 5*instr_limit + 100;
+    bool_t timed_out;
+
+    mem = init_mem(MEM_SIZE);
+    reg = init_reg();
+
+    byte_cnt = load_mem(mem, object_file, 1);
+    if (byte_cnt == 0) {
+	fprintf(stderr, "No lines of code found\n");
+	exit(1);
+    } else if (verbosity >= 2) {
+	printf("%lld bytes of code read\n", byte_cnt);
+    }
+    if (object_file != stdin)
+	fclose(object_file);
+    if (do_check) {
+	isa_state = new_state(0);
+	free_mem(isa_state->r);
+	free_mem(isa_state->m);
+	isa_state->m = copy_mem(mem);
+	isa_state->r = copy_mem(reg);
+	isa_state->cc = cc;
+    }
+    mem0 = copy_mem(mem);
+    reg0 = copy_mem(reg);
+
+    status = sim_run(instr_limit, max_cycle);
+    /* Stopped short of the instruction limit by the cycle limit? */
+    timed_out = status == STAT_AOK && instructions < instr_limit
+	&& cycles >= max_cycle;
+    if (verbosity > 0) {
+	printf("%lld instructions executed\n", instructions);
+	if (timed_out)
+	    printf("Cycle limit of %lld reached\n", max_cycle);
+	printf("Status = %s\n", stat_name(status));
+	printf("Condition Codes: %s\n", cc_name(cc));
+	printf("Changed Register State:\n");
+	diff_reg(reg0, reg, stdout);
+	printf("Changed Memory State:\n");
+	diff_mem(mem0, mem, stdout);
+    }
+    if (do_check) {
+	if (check_ok && (diff_reg(isa_state->r, reg, NULL)
+			 || diff_mem(isa_state->m, mem, NULL)
+			 || isa_state->cc != cc)) {
+	    printf("ISA Check Fails: final state differs\n");
+	    check_ok = FALSE;
+	}
+	if (!check_ok)
+	    printf("ISA Check Fails\n");
+	else if (timed_out)
+	    printf("ISA Check Incomplete: cycle limit reached\n");
+	else
+	    printf("ISA Check Succeeds\n");
+    }
+    report(status);
+}
@@ -0,0 +1,276 @@
+/******************************************************************************
+ *	cache.c
+ *
+ *	Cache hierarchy timing model for the pipelined simulator
+ *
+ *	Up to three levels can be configured with -c: separate L1
+ *	instruction and data caches, and a unified L2 behind both of
+ *	them.  Only tags are kept.  Data still comes from the simulator
+ *	memory, so the caches change timing but never results.
+ *
+ *	An L1 that is not configured behaves like a perfect cache, so
+ *	psim without -c keeps its one-cycle memory.  Stores sent to the
+ *	next level (write-through stores and dirty evictions) go into a
+ *	write buffer and do not stall the pipeline.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isa.h"
+#include "cache.h"
+
+/******************************************************************************
+ *	function definitions
+ ******************************************************************************/
+
+static bool_t power_of_two(word_t x)
+{
+    return x > 0 && (x & (x - 1)) == 0;
+}
+
+/* Parse a nonnegative decimal number.  Return FALSE if malformed */
+static bool_t parse_num(char *s, word_t *valp)
+{
+    char *end;
+    if (!s || !*s)
+	return FALSE;
+    *valp = strtoll(s, &end, 10);
+    return *end == '\0' && *valp >= 0;
+}
+
+void cache_init(cache_sys_t *cs)
+{
+    static cache_t l1i = { "L1-I", 0, 0, 0, REPL_LRU, TRUE, L1_LATENCY };
+    static cache_t l1d = { "L1-D", 0, 0, 0, REPL_LRU, TRUE, L1_LATENCY };
+    static cache_t l2 = { "L2", 0, 0, 0, REPL_LRU, TRUE, L2_LATENCY };
+
+    memset(cs, 0, sizeof(*cs));
+    cs->l1i = l1i;
+    cs->l1d = l1d;
+    cs->l2 = l2;
+    cs->mem_latency = MEM_LATENCY;
+    cs->seed = 1;
+}
+
+void cache_free(cache_sys_t *cs)
+{
+    free(cs->l1i.lines);
+    free(cs->l1d.lines);
+    free(cs->l2.lines);
+    cs->l1i.lines = cs->l1d.lines = cs->l2.lines = NULL;
+}
+
+bool_t cache_config(cache_sys_t *cs, char *spec)
+{
+    char buf[128];
+    char *field[7];
+    int nfield = 0;
+    cache_t *c;
+    word_t sets, ways, block;
+    char *s;
+
+    strncpy(buf, spec, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    for (s = strtok(buf, ":"); s && nfield < 7; s = strtok(NULL, ":"))
+	field[nfield++] = s;
+    if (s || nfield < 2)
+	return FALSE;
+
+    if (strcmp(field[0], "mem") == 0)
+	return nfield == 2 && parse_num(field[1], &cs->mem_latency);
+
+    if (strcmp(field[0], "l1i") == 0)
+	c = &cs->l1i;
+    else if (strcmp(field[0], "l1d") == 0)
+	c = &cs->l1d;
+    else if (strcmp(field[0], "l2") == 0)
+	c = &cs->l2;
+    else
+	return FALSE;
+
+    if (nfield < 4 || !parse_num(field[1], &sets) || !parse_num(field[2], &ways)
+	|| !parse_num(field[3], &block))
+	return FALSE;
+    if (!power_of_two(sets) || ways <= 0 || !power_of_two(block))
+	return FALSE;
+    if (nfield > 4) {
+	if (strcmp(field[4], "lru") == 0)
+	    c->repl = REPL_LRU;
+	else if (strcmp(field[4], "fifo") == 0)
+	    c->repl = REPL_FIFO;
+	else if (strcmp(field[4], "random") == 0)
+	    c->repl = REPL_RANDOM;
+	else
+	    return FALSE;
+    }
+    if (nfield > 5) {
+	if (strcmp(field[5], "wb") == 0)
+	    c->write_back = TRUE;
+	else if (strcmp(field[5], "wt") == 0)
+	    c->write_back = FALSE;
+	else
+	    return FALSE;
+    }
+    if (nfield > 6 && !parse_num(field[6], &c->latency))
+	return FALSE;
+
+    c->sets = sets;
+    c->ways = ways;
+    c->block = block;
+    free(c->lines);
+    c->lines = (line_t *) calloc(sets * ways, sizeof(line_t));
+    cs->l1i.next = cs->l1d.next = cs->l2.lines ? &cs->l2 : NULL;
+    return TRUE;
+}
+
+bool_t cache_enabled(cache_sys_t *cs)
+{
+    return cs->l1i.lines || cs->l1d.lines || cs->l2.lines;
+}
+
+static void reset_level(cache_t *c)
+{
+    if (c->lines)
+	memset(c->lines, 0, c->sets * c->ways * sizeof(line_t));
+    c->accesses = c->misses = c->writebacks = 0;
+}
+
+void cache_reset(cache_sys_t *cs)
+{
+    reset_level(&cs->l1i);
+    reset_level(&cs->l1d);
+    reset_level(&cs->l2);
+    cs->mem_reads = cs->mem_writes = 0;
+    cs->tick = 0;
+    cs->seed = 1;
+    cs->fetch_stall = cs->data_stall = 0;
+}
+
+/* Choose line of set to replace */
+static line_t *victim(cache_sys_t *cs, cache_t *c, line_t *set)
+{
+    line_t *v = set;
+    word_t w;
+    for (w = 0; w < c->ways; w++)
+	if (!set[w].valid)
+	    return &set[w];
+    if (c->repl == REPL_RANDOM) {
+	cs->seed = cs->seed * 1103515245 + 12345;
+	return &set[(cs->seed >> 16) % c->ways];
+    }
+    /* LRU and FIFO both evict the oldest stamp */
+    for (w = 1; w < c->ways; w++)
+	if (set[w].stamp < v->stamp)
+	    v = &set[w];
+    return v;
+}
+
+/* Access block containing addr at level c (NULL for memory).
+   Return latency of the access */
+static word_t access_block(cache_sys_t *cs, cache_t *c, word_t addr,
+			   bool_t write)
+{
+    word_t blk, tag, w;
+    line_t *set, *l;
+    word_t cost;
+
+    if (!c) {
+	if (write)
+	    cs->mem_writes++;
+	else
+	    cs->mem_reads++;
+	return cs->mem_latency;
+    }
+    blk = addr / c->block;
+    tag = blk / c->sets;
+    set = &c->lines[(blk % c->sets) * c->ways];
+    c->accesses++;
+    cs->tick++;
+
+    for (w = 0; w < c->ways; w++) {
+	l = &set[w];
+	if (l->valid && l->tag == tag) {
+	    if (c->repl == REPL_LRU)
+		l->stamp = cs->tick;
+	    if (write) {
+		if (c->write_back)
+		    l->dirty = TRUE;
+		else
+		    access_block(cs, c->next, addr, TRUE);
+	    }
+	    return c->latency;
+	}
+    }
+
+    c->misses++;
+    if (write && !c->write_back) {
+	/* No write allocate */
+	access_block(cs, c->next, addr, TRUE);
+	return c->latency;
+    }
+    l = victim(cs, c, set);
+    if (l->valid && l->dirty) {
+	c->writebacks++;
+	access_block(cs, c->next, (l->tag * c->sets + blk % c->sets) * c->block, TRUE);
+    }
+    cost = c->latency + access_block(cs, c->next, addr, FALSE);
+    l->valid = TRUE;
+    l->dirty = write;
+    l->tag = tag;
+    l->stamp = cs->tick;
+    return cost;
+}
+
+/* Access every block touched by len bytes starting at addr */
+static word_t access_range(cache_sys_t *cs, cache_t *c, word_t addr, int len,
+			   bool_t write)
+{
+    word_t cost = 0;
+    word_t blk;
+    if (!c->lines)
+	return 0;
+    for (blk = addr / c->block; blk <= (addr + len - 1) / c->block; blk++)
+	cost += access_block(cs, c, blk == addr / c->block ? addr : blk * c->block,
+			     write);
+    return cost;
+}
+
+word_t cache_fetch(cache_sys_t *cs, word_t addr, int len)
+{
+    return access_range(cs, &cs->l1i, addr, len, FALSE);
+}
+
+word_t cache_data(cache_sys_t *cs, word_t addr, int len, bool_t write)
+{
+    return access_range(cs, &cs->l1d, addr, len, write);
+}
+
+static void report_level(FILE *fp, cache_t *c)
+{
+    if (!c->lines)
+	return;
+    fprintf(fp, "%-5s %lld sets x %lld ways x %lld bytes, %s, %s: "
+	    "%lld accesses, %lld misses (%.2f%% miss rate)",
+	    c->name, c->sets, c->ways, c->block,
+	    c->repl == REPL_LRU ? "lru" : c->repl == REPL_FIFO ? "fifo" : "random",
+	    c->write_back ? "wb" : "wt",
+	    c->accesses, c->misses,
+	    c->accesses > 0 ? 100.0 * c->misses / c->accesses : 0.0);
+    if (c->write_back)
+	fprintf(fp, ", %lld writebacks", c->writebacks);
+    fprintf(fp, "\n");
+}
+
+void cache_report(cache_sys_t *cs, FILE *fp)
+{
+    if (!cache_enabled(cs))
+	return;
+    report_level(fp, &cs->l1i);
+    report_level(fp, &cs->l1d);
+    report_level(fp, &cs->l2);
+    fprintf(fp, "Memory: %lld reads, %lld writes\n", cs->mem_reads, cs->mem_writes);
+    fprintf(fp, "Cache stalls: %lld fetch cycles, %lld data cycles\n",
+	    cs->fetch_stall, cs->data_stall);
+}
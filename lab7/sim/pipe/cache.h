@@ -0,0 +1,105 @@
+/******************************************************************************
+ *	cache.h
+ *
+ *	Cache hierarchy timing model for the pipelined simulator
+ ******************************************************************************/
+
+#ifndef CACHE_H
+#define CACHE_H
+
+/******************************************************************************
+ *	#includes
+ ******************************************************************************/
+
+#include <stdio.h>
+
+/******************************************************************************
+ *	typedefs
+ ******************************************************************************/
+
+/* Replacement policies */
+typedef enum { REPL_LRU, REPL_FIFO, REPL_RANDOM } repl_t;
+
+/* Default latencies, in extra cycles beyond the one-cycle stage */
+#define L1_LATENCY 0
+#define L2_LATENCY 10
+#define MEM_LATENCY 100
+
+typedef struct {
+    bool_t valid;
+    bool_t dirty;
+    word_t tag;
+    word_t stamp;	/* Last use (LRU) or fill (FIFO) */
+} line_t;
+
+typedef struct cache_rec {
+    char *name;
+    word_t sets;
+    word_t ways;
+    word_t block;
+    repl_t repl;
+    bool_t write_back;
+    word_t latency;
+    line_t *lines;	/* sets * ways lines, one set after the other */
+    struct cache_rec *next;	/* Next level, or NULL for memory */
+    /* Statistics */
+    word_t accesses;
+    word_t misses;
+    word_t writebacks;
+} cache_t;
+
+/* The hierarchy of one simulation */
+typedef struct {
+    cache_t l1i;
+    cache_t l1d;
+    cache_t l2;
+    word_t mem_latency;
+    word_t mem_reads;
+    word_t mem_writes;
+    /* Time of last access, for LRU and FIFO */
+    word_t tick;
+    /* State of pseudo-random generator for random replacement */
+    unsigned long seed;
+    /* Cycles the pipeline was held for fetch and for data accesses,
+       counted by the simulator as they pass */
+    word_t fetch_stall;
+    word_t data_stall;
+} cache_sys_t;
+
+/******************************************************************************
+ *	function declarations
+ ******************************************************************************/
+
+/* Set up hierarchy with no levels configured */
+void cache_init(cache_sys_t *cs);
+
+/* Free the lines of all levels */
+void cache_free(cache_sys_t *cs);
+
+/* Configure one level from a -c argument of the form
+   name:sets:ways:block[:policy[:write[:latency]]]  or  mem:latency
+   where name is l1i, l1d, or l2, policy is lru, fifo, or random,
+   and write is wb (write-back) or wt (write-through).
+   Return FALSE if spec is malformed */
+bool_t cache_config(cache_sys_t *cs, char *spec);
+
+/* Has any level been configured? */
+bool_t cache_enabled(cache_sys_t *cs);
+
+/* Invalidate all lines and clear statistics */
+void cache_reset(cache_sys_t *cs);
+
+/* Fetch len bytes of instruction starting at addr.
+   Return its latency in extra cycles */
+word_t cache_fetch(cache_sys_t *cs, word_t addr, int len);
+
+/* Read or write len bytes of data starting at addr.
+   Return its latency in extra cycles */
+word_t cache_data(cache_sys_t *cs, word_t addr, int len, bool_t write);
+
+/* Print access and miss statistics for each level */
+void cache_report(cache_sys_t *cs, FILE *fp);
+
+/******************************************************************************/
+
+#endif /* CACHE_H */
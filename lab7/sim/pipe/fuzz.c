@@ -0,0 +1,533 @@
+/*
+ * fuzz.c - Random-program testing of a PIPE design
+ *
+ * Generates random Y86-64 programs, and runs each one on the pipeline
+ * simulator, checking it against the ISA simulator as psim -t does.
+ * Failing programs are left in a directory as .ys files.
+ *
+ * The program is linked with psim.c compiled with -DSIM_LIB, the HCL
+ * file translated with hcl2c -c, and yas.c compiled with -DYAS_LIB.
+ * See the Makefile.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+
+#include "isa.h"
+#include "pipeline.h"
+#include "stages.h"
+#include "sim.h"
+
+#define MAXBUF 1024
+#define MAXCACHE 8
+
+/* Memory layout of the programs.  The data area holds DATA_WORDS
+   words, and the stack grows down from the start of the code.  The
+   stores of a program mostly use small addresses, and the pipeline
+   would not see one that changed an instruction already fetched */
+#define DATA_ADDR 0x100
+#define DATA_WORDS 32
+#define CODE_ADDR 0x800
+
+/* Longest program that fits in memory */
+#define MAXLEN 500
+
+/* Assembler core, from yas.c */
+int assemble(FILE *in, FILE *out);
+
+/* Simulator settings, from psim.c */
+extern char simname[];
+extern bool_t verbosity;
+extern word_t instr_limit;
+extern bool_t fast_mode;
+
+
+/***************
+ * Begin Globals
+ ***************/
+
+/* Parameters modified by the command line */
+static int prog_cnt = 4096;       /* Number of programs (-n) */
+static int prog_len = 40;         /* Instructions in each program (-l) */
+static unsigned seed = 1;         /* Seed for the first program (-s) */
+static bool_t testiaddq = FALSE;  /* Generate iaddq instructions? (-i) */
+static char *outputdir = ".";     /* Where failing programs are left (-d) */
+static char *pred_type = NULL;    /* Branch predictor (-p) */
+static char *caches[MAXCACHE];    /* Cache levels of every run (-c) */
+static int cache_cnt = 0;
+
+/* A generated program and its result */
+typedef struct {
+    char *src;           /* Y86-64 assembly code */
+    size_t len;
+    mem_t image;         /* Assembled code and data.  NULL if yas failed */
+    bool_t ok;           /* Did ISA check succeed? */
+    byte_t status;       /* Status at the end of the run */
+    word_t cycles;
+    word_t instructions;
+} prog_rec, *prog_ptr;
+
+static prog_ptr progs = NULL;
+
+/*************
+ * End Globals
+ *************/
+
+
+/*****************************************************************
+ * Part 1: Program generation.  Program i is generated from seed+i,
+ * so any one of them can be reproduced on its own.  Only programs
+ * that keep to their own code on the ISA simulator are kept.
+ *****************************************************************/
+
+static char *regs[] = { "%rax", "%rcx", "%rdx", "%rbx", "%rsp", "%rbp",
+			"%rsi", "%rdi", "%r8", "%r9", "%r10", "%r11",
+			"%r12", "%r13", "%r14" };
+#define NREG 15
+
+static char *alu_ops[] = { "addq", "subq", "andq", "xorq" };
+static char *moves[] = { "rrmovq", "cmovle", "cmovl", "cmove",
+			 "cmovne", "cmovge", "cmovg" };
+static char *jumps[] = { "jmp", "jle", "jl", "je", "jne", "jge", "jg" };
+
+/* Register other than %rsp, which stays a valid stack pointer more often
+   than not */
+static char *any_reg(unsigned *state)
+{
+    int r = rand_r(state) % (NREG-1);
+    return regs[r < 4 ? r : r+1];
+}
+
+/* Constant: often small, sometimes an address in the data area */
+static word_t any_val(unsigned *state)
+{
+    switch (rand_r(state) % 4) {
+    case 0:
+	return 0;
+    case 1:
+	return rand_r(state) % 16 - 8;
+    case 2:
+	return rand_r(state);
+    default:
+	return -1;  /* Replaced by a data address */
+    }
+}
+
+static void gen_val(FILE *out, unsigned *state)
+{
+    word_t v = any_val(state);
+    if (v == -1)
+	fprintf(out, "$0x%x", DATA_ADDR + 8 * (rand_r(state) % DATA_WORDS));
+    else
+	fprintf(out, "$%lld", v);
+}
+
+/* Write program with prog_len random instructions to out, drawing
+   from *statep */
+static void gen_program(FILE *out, unsigned *statep)
+{
+    unsigned state = *statep;
+    int i, r;
+
+    fprintf(out, "\t.pos 0\n");
+    fprintf(out, "\tjmp Start\n");
+    fprintf(out, "\t.pos 0x%x\n", DATA_ADDR);
+    for (i = 0; i < DATA_WORDS; i++)
+	fprintf(out, "\t.quad 0x%x\n", rand_r(&state));
+    fprintf(out, "\t.pos 0x%x\n", CODE_ADDR);
+    fprintf(out, "Start:\tirmovq Start,%%rsp\n");
+    for (r = 0; r < NREG; r++) {
+	if (r == REG_RSP)
+	    continue;
+	fprintf(out, "\tirmovq ");
+	gen_val(out, &state);
+	fprintf(out, ",%s\n", regs[r]);
+    }
+    for (i = 0; i < prog_len; i++) {
+	/* Jumps and calls go forward, to L1 .. Lprog_len */
+	int target = i + 1 + rand_r(&state) % (prog_len - i);
+	fprintf(out, "L%d:\t", i);
+	switch (rand_r(&state) % 16) {
+	case 0:
+	case 1:
+	    fprintf(out, "%s %s,%s\n", moves[rand_r(&state) % 7],
+		    any_reg(&state), any_reg(&state));
+	    break;
+	case 2:
+	    fprintf(out, "irmovq ");
+	    gen_val(out, &state);
+	    fprintf(out, ",%s\n", any_reg(&state));
+	    break;
+	case 3:
+	case 4:
+	    fprintf(out, "rmmovq %s,%d(%s)\n", any_reg(&state),
+		    8 * (rand_r(&state) % 4), any_reg(&state));
+	    break;
+	case 5:
+	case 6:
+	    fprintf(out, "mrmovq %d(%s),%s\n", 8 * (rand_r(&state) % 4),
+		    any_reg(&state), any_reg(&state));
+	    break;
+	case 7:
+	case 8:
+	case 9:
+	    fprintf(out, "%s %s,%s\n", alu_ops[rand_r(&state) % 4],
+		    any_reg(&state), any_reg(&state));
+	    break;
+	case 10:
+	    fprintf(out, "%s L%d\n", jumps[rand_r(&state) % 7], target);
+	    break;
+	case 11:
+	    /* The return address is often popped by something else */
+	    fprintf(out, "call L%d\n", target);
+	    break;
+	case 12:
+	    fprintf(out, "ret\n");
+	    break;
+	case 13:
+	    fprintf(out, "pushq %s\n", regs[rand_r(&state) % NREG]);
+	    break;
+	case 14:
+	    fprintf(out, "popq %s\n", regs[rand_r(&state) % NREG]);
+	    break;
+	default:
+	    if (testiaddq) {
+		fprintf(out, "iaddq ");
+		gen_val(out, &state);
+		fprintf(out, ",%s\n", any_reg(&state));
+	    } else
+		fprintf(out, "nop\n");
+	    break;
+	}
+    }
+    fprintf(out, "L%d:\thalt\n", prog_len);
+    *statep = state;
+}
+
+/* Mark the addresses in the code area where the listing obj has an
+   instruction */
+static void mark_instrs(char *obj, size_t objlen, bool_t *instr)
+{
+    char *line = obj, *end = obj + objlen;
+    word_t addr;
+    char hex[MAXBUF];
+
+    memset(instr, 0, (MEM_SIZE - CODE_ADDR) * sizeof(bool_t));
+    while (line < end) {
+	if (sscanf(line, "0x%llx: %[0-9a-f]", &addr, hex) == 2 &&
+	    addr >= CODE_ADDR && addr < MEM_SIZE)
+	    instr[addr - CODE_ADDR] = TRUE;
+	line = memchr(line, '\n', end - line);
+	if (!line)
+	    break;
+	line++;
+    }
+}
+
+/* Run program image on the ISA simulator, and check that it only
+   executes the generated instructions, and does not write over them.
+   PIPE does not model everything the ISA simulator does with other
+   bytes: a ret to a popped data address can execute the random words
+   of the data area, whose register IDs and instruction codes PIPE
+   handles differently, and a store into the code is not seen by
+   instructions already fetched */
+static bool_t stays_in_code(mem_t image, bool_t *instr)
+{
+    state_ptr s = new_state(0);
+    stat_t status = STAT_AOK;
+    word_t steps;
+    bool_t ok = TRUE;
+
+    free_mem(s->m);
+    s->m = copy_mem(image);
+    s->pc = 0;
+    for (steps = 0; status == STAT_AOK && steps < instr_limit; steps++) {
+	if (s->pc != 0 &&
+	    (s->pc < CODE_ADDR || s->pc >= MEM_SIZE ||
+	     !instr[s->pc - CODE_ADDR])) {
+	    ok = FALSE;
+	    break;
+	}
+	status = step_state(s, NULL);
+    }
+    if (ok)
+	ok = memcmp(s->m->contents + CODE_ADDR, image->contents + CODE_ADDR,
+		    MEM_SIZE - CODE_ADDR) == 0;
+    free_state(s);
+    return ok;
+}
+
+/* Generate and assemble the programs.  A program that leaves its
+   code is replaced by the next one drawn from the same seed */
+static void gen_programs()
+{
+    bool_t *instr = (bool_t *) malloc((MEM_SIZE - CODE_ADDR) * sizeof(bool_t));
+    int i;
+
+    progs = (prog_ptr) calloc(prog_cnt, sizeof(prog_rec));
+    if (!progs || !instr) {
+	perror("calloc error");
+	exit(1);
+    }
+    for (i = 0; i < prog_cnt; i++) {
+	prog_ptr p = &progs[i];
+	unsigned state = seed + i;
+	bool_t ok = FALSE;
+	int tries;
+
+	for (tries = 1; !ok; tries++) {
+	    FILE *in, *out;
+	    char *obj = NULL;
+	    size_t objlen = 0;
+
+	    free(p->src);
+	    p->src = NULL;
+	    out = open_memstream(&p->src, &p->len);
+	    if (!out) {
+		perror("open_memstream error");
+		exit(1);
+	    }
+	    fprintf(out, "# Random program, seed %u, try %d\n", seed + i, tries);
+	    gen_program(out, &state);
+	    fclose(out);
+
+	    in = fmemopen(p->src, p->len, "r");
+	    out = open_memstream(&obj, &objlen);
+	    if (assemble(in, out) == 0) {
+		p->image = init_mem(MEM_SIZE);
+		fclose(out);
+		out = NULL;
+		fclose(in);
+		in = fmemopen(obj, objlen, "r");
+		if (load_mem(p->image, in, 1) == 0) {
+		    free_mem(p->image);
+		    p->image = NULL;
+		}
+	    }
+	    fclose(in);
+	    if (out)
+		fclose(out);
+	    if (!p->image)
+		ok = TRUE;  /* Reported as not assembling */
+	    else {
+		mark_instrs(obj, objlen, instr);
+		ok = stays_in_code(p->image, instr);
+		if (!ok) {
+		    free_mem(p->image);
+		    p->image = NULL;
+		}
+	    }
+	    free(obj);
+	}
+    }
+    free(instr);
+}
+
+
+/*****************************************************************
+ * Part 2: Running the programs.  The simulator starts each program
+ * with an ISA simulator state to check it against.
+ *****************************************************************/
+
+static sim_ctx_t *new_sim()
+{
+    sim_ctx_t *ctx = sim_new();
+    int c;
+    if (pred_type)
+	pred_set_type(&ctx->pred, pred_type);
+    for (c = 0; c < cache_cnt; c++)
+	cache_config(&ctx->cache, caches[c]);
+    return ctx;
+}
+
+static void start_program(sim_ctx_t *ctx, prog_ptr p)
+{
+    sim_reset(ctx);
+    free_mem(ctx->mem);
+    ctx->mem = copy_mem(p->image);
+    ctx->isa_state = sim_isa_state(ctx);
+    ctx->check_ok = TRUE;
+}
+
+/* Check the final state, as psim -t does */
+static void finish_program(sim_ctx_t *ctx, prog_ptr p)
+{
+    p->ok = ctx->check_ok;
+    if (p->ok)
+	p->ok = !diff_reg(ctx->isa_state->r, ctx->reg, NULL) &&
+	    !diff_mem(ctx->isa_state->m, ctx->mem, NULL) &&
+	    ctx->isa_state->cc == ctx->cc;
+    p->cycles = ctx->cycles;
+    p->instructions = ctx->instructions;
+    free_state(ctx->isa_state);
+    ctx->isa_state = NULL;
+}
+
+/* Simulate the programs one after another */
+static void run_programs()
+{
+    sim_ctx_t *ctx = new_sim();
+    int i;
+    for (i = 0; i < prog_cnt; i++) {
+	prog_ptr p = &progs[i];
+	if (!p->image)
+	    continue;
+	start_program(ctx, p);
+	sim_run_pipe(ctx, instr_limit, 5*instr_limit, &p->status, NULL);
+	finish_program(ctx, p);
+    }
+    sim_free(ctx);
+}
+
+
+/*****************************************************************
+ * Part 3: Reporting
+ *****************************************************************/
+
+/* Leave source of failing program in outputdir */
+static void save_program(int i)
+{
+    char fname[MAXBUF];
+    FILE *fp;
+    snprintf(fname, MAXBUF, "%s/fuzz-%u.ys", outputdir, seed + i);
+    fp = fopen(fname, "w");
+    if (!fp) {
+	fprintf(stderr, "Can't write to %s\n", fname);
+	return;
+    }
+    fwrite(progs[i].src, 1, progs[i].len, fp);
+    fclose(fp);
+}
+
+/* Print the results.  Return the number of programs that failed */
+static int report(double secs)
+{
+    word_t cycles = 0, instructions = 0;
+    int ran = 0, bad = 0;
+    int i;
+
+    printf("Simulating with %s\n", simname);
+    for (i = 0; i < prog_cnt; i++) {
+	prog_ptr p = &progs[i];
+	if (!p->image) {
+	    printf("Program %u did not assemble\n", seed + i);
+	    continue;
+	}
+	ran++;
+	cycles += p->cycles;
+	instructions += p->instructions;
+	if (!p->ok) {
+	    printf("Program %u failed (status %s)\n", seed + i,
+		   stat_name(p->status));
+	    save_program(i);
+	    bad++;
+	}
+    }
+    if (bad == 0)
+	printf("  All %d ISA Checks Succeed\n", ran);
+    else
+	printf("  %d/%d ISA Checks Failed\n", bad, ran);
+    printf("  %lld cycles, %lld instructions, %.2f s (%.2f Mcycles/s)\n",
+	   cycles, instructions, secs, secs > 0 ? cycles / secs / 1e6 : 0.0);
+    return bad;
+}
+
+static void usage(char *name)
+{
+    printf("Usage: %s [-hi] [-n N] [-l len] [-s seed] [-d dir] [-p pred] [-c cache]...\n", name);
+    printf("   -h       Print this message\n");
+    printf("   -i       Generate iaddq instructions\n");
+    printf("   -n N     Number of programs (default %d)\n", prog_cnt);
+    printf("   -l len   Instructions in each program (default %d)\n", prog_len);
+    printf("   -s seed  Seed of the first program (default 1)\n");
+    printf("   -d dir   Specify directory for failing programs\n");
+    printf("   -p pred  Branch predictor, as for psim -p\n");
+    printf("   -c cache Add cache level to every run, as for psim -c\n");
+    exit(0);
+}
+
+/*
+ * sim_main - called from the main() routine in the HCL file, in place
+ * of the simulator's own
+ */
+int sim_main(int argc, char **argv)
+{
+    struct timeval start, end;
+    cache_sys_t cs;
+    pred_t pred;
+    int out_fd, null_fd;
+    int c;
+
+    cache_init(&cs);
+    while ((c = getopt(argc, argv, "hin:l:s:d:p:c:")) != -1) {
+	switch(c) {
+	case 'h':
+	    usage(argv[0]);
+	    break;
+	case 'i':
+	    testiaddq = TRUE;
+	    break;
+	case 'n':
+	    prog_cnt = atoi(optarg);
+	    break;
+	case 'l':
+	    prog_len = atoi(optarg);
+	    if (prog_len < 1 || prog_len > MAXLEN) {
+		printf("Program length must be between 1 and %d\n", MAXLEN);
+		usage(argv[0]);
+	    }
+	    break;
+	case 's':
+	    seed = atoi(optarg);
+	    break;
+	case 'd':
+	    outputdir = optarg;
+	    break;
+	case 'p':
+	    if (!pred_set_type(&pred, optarg)) {
+		printf("Invalid predictor '%s'\n", optarg);
+		usage(argv[0]);
+	    }
+	    pred_type = optarg;
+	    break;
+	case 'c':
+	    if (cache_cnt == MAXCACHE || !cache_config(&cs, optarg)) {
+		printf("Invalid cache specification '%s'\n", optarg);
+		usage(argv[0]);
+	    }
+	    caches[cache_cnt++] = optarg;
+	    break;
+	default:
+	    printf("Invalid option '%c'\n", c);
+	    usage(argv[0]);
+	    break;
+	}
+    }
+    cache_free(&cs);
+
+    verbosity = 0;
+    fast_mode = TRUE;
+
+    gen_programs();
+    /* The ISA check prints its differences on stdout */
+    fflush(stdout);
+    out_fd = dup(STDOUT_FILENO);
+    null_fd = open("/dev/null", O_WRONLY);
+    if (out_fd < 0 || null_fd < 0 || dup2(null_fd, STDOUT_FILENO) < 0) {
+	perror("dup error");
+	exit(1);
+    }
+    gettimeofday(&start, NULL);
+    run_programs();
+    gettimeofday(&end, NULL);
+    fflush(stdout);
+    dup2(out_fd, STDOUT_FILENO);
+    close(out_fd);
+    close(null_fd);
+    exit(report((end.tv_sec - start.tv_sec) +
+		(end.tv_usec - start.tv_usec) / 1e6) ? 1 : 0);
+}
@@ -0,0 +1,500 @@
+#/* $begin pipe-all-hcl */
+####################################################################
+#    HCL Description of Control for Pipelined Y86-64 Processor     #
+#    Copyright (C) Randal E. Bryant, David R. O'Hallaron, 2014     #
+####################################################################
+
+## This version is a 2-wide in-order pipeline.  Every pipeline
+## register except F holds two instructions side by side: lane 0 and
+## the younger lane 1.  Fetch reads two consecutive instructions, and
+## the second one only issues in lane 1 if it can execute together
+## with the first (see f_pair).  Otherwise lane 1 gets a bubble, and
+## the instruction is fetched again into lane 0 on the next cycle.
+## The two lanes then move through the pipeline together.
+##
+## Signals named with a plain stage letter (D_icode, e_valE, ...)
+## refer to the lane being computed.  Signals with a lane number
+## (E0_icode, e1_valE, ...) refer to that lane, and are used for
+## forwarding between lanes and for pipeline control.
+##
+## psim must be built with -DPIPE_WIDTH=2 to use this file.
+
+####################################################################
+#    C Include's.  Don't alter these                               #
+####################################################################
+
+quote '#include <stdio.h>'
+quote '#include "isa.h"'
+quote '#include "pipeline.h"'
+quote '#include "stages.h"'
+quote '#include "sim.h"'
+quote '#if PIPE_WIDTH < 2'
+quote '#error pipe-2w.hcl needs psim built with -DPIPE_WIDTH=2'
+quote '#endif'
+quote 'int sim_main(int argc, char *argv[]);'
+quote 'int main(int argc, char *argv[]){return sim_main(argc,argv);}'
+
+####################################################################
+#    Declarations.  Do not change/remove/delete any of these       #
+####################################################################
+
+##### Symbolic representation of Y86-64 Instruction Codes #############
+wordsig INOP 	'I_NOP'
+wordsig IHALT	'I_HALT'
+wordsig IRRMOVQ	'I_RRMOVQ'
+wordsig IIRMOVQ	'I_IRMOVQ'
+wordsig IRMMOVQ	'I_RMMOVQ'
+wordsig IMRMOVQ	'I_MRMOVQ'
+wordsig IOPQ	'I_ALU'
+wordsig IJXX	'I_JMP'
+wordsig ICALL	'I_CALL'
+wordsig IRET	'I_RET'
+wordsig IPUSHQ	'I_PUSHQ'
+wordsig IPOPQ	'I_POPQ'
+
+##### Symbolic represenations of Y86-64 function codes            #####
+wordsig FNONE    'F_NONE'        # Default function code
+wordsig UNCOND   'C_YES'         # Unconditional transfer
+
+##### Symbolic representation of Y86-64 Registers referenced      #####
+wordsig RRSP     'REG_RSP'    	     # Stack Pointer
+wordsig RNONE    'REG_NONE'   	     # Special value indicating "no register"
+
+##### ALU Functions referenced explicitly ##########################
+wordsig ALUADD	'A_ADD'		     # ALU should add its arguments
+
+##### Possible instruction status values                       #####
+wordsig SBUB	'STAT_BUB'	# Bubble in stage
+wordsig SAOK	'STAT_AOK'	# Normal execution
+wordsig SADR	'STAT_ADR'	# Invalid memory address
+wordsig SINS	'STAT_INS'	# Invalid instruction
+wordsig SHLT	'STAT_HLT'	# Halt instruction encountered
+
+##### Signals that can be referenced by control logic ##############
+
+wordsig lane 'lane'		     # Lane being computed
+
+##### Pipeline Register F ##########################################
+
+wordsig F_predPC 'pc_curr->pc'	     # Predicted value of PC
+
+##### Intermediate Values in Fetch Stage ###########################
+
+wordsig imem_icode  'imem_icode'      # icode field from instruction memory
+wordsig imem_ifun   'imem_ifun'       # ifun  field from instruction memory
+wordsig f_icode	'if_id_next[lane].icode'  # (Possibly modified) instruction code
+wordsig f_ifun	'if_id_next[lane].ifun'   # Fetched instruction function
+wordsig f_valC	'if_id_next[lane].valc'   # Constant data of fetched instruction
+wordsig f_valP	'if_id_next[lane].valp'   # Address of following instruction
+boolsig imem_error 'imem_error'	     # Error signal from instruction memory
+boolsig instr_valid 'instr_valid'    # Is fetched instruction valid?
+
+wordsig f0_icode 'if_id_next[0].icode' # Instruction fetched in lane 0
+wordsig f0_rA	 'if_id_next[0].ra'
+wordsig f0_rB	 'if_id_next[0].rb'
+wordsig f0_stat	 'if_id_next[0].status'
+wordsig f1_icode 'if_id_next[1].icode' # Instruction fetched in lane 1
+wordsig f1_ifun	 'if_id_next[1].ifun'
+wordsig f1_rA	 'if_id_next[1].ra'
+wordsig f1_rB	 'if_id_next[1].rb'
+wordsig f1_stat	 'if_id_next[1].status'
+
+##### Pipeline Register D ##########################################
+wordsig D_icode 'if_id_curr[lane].icode'   # Instruction code
+wordsig D_rA 'if_id_curr[lane].ra'	     # rA field from instruction
+wordsig D_rB 'if_id_curr[lane].rb'	     # rB field from instruction
+wordsig D_valP 'if_id_curr[lane].valp'     # Incremented PC
+
+wordsig D0_icode 'if_id_curr[0].icode'
+
+##### Intermediate Values in Decode Stage  #########################
+
+wordsig d_srcA	 'id_ex_next[lane].srca'  # srcA from decoded instruction
+wordsig d_srcB	 'id_ex_next[lane].srcb'  # srcB from decoded instruction
+wordsig d_rvalA 'd_regvala'	     # valA read from register file
+wordsig d_rvalB 'd_regvalb'	     # valB read from register file
+
+wordsig d0_srcA	 'id_ex_next[0].srca'
+wordsig d0_srcB	 'id_ex_next[0].srcb'
+wordsig d1_srcA	 'id_ex_next[1].srca'
+wordsig d1_srcB	 'id_ex_next[1].srcb'
+
+##### Pipeline Register E ##########################################
+wordsig E_icode 'id_ex_curr[lane].icode'   # Instruction code
+wordsig E_ifun  'id_ex_curr[lane].ifun'    # Instruction function
+wordsig E_valC  'id_ex_curr[lane].valc'    # Constant data
+wordsig E_srcA  'id_ex_curr[lane].srca'    # Source A register ID
+wordsig E_valA  'id_ex_curr[lane].vala'    # Source A value
+wordsig E_srcB  'id_ex_curr[lane].srcb'    # Source B register ID
+wordsig E_valB  'id_ex_curr[lane].valb'    # Source B value
+wordsig E_dstE 'id_ex_curr[lane].deste'    # Destination E register ID
+wordsig E_dstM 'id_ex_curr[lane].destm'    # Destination M register ID
+
+wordsig E0_icode 'id_ex_curr[0].icode'
+wordsig E0_dstM	 'id_ex_curr[0].destm'
+wordsig E1_icode 'id_ex_curr[1].icode'
+wordsig E1_dstM	 'id_ex_curr[1].destm'
+
+##### Intermediate Values in Execute Stage #########################
+wordsig e_valE 'ex_mem_next[lane].vale'	# valE generated by ALU
+boolsig e_Cnd 'ex_mem_next[lane].takebranch' # Does condition hold?
+wordsig e_dstE 'ex_mem_next[lane].deste'      # dstE (possibly modified to be RNONE)
+
+wordsig e0_valE	 'ex_mem_next[0].vale'
+boolsig e0_Cnd	 'ex_mem_next[0].takebranch'
+wordsig e0_dstE	 'ex_mem_next[0].deste'
+wordsig e1_valE	 'ex_mem_next[1].vale'
+boolsig e1_Cnd	 'ex_mem_next[1].takebranch'
+wordsig e1_dstE	 'ex_mem_next[1].deste'
+
+##### Pipeline Register M                  #########################
+wordsig M_stat 'ex_mem_curr[lane].status'     # Instruction status
+wordsig M_icode 'ex_mem_curr[lane].icode'	# Instruction code
+wordsig M_ifun  'ex_mem_curr[lane].ifun'	# Instruction function
+wordsig M_valA  'ex_mem_curr[lane].vala'      # Source A value
+wordsig M_dstE 'ex_mem_curr[lane].deste'	# Destination E register ID
+wordsig M_valE  'ex_mem_curr[lane].vale'      # ALU E value
+wordsig M_dstM 'ex_mem_curr[lane].destm'	# Destination M register ID
+boolsig M_Cnd 'ex_mem_curr[lane].takebranch'	# Condition flag
+boolsig dmem_error 'dmem_error'	        # Error signal from instruction memory
+
+wordsig M0_icode 'ex_mem_curr[0].icode'
+boolsig M0_Cnd	 'ex_mem_curr[0].takebranch'
+wordsig M0_valA	 'ex_mem_curr[0].vala'
+wordsig M0_dstE	 'ex_mem_curr[0].deste'
+wordsig M0_valE	 'ex_mem_curr[0].vale'
+wordsig M0_dstM	 'ex_mem_curr[0].destm'
+wordsig M1_icode 'ex_mem_curr[1].icode'
+boolsig M1_Cnd	 'ex_mem_curr[1].takebranch'
+wordsig M1_valA	 'ex_mem_curr[1].vala'
+wordsig M1_dstE	 'ex_mem_curr[1].deste'
+wordsig M1_valE	 'ex_mem_curr[1].vale'
+wordsig M1_dstM	 'ex_mem_curr[1].destm'
+
+##### Intermediate Values in Memory Stage ##########################
+wordsig m_valM 'mem_wb_next[lane].valm'	# valM generated by memory
+wordsig m_stat 'mem_wb_next[lane].status'	# stat (possibly modified to be SADR)
+
+wordsig m0_valM	 'mem_wb_next[0].valm'
+wordsig m0_stat	 'mem_wb_next[0].status'
+wordsig m1_valM	 'mem_wb_next[1].valm'
+wordsig m1_stat	 'mem_wb_next[1].status'
+
+##### Pipeline Register W ##########################################
+wordsig W_stat 'mem_wb_curr[lane].status'     # Instruction status
+wordsig W_icode 'mem_wb_curr[lane].icode'	# Instruction code
+wordsig W_dstE 'mem_wb_curr[lane].deste'	# Destination E register ID
+wordsig W_valE  'mem_wb_curr[lane].vale'      # ALU E value
+wordsig W_dstM 'mem_wb_curr[lane].destm'	# Destination M register ID
+wordsig W_valM  'mem_wb_curr[lane].valm'	# Memory M value
+
+wordsig W0_stat	 'mem_wb_curr[0].status'
+wordsig W0_icode 'mem_wb_curr[0].icode'
+wordsig W0_dstE	 'mem_wb_curr[0].deste'
+wordsig W0_valE	 'mem_wb_curr[0].vale'
+wordsig W0_dstM	 'mem_wb_curr[0].destm'
+wordsig W0_valM	 'mem_wb_curr[0].valm'
+wordsig W1_stat	 'mem_wb_curr[1].status'
+wordsig W1_dstE	 'mem_wb_curr[1].deste'
+wordsig W1_valE	 'mem_wb_curr[1].vale'
+wordsig W1_dstM	 'mem_wb_curr[1].destm'
+wordsig W1_valM	 'mem_wb_curr[1].valm'
+
+####################################################################
+#    Control Signal Definitions.                                   #
+####################################################################
+
+################ Fetch Stage     ###################################
+
+## What address should instruction be fetched at
+word f_pc = [
+	# Mispredicted branch.  Fetch at incremented PC
+	M0_icode == IJXX && !M0_Cnd : M0_valA;
+	M1_icode == IJXX && !M1_Cnd : M1_valA;
+	# Completion of RET instruction
+	W0_icode == IRET : W0_valM;
+	# Default: Use predicted value of PC
+	1 : F_predPC;
+];
+
+## Determine icode of fetched instruction
+word f_icode = [
+	imem_error : INOP;
+	1: imem_icode;
+];
+
+# Determine ifun
+word f_ifun = [
+	imem_error : FNONE;
+	1: imem_ifun;
+];
+
+# Is instruction valid?
+bool instr_valid = f_icode in
+	{ INOP, IHALT, IRRMOVQ, IIRMOVQ, IRMMOVQ, IMRMOVQ,
+	  IOPQ, IJXX, ICALL, IRET, IPUSHQ, IPOPQ };
+
+# Determine status code for fetched instruction
+word f_stat = [
+	imem_error: SADR;
+	!instr_valid : SINS;
+	f_icode == IHALT : SHLT;
+	1 : SAOK;
+];
+
+# Does fetched instruction require a regid byte?
+bool need_regids =
+	f_icode in { IRRMOVQ, IOPQ, IPUSHQ, IPOPQ,
+		     IIRMOVQ, IRMMOVQ, IMRMOVQ };
+
+# Does fetched instruction require a constant word?
+bool need_valC =
+	f_icode in { IIRMOVQ, IRMMOVQ, IMRMOVQ, IJXX, ICALL };
+
+## Can the instruction fetched in lane 1 issue together with lane 0?
+bool f_pair =
+	# Both instructions fetched normally
+	f0_stat == SAOK && f1_stat == SAOK &&
+	# Lane 0 must not change the flow of control
+	f0_icode in { INOP, IRRMOVQ, IIRMOVQ, IRMMOVQ, IMRMOVQ,
+		      IOPQ, IPUSHQ, IPOPQ } &&
+	# Lane 1 has no stack instructions, so it never uses %rsp implicitly
+	f1_icode in { INOP, IRRMOVQ, IIRMOVQ, IRMMOVQ, IMRMOVQ,
+		      IOPQ, IJXX } &&
+	# There is a single data memory port, and lane 1 cannot set the
+	# condition codes before lane 0 finds out if its access faults
+	!(f0_icode in { IRMMOVQ, IMRMOVQ, IPUSHQ, IPOPQ } &&
+	  f1_icode in { IRMMOVQ, IMRMOVQ, IOPQ }) &&
+	# Lane 1 cannot test condition codes set by lane 0
+	!(f0_icode == IOPQ && f1_icode in { IRRMOVQ, IJXX } &&
+	  f1_ifun != UNCOND) &&
+	# Lane 1 cannot read a register written by lane 0
+	!(f0_icode in { IRRMOVQ, IIRMOVQ, IOPQ } &&
+	  (f1_icode in { IRRMOVQ, IRMMOVQ, IOPQ } && f1_rA == f0_rB ||
+	   f1_icode in { IRMMOVQ, IMRMOVQ, IOPQ } && f1_rB == f0_rB)) &&
+	!(f0_icode in { IMRMOVQ, IPOPQ } &&
+	  (f1_icode in { IRRMOVQ, IRMMOVQ, IOPQ } && f1_rA == f0_rA ||
+	   f1_icode in { IRMMOVQ, IMRMOVQ, IOPQ } && f1_rB == f0_rA)) &&
+	!(f0_icode in { IPUSHQ, IPOPQ } &&
+	  (f1_icode in { IRRMOVQ, IRMMOVQ, IOPQ } && f1_rA == RRSP ||
+	   f1_icode in { IRMMOVQ, IMRMOVQ, IOPQ } && f1_rB == RRSP));
+
+# Predict next value of PC from the youngest instruction fetched
+word f_predPC = [
+	f_icode in { IJXX, ICALL } : f_valC;
+	1 : f_valP;
+];
+
+################ Decode Stage ######################################
+
+
+## What register should be used as the A source?
+word d_srcA = [
+	D_icode in { IRRMOVQ, IRMMOVQ, IOPQ, IPUSHQ  } : D_rA;
+	D_icode in { IPOPQ, IRET } : RRSP;
+	1 : RNONE; # Don't need register
+];
+
+## What register should be used as the B source?
+word d_srcB = [
+	D_icode in { IOPQ, IRMMOVQ, IMRMOVQ  } : D_rB;
+	D_icode in { IPUSHQ, IPOPQ, ICALL, IRET } : RRSP;
+	1 : RNONE;  # Don't need register
+];
+
+## What register should be used as the E destination?
+word d_dstE = [
+	D_icode in { IRRMOVQ, IIRMOVQ, IOPQ} : D_rB;
+	D_icode in { IPUSHQ, IPOPQ, ICALL, IRET } : RRSP;
+	1 : RNONE;  # Don't write any register
+];
+
+## What register should be used as the M destination?
+word d_dstM = [
+	D_icode in { IMRMOVQ, IPOPQ } : D_rA;
+	1 : RNONE;  # Don't write any register
+];
+
+## What should be the A value?
+## Forward into decode stage for valA.  Within a stage, lane 1 holds
+## the younger instruction, so its results take priority
+word d_valA = [
+	D_icode in { ICALL, IJXX } : D_valP; # Use incremented PC
+	d_srcA == e1_dstE : e1_valE;    # Forward valE from execute
+	d_srcA == e0_dstE : e0_valE;
+	d_srcA == M1_dstM : m1_valM;    # Forward valM from memory
+	d_srcA == M1_dstE : M1_valE;    # Forward valE from memory
+	d_srcA == M0_dstM : m0_valM;
+	d_srcA == M0_dstE : M0_valE;
+	d_srcA == W1_dstM : W1_valM;    # Forward valM from write back
+	d_srcA == W1_dstE : W1_valE;    # Forward valE from write back
+	d_srcA == W0_dstM : W0_valM;
+	d_srcA == W0_dstE : W0_valE;
+	1 : d_rvalA;  # Use value read from register file
+];
+
+word d_valB = [
+	d_srcB == e1_dstE : e1_valE;    # Forward valE from execute
+	d_srcB == e0_dstE : e0_valE;
+	d_srcB == M1_dstM : m1_valM;    # Forward valM from memory
+	d_srcB == M1_dstE : M1_valE;    # Forward valE from memory
+	d_srcB == M0_dstM : m0_valM;
+	d_srcB == M0_dstE : M0_valE;
+	d_srcB == W1_dstM : W1_valM;    # Forward valM from write back
+	d_srcB == W1_dstE : W1_valE;    # Forward valE from write back
+	d_srcB == W0_dstM : W0_valM;
+	d_srcB == W0_dstE : W0_valE;
+	1 : d_rvalB;  # Use value read from register file
+];
+
+################ Execute Stage #####################################
+
+## Select input A to ALU
+word aluA = [
+	E_icode in { IRRMOVQ, IOPQ } : E_valA;
+	E_icode in { IIRMOVQ, IRMMOVQ, IMRMOVQ } : E_valC;
+	E_icode in { ICALL, IPUSHQ } : -8;
+	E_icode in { IRET, IPOPQ } : 8;
+	# Other instructions don't need ALU
+];
+
+## Select input B to ALU
+word aluB = [
+	E_icode in { IRMMOVQ, IMRMOVQ, IOPQ, ICALL,
+		     IPUSHQ, IRET, IPOPQ } : E_valB;
+	E_icode in { IRRMOVQ, IIRMOVQ } : 0;
+	# Other instructions don't need ALU
+];
+
+## Set the ALU function
+word alufun = [
+	E_icode == IOPQ : E_ifun;
+	1 : ALUADD;
+];
+
+## Should the condition codes be updated?
+bool set_cc = E_icode == IOPQ &&
+	# State changes only during normal operation
+	!m0_stat in { SADR, SINS, SHLT } && !m1_stat in { SADR, SINS, SHLT } &&
+	!W0_stat in { SADR, SINS, SHLT } && !W1_stat in { SADR, SINS, SHLT };
+
+## Generate valA in execute stage
+word e_valA = E_valA;    # Pass valA through stage
+
+## Set dstE to RNONE in event of not-taken conditional move
+word e_dstE = [
+	E_icode == IRRMOVQ && !e_Cnd : RNONE;
+	1 : E_dstE;
+];
+
+################ Memory Stage ######################################
+
+## Select memory address
+word mem_addr = [
+	M_icode in { IRMMOVQ, IPUSHQ, ICALL, IMRMOVQ } : M_valE;
+	M_icode in { IPOPQ, IRET } : M_valA;
+	# Other instructions don't need address
+];
+
+## Set read control signal
+bool mem_read = M_icode in { IMRMOVQ, IPOPQ, IRET };
+
+## Set write control signal
+bool mem_write = M_icode in { IRMMOVQ, IPUSHQ, ICALL };
+
+## Update the status
+word m_stat = [
+	# Exception in lane 0 cancels the younger instruction in lane 1
+	lane == 1 && m0_stat in { SADR, SINS, SHLT } : SBUB;
+	dmem_error : SADR;
+	1 : M_stat;
+];
+
+## Set E port register ID.  Cancelled instructions write nothing
+word w_dstE = [
+	W_stat == SBUB : RNONE;
+	1 : W_dstE;
+];
+
+## Set E port value
+word w_valE = W_valE;
+
+## Set M port register ID
+word w_dstM = [
+	W_stat == SBUB : RNONE;
+	1 : W_dstM;
+];
+
+## Set M port value
+word w_valM = W_valM;
+
+## Update processor status
+word Stat = [
+	W_stat == SBUB : SAOK;
+	1 : W_stat;
+];
+
+################ Pipeline Register Control #########################
+
+# Should I stall or inject a bubble into Pipeline Register F?
+# At most one of these can be true.
+bool F_bubble = 0;
+bool F_stall =
+	# Conditions for a load/use hazard in either lane
+	E0_icode in { IMRMOVQ, IPOPQ } &&
+	 E0_dstM in { d0_srcA, d0_srcB, d1_srcA, d1_srcB } ||
+	E1_icode == IMRMOVQ &&
+	 E1_dstM in { d0_srcA, d0_srcB, d1_srcA, d1_srcB } ||
+	# Stalling at fetch while ret passes through pipeline.
+	# A ret is never paired, so it is always in lane 0
+	IRET in { D0_icode, E0_icode, M0_icode };
+
+# Should I stall or inject a bubble into Pipeline Register D?
+# At most one of these can be true.
+bool D_stall =
+	# Conditions for a load/use hazard
+	(E0_icode in { IMRMOVQ, IPOPQ } &&
+	  E0_dstM in { d0_srcA, d0_srcB, d1_srcA, d1_srcB } ||
+	 E1_icode == IMRMOVQ &&
+	  E1_dstM in { d0_srcA, d0_srcB, d1_srcA, d1_srcB }) &&
+	# but not when a jump paired with the load was mispredicted
+	!(E1_icode == IJXX && !e1_Cnd);
+
+bool D_bubble =
+	# Mispredicted branch
+	(E0_icode == IJXX && !e0_Cnd) ||
+	(E1_icode == IJXX && !e1_Cnd) ||
+	# Stalling at fetch while ret passes through pipeline
+	# but not condition for a load/use hazard
+	!(E0_icode in { IMRMOVQ, IPOPQ } &&
+	  E0_dstM in { d0_srcA, d0_srcB, d1_srcA, d1_srcB } ||
+	  E1_icode == IMRMOVQ &&
+	  E1_dstM in { d0_srcA, d0_srcB, d1_srcA, d1_srcB }) &&
+	  IRET in { D0_icode, E0_icode, M0_icode };
+
+# Should I stall or inject a bubble into Pipeline Register E?
+# At most one of these can be true.
+bool E_stall = 0;
+bool E_bubble =
+	# Mispredicted branch
+	(E0_icode == IJXX && !e0_Cnd) ||
+	(E1_icode == IJXX && !e1_Cnd) ||
+	# Conditions for a load/use hazard
+	E0_icode in { IMRMOVQ, IPOPQ } &&
+	 E0_dstM in { d0_srcA, d0_srcB, d1_srcA, d1_srcB } ||
+	E1_icode == IMRMOVQ &&
+	 E1_dstM in { d0_srcA, d0_srcB, d1_srcA, d1_srcB };
+
+# Should I stall or inject a bubble into Pipeline Register M?
+# At most one of these can be true.
+bool M_stall = 0;
+# Start injecting bubbles as soon as exception passes through memory stage
+bool M_bubble =
+	m0_stat in { SADR, SINS, SHLT } || m1_stat in { SADR, SINS, SHLT } ||
+	W0_stat in { SADR, SINS, SHLT } || W1_stat in { SADR, SINS, SHLT };
+
+# Should I stall or inject a bubble into Pipeline Register W?
+bool W_stall =
+	W0_stat in { SADR, SINS, SHLT } || W1_stat in { SADR, SINS, SHLT };
+bool W_bubble = 0;
+#/* $end pipe-all-hcl */
@@ -18,7 +18,7 @@
  ******************************************************************************/
 
 /* Different control operations for pipeline register */
-/* LOAD:   Copy next state to current   */
+/* LOAD:   Swap next and current state  */
 /* STALL:  Keep current state unchanged */
 /* BUBBLE: Set current state to nop     */
 /* ERROR:  Occurs when both stall & load signals set */
@@ -26,13 +26,19 @@
 typedef enum { P_LOAD, P_STALL, P_BUBBLE, P_ERROR } p_stat_t;
 
 typedef struct {
-    /* Current and next register state */
+    /* Current and next register state.  These two buffers are swapped
+       on a load, so stage code must go through the bound pointers below */
     void *current;
     void *next;
+    /* Pointers used by the stage code (e.g., if_id_curr & if_id_next) */
+    void **current_ref;
+    void **next_ref;
     /* Contents of register when bubble occurs */
     void *bubble_val;
-    /* Number of state bytes */
+    /* Number of state bytes in each lane */
     int count;
+    /* Number of lanes (instructions held side by side) */
+    int width;
     /* How should state be updated next time? */
     p_stat_t op;
 } pipe_ele, *pipe_ptr;
@@ -41,15 +47,20 @@ typedef struct {
  *	function declarations
  ******************************************************************************/
 
-/* Create new pipe with count bytes of state */
-/* bubble_val indicates state corresponding to pipeline bubble */
-pipe_ptr new_pipe(int count, void *bubble_val);
+/* Create new pipe with width lanes of count bytes of state each */
+/* bubble_val indicates state of one lane corresponding to pipeline bubble */
+/* current_ref & next_ref are kept pointing at the current & next state */
+pipe_ptr new_pipe(int count, int width, void *bubble_val,
+		  void **current_ref, void **next_ref);
 
-/* Update all pipes */
-void update_pipes();
+/* Free pipe created by new_pipe */
+void free_pipe(pipe_ptr p);
 
-/* Set all pipes to bubble values */
-void clear_pipes();
+/* Update count pipes */
+void update_pipes(pipe_ptr *pipes, int count);
+
+/* Set count pipes to bubble values */
+void clear_pipes(pipe_ptr *pipes, int count);
 
 /* Utility code */
 
@@ -0,0 +1,192 @@
+/******************************************************************************
+ *	predict.c
+ *
+ *	Branch and return predictors for the pipelined simulator
+ *
+ *	The direction predictor selected with -p can be consulted from HCL
+ *	via pred_taken(); the return stack via pred_return().  All of the
+ *	predictors are trained on every conditional jump, so the report
+ *	can show how each of them would have fared on the same run.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "isa.h"
+#include "predict.h"
+
+/******************************************************************************
+ *	static variables
+ ******************************************************************************/
+
+static char *pred_names[PRED_COUNT] =
+    { "taken", "nt", "btfnt", "bimodal", "gshare", "tournament" };
+
+/******************************************************************************
+ *	function definitions
+ ******************************************************************************/
+
+bool_t pred_set_type(pred_t *p, char *name)
+{
+    int i;
+    for (i = 0; i < PRED_COUNT; i++) {
+	if (strcmp(name, pred_names[i]) == 0) {
+	    p->type = (pred_type_t) i;
+	    return TRUE;
+	}
+    }
+    return FALSE;
+}
+
+char *pred_name(pred_t *p)
+{
+    return pred_names[p->type];
+}
+
+void pred_reset(pred_t *p)
+{
+    memset(p->bimodal, 2, sizeof(p->bimodal));
+    memset(p->gshare, 2, sizeof(p->gshare));
+    memset(p->chooser, 1, sizeof(p->chooser));
+    p->history = 0;
+    memset(p->ras, 0, sizeof(p->ras));
+    p->ras_sp = 0;
+    p->fetch_icode = I_NOP;
+    p->fetch_valp = 0;
+    p->log_cnt = 0;
+    p->branch_cnt = p->branch_miss = 0;
+    memset(p->shadow_miss, 0, sizeof(p->shadow_miss));
+    p->ret_cnt = p->ret_miss = 0;
+}
+
+static int gshare_index(pred_t *p, word_t pc)
+{
+    return (pc ^ p->history) & PRED_MASK;
+}
+
+/* Prediction made by predictor t */
+static bool_t predict(pred_t *p, pred_type_t t, word_t pc, word_t target)
+{
+    switch (t)
+	{
+	case PRED_TAKEN:
+	    return TRUE;
+	case PRED_NT:
+	    return FALSE;
+	case PRED_BTFNT:
+	    return target <= pc;
+	case PRED_BIMODAL:
+	    return p->bimodal[pc & PRED_MASK] >= 2;
+	case PRED_GSHARE:
+	    return p->gshare[gshare_index(p, pc)] >= 2;
+	case PRED_TOURNAMENT:
+	    if (p->chooser[pc & PRED_MASK] >= 2)
+		return p->gshare[gshare_index(p, pc)] >= 2;
+	    return p->bimodal[pc & PRED_MASK] >= 2;
+	}
+    return TRUE;
+}
+
+/* Move 2-bit counter toward outcome */
+static void train(byte_t *counter, bool_t up)
+{
+    if (up && *counter < 3)
+	(*counter)++;
+    if (!up && *counter > 0)
+	(*counter)--;
+}
+
+bool_t pred_taken(pred_t *p, word_t pc, word_t target)
+{
+    p->used = TRUE;
+    return predict(p, p->type, pc, target);
+}
+
+word_t pred_return(pred_t *p)
+{
+    return p->ras[(p->ras_sp - 1) & (RAS_SIZE - 1)];
+}
+
+void pred_fetch(pred_t *p, byte_t icode, word_t valp)
+{
+    p->fetch_icode = icode;
+    p->fetch_valp = valp;
+}
+
+void pred_accept(pred_t *p)
+{
+    int l = p->log_cnt++ & (LOG_SIZE - 1);
+    p->accept_log[l].icode = p->fetch_icode;
+    if (p->fetch_icode == I_CALL) {
+	p->accept_log[l].old = p->ras[p->ras_sp & (RAS_SIZE - 1)];
+	p->ras[p->ras_sp & (RAS_SIZE - 1)] = p->fetch_valp;
+	p->ras_sp++;
+    } else if (p->fetch_icode == I_RET) {
+	p->ras_sp--;
+    }
+}
+
+/* Cancelled instructions are always the youngest ones, except after an
+   exception, which ends the run anyway */
+void pred_squash(pred_t *p, int count)
+{
+    while (count-- > 0 && p->log_cnt > 0) {
+	int l = --p->log_cnt & (LOG_SIZE - 1);
+	if (p->accept_log[l].icode == I_CALL) {
+	    p->ras_sp--;
+	    p->ras[p->ras_sp & (RAS_SIZE - 1)] = p->accept_log[l].old;
+	} else if (p->accept_log[l].icode == I_RET) {
+	    p->ras_sp++;
+	}
+    }
+}
+
+void pred_branch(pred_t *p, word_t pc, word_t target, bool_t predicted,
+		 bool_t taken)
+{
+    int t;
+    bool_t bimodal_ok = (p->bimodal[pc & PRED_MASK] >= 2) == taken;
+    bool_t gshare_ok = (p->gshare[gshare_index(p, pc)] >= 2) == taken;
+
+    p->branch_cnt++;
+    if (predicted != taken)
+	p->branch_miss++;
+    for (t = 0; t < PRED_COUNT; t++)
+	if (predict(p, (pred_type_t) t, pc, target) != taken)
+	    p->shadow_miss[t]++;
+
+    if (bimodal_ok != gshare_ok)
+	train(&p->chooser[pc & PRED_MASK], gshare_ok);
+    train(&p->bimodal[pc & PRED_MASK], taken);
+    train(&p->gshare[gshare_index(p, pc)], taken);
+    p->history = ((p->history << 1) | taken) & PRED_MASK;
+}
+
+void pred_ret(pred_t *p, bool_t correct)
+{
+    p->ret_cnt++;
+    if (!correct)
+	p->ret_miss++;
+}
+
+static double pct_correct(word_t miss, word_t total)
+{
+    return total > 0 ? 100.0 * (total - miss) / total : 100.0;
+}
+
+void pred_report(pred_t *p, FILE *fp)
+{
+    int t;
+    fprintf(fp, "Branches: %lld conditional, %lld mispredicted (%.2f%% correct), %lld bubbles\n",
+	    p->branch_cnt, p->branch_miss,
+	    pct_correct(p->branch_miss, p->branch_cnt),
+	    BRANCH_PENALTY * p->branch_miss);
+    for (t = 0; t < PRED_COUNT; t++)
+	fprintf(fp, "   %-10s %6.2f%% correct, %lld bubbles%s\n",
+		pred_names[t], pct_correct(p->shadow_miss[t], p->branch_cnt),
+		BRANCH_PENALTY * p->shadow_miss[t],
+		t == p->type && p->used ? " (selected)" : "");
+    fprintf(fp, "Returns: %lld, %lld mispredicted (%.2f%% correct), %lld bubbles\n",
+	    p->ret_cnt, p->ret_miss, pct_correct(p->ret_miss, p->ret_cnt),
+	    RET_PENALTY * p->ret_miss);
+}
@@ -0,0 +1,135 @@
+/******************************************************************************
+ *	predict.h
+ *
+ *	Branch and return predictors for the pipelined simulator
+ ******************************************************************************/
+
+#ifndef PREDICT_H
+#define PREDICT_H
+
+/******************************************************************************
+ *	#includes
+ ******************************************************************************/
+
+#include <stdio.h>
+
+/******************************************************************************
+ *	typedefs
+ ******************************************************************************/
+
+/* Direction predictors for conditional jumps, selected with -p */
+/* TAKEN:      Always predict taken                                 */
+/* NT:         Never predict taken                                  */
+/* BTFNT:      Backward taken, forward not taken                    */
+/* BIMODAL:    Table of 2-bit counters indexed by PC                */
+/* GSHARE:     Table of 2-bit counters indexed by PC ^ global history */
+/* TOURNAMENT: Chooser table picking between BIMODAL and GSHARE     */
+
+typedef enum { PRED_TAKEN, PRED_NT, PRED_BTFNT,
+	       PRED_BIMODAL, PRED_GSHARE, PRED_TOURNAMENT } pred_type_t;
+
+#define PRED_COUNT (PRED_TOURNAMENT + 1)
+
+/* Number of index bits for the counter tables (and global history) */
+#define PRED_BITS 10
+#define PRED_SIZE (1 << PRED_BITS)
+#define PRED_MASK (PRED_SIZE - 1)
+
+/* Number of entries in the return address stack */
+#define RAS_SIZE 16
+
+/* Number of accepted instructions that can be undone */
+#define LOG_SIZE 8
+
+/* Penalty (in bubbles) of a misprediction in the 5-stage pipeline */
+#define BRANCH_PENALTY 2
+#define RET_PENALTY 3
+
+/* State of the predictors for one simulation.  All zero selects
+   PRED_TAKEN; pred_reset() sets up the tables */
+typedef struct {
+    pred_type_t type;
+
+    /* 2-bit saturating counters.  Values 2 and 3 predict taken */
+    byte_t bimodal[PRED_SIZE];
+    byte_t gshare[PRED_SIZE];
+    /* Values 2 and 3 select gshare, 0 and 1 select bimodal */
+    byte_t chooser[PRED_SIZE];
+    /* Outcomes of the most recent jumps, newest in the low bit */
+    word_t history;
+
+    /* Return address stack.  Wraps around when it overflows */
+    word_t ras[RAS_SIZE];
+    int ras_sp;
+
+    /* Instruction fetched this cycle */
+    byte_t fetch_icode;
+    word_t fetch_valp;
+
+    /* Recently accepted instructions, with the entry each call overwrote */
+    struct {
+	byte_t icode;
+	word_t old;
+    } accept_log[LOG_SIZE];
+    int log_cnt;
+
+    /* Has the HCL called pred_taken()?  Left set by pred_reset */
+    bool_t used;
+
+    /* Statistics */
+    word_t branch_cnt;
+    word_t branch_miss;
+    word_t shadow_miss[PRED_COUNT];
+    word_t ret_cnt;
+    word_t ret_miss;
+} pred_t;
+
+/******************************************************************************
+ *	function declarations
+ ******************************************************************************/
+
+/* Select predictor by name.  Return FALSE if name is unknown */
+bool_t pred_set_type(pred_t *p, char *name);
+
+/* Name of the selected predictor */
+char *pred_name(pred_t *p);
+
+/* Clear prediction tables, return stack, and statistics */
+void pred_reset(pred_t *p);
+
+/* Functions for use in HCL.  With hcl2c -c, sim.h passes them the
+   predictor of the simulation being evaluated */
+
+/* Should the conditional jump at pc with given target be taken? */
+bool_t pred_taken(pred_t *p, word_t pc, word_t target);
+
+/* Predicted target of a ret instruction (top of return stack) */
+word_t pred_return(pred_t *p);
+
+/* Functions for use by the stage code */
+
+/* Instruction with icode and valP was fetched.  Effect on the return
+   stack is held until pred_accept() */
+void pred_fetch(pred_t *p, byte_t icode, word_t valp);
+
+/* Most recently fetched instruction has been loaded into decode */
+void pred_accept(pred_t *p);
+
+/* The count most recently accepted instructions were cancelled.
+   Undo their effect on the return stack */
+void pred_squash(pred_t *p, int count);
+
+/* Conditional jump at pc resolved in execute.  Trains the predictors */
+void pred_branch(pred_t *p, word_t pc, word_t target, bool_t predicted,
+		 bool_t taken);
+
+/* A ret reached write back.  Was its target predicted correctly? */
+void pred_ret(pred_t *p, bool_t correct);
+
+/* Print prediction statistics.  The selected predictor is only marked
+   if pred_taken() was called */
+void pred_report(pred_t *p, FILE *fp);
+
+/******************************************************************************/
+
+#endif /* PREDICT_H */
@@ -9,12 +9,16 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <string.h>
+#include <math.h>
 
 #include "isa.h"
 #include "pipeline.h"
 #include "stages.h"
 #include "sim.h"
+#include "predict.h"
+#include "cache.h"
 
 #define MAXBUF 1024
 #define DEFAULTNAME "Y86-64 Simulator: "
@@ -27,6 +31,12 @@
 #define MAXBUF 1024
 #define TKARGS 3
 
+/* Addresses listed by the stall report */
+#define STALL_TOP 10
+
+/* Output buffer for the pipeline trace */
+#define TRACE_BUF (1<<20)
+
 
 /***************
  * Begin Globals
@@ -43,6 +53,42 @@ FILE *object_file;       /* Input file handle */
 bool_t verbosity = 2;    /* Verbosity level [TTY only] (-v) */ 
 word_t instr_limit = 10000; /* Instruction limit [TTY only] (-l) */
 bool_t do_check = FALSE; /* Test with ISA simulator? [TTY only] (-t) */
+bool_t fast_mode = FALSE; /* Run without tracing or reporting? [TTY only] (-f) */
+
+/* Context of the simulation run by the TTY and GUI front ends */
+#ifndef SIM_LIB
+static sim_ctx_t *main_ctx = NULL;
+
+/* Sampling [TTY only].  Fast-forward on the ISA simulator (-F) ... */
+static word_t ff_count = 0;      /* ... for this many instructions */
+static word_t ff_pc = -1;        /* ... or up to this PC */
+/* ... then each period of instructions ends with warm instructions
+   to refill the pipeline and window measured ones (-S) */
+static word_t sample_period = 0;
+static word_t sample_warm = 0;
+static word_t sample_window = 0;
+
+/* CPI of each window, for the estimate */
+static word_t sample_cnt = 0;
+static double sample_sum = 0.0;
+static double sample_sumsq = 0.0;
+
+/* Was a branch predictor chosen? [TTY only] (-p) */
+static bool_t pred_given = FALSE;
+
+/* Report bubbles by cause and address? [TTY only] (-r) */
+static bool_t stall_report = FALSE;
+
+/* Write a pipeline trace here [TTY only] (-T) */
+static char *trace_filename = NULL;
+
+/* Long forms of the options */
+static struct option long_opts[] = {
+    { "stall-report", no_argument, NULL, 'r' },
+    { "pipe-trace", required_argument, NULL, 'T' },
+    { NULL, 0, NULL, 0 }
+};
+#endif /* SIM_LIB */
 
 /************* 
  * End Globals 
@@ -53,9 +99,13 @@ bool_t do_check = FALSE; /* Test with ISA simulator? [TTY only] (-t) */
  * Begin function prototypes 
  ***************************/
 
-word_t sim_run_pipe(word_t max_instr, word_t max_cycle, byte_t *statusp, cc_t *ccp);
+#ifndef SIM_LIB
 static void usage(char *name);           /* Print helpful usage message */
 static void run_tty_sim();               /* Run simulator in TTY mode */
+static word_t run_sampled(sim_ctx_t *ctx, byte_t *statusp, cc_t *ccp);
+static bool_t check_state(sim_ctx_t *ctx, cc_t cc, bool_t check_cc);
+static void write_back(sim_ctx_t *ctx);
+#endif /* SIM_LIB */
 
 #ifdef HAS_GUI
 void addAppCommands(Tcl_Interp *interp); /* Add application-dependent commands */
@@ -73,6 +123,10 @@ void addAppCommands(Tcl_Interp *interp); /* Add application-dependent commands *
  * simulation.
  *******************************************************************/
 
+/* With SIM_LIB defined, the simulator is linked into a program such as
+   ptest/ptest.c, which provides sim_main itself */
+#ifndef SIM_LIB
+
 /* 
  * sim_main - main simulator routine. This function is called from the
  * main() routine in the HCL file.
@@ -82,9 +136,13 @@ int sim_main(int argc, char **argv)
     int i;
     int c;
     char *myargv[MAXARGS];
+
+    /* Options -p and -c configure the simulator */
+    main_ctx = sim_new();
     
     /* Parse the command line arguments */
-    while ((c = getopt(argc, argv, "htgl:v:")) != -1) {
+    while ((c = getopt_long(argc, argv, "htgfrl:v:p:c:F:S:T:",
+			    long_opts, NULL)) != -1) {
 	switch(c) {
 	case 'h':
 	    usage(argv[0]);
@@ -105,6 +163,44 @@ int sim_main(int argc, char **argv)
 	case 'g':
 	    gui_mode = TRUE;
 	    break;
+	case 'f':
+	    fast_mode = TRUE;
+	    break;
+	case 'r':
+	    stall_report = TRUE;
+	    break;
+	case 'T':
+	    trace_filename = optarg;
+	    break;
+	case 'p':
+	    if (!pred_set_type(&main_ctx->pred, optarg)) {
+		printf("Invalid branch predictor '%s'\n", optarg);
+		usage(argv[0]);
+	    }
+	    pred_given = TRUE;
+	    break;
+	case 'c':
+	    if (!cache_config(&main_ctx->cache, optarg)) {
+		printf("Invalid cache configuration '%s'\n", optarg);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'F':
+	    if (optarg[0] == '@') {
+		ff_pc = strtoll(optarg+1, NULL, 0);
+		ff_count = 0x7fffffffffffffffLL;
+	    } else
+		ff_count = atoll(optarg);
+	    break;
+	case 'S':
+	    if (sscanf(optarg, "%lld:%lld:%lld", &sample_period,
+		       &sample_warm, &sample_window) != 3 ||
+		sample_warm < 0 || sample_window <= 0 ||
+		sample_warm + sample_window > sample_period) {
+		printf("Invalid sampling '%s'\n", optarg);
+		usage(argv[0]);
+	    }
+	    break;
 	default:
 	    printf("Invalid option '%c'\n", c);
 	    usage(argv[0]);
@@ -113,6 +209,10 @@ int sim_main(int argc, char **argv)
     }
 
 
+    /* Fast mode only reports the final results */
+    if (fast_mode)
+	verbosity = 0;
+
     /* Do we have too many arguments? */
     if (optind < argc - 1) {
 	printf("Too many command line arguments:");
@@ -180,12 +280,13 @@ int sim_main(int argc, char **argv)
  */
 static void run_tty_sim() 
 {
+    sim_ctx_t *ctx = main_ctx;
     word_t icount = 0;
     byte_t run_status = STAT_AOK;
     cc_t result_cc = 0;
     word_t byte_cnt = 0;
     mem_t mem0, reg0;
-    state_ptr isa_state = NULL;
+    FILE *trace_file = NULL;
 
 
     /* In TTY mode, the default object file comes from stdin */
@@ -194,14 +295,13 @@ static void run_tty_sim()
     }
 
     if (verbosity >= 2)
-	sim_set_dumpfile(stdout);
-    sim_init();
+	sim_set_dumpfile(ctx, stdout);
 
     /* Emit simulator name */
     if (verbosity >= 2)
 	printf("%s\n", simname);
 
-    byte_cnt = load_mem(mem, object_file, 1);
+    byte_cnt = load_mem(ctx->mem, object_file, 1);
     if (byte_cnt == 0) {
 	fprintf(stderr, "No lines of code found\n");
 	exit(1);
@@ -209,58 +309,59 @@ static void run_tty_sim()
 	printf("%lld bytes of code read\n", byte_cnt);
     }
     fclose(object_file);
-    if (do_check) {
-	isa_state = new_state(0);
-	free_mem(isa_state->r);
-	free_mem(isa_state->m);
-	isa_state->m = copy_mem(mem);
-	isa_state->r = copy_mem(reg);
-	isa_state->cc = cc;
+
+    mem0 = copy_mem(ctx->mem);
+    reg0 = copy_mem(ctx->reg);
+
+    /* Run up to the detailed simulation on the ISA simulator (-F) */
+    if (ff_count > 0) {
+	state_ptr s = sim_isa_state(ctx);
+	ff_count = sim_fast_forward(s, ff_count, ff_pc, NULL);
+	sim_load_state(ctx, s);
+	free_state(s);
     }
 
-    mem0 = copy_mem(mem);
-    reg0 = copy_mem(reg);
-    
-    icount = sim_run_pipe(instr_limit, 5*instr_limit, &run_status, &result_cc);
+    if (do_check && sample_window == 0)
+	ctx->isa_state = sim_isa_state(ctx);
+    if (stall_report)
+	sim_count_stalls(ctx);
+    if (trace_filename) {
+	trace_file = fopen(trace_filename, "w");
+	if (!trace_file) {
+	    fprintf(stderr, "Couldn't open trace file %s\n", trace_filename);
+	    exit(1);
+	}
+	setvbuf(trace_file, NULL, _IOFBF, TRACE_BUF);
+	sim_set_trace(ctx, trace_file);
+    }
+
+    if (sample_window > 0)
+	icount = run_sampled(ctx, &run_status, &result_cc);
+    else
+	icount = sim_run_pipe(ctx, instr_limit, 5*instr_limit, &run_status, &result_cc);
+    if (trace_file) {
+	sim_set_trace(ctx, NULL);
+	fclose(trace_file);
+    }
     if (verbosity > 0) {
+	if (ff_count > 0)
+	    printf("%lld instructions fast-forwarded\n", ff_count);
 	printf("%lld instructions executed\n", icount);
 	printf("Status = %s\n", stat_name(run_status));
 	printf("Condition Codes: %s\n", cc_name(result_cc));
 	printf("Changed Register State:\n");
-	diff_reg(reg0, reg, stdout);
+	diff_reg(reg0, ctx->reg, stdout);
 	printf("Changed Memory State:\n");
-	diff_mem(mem0, mem, stdout);
+	diff_mem(mem0, ctx->mem, stdout);
     }
     if (do_check) {
-	byte_t e = STAT_AOK;
-	word_t step;
-	bool_t match = TRUE;
+	/* isa_state has already executed the retired instructions.  When
+	   sampling, each window was checked as it ran, and its state
+	   compared at its end */
+	bool_t match = ctx->check_ok;
 
-	for (step = 0; step < instr_limit && e == STAT_AOK; step++) {
-	    e = step_state(isa_state, stdout);
-	}
-
-	if (diff_reg(isa_state->r, reg, NULL)) {
-	    match = FALSE;
-	    if (verbosity > 0) {
-		printf("ISA Register != Pipeline Register File\n");
-		diff_reg(isa_state->r, reg, stdout);
-	    }
-	}
-	if (diff_mem(isa_state->m, mem, NULL)) {
-	    match = FALSE;
-	    if (verbosity > 0) {
-		printf("ISA Memory != Pipeline Memory\n");
-		diff_mem(isa_state->m, mem, stdout);
-	    }
-	}
-	if (isa_state->cc != result_cc) {
+	if (ctx->isa_state && !check_state(ctx, result_cc, TRUE))
 	    match = FALSE;
-	    if (verbosity > 0) {
-		printf("ISA Cond. Codes (%s) != Pipeline Cond. Codes (%s)\n",
-		       cc_name(isa_state->cc), cc_name(result_cc));
-	    }
-	}
 	if (match) {
 	    printf("ISA Check Succeeds\n");
 	} else {
@@ -268,29 +369,173 @@ static void run_tty_sim()
 	}
     }
 
-    /* Emit CPI statistics */
-    {
-	double cpi = instructions > 0 ? (double) cycles/instructions : 1.0;
+    /* Emit CPI statistics.  When sampling, the mean CPI of the windows
+       with a 95% confidence interval */
+    if (sample_window > 0) {
+	if (sample_cnt > 0) {
+	    double mean = sample_sum/sample_cnt;
+	    double var = sample_cnt > 1 ?
+		(sample_sumsq - sample_cnt*mean*mean)/(sample_cnt-1) : 0.0;
+	    double ci = 1.96 * sqrt((var > 0.0 ? var : 0.0)/sample_cnt);
+	    printf("CPI: %.2f +/- %.2f (95%% confidence) from %lld windows of %lld instructions\n",
+		   mean, ci, sample_cnt, sample_window);
+	    printf("Estimated cycles: %.0f for %lld instructions\n",
+		   mean * icount, icount);
+	} else
+	    printf("CPI: no window of %lld instructions completed\n",
+		   sample_window);
+    } else {
+	double cpi = ctx->instructions > 0 ? (double) ctx->cycles/ctx->instructions : 1.0;
 	printf("CPI: %lld cycles/%lld instructions = %.2f\n",
-	       cycles, instructions, cpi);
+	       ctx->cycles, ctx->instructions, cpi);
+#if PIPE_WIDTH > 1
+	printf("IPC: %.2f\n", ctx->cycles > 0 ? (double) ctx->instructions/ctx->cycles : 1.0);
+#endif
     }
+    /* Only designs that consult the predictor report it by default */
+    if (pred_given && !ctx->pred.used)
+	printf("-p %s has no effect: this HCL never calls pred_taken()\n",
+	       pred_name(&ctx->pred));
+    if (pred_given || ctx->pred.used)
+	pred_report(&ctx->pred, stdout);
+    cache_report(&ctx->cache, stdout);
+    sim_stall_report(ctx, STALL_TOP, stdout);
 
 }
 
+/*
+ * check_state - Compare the registers and memory of the pipeline, and
+ * if check_cc its condition codes cc, with those of its ISA simulator.
+ * Print the differences if verbosity > 0.  Return TRUE if they agree.
+ */
+static bool_t check_state(sim_ctx_t *ctx, cc_t cc, bool_t check_cc)
+{
+    bool_t match = TRUE;
+
+    if (diff_reg(ctx->isa_state->r, ctx->reg, NULL)) {
+	match = FALSE;
+	if (verbosity > 0) {
+	    printf("ISA Register != Pipeline Register File\n");
+	    diff_reg(ctx->isa_state->r, ctx->reg, stdout);
+	}
+    }
+    if (diff_mem(ctx->isa_state->m, ctx->mem, NULL)) {
+	match = FALSE;
+	if (verbosity > 0) {
+	    printf("ISA Memory != Pipeline Memory\n");
+	    diff_mem(ctx->isa_state->m, ctx->mem, stdout);
+	}
+    }
+    if (check_cc && ctx->isa_state->cc != cc) {
+	match = FALSE;
+	if (verbosity > 0) {
+	    printf("ISA Cond. Codes (%s) != Pipeline Cond. Codes (%s)\n",
+		   cc_name(ctx->isa_state->cc), cc_name(cc));
+	}
+    }
+    return match;
+}
+
+/*
+ * run_sampled - Run the program in sampling mode (-S).  Each period
+ * runs on the ISA simulator until warm+window instructions are left.
+ * The pipeline then runs warm instructions to fill up, and window
+ * instructions whose CPI is measured.  The ISA simulator catches up by
+ * running the same instructions.  Caches and predictors keep their
+ * state from one window to the next.  With -t, each window is checked
+ * against the ISA simulator, instruction by instruction and then by
+ * its registers and memory at the end.  The condition codes may have
+ * been set by an instruction behind the last one.  Returns number of
+ * instructions executed, and leaves the final state in ctx.
+ */
+static word_t run_sampled(sim_ctx_t *ctx, byte_t *statusp, cc_t *ccp)
+{
+    state_ptr s = sim_isa_state(ctx);
+    word_t icount = 0;
+    word_t skip = sample_period - sample_warm - sample_window;
+    byte_t run_status = STAT_AOK;
+
+    while (run_status == STAT_AOK && icount < instr_limit) {
+	word_t left = instr_limit - icount;
+	word_t detail = sample_warm + sample_window;
+	byte_t window_status;
+	word_t c0, i0;
+
+	icount += sim_fast_forward(s, skip < left ? skip : left, -1,
+				   &run_status);
+	if (run_status != STAT_AOK || icount >= instr_limit)
+	    break;
+	left = instr_limit - icount;
+	if (detail > left)
+	    detail = left;
+
+	sim_load_state(ctx, s);
+	if (do_check)
+	    ctx->isa_state = copy_state(s);
+	sim_run_window(ctx, sample_warm, 5*detail, &window_status);
+	c0 = ctx->cycles;
+	i0 = ctx->instructions;
+	if (window_status == STAT_AOK || window_status == STAT_BUB)
+	    sim_run_window(ctx, detail - sample_warm, 5*detail, &window_status);
+	/* Only complete windows are measured */
+	if (ctx->instructions - i0 >= sample_window) {
+	    double cpi = (double) (ctx->cycles - c0)/(ctx->instructions - i0);
+	    sample_cnt++;
+	    sample_sum += cpi;
+	    sample_sumsq += cpi * cpi;
+	}
+	if (ctx->isa_state) {
+	    /* The instructions in write-back complete */
+	    write_back(ctx);
+	    if (ctx->check_ok && !check_state(ctx, 0, FALSE)) {
+		printf("ISA Check Fails at end of window\n");
+		ctx->check_ok = FALSE;
+	    }
+	    free_state(ctx->isa_state);
+	    ctx->isa_state = NULL;
+	}
+
+	icount += sim_fast_forward(s, detail, -1, &run_status);
+    }
+
+    sim_load_state(ctx, s);
+    free_state(s);
+    if (statusp)
+	*statusp = run_status;
+    if (ccp)
+	*ccp = ctx->cc;
+    return icount;
+}
+
 /*
  * usage - print helpful diagnostic information
  */
 static void usage(char *name)
 {
-    printf("Usage: %s [-htg] [-l m] [-v n] file.yo\n", name);
+    printf("Usage: %s [-htgfr] [-l m] [-v n] [-p pred] [-c cache]... [-F n] [-S p:w:n] [-T file] file.yo\n", name);
     printf("file.yo arg required in GUI mode, optional in TTY mode (default stdin)\n");
     printf("   -h     Print this message\n");
     printf("   -g     Run in GUI mode instead of TTY mode (default TTY)\n");  
     printf("   -l m   Set instruction limit to m [TTY mode only] (default %lld)\n", instr_limit);
     printf("   -v n   Set verbosity level to 0 <= n <= 2 [TTY mode only] (default %d)\n", verbosity);
+    printf("   -f     Fast mode: no tracing, only final results [TTY mode only]\n");
+    printf("   -p pred Branch predictor used by pred_taken() in HCL (default %s)\n", pred_name(&main_ctx->pred));
+    printf("          one of taken, nt, btfnt, bimodal, gshare, tournament\n");
+    printf("   -c cache Add cache level name:sets:ways:block[:policy[:write[:latency]]]\n");
+    printf("          name is l1i, l1d, or l2, policy lru, fifo, or random, write wb or wt\n");
+    printf("          -c mem:latency sets memory latency (default %d cycles)\n", MEM_LATENCY);
     printf("   -t     Test result against ISA simulator [TTY mode only]\n");
+    printf("   -F n   Fast-forward n instructions on the ISA simulator first [TTY mode only]\n");
+    printf("   -F @addr Fast-forward up to the first time addr is reached [TTY mode only]\n");
+    printf("   -S period:warm:window Sample window instructions of each period, after\n");
+    printf("          warm instructions to fill the pipeline, and estimate CPI [TTY mode only]\n");
+    printf("   -r, --stall-report Count bubbles by cause and list the %d instructions\n", STALL_TOP);
+    printf("          causing the most [TTY mode only]\n");
+    printf("   -T, --pipe-trace file Write the stages of each instruction to file,\n");
+    printf("          for the Konata pipeline viewer [TTY mode only]\n");
     exit(0);
 }
+#endif /* SIM_LIB */
 
 
 /*********************************************************
@@ -302,77 +547,10 @@ static void usage(char *name)
  *  Part 2 Globals
  *****************/
 
-/* Performance monitoring */
-/* How many cycles have been simulated? */
-word_t cycles = 0;
-/* How many instructions have passed through the WB stage? */
-word_t instructions = 0;
-
-/* Has simulator gotten past initial bubbles? */
-static int starting_up = 1;
-
-
-
-/* Both instruction and data memory */
-mem_t mem;
-word_t minAddr = 0;
-word_t memCnt = 0;
-
-/* Register file */
-mem_t reg;
-/* Condition code register */
-cc_t cc;
-/* Status code */
-stat_t status;
-
-
-/* Pending updates to state */
-word_t cc_in = DEFAULT_CC;
-word_t wb_destE = REG_NONE;
-word_t wb_valE = 0;
-word_t wb_destM = REG_NONE;
-word_t wb_valM = 0;
-word_t mem_addr = 0;
-word_t mem_data = 0;
-bool_t mem_write = FALSE;
-
-/* EX Operand sources */
-mux_source_t amux = MUX_NONE;
-mux_source_t bmux = MUX_NONE;
-
-/* Current and next states of all pipeline registers */
-pc_ptr pc_curr;
-if_id_ptr if_id_curr;
-id_ex_ptr id_ex_curr;
-ex_mem_ptr ex_mem_curr;
-mem_wb_ptr mem_wb_curr;
-
-pc_ptr pc_next;
-if_id_ptr if_id_next;
-id_ex_ptr id_ex_next;
-ex_mem_ptr ex_mem_next;
-mem_wb_ptr mem_wb_next;
-
-/* Intermediate values */
-word_t f_pc;
-byte_t imem_icode;
-byte_t imem_ifun;
-bool_t imem_error;
-bool_t instr_valid;
-word_t d_regvala;
-word_t d_regvalb;
-word_t e_vala;
-word_t e_valb;
-bool_t e_bcond;
-bool_t dmem_error;
-
-/* The pipeline state */
-pipe_ptr pc_state, if_id_state, id_ex_state, ex_mem_state, mem_wb_state;
+/* The state of each simulation is held in its sim_ctx_t */
 
 /* Simulator operating mode */
 sim_mode_t sim_mode = S_FORWARD;
-/* Log file */
-FILE *dumpfile = NULL;
 
 /*****************************************************************************
  * reporting code
@@ -464,30 +642,30 @@ static char *format_mem_wb(mem_wb_ptr state)
 #endif /* HAS_GUI */
 
 /* Report system state */
-static void sim_report() 
+static void sim_report(sim_ctx_t *ctx) 
 {
 
 #ifdef HAS_GUI
     if (gui_mode) {
-	report_pc(f_pc, pc_curr->status != STAT_BUB,
-		  if_id_curr->stage_pc, if_id_curr->status != STAT_BUB,
-		  id_ex_curr->stage_pc, id_ex_curr->status != STAT_BUB,
-		  ex_mem_curr->stage_pc, ex_mem_curr->status != STAT_BUB,
-		  mem_wb_curr->stage_pc, mem_wb_curr->status != STAT_BUB);
-	report_state("F", 0, format_pc(pc_next));
-	report_state("F", 1, format_pc(pc_curr));
-	report_state("D", 0, format_if_id(if_id_next));
-	report_state("D", 1, format_if_id(if_id_curr));
-	report_state("E", 0, format_id_ex(id_ex_next));
-	report_state("E", 1, format_id_ex(id_ex_curr));
-	report_state("M", 0, format_ex_mem(ex_mem_next));
-	report_state("M", 1, format_ex_mem(ex_mem_curr));
-	report_state("W", 0, format_mem_wb(mem_wb_next));
-	report_state("W", 1, format_mem_wb(mem_wb_curr));
-	/* signal_sources(); */
-	show_cc(cc);
-	show_stat(status);
-	show_cpi();
+	report_pc(ctx->f_pc, ctx->pc_curr->status != STAT_BUB,
+		  ctx->if_id_curr->stage_pc, ctx->if_id_curr->status != STAT_BUB,
+		  ctx->id_ex_curr->stage_pc, ctx->id_ex_curr->status != STAT_BUB,
+		  ctx->ex_mem_curr->stage_pc, ctx->ex_mem_curr->status != STAT_BUB,
+		  ctx->mem_wb_curr->stage_pc, ctx->mem_wb_curr->status != STAT_BUB);
+	report_state("F", 0, format_pc(ctx->pc_next));
+	report_state("F", 1, format_pc(ctx->pc_curr));
+	report_state("D", 0, format_if_id(ctx->if_id_next));
+	report_state("D", 1, format_if_id(ctx->if_id_curr));
+	report_state("E", 0, format_id_ex(ctx->id_ex_next));
+	report_state("E", 1, format_id_ex(ctx->id_ex_curr));
+	report_state("M", 0, format_ex_mem(ctx->ex_mem_next));
+	report_state("M", 1, format_ex_mem(ctx->ex_mem_curr));
+	report_state("W", 0, format_mem_wb(ctx->mem_wb_next));
+	report_state("W", 1, format_mem_wb(ctx->mem_wb_curr));
+	/* signal_sources(ctx); */
+	show_cc(ctx->cc);
+	show_stat(ctx->status);
+	show_cpi(ctx);
     }
 #endif
 
@@ -499,247 +677,473 @@ static void sim_report()
  *****************************************************************************/
 
 /* bubble stage (has effect at next update) */
-void sim_bubble_stage(stage_id_t stage) 
+void sim_bubble_stage(sim_ctx_t *ctx, stage_id_t stage) 
 {
     switch (stage)
 	{
-	case IF_STAGE : pc_state->op     = P_BUBBLE; break;
-	case ID_STAGE : if_id_state->op  = P_BUBBLE; break;
-	case EX_STAGE : id_ex_state->op  = P_BUBBLE; break;
-	case MEM_STAGE: ex_mem_state->op = P_BUBBLE; break;
-	case WB_STAGE : mem_wb_state->op = P_BUBBLE; break;
+	case IF_STAGE : ctx->pc_state->op     = P_BUBBLE; break;
+	case ID_STAGE : ctx->if_id_state->op  = P_BUBBLE; break;
+	case EX_STAGE : ctx->id_ex_state->op  = P_BUBBLE; break;
+	case MEM_STAGE: ctx->ex_mem_state->op = P_BUBBLE; break;
+	case WB_STAGE : ctx->mem_wb_state->op = P_BUBBLE; break;
 	}
 }
 
 /* stall stage (has effect at next update) */
-void sim_stall_stage(stage_id_t stage) {
+void sim_stall_stage(sim_ctx_t *ctx, stage_id_t stage) {
     switch (stage)
 	{
-	case IF_STAGE : pc_state->op     = P_STALL; break;
-	case ID_STAGE : if_id_state->op  = P_STALL; break;
-	case EX_STAGE : id_ex_state->op  = P_STALL; break;
-	case MEM_STAGE: ex_mem_state->op = P_STALL; break;
-	case WB_STAGE : mem_wb_state->op = P_STALL; break;
+	case IF_STAGE : ctx->pc_state->op     = P_STALL; break;
+	case ID_STAGE : ctx->if_id_state->op  = P_STALL; break;
+	case EX_STAGE : ctx->id_ex_state->op  = P_STALL; break;
+	case MEM_STAGE: ctx->ex_mem_state->op = P_STALL; break;
+	case WB_STAGE : ctx->mem_wb_state->op = P_STALL; break;
 	}
 }
 
 
-static int initialized = 0;
-
-void sim_init()
+sim_ctx_t *sim_new()
 {
+    sim_ctx_t *ctx = (sim_ctx_t *) calloc(1, sizeof(sim_ctx_t));
+
+    if (!ctx) {
+	perror("calloc error");
+	exit(1);
+    }
+    ctx->check_ok = TRUE;
+    ctx->check_out = stdout;
+    cache_init(&ctx->cache);
+
     /* Create memory and register files */
-    initialized = 1;
-    mem = init_mem(MEM_SIZE);
-    reg = init_reg();
+    ctx->mem = init_mem(MEM_SIZE);
+    ctx->reg = init_reg();
     
-    /* create 5 pipe registers */
-    pc_state     = new_pipe(sizeof(pc_ele), (void *) &bubble_pc);
-    if_id_state  = new_pipe(sizeof(if_id_ele), (void *) &bubble_if_id);
-    id_ex_state  = new_pipe(sizeof(id_ex_ele), (void *) &bubble_id_ex);
-    ex_mem_state = new_pipe(sizeof(ex_mem_ele), (void *) &bubble_ex_mem);
-    mem_wb_state = new_pipe(sizeof(mem_wb_ele), (void *) &bubble_mem_wb);
-  
-    /* connect them to the pipeline stages */
-    pc_next   = pc_state->next;
-    pc_curr   = pc_state->current;
-  
-    if_id_next = if_id_state->next;
-    if_id_curr = if_id_state->current;
-
-    id_ex_next = id_ex_state->next;
-    id_ex_curr = id_ex_state->current;
-
-    ex_mem_next = ex_mem_state->next;
-    ex_mem_curr = ex_mem_state->current;
-
-    mem_wb_next = mem_wb_state->next;
-    mem_wb_curr = mem_wb_state->current;
-
-    sim_reset();
-    clear_mem(mem);
-}
-
-void sim_reset()
-{
-    if (!initialized)
-	sim_init();
-    clear_pipes();
-    clear_mem(reg);
-    minAddr = 0;
-    memCnt = 0;
-    starting_up = 1;
-    cycles = instructions = 0;
-    cc = DEFAULT_CC;
-    status = STAT_AOK;
+    /* create 5 pipe registers and connect them to the pipeline stages.
+       All but PC hold PIPE_WIDTH instructions */
+    ctx->pc_state     = new_pipe(sizeof(pc_ele), 1, (void *) &bubble_pc,
+			    (void **) &ctx->pc_curr, (void **) &ctx->pc_next);
+    ctx->if_id_state  = new_pipe(sizeof(if_id_ele), PIPE_WIDTH, (void *) &bubble_if_id,
+			    (void **) &ctx->if_id_curr, (void **) &ctx->if_id_next);
+    ctx->id_ex_state  = new_pipe(sizeof(id_ex_ele), PIPE_WIDTH, (void *) &bubble_id_ex,
+			    (void **) &ctx->id_ex_curr, (void **) &ctx->id_ex_next);
+    ctx->ex_mem_state = new_pipe(sizeof(ex_mem_ele), PIPE_WIDTH, (void *) &bubble_ex_mem,
+			    (void **) &ctx->ex_mem_curr, (void **) &ctx->ex_mem_next);
+    ctx->mem_wb_state = new_pipe(sizeof(mem_wb_ele), PIPE_WIDTH, (void *) &bubble_mem_wb,
+			    (void **) &ctx->mem_wb_curr, (void **) &ctx->mem_wb_next);
+    ctx->pipes[ctx->pipe_count++] = ctx->pc_state;
+    ctx->pipes[ctx->pipe_count++] = ctx->if_id_state;
+    ctx->pipes[ctx->pipe_count++] = ctx->id_ex_state;
+    ctx->pipes[ctx->pipe_count++] = ctx->ex_mem_state;
+    ctx->pipes[ctx->pipe_count++] = ctx->mem_wb_state;
+
+    sim_reset(ctx);
+    clear_mem(ctx->mem);
+    return ctx;
+}
+
+void sim_free(sim_ctx_t *ctx)
+{
+    int s;
+    for (s = 0; s < ctx->pipe_count; s++)
+	free_pipe(ctx->pipes[s]);
+    free_mem(ctx->mem);
+    free_reg(ctx->reg);
+    cache_free(&ctx->cache);
+    free(ctx->stall_sites);
+    free(ctx);
+}
+
+static void clear_stalls(sim_ctx_t *ctx);
+static void clear_trace(sim_ctx_t *ctx);
+
+/* Empty the pipeline.  Memory, registers, the predictor and the caches
+   keep their state */
+static void clear_pipeline(sim_ctx_t *ctx)
+{
+    int l;
+    clear_pipes(ctx->pipes, ctx->pipe_count);
+    ctx->starting_up = 1;
+    ctx->status = STAT_AOK;
+    ctx->fetch_wait = ctx->data_wait = 0;
+    ctx->fetch_started = ctx->data_started = FALSE;
+    ctx->amux = ctx->bmux = MUX_NONE;
+    for (l = 0; l < PIPE_WIDTH; l++) {
+	ctx->wb_destE[l] = REG_NONE;
+	ctx->wb_valE[l] = 0;
+	ctx->wb_destM[l] = REG_NONE;
+	ctx->wb_valM[l] = 0;
+    }
+    ctx->lane = 0;
+    ctx->mem_addr = 0;
+    ctx->mem_data = 0;
+    ctx->mem_read = FALSE;
+    ctx->mem_write = FALSE;
+    clear_trace(ctx);
+}
+
+void sim_reset(sim_ctx_t *ctx)
+{
+    clear_pipeline(ctx);
+    clear_mem(ctx->reg);
+    ctx->minAddr = 0;
+    ctx->memCnt = 0;
+    ctx->cycles = ctx->instructions = 0;
+    ctx->cc = ctx->cc_in = DEFAULT_CC;
+    ctx->pop_pending = FALSE;
+    pred_reset(&ctx->pred);
+    cache_reset(&ctx->cache);
+    clear_stalls(ctx);
 
 #ifdef HAS_GUI
     if (gui_mode) {
 	signal_register_clear();
-	create_memory_display();
+	create_memory_display(ctx);
     }
 #endif
 
-    amux = bmux = MUX_NONE;
-    cc = cc_in = DEFAULT_CC;
-    wb_destE = REG_NONE;
-    wb_valE = 0;
-    wb_destM = REG_NONE;
-    wb_valM = 0;
-    mem_addr = 0;
-    mem_data = 0;
-    mem_write = FALSE;
-    sim_report();
+    sim_report(ctx);
 }
 
-/* Update state elements */
-/* May need to disable updating of memory & condition codes */
-static void update_state(bool_t update_mem, bool_t update_cc)
+/* Register writes of the instructions in WB */
+static void write_back(sim_ctx_t *ctx)
 {
     /* Writeback(s):
        If either register is REG_NONE, write will have no effect .
        Order of two writes determines semantics of
-       popl %rsp.  According to ISA, %rsp will get popped value
+       popl %rsp.  According to ISA, %rsp will get popped value.
+       Younger lanes write last
     */
+    int l;
 
-    if (wb_destE != REG_NONE) {
-	sim_log("\tWriteback: Wrote 0x%llx to register %s\n",
-		wb_valE, reg_name(wb_destE));
-	set_reg_val(reg, wb_destE, wb_valE);
-    }
-    if (wb_destM != REG_NONE) {
-	sim_log("\tWriteback: Wrote 0x%llx to register %s\n",
-		wb_valM, reg_name(wb_destM));
-	set_reg_val(reg, wb_destM, wb_valM);
+    for (l = 0; l < PIPE_WIDTH; l++) {
+	if (ctx->wb_destE[l] != REG_NONE) {
+	    sim_log(ctx, "\tWriteback: Wrote 0x%llx to register %s\n",
+		    ctx->wb_valE[l], reg_name(ctx->wb_destE[l]));
+	    set_reg_val(ctx->reg, ctx->wb_destE[l], ctx->wb_valE[l]);
+	}
+	if (ctx->wb_destM[l] != REG_NONE) {
+	    sim_log(ctx, "\tWriteback: Wrote 0x%llx to register %s\n",
+		    ctx->wb_valM[l], reg_name(ctx->wb_destM[l]));
+	    set_reg_val(ctx->reg, ctx->wb_destM[l], ctx->wb_valM[l]);
+	}
     }
+}
+
+/* Update state elements */
+/* May need to disable updating of memory, and of the condition codes
+   by all but the first cc_lanes lanes */
+static void update_state(sim_ctx_t *ctx, bool_t update_mem, int cc_lanes)
+{
+    write_back(ctx);
 
     /* Memory write */
-    if (mem_write && !update_mem) {
-	sim_log("\tDisabled write of 0x%llx to address 0x%llx\n", mem_data, mem_addr);
+    if (ctx->mem_write && !update_mem) {
+	sim_log(ctx, "\tDisabled write of 0x%llx to address 0x%llx\n", ctx->mem_data, ctx->mem_addr);
     }
-    if (update_mem && mem_write) {
-	if (!set_word_val(mem, mem_addr, mem_data)) {
-	    sim_log("\tCouldn't write to address 0x%llx\n", mem_addr);
+    if (update_mem && ctx->mem_write) {
+	if (!set_word_val(ctx->mem, ctx->mem_addr, ctx->mem_data)) {
+	    sim_log(ctx, "\tCouldn't write to address 0x%llx\n", ctx->mem_addr);
 	} else {
-	    sim_log("\tWrote 0x%llx to address 0x%llx\n", mem_data, mem_addr);
+	    sim_log(ctx, "\tWrote 0x%llx to address 0x%llx\n", ctx->mem_data, ctx->mem_addr);
 
 #ifdef HAS_GUI
 	    if (gui_mode) {
-		if (mem_addr % 8 != 0) {
+		if (ctx->mem_addr % 8 != 0) {
 		    /* Just did a misaligned write.
 		       Need to display both words */
-		    word_t align_addr = mem_addr & ~0x3;
+		    word_t align_addr = ctx->mem_addr & ~0x3;
 		    word_t val;
-		    get_word_val(mem, align_addr, &val);
-		    set_memory(align_addr, val);
+		    get_word_val(ctx->mem, align_addr, &val);
+		    set_memory(ctx, align_addr, val);
 		    align_addr+=8;
-		    get_word_val(mem, align_addr, &val);
-		    set_memory(align_addr, val);
+		    get_word_val(ctx->mem, align_addr, &val);
+		    set_memory(ctx, align_addr, val);
 		} else {
-		    set_memory(mem_addr, mem_data);
+		    set_memory(ctx, ctx->mem_addr, ctx->mem_data);
 		}
 	    }
 #endif
 
 	}
     }
-    if (update_cc)
-	cc = cc_in;
+    if (cc_lanes == PIPE_WIDTH)
+	ctx->cc = ctx->cc_in;
+    else if (cc_lanes > 0)
+	ctx->cc = ctx->cc_lane[cc_lanes-1];
 }
 
+/* Suffix distinguishing lanes in the trace.  Lane 0 has none */
+static char *lane_names[] = { "", "1", "2", "3" };
+
 /* Text representation of status */
-void tty_report(word_t cyc) {
-  sim_log("\nCycle %lld. CC=%s, Stat=%s\n", cyc, cc_name(cc), stat_name(status));
-
-  sim_log("F: predPC = 0x%llx\n", pc_curr->pc);
-
-  sim_log("D: instr = %s, rA = %s, rB = %s, valC = 0x%llx, valP = 0x%llx, Stat = %s\n",
-	  iname(HPACK(if_id_curr->icode, if_id_curr->ifun)),
-	  reg_name(if_id_curr->ra), reg_name(if_id_curr->rb),
-	  if_id_curr->valc, if_id_curr->valp,
-	  stat_name(if_id_curr->status));
-
-  sim_log("E: instr = %s, valC = 0x%llx, valA = 0x%llx, valB = 0x%llx\n   srcA = %s, srcB = %s, dstE = %s, dstM = %s, Stat = %s\n",
-	  iname(HPACK(id_ex_curr->icode, id_ex_curr->ifun)),
-	  id_ex_curr->valc, id_ex_curr->vala, id_ex_curr->valb,
-	  reg_name(id_ex_curr->srca), reg_name(id_ex_curr->srcb),
-	  reg_name(id_ex_curr->deste), reg_name(id_ex_curr->destm),
-	  stat_name(id_ex_curr->status));
-
-  sim_log("M: instr = %s, Cnd = %d, valE = 0x%llx, valA = 0x%llx\n   dstE = %s, dstM = %s, Stat = %s\n",
-	  iname(HPACK(ex_mem_curr->icode, ex_mem_curr->ifun)),
-	  ex_mem_curr->takebranch,
-	  ex_mem_curr->vale, ex_mem_curr->vala,
-	  reg_name(ex_mem_curr->deste), reg_name(ex_mem_curr->destm),
-	  stat_name(ex_mem_curr->status));
-
-  sim_log("W: instr = %s, valE = 0x%llx, valM = 0x%llx, dstE = %s, dstM = %s, Stat = %s\n",
-	  iname(HPACK(mem_wb_curr->icode, mem_wb_curr->ifun)),
-	  mem_wb_curr->vale, mem_wb_curr->valm,
-	  reg_name(mem_wb_curr->deste), reg_name(mem_wb_curr->destm),
-	  stat_name(mem_wb_curr->status));
+void tty_report(sim_ctx_t *ctx, word_t cyc) {
+  int l;
+  sim_log(ctx, "\nCycle %lld. CC=%s, Stat=%s\n", cyc, cc_name(ctx->cc), stat_name(ctx->status));
+
+  sim_log(ctx, "F: predPC = 0x%llx\n", ctx->pc_curr->pc);
+
+  for (l = 0; l < PIPE_WIDTH; l++)
+    sim_log(ctx, "D%s: instr = %s, rA = %s, rB = %s, valC = 0x%llx, valP = 0x%llx, Stat = %s\n",
+	    lane_names[l],
+	    iname(HPACK(ctx->if_id_curr[l].icode, ctx->if_id_curr[l].ifun)),
+	    reg_name(ctx->if_id_curr[l].ra), reg_name(ctx->if_id_curr[l].rb),
+	    ctx->if_id_curr[l].valc, ctx->if_id_curr[l].valp,
+	    stat_name(ctx->if_id_curr[l].status));
+
+  for (l = 0; l < PIPE_WIDTH; l++)
+    sim_log(ctx, "E%s: instr = %s, valC = 0x%llx, valA = 0x%llx, valB = 0x%llx\n   srcA = %s, srcB = %s, dstE = %s, dstM = %s, Stat = %s\n",
+	    lane_names[l],
+	    iname(HPACK(ctx->id_ex_curr[l].icode, ctx->id_ex_curr[l].ifun)),
+	    ctx->id_ex_curr[l].valc, ctx->id_ex_curr[l].vala, ctx->id_ex_curr[l].valb,
+	    reg_name(ctx->id_ex_curr[l].srca), reg_name(ctx->id_ex_curr[l].srcb),
+	    reg_name(ctx->id_ex_curr[l].deste), reg_name(ctx->id_ex_curr[l].destm),
+	    stat_name(ctx->id_ex_curr[l].status));
+
+  for (l = 0; l < PIPE_WIDTH; l++)
+    sim_log(ctx, "M%s: instr = %s, Cnd = %d, valE = 0x%llx, valA = 0x%llx\n   dstE = %s, dstM = %s, Stat = %s\n",
+	    lane_names[l],
+	    iname(HPACK(ctx->ex_mem_curr[l].icode, ctx->ex_mem_curr[l].ifun)),
+	    ctx->ex_mem_curr[l].takebranch,
+	    ctx->ex_mem_curr[l].vale, ctx->ex_mem_curr[l].vala,
+	    reg_name(ctx->ex_mem_curr[l].deste), reg_name(ctx->ex_mem_curr[l].destm),
+	    stat_name(ctx->ex_mem_curr[l].status));
+
+  for (l = 0; l < PIPE_WIDTH; l++)
+    sim_log(ctx, "W%s: instr = %s, valE = 0x%llx, valM = 0x%llx, dstE = %s, dstM = %s, Stat = %s\n",
+	    lane_names[l],
+	    iname(HPACK(ctx->mem_wb_curr[l].icode, ctx->mem_wb_curr[l].ifun)),
+	    ctx->mem_wb_curr[l].vale, ctx->mem_wb_curr[l].valm,
+	    reg_name(ctx->mem_wb_curr[l].deste), reg_name(ctx->mem_wb_curr[l].destm),
+	    stat_name(ctx->mem_wb_curr[l].status));
+}
+
+/* Check instructions in write-back against ISA simulator (-t), the
+   first max_instr of them */
+static void check_wb(sim_ctx_t *ctx, word_t max_instr)
+{
+    word_t n = 0;
+    int l;
+    for (l = 0; l < PIPE_WIDTH && ctx->check_ok && n < max_instr; l++) {
+	mem_wb_ptr W = &ctx->mem_wb_curr[l];
+	retire_rec r;
+	if (W->status == STAT_BUB)
+	    continue;
+	n++;
+	/* IPOP2 loads the register of a popq whose first part only
+	   moved %rsp, and is checked with it */
+	if (W->icode == I_POP2) {
+	    if (!ctx->pop_pending)
+		continue;
+	    r = ctx->pop_retire;
+	    r.status = W->status;
+	    r.dstM = ctx->wb_destM[l];
+	    r.valM = ctx->wb_valM[l];
+	    ctx->pop_pending = FALSE;
+	} else {
+	    r.pc = W->stage_pc;
+	    r.status = W->status;
+	    r.dstE = ctx->wb_destE[l];
+	    r.valE = ctx->wb_valE[l];
+	    r.dstM = ctx->wb_destM[l];
+	    r.valM = ctx->wb_valM[l];
+	    /* The memory stage has already done the write */
+	    r.mem_write = W->memwrite;
+	    r.mem_addr = W->memaddr;
+	    r.mem_data = 0;
+	    if (r.mem_write)
+		get_word_val(ctx->mem, r.mem_addr, &r.mem_data);
+	    if (W->icode == I_POPQ && r.status == STAT_AOK
+		&& r.dstM == REG_NONE) {
+		ctx->pop_retire = r;
+		ctx->pop_pending = TRUE;
+		continue;
+	    }
+	}
+	if (!check_retire(ctx->isa_state, &r, ctx->check_out)) {
+	    fprintf(ctx->check_out, "ISA Check Fails in cycle %lld\n", ctx->cycles);
+	    ctx->check_ok = FALSE;
+	}
+	if (W->status != STAT_AOK)
+	    break;
+    }
+}
+
+/* Number of instructions in the lanes of W that complete: those up to
+   and including the oldest one with an exception, and no more than
+   max_instr */
+static inline word_t wb_count(mem_wb_ptr W, word_t max_instr)
+{
+    word_t n = 0;
+    int l;
+
+    for (l = 0; l < PIPE_WIDTH && n < max_instr; l++) {
+	if (W[l].status == STAT_BUB)
+	    continue;
+	n++;
+	if (W[l].status != STAT_AOK)
+	    break;
+    }
+    return n;
+}
+
+/* Limit on the instructions that complete in the next step, with left
+   more to go in the run.  In the last cycle, only those entering W do */
+static inline word_t step_limit(sim_ctx_t *ctx, word_t left, bool_t last)
+{
+    word_t entering;
+
+    if (!last)
+	return left;
+    entering = ctx->mem_wb_state->op == P_BUBBLE ?
+	0 : wb_count(ctx->mem_wb_next, PIPE_WIDTH);
+    return entering < left ? entering : left;
 }
 
+/* Cancel the register writes of the instructions in W that don't
+   complete because the run stops after max_instr more */
+static void limit_wb(sim_ctx_t *ctx, word_t max_instr)
+{
+    word_t n = 0;
+    int l;
+
+    for (l = 0; l < PIPE_WIDTH; l++) {
+	if (ctx->mem_wb_curr[l].status == STAT_BUB)
+	    continue;
+	if (n < max_instr)
+	    n++;
+	else
+	    ctx->wb_destE[l] = ctx->wb_destM[l] = REG_NONE;
+    }
+}
+
+static void count_stalls(sim_ctx_t *ctx, p_stat_t hcl_id_op);
+static void trace_fetch(sim_ctx_t *ctx);
+static void trace_cycle(sim_ctx_t *ctx);
+
 /* Run pipeline for one cycle */
 /* Return status of processor */
 /* Max_instr indicates maximum number of instructions that
    want to complete during this simulation run.  */
-static byte_t sim_step_pipe(word_t max_instr, word_t ccount)
+/* Fast is a constant in each caller, so the compiler generates one copy
+   of the cycle with the tracing and GUI reporting and one without */
+static inline byte_t sim_step_pipe_body(sim_ctx_t *ctx, word_t max_instr,
+					 word_t ccount, const bool_t fast)
 {
-    byte_t wb_status = mem_wb_curr->status;
-    byte_t mem_status = mem_wb_next->status;
-    /* How many instructions are ahead of one in wb / ex? */
-    int ahead_mem = (wb_status != STAT_BUB);
-    int ahead_ex = ahead_mem + (mem_status != STAT_BUB);
-    bool_t update_mem = ahead_mem < max_instr;
-    bool_t update_cc = ahead_ex < max_instr;
+    /* How many instructions complete up to the one that wrote memory,
+       now entering wb, and up to each lane that set the condition
+       codes, now entering mem?  Their updates are made if they are
+       within the limit */
+    word_t upto_mem = 0;
+    word_t upto_cc = wb_count(ctx->mem_wb_next, PIPE_WIDTH);
+    int cc_lanes = 0;
+    p_stat_t id_op;
+    int l;
+
+    for (l = 0; l < PIPE_WIDTH; l++) {
+	upto_mem += ctx->mem_wb_next[l].status != STAT_BUB;
+	if (ctx->mem_wb_next[l].memwrite)
+	    break;
+    }
+    for (l = 0; l < PIPE_WIDTH; l++) {
+	upto_cc += ctx->ex_mem_next[l].status != STAT_BUB;
+	if (upto_cc > max_instr)
+	    break;
+	cc_lanes = l + 1;
+    }
 
     /* Update program-visible state */
-    update_state(update_mem, update_cc);
+    update_state(ctx, upto_mem <= max_instr, cc_lanes);
     /* Update pipe registers */
-    update_pipes();
-    tty_report(ccount);
-    if (pc_state->op == P_ERROR)
-	pc_curr->status = STAT_PIP;
-    if (if_id_state->op == P_ERROR)
-	if_id_curr->status = STAT_PIP;
-    if (id_ex_state->op == P_ERROR)
-	id_ex_curr->status = STAT_PIP;
-    if (ex_mem_state->op == P_ERROR)
-	ex_mem_curr->status = STAT_PIP;
-    if (mem_wb_state->op == P_ERROR)
-	mem_wb_curr->status = STAT_PIP;
+    update_pipes(ctx->pipes, ctx->pipe_count);
+    if (!fast)
+	tty_report(ctx, ccount);
+    if (ctx->pc_state->op == P_ERROR)
+	ctx->pc_curr->status = STAT_PIP;
+    if (ctx->if_id_state->op == P_ERROR)
+	ctx->if_id_curr->status = STAT_PIP;
+    if (ctx->id_ex_state->op == P_ERROR)
+	ctx->id_ex_curr->status = STAT_PIP;
+    if (ctx->ex_mem_state->op == P_ERROR)
+	ctx->ex_mem_curr->status = STAT_PIP;
+    if (ctx->mem_wb_state->op == P_ERROR)
+	ctx->mem_wb_curr->status = STAT_PIP;
     
     /* Need to do decode after execute & memory stages,
        and memory stage before execute, in order to propagate
        forwarding values properly */
-    do_if_stage();
-    do_mem_stage();
-    do_ex_stage();
-    do_id_wb_stages();
-
-    do_stall_check();
+    do_if_stage(ctx);
+    do_mem_stage(ctx);
+    do_ex_stage(ctx);
+    do_id_wb_stages(ctx);
+    if (ctx->trace)
+	trace_fetch(ctx);
+    /* Only the instructions in wb within the limit complete */
+    limit_wb(ctx, max_instr);
+    if (ctx->isa_state)
+	check_wb(ctx, max_instr);
+
+    do_stall_check(ctx);
+    id_op = ctx->if_id_state->op;
+    do_cache_stall_check(ctx);
+    if (ctx->stall_sites)
+	count_stalls(ctx, id_op);
+    if (ctx->trace)
+	trace_cycle(ctx);
+    /* Instructions in decode and execute may be cancelled */
+    {
+	int squashed = 0;
+	if (ctx->id_ex_state->op == P_BUBBLE && ctx->if_id_state->op != P_STALL
+	    && ctx->if_id_curr->status != STAT_BUB)
+	    squashed++;
+	if (ctx->ex_mem_state->op == P_BUBBLE && ctx->id_ex_state->op != P_STALL
+	    && ctx->id_ex_curr->status != STAT_BUB)
+	    squashed++;
+	pred_squash(&ctx->pred, squashed);
+    }
+    /* Fetched instruction moves on to decode */
+    if (ctx->if_id_state->op == P_LOAD)
+	pred_accept(&ctx->pred);
+    /* Conditional jumps leave execute, unless stalled or cancelled */
+    for (l = 0; l < PIPE_WIDTH && ctx->ex_mem_state->op == P_LOAD; l++)
+	if (ctx->id_ex_curr[l].icode == I_JMP && ctx->id_ex_curr[l].ifun != C_YES
+	    && ctx->id_ex_curr[l].status == STAT_AOK)
+	    pred_branch(&ctx->pred, ctx->id_ex_curr[l].stage_pc, ctx->id_ex_curr[l].valc,
+			ctx->id_ex_curr[l].predpc == ctx->id_ex_curr[l].valc,
+			ctx->ex_mem_next[l].takebranch);
 #if 0
     /* This doesn't seem necessary */
-    if (id_ex_curr->status != STAT_AOK
-	&& id_ex_curr->status != STAT_BUB) {
-	if_id_state->op = P_BUBBLE;
-	id_ex_state->op = P_BUBBLE;
+    if (ctx->id_ex_curr->status != STAT_AOK
+	&& ctx->id_ex_curr->status != STAT_BUB) {
+	ctx->if_id_state->op = P_BUBBLE;
+	ctx->id_ex_state->op = P_BUBBLE;
     }
 #endif
 
     /* Performance monitoring */
-    if (mem_wb_curr->status != STAT_BUB && mem_wb_curr->icode != I_POP2) {
-	starting_up = 0;
-	instructions++;
-	cycles++;
-    } else {
-	if (!starting_up)
-	    cycles++;
-    }
+    if (ctx->mem_wb_curr->icode == I_RET && ctx->mem_wb_curr->status == STAT_AOK)
+	pred_ret(&ctx->pred, ctx->mem_wb_curr->predpc == ctx->mem_wb_curr->valm);
+    for (l = 0; l < PIPE_WIDTH; l++)
+	if (ctx->mem_wb_curr[l].status != STAT_BUB && ctx->mem_wb_curr[l].icode != I_POP2) {
+	    ctx->starting_up = 0;
+	    ctx->instructions++;
+	}
+    if (!ctx->starting_up)
+	ctx->cycles++;
     
-    sim_report();
-    return status;
+    if (!fast)
+	sim_report(ctx);
+    return ctx->status;
+}
+
+static byte_t sim_step_pipe(sim_ctx_t *ctx, word_t max_instr, word_t ccount)
+{
+    return sim_step_pipe_body(ctx, max_instr, ccount, FALSE);
+}
+
+static byte_t sim_step_pipe_fast(sim_ctx_t *ctx, word_t max_instr,
+				 word_t ccount)
+{
+    return sim_step_pipe_body(ctx, max_instr, ccount, TRUE);
 }
 
 /*
@@ -752,41 +1156,128 @@ static byte_t sim_step_pipe(word_t max_instr, word_t ccount)
   if statusp nonnull, then will be set to status of final instruction
   if ccp nonnull, then will be set to condition codes of final instruction
 */
-word_t sim_run_pipe(word_t max_instr, word_t max_cycle, byte_t *statusp, cc_t *ccp)
+word_t sim_run_pipe(sim_ctx_t *ctx, word_t max_instr, word_t max_cycle,
+		    byte_t *statusp, cc_t *ccp)
 {
     word_t icount = 0;
     word_t ccount = 0;
     byte_t run_status = STAT_AOK;
+    byte_t (*step)(sim_ctx_t *, word_t, word_t) =
+	fast_mode ? sim_step_pipe_fast : sim_step_pipe;
     while (icount < max_instr && ccount < max_cycle) {
-        run_status = sim_step_pipe(max_instr-icount, ccount);
-	if (run_status != STAT_BUB)
-	    icount++;
+	word_t left = step_limit(ctx, max_instr-icount, ccount+1 == max_cycle);
+        run_status = step(ctx, left, ccount);
+	icount += wb_count(ctx->mem_wb_curr, left);
+	ccount++;
 	if (run_status != STAT_AOK && run_status != STAT_BUB)
 	    break;
-	ccount++;
     }
+    /* The instructions in write-back in the last step complete */
+    if (ccount > 0)
+	write_back(ctx);
     if (statusp)
 	*statusp = run_status;
     if (ccp)
-	*ccp = cc;
+	*ccp = ctx->cc;
+    return icount;
+}
+
+/*
+ * Sampling.  Between detailed windows, the program runs on the ISA
+ * simulator.  Each window copies the ISA state into the pipeline, which
+ * starts out empty at its PC.
+ */
+
+/* Make an ISA simulator state from the memory and registers of an
+   empty pipeline, at the PC it will fetch from */
+state_ptr sim_isa_state(sim_ctx_t *ctx)
+{
+    state_ptr s = new_state(0);
+    free_mem(s->r);
+    free_mem(s->m);
+    s->m = copy_mem(ctx->mem);
+    s->r = copy_mem(ctx->reg);
+    s->cc = ctx->cc;
+    s->pc = ctx->pc_curr->pc;
+    return s;
+}
+
+/* Restart the pipeline, empty, from the state of ISA simulator s */
+void sim_load_state(sim_ctx_t *ctx, state_ptr s)
+{
+    clear_pipeline(ctx);
+    free_mem(ctx->mem);
+    free_mem(ctx->reg);
+    ctx->mem = copy_mem(s->m);
+    ctx->reg = copy_mem(s->r);
+    ctx->cc = ctx->cc_in = s->cc;
+    /* The first cycle loads pc_next into pc_curr */
+    ctx->pc_curr->pc = ctx->pc_next->pc = s->pc;
+}
+
+/*
+  Run ISA simulator s until count instructions have executed, it is
+  about to execute the instruction at stop_pc, or an instruction fails
+  to complete normally.  Pass -1 as stop_pc to run to count.
+
+  Return number of instructions executed.
+  if statusp nonnull, then will be set to status of final instruction
+*/
+word_t sim_fast_forward(state_ptr s, word_t count, word_t stop_pc,
+			byte_t *statusp)
+{
+    stat_t run_status;
+    word_t icount = run_state(s, count, stop_pc, &run_status, NULL);
+    if (statusp)
+	*statusp = run_status;
     return icount;
 }
 
+/*
+  Run pipeline until count more instructions have completed through
+  WB, or one of the conditions of sim_run_pipe occurs.  Unlike
+  sim_run_pipe, instructions behind the last one still update memory
+  and the condition codes, so the pipeline should be restarted with
+  sim_load_state afterwards.
+
+  Return number of instructions completed.
+  if statusp nonnull, then will be set to status of final instruction
+*/
+word_t sim_run_window(sim_ctx_t *ctx, word_t count, word_t max_cycle,
+		      byte_t *statusp)
+{
+    word_t start = ctx->instructions;
+    word_t ccount = 0;
+    byte_t run_status = STAT_AOK;
+    byte_t (*step)(sim_ctx_t *, word_t, word_t) =
+	fast_mode ? sim_step_pipe_fast : sim_step_pipe;
+    while (ctx->instructions - start < count && ccount < max_cycle) {
+	/* Allow for the instructions in memory and write-back */
+	run_status = step(ctx, count + 2, ccount);
+	if (run_status != STAT_AOK && run_status != STAT_BUB)
+	    break;
+	ccount++;
+    }
+    if (statusp)
+	*statusp = run_status;
+    return ctx->instructions - start;
+}
+
 /* If dumpfile set nonNULL, lots of status info printed out */
-void sim_set_dumpfile(FILE *df)
+void sim_set_dumpfile(sim_ctx_t *ctx, FILE *df)
 {
-    dumpfile = df;
+    ctx->dumpfile = df;
 }
 
 /*
  * sim_log dumps a formatted string to the dumpfile, if it exists
  * accepts variable argument list
  */
-void sim_log( const char *format, ... ) {
-    if (dumpfile) {
+void (sim_log)(sim_ctx_t *ctx, const char *format, ... ) {
+    if (ctx->dumpfile) {
 	va_list arg;
 	va_start( arg, format );
-	vfprintf( dumpfile, format, arg );
+	vfprintf( ctx->dumpfile, format, arg );
 	va_end( arg );
     }
 }
@@ -853,10 +1344,10 @@ int simResetCmd(ClientData clientData, Tcl_Interp *interp,
 	interp->result = "No arguments allowed";
 	return TCL_ERROR;
     }
-    sim_reset();
+    sim_reset(main_ctx);
     if (post_load_mem) {
-	free_mem(mem);
-	mem = copy_mem(post_load_mem);
+	free_mem(main_ctx->mem);
+	main_ctx->mem = copy_mem(post_load_mem);
     }
     interp->result = stat_name(STAT_AOK);
     return TCL_OK;
@@ -878,9 +1369,9 @@ int simLoadCodeCmd(ClientData clientData, Tcl_Interp *interp,
 	interp->result = tcl_msg;
 	return TCL_ERROR;
     }
-    sim_reset();
-    code_count = load_mem(mem, code_file, 0);
-    post_load_mem = copy_mem(mem);
+    sim_reset(main_ctx);
+    code_count = load_mem(main_ctx->mem, code_file, 0);
+    post_load_mem = copy_mem(main_ctx->mem);
     sprintf(tcl_msg, "%lld", code_count);
     interp->result = tcl_msg;
     fclose(code_file);
@@ -932,7 +1423,7 @@ int simRunCmd(ClientData clientData, Tcl_Interp *interp,
 	interp->result = tcl_msg;
 	return TCL_ERROR;
     }
-    sim_run_pipe(cycle_limit + 5, cycle_limit, &status, &cc);
+    sim_run_pipe(main_ctx, cycle_limit + 5, cycle_limit, &status, &cc);
     interp->result = stat_name(status);
     return TCL_OK;
 }
@@ -996,19 +1487,19 @@ void signal_register_update(reg_id_t r, word_t val) {
 }
 
 /* Provide mechanism for simulator to generate memory display */
-void create_memory_display() {
+void create_memory_display(sim_ctx_t *ctx) {
     int code;
-    sprintf(tcl_msg, "createMem %lld %lld", minAddr, memCnt);
+    sprintf(tcl_msg, "createMem %lld %lld", ctx->minAddr, ctx->memCnt);
     code = Tcl_Eval(sim_interp, tcl_msg);
     if (code != TCL_OK) {
 	fprintf(stderr, "Command '%s' failed\n", tcl_msg);
 	fprintf(stderr, "Error Message was '%s'\n", sim_interp->result);
     } else {
 	word_t i;
-	for (i = 0; i < memCnt && code == TCL_OK; i+=8) {
-	    word_t addr = minAddr+i;
+	for (i = 0; i < ctx->memCnt && code == TCL_OK; i+=8) {
+	    word_t addr = ctx->minAddr+i;
 	    word_t val;
-	    if (!get_word_val(mem, addr, &val)) {
+	    if (!get_word_val(ctx->mem, addr, &val)) {
 		fprintf(stderr, "Out of bounds memory display\n");
 		return;
 	    }
@@ -1023,29 +1514,29 @@ void create_memory_display() {
 }
 
 /* Provide mechanism for simulator to update memory value */
-void set_memory(word_t addr, word_t val) {
+void set_memory(sim_ctx_t *ctx, word_t addr, word_t val) {
     int code;
-    word_t nminAddr = minAddr;
-    word_t nmemCnt = memCnt;
+    word_t nminAddr = ctx->minAddr;
+    word_t nmemCnt = ctx->memCnt;
 
     /* First see if we need to expand memory range */
-    if (memCnt == 0) {
+    if (ctx->memCnt == 0) {
 	nminAddr = addr;
 	nmemCnt = 8;
-    } else if (addr < minAddr) {
+    } else if (addr < ctx->minAddr) {
 	nminAddr = addr;
-	nmemCnt = minAddr + memCnt - addr;
-    } else if (addr >= minAddr+memCnt) {
-	nmemCnt = addr-minAddr+8;
+	nmemCnt = ctx->minAddr + ctx->memCnt - addr;
+    } else if (addr >= ctx->minAddr+ctx->memCnt) {
+	nmemCnt = addr-ctx->minAddr+8;
     }
     /* Now make sure nminAddr & nmemCnt are multiples of 16 */
     nmemCnt = ((nminAddr & 0xF) + nmemCnt + 0xF) & ~0xF;
     nminAddr = nminAddr & ~0xF;
 
-    if (nminAddr != minAddr || nmemCnt != memCnt) {
-	minAddr = nminAddr;
-	memCnt = nmemCnt;
-	create_memory_display();
+    if (nminAddr != ctx->minAddr || nmemCnt != ctx->memCnt) {
+	ctx->minAddr = nminAddr;
+	ctx->memCnt = nmemCnt;
+	create_memory_display(ctx);
     } else {
 	sprintf(tcl_msg, "setMem %lld %lld", addr, val);
 	code = Tcl_Eval(sim_interp, tcl_msg);
@@ -1085,11 +1576,12 @@ void show_stat(stat_t stat)
 
 
 /* Provide mechanism for simulator to update performance information */
-void show_cpi() {
+void show_cpi(sim_ctx_t *ctx) {
     int code;
-    double cpi = instructions > 0 ? (double) cycles/instructions : 1.0;
+    double cpi = ctx->instructions > 0 ?
+	(double) ctx->cycles/ctx->instructions : 1.0;
     sprintf(tcl_msg, "showCPI %lld %lld %.2f",
-	    cycles, instructions, (double) cpi);
+	    ctx->cycles, ctx->instructions, (double) cpi);
     code = Tcl_Eval(sim_interp, tcl_msg);
     if (code != TCL_OK) {
 	fprintf(stderr, "Failed to display CPI\n");
@@ -1100,10 +1592,10 @@ void show_cpi() {
 char *rname[] = {"none", "ea", "eb", "me", "wm", "we"};
 
 /* provide mechanism for simulator to specify source registers */
-void signal_sources() {
+void signal_sources(sim_ctx_t *ctx) {
     int code;
     sprintf(tcl_msg, "showSources %s %s",
-	    rname[amux], rname[bmux]);
+	    rname[ctx->amux], rname[ctx->bmux]);
     code = Tcl_Eval(sim_interp, tcl_msg);
     if (code != TCL_OK) {
 	fprintf(stderr, "Failed to signal forwarding sources\n");
@@ -1242,59 +1734,75 @@ int Tcl_AppInit(Tcl_Interp *interp)
  * Part 4: Code for implementing pipelined processor simulators
  *************************************************************/
 
-/******************************************************************************
- *	defines
- ******************************************************************************/
-
-#define MAX_STAGE 10
-
-/******************************************************************************
- *	static variables
- ******************************************************************************/
-
-static pipe_ptr pipes[MAX_STAGE];
-static int pipe_count = 0;
-
 /******************************************************************************
  *	function definitions
  ******************************************************************************/
 
-/* Create new pipe with count bytes of state */
-/* bubble_val indicates state corresponding to pipeline bubble */
-pipe_ptr new_pipe(int count, void *bubble_val)
+/* Fill every lane of state with bubbles */
+static void fill_bubble(pipe_ptr p, void *state)
+{
+  int l;
+  for (l = 0; l < p->width; l++)
+    memcpy((char *) state + l * p->count, p->bubble_val, p->count);
+}
+
+/* Create new pipe with width lanes of count bytes of state each */
+/* bubble_val indicates state of one lane corresponding to pipeline bubble */
+/* current_ref & next_ref are kept pointing at the current & next state */
+pipe_ptr new_pipe(int count, int width, void *bubble_val,
+		  void **current_ref, void **next_ref)
 {
   pipe_ptr result = (pipe_ptr) malloc(sizeof(pipe_ele));
-  result->current = malloc(count);
-  result->next = malloc(count);
-  memcpy(result->current, bubble_val, count);
-  memcpy(result->next, bubble_val, count);
+  result->current = malloc(count * width);
+  result->next = malloc(count * width);
   result->count = count;
-  result->op = P_LOAD;
+  result->width = width;
   result->bubble_val = bubble_val;
-  pipes[pipe_count++] = result; 
+  fill_bubble(result, result->current);
+  fill_bubble(result, result->next);
+  result->current_ref = current_ref;
+  result->next_ref = next_ref;
+  *current_ref = result->current;
+  *next_ref = result->next;
+  result->op = P_LOAD;
   return result;
 }
 
-/* Update all pipes */
-void update_pipes()
+/* Free pipe created by new_pipe */
+void free_pipe(pipe_ptr p)
+{
+  free(p->current);
+  free(p->next);
+  free(p);
+}
+
+/* Update count pipes */
+/* The stage functions rewrite every field of the next state each cycle,
+   so a load can simply exchange the two buffers rather than copy them */
+void update_pipes(pipe_ptr *pipes, int count)
 {
   int s;
-  for (s = 0; s < pipe_count; s++) {
+  for (s = 0; s < count; s++) {
     pipe_ptr p = pipes[s];
+    void *tmp;
     switch (p->op)
       {
       case P_BUBBLE:
       	/* insert a bubble into the next stage */
-      	memcpy(p->current, p->bubble_val, p->count);
+      	fill_bubble(p, p->current);
       	break;
       
       case P_LOAD:
-      	/* copy calculated state from previous stage */
-      	memcpy(p->current, p->next, p->count);
+      	/* take calculated state from previous stage */
+      	tmp = p->current;
+      	p->current = p->next;
+      	p->next = tmp;
+      	*p->current_ref = p->current;
+      	*p->next_ref = p->next;
       	break;
       case P_ERROR:
 	  /* Like a bubble, but insert error condition */
-      	memcpy(p->current, p->bubble_val, p->count);
+      	fill_bubble(p, p->current);
       	break;
       case P_STALL:
       default:
@@ -1306,14 +1814,14 @@ void update_pipes()
   }
 }
 
-/* Set all pipes to bubble values */
-void clear_pipes()
+/* Set count pipes to bubble values */
+void clear_pipes(pipe_ptr *pipes, int count)
 {
   int s;
-  for (s = 0; s < pipe_count; s++) {
+  for (s = 0; s < count; s++) {
     pipe_ptr p = pipes[s];
-    memcpy(p->current, p->bubble_val, p->count);
-    memcpy(p->next, p->bubble_val, p->count);
+    fill_bubble(p, p->current);
+    fill_bubble(p, p->next);
     p->op = P_LOAD;
   }
 }
@@ -1361,227 +1869,298 @@ void wstring(uword_t x, int bpd, int bpw, char *str)
 
 pc_ele bubble_pc = {0,STAT_AOK};
 if_id_ele bubble_if_id = { I_NOP, 0, REG_NONE,REG_NONE,
-			   0, 0, STAT_BUB, 0};
+			   0, 0, STAT_BUB, 0, 0};
 id_ex_ele bubble_id_ex = { I_NOP, 0, 0, 0, 0,
 			   REG_NONE, REG_NONE, REG_NONE, REG_NONE,
-			   STAT_BUB, 0};
+			   STAT_BUB, 0, 0};
 
 ex_mem_ele bubble_ex_mem = { I_NOP, 0, FALSE, 0, 0,
-			     REG_NONE, REG_NONE, STAT_BUB, 0};
+			     REG_NONE, REG_NONE, REG_NONE, STAT_BUB, 0, 0};
 
 mem_wb_ele bubble_mem_wb = { I_NOP, 0, 0, 0, REG_NONE, REG_NONE,
-			     STAT_BUB, 0};
+			     STAT_BUB, 0, 0, FALSE, 0};
 
 /*************** Stage Implementations *****************/
 
-word_t gen_f_pc();
-word_t gen_need_regids();
-word_t gen_need_valC();
-word_t gen_instr_valid();
-word_t gen_f_predPC();
-word_t gen_f_icode();
-word_t gen_f_ifun();
-word_t gen_f_stat();
-word_t gen_instr_valid();
-
-void do_if_stage()
-{
-    byte_t instr = HPACK(I_NOP, F_NONE);
-    byte_t regids = HPACK(REG_NONE, REG_NONE);
-    word_t valc = 0;
-    word_t valp = f_pc = gen_f_pc();
-
-    /* Ready to fetch instruction.  Speculatively fetch register byte
-       and immediate word
-    */
-    imem_error = !get_byte_val(mem, valp, &instr);
-    imem_icode = HI4(instr);
-    imem_ifun = LO4(instr);
-    if (!imem_error) {
-      byte_t junk;
-      /* Make sure can read maximum length instruction */
-      imem_error = !get_byte_val(mem, valp+5, &junk);
-    }
-    if_id_next->icode = gen_f_icode();
-    if_id_next->ifun  = gen_f_ifun();
-    if (!imem_error) {
-	sim_log("\tFetch: f_pc = 0x%llx, imem_instr = %s, f_instr = %s\n",
-		f_pc, iname(instr),
-		iname(HPACK(if_id_next->icode, if_id_next->ifun)));
-    }
-
-    instr_valid = gen_instr_valid();
-    if (!instr_valid) 
-      sim_log("\tFetch: Instruction code 0x%llx invalid\n", instr);
-    if_id_next->status = gen_f_stat();
-
-    valp++;
-    if (gen_need_regids()) {
-	get_byte_val(mem, valp, &regids);
-	valp ++;
-    }
-    if_id_next->ra = HI4(regids);
-    if_id_next->rb = LO4(regids);
-    if (gen_need_valC()) {
-	get_word_val(mem, valp, &valc);
-	valp+= 8;
-    }
-    if_id_next->valp = valp;
-    if_id_next->valc = valc;
-
-    pc_next->pc = gen_f_predPC();
-
-    pc_next->status = (if_id_next->status == STAT_AOK) ? STAT_AOK : STAT_BUB;
-
-    if_id_next->stage_pc = f_pc;
-}
-
-word_t gen_d_srcA();
-word_t gen_d_srcB();
-word_t gen_d_dstE();
-word_t gen_d_dstM();
-word_t gen_d_valA();
-word_t gen_d_valB();
-word_t gen_w_dstE();
-word_t gen_w_valE();
-word_t gen_w_dstM();
-word_t gen_w_valM();
-word_t gen_Stat();
+word_t gen_f_pc(sim_ctx_t *ctx);
+word_t gen_need_regids(sim_ctx_t *ctx);
+word_t gen_need_valC(sim_ctx_t *ctx);
+word_t gen_instr_valid(sim_ctx_t *ctx);
+word_t gen_f_predPC(sim_ctx_t *ctx);
+word_t gen_f_icode(sim_ctx_t *ctx);
+word_t gen_f_ifun(sim_ctx_t *ctx);
+word_t gen_f_stat(sim_ctx_t *ctx);
+word_t gen_instr_valid(sim_ctx_t *ctx);
+
+#if PIPE_WIDTH > 1
+word_t gen_f_pair(sim_ctx_t *ctx);
+#endif
 
-/* Implements both ID and WB */
-void do_id_wb_stages()
+void do_if_stage(sim_ctx_t *ctx)
 {
-    /* Set up write backs.  Don't occur until end of cycle */
-    wb_destE = gen_w_dstE();
-    wb_valE = gen_w_valE();
-    wb_destM = gen_w_dstM();
-    wb_valM = gen_w_valM();
+    word_t valp = ctx->f_pc = gen_f_pc(ctx);
+    int l;
+
+    /* Fetch one instruction per lane from consecutive addresses */
+    for (ctx->lane = 0; ctx->lane < PIPE_WIDTH; ctx->lane++) {
+	if_id_ptr f = &ctx->if_id_next[ctx->lane];
+	byte_t instr = HPACK(I_NOP, F_NONE);
+	byte_t regids = HPACK(REG_NONE, REG_NONE);
+	word_t valc = 0;
+	word_t pc = valp;
+
+	/* Ready to fetch instruction.  Speculatively fetch register byte
+	   and immediate word
+	*/
+	ctx->imem_error = !get_byte_val(ctx->mem, valp, &instr);
+	ctx->imem_icode = HI4(instr);
+	ctx->imem_ifun = LO4(instr);
+	if (!ctx->imem_error) {
+	  byte_t junk;
+	  /* Make sure can read maximum length instruction */
+	  ctx->imem_error = !get_byte_val(ctx->mem, valp+5, &junk);
+	}
+	f->icode = gen_f_icode(ctx);
+	f->ifun  = gen_f_ifun(ctx);
+	if (!ctx->imem_error) {
+	    sim_log(ctx, "\tFetch: f_pc = 0x%llx, imem_instr = %s, f_instr = %s\n",
+		    pc, iname(instr),
+		    iname(HPACK(f->icode, f->ifun)));
+	}
+
+	ctx->instr_valid = gen_instr_valid(ctx);
+	if (!ctx->instr_valid) 
+	  sim_log(ctx, "\tFetch: Instruction code 0x%llx invalid\n", instr);
+	f->status = gen_f_stat(ctx);
+
+	valp++;
+	if (gen_need_regids(ctx)) {
+	    get_byte_val(ctx->mem, valp, &regids);
+	    valp ++;
+	}
+	f->ra = HI4(regids);
+	f->rb = LO4(regids);
+	if (gen_need_valC(ctx)) {
+	    get_word_val(ctx->mem, valp, &valc);
+	    valp+= 8;
+	}
+	f->valp = valp;
+	f->valc = valc;
+	f->stage_pc = pc;
+    }
+    ctx->fetch_end = valp;
+
+    /* Lanes whose instruction cannot issue with the older ones get
+       bubbles, and are fetched again next cycle */
+    ctx->lane = 1;
+#if PIPE_WIDTH > 1
+    while (ctx->lane < PIPE_WIDTH && gen_f_pair(ctx))
+	ctx->lane++;
+    for (l = ctx->lane; l < PIPE_WIDTH; l++)
+	memcpy(&ctx->if_id_next[l], &bubble_if_id, sizeof(if_id_ele));
+#endif
+
+    /* Youngest instruction fetched determines the next PC */
+    ctx->lane--;
+    ctx->pc_next->pc = gen_f_predPC(ctx);
 
-    /* Update processor status */
-    status = gen_Stat();
+    ctx->pc_next->status = (ctx->if_id_next[ctx->lane].status == STAT_AOK) ? STAT_AOK : STAT_BUB;
 
-    id_ex_next->srca = gen_d_srcA();
-    id_ex_next->srcb = gen_d_srcB();
-    id_ex_next->deste = gen_d_dstE();
-    id_ex_next->destm = gen_d_dstM();
+    for (l = 0; l <= ctx->lane; l++)
+	ctx->if_id_next[l].predpc = l < ctx->lane ? ctx->if_id_next[l+1].stage_pc : ctx->pc_next->pc;
+    ctx->lane = 0;
+    pred_fetch(&ctx->pred, ctx->if_id_next->icode, ctx->if_id_next->valp);
+}
 
-    /* Read the registers */
-    d_regvala = get_reg_val(reg, id_ex_next->srca);
-    d_regvalb = get_reg_val(reg, id_ex_next->srcb);
+word_t gen_d_srcA(sim_ctx_t *ctx);
+word_t gen_d_srcB(sim_ctx_t *ctx);
+word_t gen_d_dstE(sim_ctx_t *ctx);
+word_t gen_d_dstM(sim_ctx_t *ctx);
+word_t gen_d_valA(sim_ctx_t *ctx);
+word_t gen_d_valB(sim_ctx_t *ctx);
+word_t gen_w_dstE(sim_ctx_t *ctx);
+word_t gen_w_valE(sim_ctx_t *ctx);
+word_t gen_w_dstM(sim_ctx_t *ctx);
+word_t gen_w_valM(sim_ctx_t *ctx);
+word_t gen_Stat(sim_ctx_t *ctx);
+
+/* Implements both ID and WB */
+void do_id_wb_stages(sim_ctx_t *ctx)
+{
+    /* Set up write backs.  Don't occur until end of cycle */
+    for (ctx->lane = 0; ctx->lane < PIPE_WIDTH; ctx->lane++) {
+	ctx->wb_destE[ctx->lane] = gen_w_dstE(ctx);
+	ctx->wb_valE[ctx->lane] = gen_w_valE(ctx);
+	ctx->wb_destM[ctx->lane] = gen_w_dstM(ctx);
+	ctx->wb_valM[ctx->lane] = gen_w_valM(ctx);
+    }
 
-    /* Do forwarding and valA selection */
-    id_ex_next->vala = gen_d_valA();
-    id_ex_next->valb = gen_d_valB();
+    /* Update processor status.  The oldest lane with an exception
+       determines it, and neither that lane nor any younger one writes
+       back */
+    for (ctx->lane = 0; ctx->lane < PIPE_WIDTH; ctx->lane++) {
+	stat_t s = gen_Stat(ctx);
+	if (ctx->lane == 0 || ctx->status == STAT_AOK || ctx->status == STAT_BUB)
+	    ctx->status = s;
+	if (ctx->status != STAT_AOK && ctx->status != STAT_BUB)
+	    ctx->wb_destE[ctx->lane] = ctx->wb_destM[ctx->lane] = REG_NONE;
+    }
 
-    id_ex_next->icode = if_id_curr->icode;
-    id_ex_next->ifun = if_id_curr->ifun;
-    id_ex_next->valc = if_id_curr->valc;
-    id_ex_next->stage_pc = if_id_curr->stage_pc;
-    id_ex_next->status = if_id_curr->status;
+    for (ctx->lane = 0; ctx->lane < PIPE_WIDTH; ctx->lane++) {
+	id_ex_ptr d = &ctx->id_ex_next[ctx->lane];
+	if_id_ptr D = &ctx->if_id_curr[ctx->lane];
+
+	d->srca = gen_d_srcA(ctx);
+	d->srcb = gen_d_srcB(ctx);
+	d->deste = gen_d_dstE(ctx);
+	d->destm = gen_d_dstM(ctx);
+
+	/* Read the registers */
+	ctx->d_regvala = get_reg_val(ctx->reg, d->srca);
+	ctx->d_regvalb = get_reg_val(ctx->reg, d->srcb);
+
+	/* Do forwarding and valA selection */
+	d->vala = gen_d_valA(ctx);
+	d->valb = gen_d_valB(ctx);
+
+	d->icode = D->icode;
+	d->ifun = D->ifun;
+	d->valc = D->valc;
+	d->stage_pc = D->stage_pc;
+	d->status = D->status;
+	d->predpc = D->predpc;
+    }
+    ctx->lane = 0;
 }
 
-word_t gen_alufun();
-word_t gen_set_cc();
-word_t gen_Bch();
-word_t gen_aluA();
-word_t gen_aluB();
-word_t gen_e_valA();
-word_t gen_e_dstE();
+word_t gen_alufun(sim_ctx_t *ctx);
+word_t gen_set_cc(sim_ctx_t *ctx);
+word_t gen_Bch(sim_ctx_t *ctx);
+word_t gen_aluA(sim_ctx_t *ctx);
+word_t gen_aluB(sim_ctx_t *ctx);
+word_t gen_e_valA(sim_ctx_t *ctx);
+word_t gen_e_dstE(sim_ctx_t *ctx);
 
-void do_ex_stage()
+void do_ex_stage(sim_ctx_t *ctx)
 {
-    alu_t alufun = gen_alufun();
-    bool_t setcc = gen_set_cc();
-    word_t alua, alub;
+    for (ctx->lane = 0; ctx->lane < PIPE_WIDTH; ctx->lane++) {
+	id_ex_ptr E = &ctx->id_ex_curr[ctx->lane];
+	ex_mem_ptr e = &ctx->ex_mem_next[ctx->lane];
+	alu_t alufun = gen_alufun(ctx);
+	bool_t setcc = gen_set_cc(ctx);
+	word_t alua, alub;
 
-    alua = gen_aluA();
-    alub = gen_aluB();
+	alua = gen_aluA(ctx);
+	alub = gen_aluB(ctx);
 
-    e_bcond = 	cond_holds(cc, id_ex_curr->ifun);
+	ctx->e_bcond = 	cond_holds(ctx->cc, E->ifun);
     
-    ex_mem_next->takebranch = e_bcond;
+	e->takebranch = ctx->e_bcond;
 
-    if (id_ex_curr->icode == I_JMP)
-      sim_log("\tExecute: instr = %s, cc = %s, branch %staken\n",
-	      iname(HPACK(id_ex_curr->icode, id_ex_curr->ifun)),
-	      cc_name(cc),
-	      ex_mem_next->takebranch ? "" : "not ");
+	if (E->icode == I_JMP)
+	  sim_log(ctx, "\tExecute: instr = %s, cc = %s, branch %staken\n",
+		  iname(HPACK(E->icode, E->ifun)),
+		  cc_name(ctx->cc),
+		  e->takebranch ? "" : "not ");
     
-    /* Perform the ALU operation */
-    word_t aluout = compute_alu(alufun, alua, alub);
-    ex_mem_next->vale = aluout;
-    sim_log("\tExecute: ALU: %c 0x%llx 0x%llx --> 0x%llx\n",
-	    op_name(alufun), alua, alub, aluout);
-
-    if (setcc) {
-	cc_in = compute_cc(alufun, alua, alub);
-	sim_log("\tExecute: New cc = %s\n", cc_name(cc_in));
+	/* Perform the ALU operation */
+	word_t aluout = compute_alu(alufun, alua, alub);
+	e->vale = aluout;
+	sim_log(ctx, "\tExecute: ALU: %c 0x%llx 0x%llx --> 0x%llx\n",
+		op_name(alufun), alua, alub, aluout);
+
+	if (setcc) {
+	    ctx->cc_in = compute_cc(alufun, alua, alub);
+	    sim_log(ctx, "\tExecute: New cc = %s\n", cc_name(ctx->cc_in));
+	}
+	ctx->cc_lane[ctx->lane] = ctx->cc_in;
+
+	e->icode = E->icode;
+	e->ifun = E->ifun;
+	e->vala = gen_e_valA(ctx);
+	e->deste = gen_e_dstE(ctx);
+	e->destm = E->destm;
+	e->srca = E->srca;
+	e->status = E->status;
+	e->stage_pc = E->stage_pc;
+	e->predpc = E->predpc;
     }
-
-    ex_mem_next->icode = id_ex_curr->icode;
-    ex_mem_next->ifun = id_ex_curr->ifun;
-    ex_mem_next->vala = gen_e_valA();
-    ex_mem_next->deste = gen_e_dstE();
-    ex_mem_next->destm = id_ex_curr->destm;
-    ex_mem_next->srca = id_ex_curr->srca;
-    ex_mem_next->status = id_ex_curr->status;
-    ex_mem_next->stage_pc = id_ex_curr->stage_pc;
+    ctx->lane = 0;
 }
 
 /* Functions defined using HCL */
-word_t gen_mem_addr();
-word_t gen_mem_read();
-word_t gen_mem_write();
-word_t gen_m_stat();
-
-void do_mem_stage()
-{
-    bool_t read = gen_mem_read();
-
-    word_t valm = 0;
-
-    mem_addr = gen_mem_addr();
-    mem_data = ex_mem_curr->vala;
-    mem_write = gen_mem_write();
-    dmem_error = FALSE;
-
-    if (read) {
-	dmem_error = dmem_error || !get_word_val(mem, mem_addr, &valm);
-	if (!dmem_error)
-	  sim_log("\tMemory: Read 0x%llx from 0x%llx\n",
-		  valm, mem_addr);
-    }
-    if (mem_write) {
-	word_t sink;
-	/* Do a read of address just to check validity */
-	dmem_error = dmem_error || !get_word_val(mem, mem_addr, &sink);
-	if (dmem_error)
-	  sim_log("\tMemory: Invalid address 0x%llx\n",
-		  mem_addr);
-    }
-    mem_wb_next->icode = ex_mem_curr->icode;
-    mem_wb_next->ifun = ex_mem_curr->ifun;
-    mem_wb_next->vale = ex_mem_curr->vale;
-    mem_wb_next->valm = valm;
-    mem_wb_next->deste = ex_mem_curr->deste;
-    mem_wb_next->destm = ex_mem_curr->destm;
-    mem_wb_next->status = gen_m_stat();
-    mem_wb_next->stage_pc = ex_mem_curr->stage_pc;
+word_t gen_mem_addr(sim_ctx_t *ctx);
+word_t gen_mem_read(sim_ctx_t *ctx);
+word_t gen_mem_write(sim_ctx_t *ctx);
+word_t gen_m_stat(sim_ctx_t *ctx);
+
+/* At most one lane may access memory in each cycle.  dmem_error is set
+   for each lane in turn, and left as that of the access */
+void do_mem_stage(sim_ctx_t *ctx)
+{
+    bool_t access_error = FALSE;
+
+    for (ctx->lane = 0; ctx->lane < PIPE_WIDTH; ctx->lane++) {
+	ex_mem_ptr M = &ctx->ex_mem_curr[ctx->lane];
+	mem_wb_ptr m = &ctx->mem_wb_next[ctx->lane];
+	bool_t read = gen_mem_read(ctx);
+	bool_t write = gen_mem_write(ctx);
+	word_t valm = 0;
+	word_t addr = gen_mem_addr(ctx);
+
+	if (ctx->lane == 0 || read || write) {
+	    ctx->mem_read = read;
+	    ctx->mem_addr = addr;
+	    ctx->mem_data = M->vala;
+	    ctx->mem_write = write;
+	}
+	ctx->dmem_error = FALSE;
+
+	if (read) {
+	    ctx->dmem_error = ctx->dmem_error || !get_word_val(ctx->mem, addr, &valm);
+	    if (!ctx->dmem_error)
+	      sim_log(ctx, "\tMemory: Read 0x%llx from 0x%llx\n",
+		      valm, addr);
+	}
+	if (write) {
+	    word_t sink;
+	    /* Do a read of address just to check validity */
+	    ctx->dmem_error = ctx->dmem_error || !get_word_val(ctx->mem, addr, &sink);
+	    if (ctx->dmem_error)
+	      sim_log(ctx, "\tMemory: Invalid address 0x%llx\n",
+		      addr);
+	}
+	if (read || write)
+	    access_error = ctx->dmem_error;
+	m->icode = M->icode;
+	m->ifun = M->ifun;
+	m->vale = M->vale;
+	m->valm = valm;
+	m->deste = M->deste;
+	m->destm = M->destm;
+	m->status = gen_m_stat(ctx);
+	m->stage_pc = M->stage_pc;
+	m->predpc = M->predpc;
+	m->memwrite = write;
+	m->memaddr = addr;
+    }
+    ctx->lane = 0;
+    ctx->dmem_error = access_error;
 }
 
 /* Set stalling conditions for different stages */
 
-word_t gen_F_stall(), gen_F_bubble();
-word_t gen_D_stall(), gen_D_bubble();
-word_t gen_E_stall(), gen_E_bubble();
-word_t gen_M_stall(), gen_M_bubble();
-word_t gen_W_stall(), gen_W_bubble();
+word_t gen_F_stall(sim_ctx_t *ctx), gen_F_bubble(sim_ctx_t *ctx);
+word_t gen_D_stall(sim_ctx_t *ctx), gen_D_bubble(sim_ctx_t *ctx);
+word_t gen_E_stall(sim_ctx_t *ctx), gen_E_bubble(sim_ctx_t *ctx);
+word_t gen_M_stall(sim_ctx_t *ctx), gen_M_bubble(sim_ctx_t *ctx);
+word_t gen_W_stall(sim_ctx_t *ctx), gen_W_bubble(sim_ctx_t *ctx);
 
-p_stat_t pipe_cntl(char *name, word_t stall, word_t bubble)
+p_stat_t pipe_cntl(sim_ctx_t *ctx, char *name, word_t stall, word_t bubble)
 {
     if (stall) {
 	if (bubble) {
-	    sim_log("%s: Conflicting control signals for pipe register\n",
+	    sim_log(ctx, "%s: Conflicting control signals for pipe register\n",
 		    name);
 	    return P_ERROR;
 	} else 
@@ -1591,14 +2170,433 @@ p_stat_t pipe_cntl(char *name, word_t stall, word_t bubble)
     }
 }
 
-void do_stall_check()
+void do_stall_check(sim_ctx_t *ctx)
+{
+    ctx->pc_state->op = pipe_cntl(ctx, "PC", gen_F_stall(ctx), gen_F_bubble(ctx));
+    ctx->if_id_state->op = pipe_cntl(ctx, "ID", gen_D_stall(ctx), gen_D_bubble(ctx));
+    ctx->id_ex_state->op = pipe_cntl(ctx, "EX", gen_E_stall(ctx), gen_E_bubble(ctx));
+    ctx->ex_mem_state->op = pipe_cntl(ctx, "MEM", gen_M_stall(ctx), gen_M_bubble(ctx));
+    ctx->mem_wb_state->op = pipe_cntl(ctx, "WB", gen_W_stall(ctx), gen_W_bubble(ctx));
+}
+
+/* Keep fetching from f_pc.  Loading PC rather than stalling it keeps
+   any redirection of fetch selected this cycle */
+static void hold_fetch(sim_ctx_t *ctx)
+{
+    if (ctx->pc_state->op == P_LOAD) {
+	ctx->pc_next->pc = ctx->f_pc;
+	ctx->pc_next->status = STAT_AOK;
+    }
+}
+
+/* Override pipeline control while the caches handle a miss.
+   Only one miss is serviced at a time */
+void do_cache_stall_check(sim_ctx_t *ctx)
 {
-    pc_state->op = pipe_cntl("PC", gen_F_stall(), gen_F_bubble());
-    if_id_state->op = pipe_cntl("ID", gen_D_stall(), gen_D_bubble());
-    id_ex_state->op = pipe_cntl("EX", gen_E_stall(), gen_E_bubble());
-    ex_mem_state->op = pipe_cntl("MEM", gen_M_stall(), gen_M_bubble());
-    mem_wb_state->op = pipe_cntl("WB", gen_W_stall(), gen_W_bubble());
+    int l;
+
+    if (!cache_enabled(&ctx->cache))
+	return;
+
+    /* Access by instruction about to leave memory stage */
+    if ((ctx->mem_read || ctx->mem_write) && !ctx->dmem_error
+	&& ctx->mem_wb_state->op == P_LOAD) {
+	if (!ctx->data_started) {
+	    ctx->data_wait = cache_data(&ctx->cache, ctx->mem_addr, 8, ctx->mem_write);
+	    ctx->data_started = TRUE;
+	}
+	if (ctx->data_wait > 0) {
+	    sim_log(ctx, "\tMemory: Cache miss, %lld cycles left\n", ctx->data_wait);
+	    ctx->data_wait--;
+	    ctx->cache.data_stall++;
+	    hold_fetch(ctx);
+	    if (ctx->pc_state->op != P_LOAD)
+		sim_stall_stage(ctx, IF_STAGE);
+	    sim_stall_stage(ctx, ID_STAGE);
+	    sim_stall_stage(ctx, EX_STAGE);
+	    sim_stall_stage(ctx, MEM_STAGE);
+	    sim_bubble_stage(ctx, WB_STAGE);
+	    /* Write once the miss completes */
+	    ctx->mem_write = FALSE;
+	    /* Execute stage runs again, so it must see the same CC */
+	    ctx->cc_in = ctx->cc;
+	    for (l = 0; l < PIPE_WIDTH; l++)
+		ctx->cc_lane[l] = ctx->cc;
+	    return;
+	}
+	ctx->data_started = FALSE;
+    }
+
+    /* Access by instruction about to enter decode.  Once started, a
+       miss takes its cycles whether or not decode is waiting for it,
+       and is abandoned if fetch moves elsewhere before it completes */
+    if (!ctx->imem_error && ctx->if_id_state->op == P_LOAD) {
+	if (!ctx->fetch_started || ctx->fetch_pc != ctx->f_pc) {
+	    ctx->fetch_wait = cache_fetch(&ctx->cache, ctx->f_pc, ctx->fetch_end - ctx->f_pc);
+	    ctx->fetch_pc = ctx->f_pc;
+	    ctx->fetch_started = TRUE;
+	}
+	if (ctx->fetch_wait > 0) {
+	    sim_log(ctx, "\tFetch: Cache miss, %lld cycles left\n", ctx->fetch_wait);
+	    ctx->fetch_wait--;
+	    ctx->cache.fetch_stall++;
+	    hold_fetch(ctx);
+	    sim_bubble_stage(ctx, ID_STAGE);
+	    return;
+	}
+	ctx->fetch_started = FALSE;
+    } else if (ctx->fetch_started && ctx->fetch_wait > 0)
+	ctx->fetch_wait--;
 }
 
+/*************** Stall accounting ***************/
+
+#define STALL_INIT_SIZE 64
 
+static char *stall_names[STALL_CAUSES] =
+    { "load/use", "mispredict", "ret", "icache", "dcache", "other" };
 
+/* Forget all bubbles counted so far */
+static void clear_stalls(sim_ctx_t *ctx)
+{
+    int i;
+    memset(ctx->stalls, 0, sizeof(ctx->stalls));
+    for (i = 0; i < ctx->stall_size; i++)
+	ctx->stall_sites[i].pc = -1;
+    ctx->stall_used = 0;
+}
+
+static stall_site_t *new_sites(int size)
+{
+    stall_site_t *sites = (stall_site_t *) malloc(size * sizeof(stall_site_t));
+    int i;
+    if (!sites) {
+	perror("malloc error");
+	exit(1);
+    }
+    for (i = 0; i < size; i++)
+	sites[i].pc = -1;
+    return sites;
+}
+
+void sim_count_stalls(sim_ctx_t *ctx)
+{
+    if (ctx->stall_sites)
+	return;
+    ctx->stall_size = STALL_INIT_SIZE;
+    ctx->stall_sites = new_sites(ctx->stall_size);
+    clear_stalls(ctx);
+}
+
+/* Find the entry for pc, adding it if there is none */
+static stall_site_t *find_site(sim_ctx_t *ctx, word_t pc)
+{
+    int mask = ctx->stall_size - 1;
+    int i = (int) ((uword_t) pc * 0x9E3779B97F4A7C15ULL >> 40) & mask;
+
+    while (ctx->stall_sites[i].pc != pc) {
+	if (ctx->stall_sites[i].pc == -1) {
+	    /* Keep the table at most half full */
+	    if (2 * (ctx->stall_used + 1) > ctx->stall_size) {
+		stall_site_t *old = ctx->stall_sites;
+		int old_size = ctx->stall_size;
+		int j;
+		ctx->stall_size *= 2;
+		ctx->stall_sites = new_sites(ctx->stall_size);
+		ctx->stall_used = 0;
+		for (j = 0; j < old_size; j++)
+		    if (old[j].pc != -1)
+			*find_site(ctx, old[j].pc) = old[j];
+		free(old);
+		return find_site(ctx, pc);
+	    }
+	    memset(&ctx->stall_sites[i], 0, sizeof(stall_site_t));
+	    ctx->stall_sites[i].pc = pc;
+	    ctx->stall_used++;
+	    break;
+	}
+	i = (i + 1) & mask;
+    }
+    return &ctx->stall_sites[i];
+}
+
+static void charge_stall(sim_ctx_t *ctx, stall_cause_t cause, word_t pc)
+{
+    ctx->stalls[cause]++;
+    find_site(ctx, pc)->count[cause]++;
+}
+
+/* Is the instruction in execute a conditional jump going the other
+   way from the address fetched after it? */
+static bool_t jump_mispredicted(sim_ctx_t *ctx)
+{
+    id_ex_ptr e = ctx->id_ex_curr;
+    return e->icode == I_JMP && e->ifun != C_YES && e->status == STAT_AOK
+	&& (e->predpc == e->valc) != ctx->ex_mem_next->takebranch;
+}
+
+/* Does status s stop the program once it reaches write-back? */
+static bool_t stat_ends(stat_t s)
+{
+    return s != STAT_AOK && s != STAT_BUB;
+}
+
+/* Classify a bubble injected into decode or execute */
+static void charge_bubble(sim_ctx_t *ctx, word_t other_pc)
+{
+    if (jump_mispredicted(ctx))
+	charge_stall(ctx, STALL_MISPREDICT, ctx->id_ex_curr->stage_pc);
+    else if (ctx->ex_mem_curr->icode == I_RET && ctx->ex_mem_curr->status == STAT_AOK)
+	charge_stall(ctx, STALL_RET, ctx->ex_mem_curr->stage_pc);
+    else if (ctx->id_ex_curr->icode == I_RET && ctx->id_ex_curr->status == STAT_AOK)
+	charge_stall(ctx, STALL_RET, ctx->id_ex_curr->stage_pc);
+    else if (ctx->if_id_curr->icode == I_RET && ctx->if_id_curr->status == STAT_AOK)
+	charge_stall(ctx, STALL_RET, ctx->if_id_curr->stage_pc);
+    else
+	charge_stall(ctx, STALL_OTHER, other_pc);
+}
+
+/*
+ * count_stalls - Charge each bubble that the pipe register controls
+ * of this cycle add to the pipeline.  A bubble adds one unless it
+ * replaces a bubble moving on from the stage before.  Once the
+ * pipeline has started up, every bubble reaching write-back costs a
+ * cycle, so the counts add up to cycles less instructions on a
+ * one-wide pipeline.  Bubbles behind an instruction that stops the
+ * program, or ahead of the first instruction, never cost one.
+ * hcl_id_op is the decode control set by the HCL, before any cache
+ * miss overrides it.  Load/use bubbles are charged to the load, and
+ * the others to the jump, ret, or memory access causing them.
+ */
+static void count_stalls(sim_ctx_t *ctx, p_stat_t hcl_id_op)
+{
+    if (stat_ends(ctx->mem_wb_next->status) || stat_ends(ctx->mem_wb_curr->status))
+	return;
+    /* Unless it is cancelled, the instruction in execute is the last */
+    if (stat_ends(ctx->id_ex_curr->status) && ctx->ex_mem_state->op == P_LOAD)
+	return;
+    if (ctx->starting_up && ctx->if_id_curr->status == STAT_BUB
+	&& ctx->id_ex_curr->status == STAT_BUB && ctx->ex_mem_curr->status == STAT_BUB
+	&& ctx->mem_wb_curr->status == STAT_BUB)
+	return;
+    /* Only a data cache miss stalls the memory stage */
+    if (ctx->mem_wb_state->op == P_BUBBLE) {
+	charge_stall(ctx, STALL_DCACHE, ctx->ex_mem_curr->stage_pc);
+	return;
+    }
+    /* Unless execute cancels it, an instruction that stops the program
+       in decode is the last one */
+    if (ctx->if_id_state->op == P_BUBBLE && (!stat_ends(ctx->if_id_curr->status)
+					     || ctx->id_ex_state->op == P_BUBBLE)) {
+	if (hcl_id_op == P_LOAD)
+	    charge_stall(ctx, STALL_ICACHE, ctx->f_pc);
+	else
+	    charge_bubble(ctx, ctx->if_id_curr->stage_pc);
+    }
+    if (ctx->id_ex_state->op == P_BUBBLE) {
+	if (ctx->if_id_state->op == P_STALL)
+	    charge_stall(ctx, STALL_LOAD_USE, ctx->id_ex_curr->stage_pc);
+	else if (ctx->if_id_curr->status != STAT_BUB)
+	    charge_bubble(ctx, ctx->if_id_curr->stage_pc);
+    }
+    if (ctx->ex_mem_state->op == P_BUBBLE && ctx->id_ex_curr->status != STAT_BUB)
+	charge_bubble(ctx, ctx->id_ex_curr->stage_pc);
+}
+
+static word_t stall_total(stall_site_t *site)
+{
+    word_t total = 0;
+    int c;
+    for (c = 0; c < STALL_CAUSES; c++)
+	total += site->count[c];
+    return total;
+}
+
+/* Most bubbles first, then by address */
+static int compare_sites(const void *a, const void *b)
+{
+    stall_site_t *sa = (stall_site_t *) a;
+    stall_site_t *sb = (stall_site_t *) b;
+    word_t ta = stall_total(sa), tb = stall_total(sb);
+    if (ta != tb)
+	return ta > tb ? -1 : 1;
+    return sa->pc < sb->pc ? -1 : sa->pc > sb->pc;
+}
+
+void sim_stall_report(sim_ctx_t *ctx, int top, FILE *fp)
+{
+    stall_site_t *sites;
+    word_t total = 0;
+    int c, i, n = 0;
+
+    if (!ctx->stall_sites)
+	return;
+    for (c = 0; c < STALL_CAUSES; c++)
+	total += ctx->stalls[c];
+    fprintf(fp, "Bubbles: %lld", total);
+    for (c = 0; c < STALL_CAUSES; c++)
+	fprintf(fp, ", %s %lld", stall_names[c], ctx->stalls[c]);
+    fprintf(fp, "\n");
+    if (total == 0)
+	return;
+
+    sites = (stall_site_t *) malloc(ctx->stall_used * sizeof(stall_site_t));
+    if (!sites) {
+	perror("malloc error");
+	exit(1);
+    }
+    for (i = 0; i < ctx->stall_size; i++)
+	if (ctx->stall_sites[i].pc != -1)
+	    sites[n++] = ctx->stall_sites[i];
+    qsort(sites, n, sizeof(stall_site_t), compare_sites);
+
+    fprintf(fp, "%-8s %-8s %8s", "PC", "Instr", "total");
+    for (c = 0; c < STALL_CAUSES; c++)
+	fprintf(fp, " %10s", stall_names[c]);
+    fprintf(fp, "\n");
+    for (i = 0; i < n && i < top; i++) {
+	byte_t instr = HPACK(I_NOP, F_NONE);
+	get_byte_val(ctx->mem, sites[i].pc, &instr);
+	fprintf(fp, "0x%-6llx %-8s %8lld", sites[i].pc, iname(instr),
+		stall_total(&sites[i]));
+	for (c = 0; c < STALL_CAUSES; c++)
+	    fprintf(fp, " %10lld", sites[i].count[c]);
+	fprintf(fp, "\n");
+    }
+    free(sites);
+}
+
+/*************** Pipeline trace ***************/
+
+/* Instructions in each stage of the trace are the contents of the
+   pipe register that precedes it.  Slot 0 is the instruction fetched
+   this cycle, which is decided once the fetch stage has run */
+
+static char *trace_stage_names[TRACE_STAGES] = { "F", "D", "E", "M", "W" };
+
+/* Instruction leaves the pipeline, retired or squashed */
+static void trace_end(sim_ctx_t *ctx, trace_slot_t *t, bool_t squashed)
+{
+    if (t->stalled)
+	fprintf(ctx->trace, "E\t%lld\t1\tstall\n", t->id);
+    if (squashed)
+	fprintf(ctx->trace, "R\t%lld\t0\t1\n", t->id);
+    else
+	fprintf(ctx->trace, "R\t%lld\t%lld\t0\n", t->id, ctx->trace_retired++);
+    t->id = -1;
+    t->stalled = FALSE;
+}
+
+/* Instruction stays in its stage for another cycle */
+static void trace_stall(sim_ctx_t *ctx, trace_slot_t *t)
+{
+    if (!t->stalled)
+	fprintf(ctx->trace, "S\t%lld\t1\tstall\n", t->id);
+    t->stalled = TRUE;
+}
+
+/* Empty the pipeline, squashing everything in it */
+static void clear_trace(sim_ctx_t *ctx)
+{
+    int k, l;
+    for (k = 0; k < TRACE_STAGES; k++)
+	for (l = 0; l < PIPE_WIDTH; l++) {
+	    if (ctx->trace && ctx->trace_slots[k][l].id != -1)
+		trace_end(ctx, &ctx->trace_slots[k][l], TRUE);
+	    ctx->trace_slots[k][l].id = -1;
+	    ctx->trace_slots[k][l].stalled = FALSE;
+	}
+}
+
+void sim_set_trace(sim_ctx_t *ctx, FILE *fp)
+{
+    if (ctx->trace) {
+	clear_trace(ctx);
+	fflush(ctx->trace);
+    }
+    ctx->trace = fp;
+    if (fp)
+	fprintf(fp, "Kanata\t0004\nC=\t0\n");
+}
+
+/*
+ * trace_fetch - Start the instructions fetched this cycle.  One that
+ * was fetched last cycle and did not move on to decode is fetched
+ * again, unless fetch has moved on and it was squashed.
+ */
+static void trace_fetch(sim_ctx_t *ctx)
+{
+    int l;
+    for (l = 0; l < PIPE_WIDTH; l++) {
+	if_id_ptr f = &ctx->if_id_next[l];
+	trace_slot_t *t = &ctx->trace_slots[0][l];
+	bool_t fetched = f->status != STAT_BUB;
+
+	if (t->id != -1) {
+	    if (fetched && t->pc == f->stage_pc) {
+		trace_stall(ctx, t);
+		continue;
+	    }
+	    trace_end(ctx, t, TRUE);
+	}
+	if (!fetched)
+	    continue;
+	t->id = ctx->trace_ids++;
+	t->pc = f->stage_pc;
+	fprintf(ctx->trace, "I\t%lld\t%lld\t0\n", t->id, t->id);
+	fprintf(ctx->trace, "L\t%lld\t0\t0x%llx: %s\n", t->id, t->pc,
+		iname(HPACK(f->icode, f->ifun)));
+	fprintf(ctx->trace, "L\t%lld\t1\trA = %s, rB = %s, valC = 0x%llx, Stat = %s\n",
+		t->id, reg_name(f->ra), reg_name(f->rb), f->valc,
+		stat_name(f->status));
+	fprintf(ctx->trace, "S\t%lld\t0\tF\n", t->id);
+    }
+}
+
+/*
+ * trace_cycle - Move the instructions as the pipe register controls of
+ * this cycle direct, and start the next cycle.  An instruction moves
+ * on when the next register loads, stays when its own register
+ * stalls, and is squashed otherwise.  Write-back retires every cycle.
+ */
+static void trace_cycle(sim_ctx_t *ctx)
+{
+    p_stat_t op[TRACE_STAGES];
+    int k, l;
+
+    op[0] = ctx->pc_state->op;	/* Unused, fetch is settled later */
+    op[1] = ctx->if_id_state->op;
+    op[2] = ctx->id_ex_state->op;
+    op[3] = ctx->ex_mem_state->op;
+    op[4] = ctx->mem_wb_state->op;
+
+    fprintf(ctx->trace, "C\t1\n");
+    for (l = 0; l < PIPE_WIDTH; l++) {
+	trace_slot_t *w = &ctx->trace_slots[TRACE_STAGES-1][l];
+	if (w->id != -1)
+	    trace_end(ctx, w, FALSE);
+	for (k = TRACE_STAGES-2; k >= 0; k--) {
+	    trace_slot_t *t = &ctx->trace_slots[k][l];
+	    if (t->id == -1)
+		continue;
+	    if (op[k+1] == P_LOAD) {
+		trace_slot_t *next = &ctx->trace_slots[k+1][l];
+		if (t->stalled)
+		    fprintf(ctx->trace, "E\t%lld\t1\tstall\n", t->id);
+		fprintf(ctx->trace, "S\t%lld\t0\t%s\n", t->id,
+			trace_stage_names[k+1]);
+		next->id = t->id;
+		next->pc = t->pc;
+		next->stalled = FALSE;
+		t->id = -1;
+		t->stalled = FALSE;
+	    } else if (k == 0) {
+		/* Settled by trace_fetch next cycle */
+		continue;
+	    } else if (op[k] == P_STALL)
+		trace_stall(ctx, t);
+	    else
+		trace_end(ctx, t, TRUE);
+	}
+    }
+}
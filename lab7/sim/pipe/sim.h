@@ -1,4 +1,7 @@
 
+#include "predict.h"
+#include "cache.h"
+
 /********** Typedefs ************/
 
 /* EX stage mux settings */
@@ -11,6 +14,27 @@ typedef enum { S_WEDGED, S_STALL, S_FORWARD } sim_mode_t;
 /* Pipeline stage identifiers for stage operation control */
 typedef enum { IF_STAGE, ID_STAGE, EX_STAGE, MEM_STAGE, WB_STAGE } stage_id_t;
 
+/* Causes of the bubbles that keep instructions from completing */
+typedef enum { STALL_LOAD_USE, STALL_MISPREDICT, STALL_RET,
+	       STALL_ICACHE, STALL_DCACHE, STALL_OTHER,
+	       STALL_CAUSES } stall_cause_t;
+
+/* Bubbles charged to the instruction at one address */
+typedef struct {
+    word_t pc;		/* -1 for an empty slot */
+    word_t count[STALL_CAUSES];
+} stall_site_t;
+
+/* Instruction followed by a pipeline trace */
+typedef struct {
+    word_t id;		/* -1 for none */
+    word_t pc;
+    bool_t stalled;	/* Held in its stage since the last cycle? */
+} trace_slot_t;
+
+/* Stages shown in a pipeline trace, F through W */
+#define TRACE_STAGES 5
+
 /********** Defines **************/
 
 /* Get ra out of one byte regid field */
@@ -20,91 +44,166 @@ typedef enum { IF_STAGE, ID_STAGE, EX_STAGE, MEM_STAGE, WB_STAGE } stage_id_t;
 #define GET_RB(r) LO4(r)
 
 
-/************ Global state declaration ****************/
-
-/* How many cycles have been simulated? */
-extern word_t cycles;
-/* How many instructions have passed through the EX stage? */
-extern word_t instructions;
-
-/* Both instruction and data memory */
-extern mem_t mem;
-
-/* Keep track of range of addresses that have been written */
-extern word_t minAddr;
-extern word_t memCnt;
-
-/* Register file */
-extern mem_t reg;
-/* Condition code register */
-extern cc_t cc;
-extern stat_t stat;
-
-/* Operand sources in EX (to show forwarding) */
-extern mux_source_t amux, bmux;
-
-/* Provide global access to current states of all pipeline registers */
-pipe_ptr pc_state, if_id_state, id_ex_state, ex_mem_state, mem_wb_state;
-
-/* Current States */
-extern pc_ptr pc_curr;
-extern if_id_ptr if_id_curr;
-extern id_ex_ptr id_ex_curr;
-extern ex_mem_ptr ex_mem_curr;
-extern mem_wb_ptr mem_wb_curr;
-
-/* Next States */
-extern pc_ptr pc_next;
-extern if_id_ptr if_id_next;
-extern id_ex_ptr id_ex_next;
-extern ex_mem_ptr ex_mem_next;
-extern mem_wb_ptr mem_wb_next;
-
-/* Pending updates to state */
-extern word_t cc_in;
-extern word_t wb_destE;
-extern word_t wb_valE;
-extern word_t wb_destM;
-extern word_t wb_valM;
-extern word_t mem_addr;
-extern word_t mem_data;
-extern bool_t mem_write;
-
-
-/* Intermdiate stage values that must be used by control functions */
-extern word_t f_pc;
-extern byte_t imem_icode;
-extern byte_t imem_ifun;
-extern bool_t imem_error;
-extern bool_t instr_valid;
-extern word_t d_regvala;
-extern word_t d_regvalb;
-extern word_t e_vala;
-extern word_t e_valb;
-extern bool_t e_bcond;
-extern bool_t dmem_error;
+/* Most pipe registers a simulator can have */
+#define MAX_STAGE 10
+
+
+/************ Simulator state ****************/
+
+/* Everything one simulation changes as it runs.  Several contexts can
+   be simulated at once, e.g., by different threads */
+typedef struct sim_ctx {
+    /* How many cycles have been simulated? */
+    word_t cycles;
+    /* How many instructions have passed through the WB stage? */
+    word_t instructions;
+    /* Has simulator gotten past initial bubbles? */
+    int starting_up;
+
+    /* Cache misses in progress */
+    word_t fetch_wait;	/* Cycles until fetch at fetch_pc completes */
+    word_t fetch_pc;
+    bool_t fetch_started;
+    word_t data_wait;	/* Cycles until memory stage access completes */
+    bool_t data_started;
+    /* Address following the last byte read by fetch */
+    word_t fetch_end;
+
+    /* Both instruction and data memory */
+    mem_t mem;
+    /* Keep track of range of addresses that have been written */
+    word_t minAddr;
+    word_t memCnt;
+
+    /* Register file */
+    mem_t reg;
+    /* Condition code register */
+    cc_t cc;
+    /* Status code */
+    stat_t status;
+
+    /* Pending updates to state */
+    word_t cc_in;
+    /* Condition codes after each lane of execute */
+    word_t cc_lane[PIPE_WIDTH];
+    /* Register writes, one set per lane */
+    word_t wb_destE[PIPE_WIDTH];
+    word_t wb_valE[PIPE_WIDTH];
+    word_t wb_destM[PIPE_WIDTH];
+    word_t wb_valM[PIPE_WIDTH];
+    word_t mem_addr;
+    word_t mem_data;
+    bool_t mem_read;
+    bool_t mem_write;
+
+    /* Operand sources in EX (to show forwarding) */
+    mux_source_t amux, bmux;
+
+    /* The pipe registers, in the order they are updated */
+    pipe_ptr pipes[MAX_STAGE];
+    int pipe_count;
+    pipe_ptr pc_state, if_id_state, id_ex_state, ex_mem_state, mem_wb_state;
+
+    /* Current States */
+    pc_ptr pc_curr;
+    if_id_ptr if_id_curr;
+    id_ex_ptr id_ex_curr;
+    ex_mem_ptr ex_mem_curr;
+    mem_wb_ptr mem_wb_curr;
+
+    /* Next States */
+    pc_ptr pc_next;
+    if_id_ptr if_id_next;
+    id_ex_ptr id_ex_next;
+    ex_mem_ptr ex_mem_next;
+    mem_wb_ptr mem_wb_next;
+
+    /* Lane being evaluated by the HCL functions */
+    int lane;
+
+    /* Intermdiate stage values that must be used by control functions */
+    word_t f_pc;
+    byte_t imem_icode;
+    byte_t imem_ifun;
+    bool_t imem_error;
+    bool_t instr_valid;
+    word_t d_regvala;
+    word_t d_regvalb;
+    word_t e_vala;
+    word_t e_valb;
+    bool_t e_bcond;
+    bool_t dmem_error;
+
+    /* Branch predictors and caches */
+    pred_t pred;
+    cache_sys_t cache;
+
+    /* Bubbles by cause, and by the address of the instruction
+       responsible.  Only counted once sim_count_stalls has been called */
+    word_t stalls[STALL_CAUSES];
+    stall_site_t *stall_sites;	/* Hash table, indexed by address */
+    int stall_size;		/* Slots in stall_sites, a power of 2 */
+    int stall_used;
+
+    /* Pipeline trace for the Konata viewer, if trace nonNULL.  Slot 0
+       holds the instruction fetched, and the others the contents of the
+       pipe registers */
+    FILE *trace;
+    word_t trace_ids;		/* Instructions traced so far */
+    word_t trace_retired;
+    trace_slot_t trace_slots[TRACE_STAGES][PIPE_WIDTH];
+
+    /* With -t, the ISA simulator executes each instruction as it retires */
+    state_ptr isa_state;
+    bool_t check_ok;	/* No difference found so far? */
+    FILE *check_out;	/* Where differences are reported, stdout by default */
+    /* A popq split into IPOPQ and IPOP2, until its IPOP2 completes */
+    retire_rec pop_retire;
+    bool_t pop_pending;
+
+    /* Log file */
+    FILE *dumpfile;
+} sim_ctx_t;
 
 /* Simulator operating mode */
 extern sim_mode_t sim_mode;
-/* Log file */
-extern FILE *dumpfile;
+
+/*************** Stage Functions ***********/
+
+/* Each takes the context it simulates.  The lane being evaluated is
+   ctx->lane; wide HCL files refer to fields as, e.g.,
+   if_id_curr[lane].icode */
+void do_if_stage(sim_ctx_t *ctx);
+void do_id_wb_stages(sim_ctx_t *ctx);  /* Both ID and WB */
+void do_ex_stage(sim_ctx_t *ctx);
+void do_mem_stage(sim_ctx_t *ctx);
+
+/* Set stalling conditions for different stages */
+void do_stall_check(sim_ctx_t *ctx);
+
+/* Stall stages while the caches handle a miss */
+void do_cache_stall_check(sim_ctx_t *ctx);
 
 /*************** Simulation Control Functions ***********/
 
 /* Bubble next execution of specified stage */
-void sim_bubble_stage(stage_id_t stage);
+void sim_bubble_stage(sim_ctx_t *ctx, stage_id_t stage);
 
 /* Stall stage (has effect at next update) */
-void sim_stall_stage(stage_id_t stage);
+void sim_stall_stage(sim_ctx_t *ctx, stage_id_t stage);
 
 /* Sets the simulator name (called from main routine in HCL file) */
 void set_simname(char *name);
 
-/* Initialize simulator */
-void sim_init();
+/* Create simulator with cleared memory, and no predictor or caches
+   configured */
+sim_ctx_t *sim_new();
+
+/* Free simulator and everything it holds other than isa_state */
+void sim_free(sim_ctx_t *ctx);
 
 /* Reset simulator state, including register, instruction, and data memories */
-void sim_reset();
+void sim_reset(sim_ctx_t *ctx);
 
 /*
   Run pipeline until one of following occurs:
@@ -116,22 +215,67 @@ void sim_reset();
   if statusp nonnull, then will be set to status of final instruction
   if ccp nonnull, then will be set to condition codes of final instruction
 */
-word_t sim_run_pipe(word_t max_instr, word_t max_cycle, byte_t *statusp, cc_t *ccp);
+word_t sim_run_pipe(sim_ctx_t *ctx, word_t max_instr, word_t max_cycle,
+		    byte_t *statusp, cc_t *ccp);
+
+/************* Stall accounting ****************/
+
+/* Count bubbles by cause and by address from now on */
+void sim_count_stalls(sim_ctx_t *ctx);
+
+/* Print the bubble counts, and the top addresses they are charged to */
+void sim_stall_report(sim_ctx_t *ctx, int top, FILE *fp);
+
+/************* Pipeline trace ****************/
+
+/* Write a trace of every instruction's pipeline stages to fp, in the
+   Kanata log format read by Konata.  NULL ends the trace, which shows
+   instructions still in the pipeline as squashed */
+void sim_set_trace(sim_ctx_t *ctx, FILE *fp);
+
+/************* Sampling ****************/
+
+/* Make an ISA simulator state from the memory and registers of an
+   empty pipeline, at the PC it will fetch from */
+state_ptr sim_isa_state(sim_ctx_t *ctx);
+
+/* Restart the pipeline, empty, from the state of ISA simulator s */
+void sim_load_state(sim_ctx_t *ctx, state_ptr s);
+
+/*
+  Run ISA simulator s until count instructions have executed, it is
+  about to execute the instruction at stop_pc (-1 for none), or an
+  instruction fails to complete normally.  Return number executed.
+*/
+word_t sim_fast_forward(state_ptr s, word_t count, word_t stop_pc,
+			byte_t *statusp);
+
+/*
+  Run pipeline until count more instructions have completed, as
+  sim_run_pipe does otherwise.  Instructions behind the last one may
+  already have changed state, so restart with sim_load_state after.
+  Return number of instructions completed.
+*/
+word_t sim_run_window(sim_ctx_t *ctx, word_t count, word_t max_cycle,
+		      byte_t *statusp);
 
 /* If dumpfile set nonNULL, lots of status info printed out */
-void sim_set_dumpfile(FILE *file);
+void sim_set_dumpfile(sim_ctx_t *ctx, FILE *file);
 
 /*
  * sim_log dumps a formatted string to the dumpfile, if it exists
  * accepts variable argument list
  */
-void sim_log( const char *format, ... );
+void sim_log(sim_ctx_t *ctx, const char *format, ... );
+
+/* Don't even evaluate the arguments when there is no dumpfile */
+#define sim_log(ctx, ...) ((ctx)->dumpfile ? sim_log(ctx, __VA_ARGS__) : (void) 0)
+
 
- 
 /******************* GUI Interface Functions **********************/
 #ifdef HAS_GUI
 
-void signal_sources();
+void signal_sources(sim_ctx_t *ctx);
 
 void signal_register_clear();
 
@@ -144,10 +288,41 @@ void report_pc(unsigned fpc, unsigned char fpcv,
 void report_state(char *id, word_t current, char *txt);
 
 void show_cc(cc_t cc);
-void show_cpi();
+void show_cpi(sim_ctx_t *ctx);
 void show_stat(stat_t stat);
 
-void create_memory_display();
-void set_memory(word_t addr, word_t val);
+void create_memory_display(sim_ctx_t *ctx);
+void set_memory(sim_ctx_t *ctx, word_t addr, word_t val);
 #endif
-								       
+
+/************ Names used by the HCL code ****************/
+
+/* hcl2c -c defines HCL_CTX, and passes each generated function the
+   context it evaluates as ctx.  The quoted C code in the HCL file
+   reaches the state of that context through these names */
+#ifdef HCL_CTX
+#define pc_curr (ctx->pc_curr)
+#define if_id_curr (ctx->if_id_curr)
+#define id_ex_curr (ctx->id_ex_curr)
+#define ex_mem_curr (ctx->ex_mem_curr)
+#define mem_wb_curr (ctx->mem_wb_curr)
+#define pc_next (ctx->pc_next)
+#define if_id_next (ctx->if_id_next)
+#define id_ex_next (ctx->id_ex_next)
+#define ex_mem_next (ctx->ex_mem_next)
+#define mem_wb_next (ctx->mem_wb_next)
+#define lane (ctx->lane)
+#define f_pc (ctx->f_pc)
+#define imem_icode (ctx->imem_icode)
+#define imem_ifun (ctx->imem_ifun)
+#define imem_error (ctx->imem_error)
+#define instr_valid (ctx->instr_valid)
+#define d_regvala (ctx->d_regvala)
+#define d_regvalb (ctx->d_regvalb)
+#define e_vala (ctx->e_vala)
+#define e_valb (ctx->e_valb)
+#define e_bcond (ctx->e_bcond)
+#define dmem_error (ctx->dmem_error)
+#define pred_taken(pc, target) pred_taken(&ctx->pred, pc, target)
+#define pred_return() pred_return(&ctx->pred)
+#endif /* HCL_CTX */
@@ -3,6 +3,12 @@
  * Declares the functions that implement the pipeline stages
 */
 
+/* Number of instructions held in each pipeline register (other than
+   PC).  pipe-2w.hcl needs psim built with -DPIPE_WIDTH=2 */
+#ifndef PIPE_WIDTH
+#define PIPE_WIDTH 1
+#endif
+
 /********** Pipeline register contents **************/
 
 /* Program Counter */
@@ -22,6 +28,8 @@ typedef struct {
     stat_t status;
     /* The following is included for debugging */
     word_t stage_pc;
+    /* Address predicted for the following instruction */
+    word_t predpc;
 } if_id_ele, *if_id_ptr;
 
 /* ID/EX Pipe Register */
@@ -38,6 +46,8 @@ typedef struct {
     stat_t status;
     /* The following is included for debugging */
     word_t stage_pc;
+    /* Address predicted for the following instruction */
+    word_t predpc;
 } id_ex_ele, *id_ex_ptr;
 
 /* EX/MEM Pipe Register */
@@ -53,6 +63,8 @@ typedef struct {
     stat_t status;
     /* The following is included for debugging */
     word_t stage_pc;
+    /* Address predicted for the following instruction */
+    word_t predpc;
 } ex_mem_ele, *ex_mem_ptr;
 
 /* Mem/WB Pipe Register */
@@ -66,6 +78,11 @@ typedef struct {
     stat_t status;
     /* The following is included for debugging */
     word_t stage_pc;
+    /* Address predicted for the following instruction */
+    word_t predpc;
+    /* Memory write done in memory stage, for checking with -t */
+    bool_t memwrite;
+    word_t memaddr;
 } mem_wb_ele, *mem_wb_ptr;
 
 /************ Global Declarations ********************/
@@ -75,16 +92,3 @@ extern if_id_ele bubble_if_id;
 extern id_ex_ele bubble_id_ex;
 extern ex_mem_ele bubble_ex_mem;
 extern mem_wb_ele bubble_mem_wb;
-
-/************ Function declarations *******************/
-
-/* Stage functions */
-void do_if_stage();
-void do_id_wb_stages();  /* Both ID and WB */
-void do_ex_stage();
-void do_mem_stage();
-
-/* Set stalling conditions for different stages */
-void do_stall_check();
-
-
@@ -0,0 +1,458 @@
+/*
+ * sweep.c - Design-space sweep of ncopy CPE
+ *
+ * Does the work of benchmark.pl for lengths 1..N without starting yas
+ * and psim for every length.  The driver of gen-driver.pl is generated
+ * and assembled once, for the largest length.  Each run copies that
+ * image and patches the length argument and the source array in memory
+ * before simulating it.  Runs for different lengths and branch
+ * predictors proceed in parallel threads, each with its own sim_ctx_t.
+ *
+ * The output is a CSV table with the cycles and CPE of every
+ * (variant, length) pair.  A variant is the HCL version the program was
+ * built with, plus the predictor when -p is given.  The Makefile builds
+ * one sweep-VERSION per HCL file and runs them concurrently (make sweep).
+ *
+ * The program is linked with psim.c compiled with -DSIM_LIB, and yas.c
+ * compiled with -DYAS_LIB.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "isa.h"
+#include "pipeline.h"
+#include "stages.h"
+#include "sim.h"
+
+#define MAXBUF 1024
+#define MAXLEN 64
+#define MAXPRED 16
+#define MAXCACHE 8
+
+/* Runs with small caches stall for many cycles, and psim counts those
+   against the instruction limit */
+#define SWEEP_LIMIT 1000000
+
+/* Assembler core, from yas.c */
+int assemble(FILE *in, FILE *out);
+int find_symbol(char *name);
+
+/* Simulator settings, from psim.c */
+extern char simname[];
+extern bool_t verbosity;
+extern word_t instr_limit;
+extern bool_t fast_mode;
+
+
+/***************
+ * Begin Globals
+ ***************/
+
+/* Parameters modified by the command line */
+static char *ncopy_file = "ncopy.ys"; /* ncopy code (-f) */
+static int maxlen = MAXLEN;           /* Largest length (-n) */
+static int jobs = 1;                  /* Number of threads (-j) */
+static unsigned seed = 1;             /* Seed for the source data (-s) */
+static bool_t header = TRUE;          /* Print CSV header? (-H) */
+static bool_t quiet = FALSE;          /* No average CPE on stderr (-q) */
+static char *preds[MAXPRED];          /* Predictors to compare (-p) */
+static int pred_cnt = 0;
+static char *caches[MAXCACHE];        /* Cache levels of every run (-c) */
+static int cache_cnt = 0;
+
+/* Name of the HCL version, from simname */
+static char version[64];
+
+/* The assembled driver and the addresses patched for each length */
+static mem_t image;
+static word_t len_addr;  /* Immediate of irmovq $len, %rdx */
+static word_t src_addr;
+static word_t dest_addr;
+
+/* One run: a predictor and a length */
+typedef struct {
+    int pred;            /* Index into preds, or -1 for the default */
+    int len;
+    byte_t status;       /* Status at the end of the run */
+    bool_t ok;           /* Did ncopy return the right count and copy? */
+    bool_t pred_used;    /* Did the HCL call pred_taken()? */
+    word_t cycles;
+} run_rec, *run_ptr;
+
+static run_ptr runs = NULL;
+static int run_cnt = 0;
+static int next_run = 0;
+static pthread_mutex_t run_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*************
+ * End Globals
+ *************/
+
+
+/*****************************************************************
+ * Part 1: Building the driver.  This is the driver of
+ * gen-driver.pl without the checking code, for maxlen elements.
+ *****************************************************************/
+
+/* Source data for a length, chosen as gen-driver.pl does: n/2 of the
+   elements are positive.  Return the number of positive elements */
+static int gen_data(int n, word_t *data)
+{
+    unsigned state = seed + n;
+    int tval = n/2;
+    int rval = 0;
+    int i;
+    for (i = 0; i < n; i++) {
+	data[i] = -(i+1);
+	if ((rval < tval && rand_r(&state) % 2 == 1) ||
+	    tval - rval >= n - i) {
+	    data[i] = -data[i];
+	    rval++;
+	}
+    }
+    return rval;
+}
+
+static void gen_driver(FILE *out, FILE *code)
+{
+    char buf[MAXBUF];
+    int i;
+
+    fprintf(out, "\t.pos 0\n");
+    fprintf(out, "main:\tirmovq Stack, %%rsp\n");
+    fprintf(out, "SweepLen:\n");
+    fprintf(out, "\tirmovq $%d, %%rdx\n", maxlen);
+    fprintf(out, "\tirmovq dest, %%rsi\n");
+    fprintf(out, "\tirmovq src, %%rdi\n");
+    fprintf(out, "\tcall ncopy\n");
+    fprintf(out, "\thalt\n");
+    fprintf(out, "StartFun:\n");
+    while (fgets(buf, MAXBUF, code))
+	fputs(buf, out);
+    fprintf(out, "EndFun:\n");
+
+    fprintf(out, "\t.align 8\n");
+    fprintf(out, "src:\n");
+    for (i = 0; i < maxlen; i++)
+	fprintf(out, "\t.quad %d\n", -(i+1));
+    fprintf(out, "\t.quad 0xbcdefa\n");
+    fprintf(out, "\t.align 16\n");
+    fprintf(out, "Predest:\n");
+    fprintf(out, "\t.quad 0xbcdefa\n");
+    fprintf(out, "dest:\n");
+    for (i = 0; i < maxlen; i++)
+	fprintf(out, "\t.quad 0xcdefab\n");
+    fprintf(out, "Postdest:\n");
+    fprintf(out, "\t.quad 0xdefabc\n");
+    fprintf(out, "\t.align 8\n");
+    for (i = 0; i < 16; i++)
+	fprintf(out, "\t.quad 0\n");
+    fprintf(out, "Stack:\n");
+}
+
+/* Generate, assemble and load the driver into image */
+static void load_driver()
+{
+    FILE *code, *in, *out;
+    char *src = NULL, *obj = NULL;
+    size_t srclen = 0, objlen = 0;
+
+    code = fopen(ncopy_file, "r");
+    if (!code) {
+	fprintf(stderr, "Can't open code file %s\n", ncopy_file);
+	exit(1);
+    }
+    out = open_memstream(&src, &srclen);
+    gen_driver(out, code);
+    fclose(out);
+    fclose(code);
+
+    in = fmemopen(src, srclen, "r");
+    out = open_memstream(&obj, &objlen);
+    if (assemble(in, out)) {
+	fprintf(stderr, "Couldn't assemble driver for %s\n", ncopy_file);
+	exit(1);
+    }
+    fclose(in);
+    fclose(out);
+
+    /* irmovq is 2 bytes of opcode and registers, then the immediate */
+    len_addr = find_symbol("SweepLen") + 2;
+    src_addr = find_symbol("src");
+    dest_addr = find_symbol("dest");
+
+    image = init_mem(MEM_SIZE);
+    in = fmemopen(obj, objlen, "r");
+    if (load_mem(image, in, 1) == 0) {
+	fprintf(stderr, "No code loaded from driver for %s\n", ncopy_file);
+	exit(1);
+    }
+    fclose(in);
+    free(src);
+    free(obj);
+}
+
+
+/*****************************************************************
+ * Part 2: Running the sweep.  Threads take runs from the list in
+ * order, each simulating in its own context.
+ *****************************************************************/
+
+static void do_run(sim_ctx_t *ctx, run_ptr r)
+{
+    word_t data[MAXLEN];
+    word_t val;
+    byte_t run_status = STAT_AOK;
+    cc_t result_cc = 0;
+    int count;
+    int i;
+
+    if (r->pred >= 0)
+	pred_set_type(&ctx->pred, preds[r->pred]);
+    sim_reset(ctx);
+    free_mem(ctx->mem);
+    ctx->mem = copy_mem(image);
+    count = gen_data(r->len, data);
+    set_word_val(ctx->mem, len_addr, r->len);
+    for (i = 0; i < r->len; i++)
+	set_word_val(ctx->mem, src_addr + 8*i, data[i]);
+
+    sim_run_pipe(ctx, instr_limit, 5*instr_limit, &run_status, &result_cc);
+    r->cycles = ctx->cycles;
+    r->status = run_status;
+    r->pred_used = ctx->pred.used;
+
+    r->ok = run_status == STAT_HLT &&
+	get_reg_val(ctx->reg, REG_RAX) == count;
+    for (i = 0; i < r->len && r->ok; i++)
+	r->ok = get_word_val(ctx->mem, dest_addr + 8*i, &val) &&
+	    val == data[i];
+}
+
+static void *run_thread(void *arg)
+{
+    sim_ctx_t *ctx = sim_new();
+    int i;
+    int c;
+    for (c = 0; c < cache_cnt; c++)
+	cache_config(&ctx->cache, caches[c]);
+    for (;;) {
+	pthread_mutex_lock(&run_lock);
+	i = next_run++;
+	pthread_mutex_unlock(&run_lock);
+	if (i >= run_cnt)
+	    break;
+	do_run(ctx, &runs[i]);
+    }
+    sim_free(ctx);
+    return NULL;
+}
+
+static void run_sweep()
+{
+    pthread_t *tids;
+    int npred = pred_cnt > 0 ? pred_cnt : 1;
+    int p, n, t;
+
+    run_cnt = npred * maxlen;
+    runs = (run_ptr) calloc(run_cnt, sizeof(run_rec));
+    if (!runs) {
+	perror("calloc error");
+	exit(1);
+    }
+    for (p = 0; p < npred; p++)
+	for (n = 1; n <= maxlen; n++) {
+	    run_ptr r = &runs[p*maxlen + n-1];
+	    r->pred = pred_cnt > 0 ? p : -1;
+	    r->len = n;
+	}
+
+    if (jobs > run_cnt)
+	jobs = run_cnt;
+    tids = (pthread_t *) malloc(jobs * sizeof(pthread_t));
+    if (!tids) {
+	perror("malloc error");
+	exit(1);
+    }
+    for (t = 0; t < jobs; t++)
+	if (pthread_create(&tids[t], NULL, run_thread, NULL)) {
+	    fprintf(stderr, "Couldn't create thread\n");
+	    exit(1);
+	}
+    for (t = 0; t < jobs; t++)
+	pthread_join(tids[t], NULL);
+    free(tids);
+}
+
+
+/*****************************************************************
+ * Part 3: Reporting
+ *****************************************************************/
+
+/* Variant name of a run, such as "full" or "pred/gshare" */
+static void variant_name(char *buf, run_ptr r)
+{
+    if (r->pred >= 0)
+	snprintf(buf, MAXBUF, "%s/%s", version, preds[r->pred]);
+    else
+	snprintf(buf, MAXBUF, "%s", version);
+}
+
+/* Print the table.  Return the number of runs that went wrong */
+static int report()
+{
+    char name[MAXBUF];
+    double tcpe = 0.0;
+    int bad = 0;
+    int i;
+
+    if (header)
+	printf("variant,length,cycles,cpe\n");
+    for (i = 0; i < run_cnt; i++) {
+	run_ptr r = &runs[i];
+	double cpe = (double) r->cycles/r->len;
+	variant_name(name, r);
+	printf("%s,%d,%lld,%.2f\n", name, r->len, r->cycles, cpe);
+	if (!r->ok) {
+	    fprintf(stderr, "%s: Wrong result for length %d (status %s)\n",
+		    name, r->len, stat_name(r->status));
+	    bad++;
+	}
+	tcpe += cpe;
+	if (r->len == maxlen) {
+	    if (!quiet)
+		fprintf(stderr, "%s\tAverage CPE\t%.2f\n", name, tcpe/maxlen);
+	    tcpe = 0.0;
+	}
+    }
+    return bad;
+}
+
+static void usage(char *name)
+{
+    printf("Usage: %s [-hHq] [-f file] [-n N] [-p preds] [-c cache]... [-l m] [-j n] [-s seed]\n", name);
+    printf("   -h       Print this message\n");
+    printf("   -H       Omit the CSV header line\n");
+    printf("   -q       Quiet mode: don't print average CPE on stderr\n");
+    printf("   -f file  Input .ys file (default ncopy.ys)\n");
+    printf("   -n N     Set max number of elements up to %d (default %d)\n",
+	   MAXLEN, MAXLEN);
+    printf("   -p preds Comma-separated predictors to compare, as for psim -p\n");
+    printf("   -c cache Add cache level to every run, as for psim -c\n");
+    printf("   -l m     Set instruction limit of each run to m (default %lld)\n",
+	   (word_t) SWEEP_LIMIT);
+    printf("   -j n     Run n threads (default: number of CPUs)\n");
+    printf("   -s seed  Seed for the source data (default 1)\n");
+    exit(0);
+}
+
+/* Select predictors listed in comma-separated list */
+static void set_preds(char *list, char *name)
+{
+    pred_t p;
+    char *s;
+    for (s = strtok(list, ","); s; s = strtok(NULL, ",")) {
+	if (pred_cnt == MAXPRED || !pred_set_type(&p, s)) {
+	    printf("Invalid predictor '%s'\n", s);
+	    usage(name);
+	}
+	preds[pred_cnt++] = s;
+    }
+}
+
+/*
+ * sim_main - called from the main() routine in the HCL file, in place
+ * of the simulator's own
+ */
+int sim_main(int argc, char **argv)
+{
+    cache_sys_t cs;
+    char *s;
+    int c, i;
+
+    jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs < 1)
+	jobs = 1;
+
+    instr_limit = SWEEP_LIMIT;
+    cache_init(&cs);
+    while ((c = getopt(argc, argv, "hHqf:n:p:c:l:j:s:")) != -1) {
+	switch(c) {
+	case 'h':
+	    usage(argv[0]);
+	    break;
+	case 'H':
+	    header = FALSE;
+	    break;
+	case 'q':
+	    quiet = TRUE;
+	    break;
+	case 'f':
+	    ncopy_file = optarg;
+	    break;
+	case 'n':
+	    maxlen = atoi(optarg);
+	    if (maxlen < 1 || maxlen > MAXLEN) {
+		printf("n must be between 1 and %d\n", MAXLEN);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'p':
+	    set_preds(optarg, argv[0]);
+	    break;
+	case 'c':
+	    if (cache_cnt == MAXCACHE || !cache_config(&cs, optarg)) {
+		printf("Invalid cache specification '%s'\n", optarg);
+		usage(argv[0]);
+	    }
+	    caches[cache_cnt++] = optarg;
+	    break;
+	case 'l':
+	    instr_limit = atoll(optarg);
+	    break;
+	case 'j':
+	    jobs = atoi(optarg);
+	    if (jobs < 1) {
+		printf("Invalid number of jobs %d\n", jobs);
+		usage(argv[0]);
+	    }
+	    break;
+	case 's':
+	    seed = atoi(optarg);
+	    break;
+	default:
+	    printf("Invalid option '%c'\n", c);
+	    usage(argv[0]);
+	    break;
+	}
+    }
+    cache_free(&cs);
+
+    /* simname is "Y86-64 Processor: pipe-VERSION.hcl" */
+    s = strrchr(simname, ' ');
+    s = s ? s+1 : simname;
+    if (!strncmp(s, "pipe-", 5))
+	s += 5;
+    snprintf(version, sizeof(version), "%s", s);
+    if ((s = strstr(version, ".hcl")) != NULL)
+	*s = '\0';
+
+    verbosity = 0;
+    fast_mode = TRUE;
+
+    load_driver();
+    run_sweep();
+    /* Otherwise every predictor would give the same cycles */
+    for (i = 0; i < run_cnt && !runs[i].pred_used; i++)
+	;
+    if (pred_cnt > 0 && i == run_cnt) {
+	fprintf(stderr, "-p has no effect: %s never calls pred_taken()\n",
+		version);
+	exit(1);
+    }
+    exit(report() ? 1 : 0);
+}
@@ -0,0 +1,856 @@
+/*
+ * ptest.c - Regression tests for the Y86-64 simulators, run in-process
+ *
+ * Generates the same test programs as optest.pl, jtest.pl, ctest.pl,
+ * etest.pl and htest.pl.  Rather than starting yas and a simulator for
+ * every test, it assembles them in memory with the yas core and runs
+ * them on the simulator linked into this program, checking each one
+ * against the ISA simulator as -t does.  The tests are divided among
+ * worker threads, each simulating in its own sim_ctx_t.
+ *
+ * The program is linked with psim.c (or ssim.c, with -DSEQ) compiled
+ * with -DSIM_LIB, and yas.c compiled with -DYAS_LIB.  See the Makefile.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "isa.h"
+#ifndef SEQ
+#include "pipeline.h"
+#include "stages.h"
+#endif
+#include "sim.h"
+
+#define MAXBUF 1024
+
+/* Assembler core, from yas.c */
+int assemble(FILE *in, FILE *out);
+
+/* Simulator settings, from psim.c or ssim.c */
+extern char simname[];
+extern bool_t verbosity;
+extern word_t instr_limit;
+extern bool_t fast_mode;
+
+
+/***************
+ * Begin Globals
+ ***************/
+
+/* The test scripts reproduced here */
+typedef enum { OPTEST, JTEST, CTEST, ETEST, HTEST, NSUITE } suite_t;
+static char *suite_names[NSUITE] = { "op", "j", "c", "e", "h" };
+
+/* Parameters modified by the command line */
+static bool_t run_suite[NSUITE] = { TRUE, TRUE, TRUE, FALSE, TRUE };
+static bool_t testiaddq = FALSE;  /* Test iaddq instruction? (-i) */
+static char *outputdir = ".";     /* Where failing tests are left (-d) */
+static bool_t gen_perf = FALSE;   /* Generate performance data? (-P) */
+static char *perf_file = NULL;    /* Performance targets to check (-p) */
+static int jobs = 1;              /* Number of worker threads (-j) */
+
+/* A generated test program and its result */
+typedef struct {
+    char name[32];
+    suite_t suite;
+    char *src;           /* Y86-64 assembly code */
+    size_t len;
+    char *obj;           /* Object code, NULL if it didn't assemble */
+    size_t objlen;
+    char *log;           /* What the ISA check reported */
+    size_t loglen;
+    bool_t ok;           /* Did ISA check succeed? */
+    word_t cycles;
+    word_t instructions;
+} test_rec, *test_ptr;
+
+static test_ptr tests = NULL;
+static int test_cnt = 0;
+static int test_max = 0;
+
+/* Source code of test being generated */
+static FILE *yfile;
+
+/* Next test for a worker thread to run */
+static int next_test = 0;
+static pthread_mutex_t test_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*************
+ * End Globals
+ *************/
+
+
+/*****************************************************************
+ * Part 1: Test generation.  Each test program is written to yfile
+ * between new_test and end_test, following the Perl scripts.
+ *****************************************************************/
+
+static void new_test(suite_t suite, char *name)
+{
+    test_ptr t;
+    if (test_cnt == test_max) {
+	test_max = test_max ? 2*test_max : 256;
+	tests = (test_ptr) realloc(tests, test_max*sizeof(test_rec));
+	if (!tests) {
+	    perror("realloc error");
+	    exit(1);
+	}
+    }
+    t = &tests[test_cnt];
+    strncpy(t->name, name, sizeof(t->name)-1);
+    t->name[sizeof(t->name)-1] = '\0';
+    t->suite = suite;
+    t->src = NULL;
+    t->len = 0;
+    t->obj = NULL;
+    t->objlen = 0;
+    t->log = NULL;
+    t->loglen = 0;
+    t->ok = FALSE;
+    t->cycles = t->instructions = 0;
+    yfile = open_memstream(&t->src, &t->len);
+    if (!yfile) {
+	perror("open_memstream error");
+	exit(1);
+    }
+}
+
+static void end_test()
+{
+    fclose(yfile);
+    test_cnt++;
+}
+
+/* optest.pl: Test single instructions in pipeline */
+static void optest()
+{
+    static int vals[] = { 0x100, 0x020, 0x004 };
+    static char *instr[] = { "rrmovq", "addq", "subq", "andq", "xorq" };
+    static char *regs[] = { "rdx", "rbx", "rsp" };
+    static char *sinstr[] = { "pushq", "popq" };
+    static char *sregs[] = { "rdx", "rsp" };
+    char tname[MAXBUF];
+    int t, ra, rb, v;
+
+    for (t = 0; t < 5; t++)
+	for (ra = 0; ra < 3; ra++)
+	    for (rb = 0; rb < 3; rb++) {
+		sprintf(tname, "op-%s-%s-%s", instr[t], regs[ra], regs[rb]);
+		new_test(OPTEST, tname);
+		fprintf(yfile,
+			"\tirmovq $%d, %%%s\n"
+			"\tirmovq $%d, %%%s\n"
+			"\tnop\n\tnop\n\tnop\n"
+			"\t%s %%%s,%%%s\n"
+			"\tnop\n\tnop\n\thalt\n",
+			vals[0], regs[ra], vals[1], regs[rb],
+			instr[t], regs[ra], regs[rb]);
+		end_test();
+	    }
+
+    if (testiaddq) {
+	for (ra = 0; ra < 3; ra++)
+	    for (v = 0; v < 3; v++) {
+		sprintf(tname, "op-iaddq-%d-%s", vals[v], regs[ra]);
+		new_test(OPTEST, tname);
+		fprintf(yfile,
+			"\tirmovq $%d, %%%s\n"
+			"\tnop\n\tnop\n\tnop\n"
+			"\tiaddq $-32, %%%s\n"
+			"\tnop\n\tnop\n\thalt\n",
+			vals[v], regs[ra], regs[ra]);
+		end_test();
+	    }
+    }
+
+    for (t = 0; t < 2; t++)
+	for (ra = 0; ra < 2; ra++) {
+	    sprintf(tname, "op-%s-%s", sinstr[t], sregs[ra]);
+	    new_test(OPTEST, tname);
+	    fprintf(yfile,
+		    "\tirmovq $0x200,%%rsp\n"
+		    "\tirmovq $%d, %%rax\n"
+		    "\tnop\n\tnop\n\tnop\n"
+		    "\trmmovq %%rax, 0(%%rsp)\n"
+		    "\tirmovq $%d, %%rax\n"
+		    "\tnop\n\tnop\n\tnop\n"
+		    "\trmmovq %%rax, -4(%%rsp)\n"
+		    "\tirmovq $%d, %%rdx\n"
+		    "\tnop\n\tnop\n\tnop\n"
+		    "\t%s %%%s\n"
+		    "\tnop\n\tnop\n\thalt\n",
+		    vals[1], vals[2], vals[0], sinstr[t], sregs[ra]);
+	    end_test();
+	}
+}
+
+/* jtest.pl: Test jump instructions */
+static void jtest()
+{
+    static int vals[] = { 32, 64 };
+    static char *instr[] = { "jmp", "jle", "jl", "je", "jne", "jge", "jg",
+			     "call" };
+    char tname[MAXBUF];
+    int t, a, b;
+
+    /* Forward tests */
+    for (t = 0; t < 8; t++)
+	for (a = 0; a < 2; a++)
+	    for (b = 0; b < 2; b++) {
+		sprintf(tname, "jf-%s-%d-%d", instr[t], vals[a], vals[b]);
+		new_test(JTEST, tname);
+		fprintf(yfile,
+			"\tirmovq stack, %%rsp\n"
+			"\tirmovq $1, %%rsi\n"
+			"\tirmovq $2, %%rdi\n"
+			"\tirmovq $4, %%rbp\n"
+			"\tirmovq $%d, %%rax\n"
+			"\tirmovq $%d, %%rdx\n"
+			"\tsubq %%rdx,%%rax\n"
+			"\t%s target\n"
+			"\taddq %%rsi,%%rax\n"
+			"\taddq %%rdi,%%rax\n"
+			"\taddq %%rbp,%%rax\n"
+			"\thalt\n"
+			"target:\n"
+			"\taddq %%rsi,%%rdx\n"
+			"\taddq %%rdi,%%rdx\n"
+			"\taddq %%rbp,%%rdx\n"
+			"\tnop\n\tnop\n\thalt\n"
+			".pos 0x100\n"
+			"stack:\n",
+			vals[a], vals[b], instr[t]);
+		end_test();
+	    }
+
+    /* Backward tests */
+    for (t = 0; t < 8; t++)
+	for (a = 0; a < 2; a++)
+	    for (b = 0; b < 2; b++) {
+		sprintf(tname, "jb-%s-%d-%d", instr[t], vals[a], vals[b]);
+		new_test(JTEST, tname);
+		fprintf(yfile,
+			"\tirmovq stack, %%rsp\n"
+			"\tirmovq $1, %%rsi\n"
+			"\tirmovq $2, %%rdi\n"
+			"\tirmovq $4, %%rbp\n"
+			"\tirmovq $%d, %%rax\n"
+			"\tirmovq $%d, %%rdx\n"
+			"\tjmp skip\n"
+			"\thalt\n"
+			"target:\n"
+			"\taddq %%rsi,%%rdx\n"
+			"\taddq %%rdi,%%rdx\n"
+			"\taddq %%rbp,%%rdx\n"
+			"\tnop\n\tnop\n\thalt\n"
+			"skip:\n"
+			"\tsubq %%rdx,%%rax\n"
+			"\t%s target\n"
+			"\taddq %%rsi,%%rax\n"
+			"\taddq %%rdi,%%rax\n"
+			"\taddq %%rbp,%%rax\n"
+			"\thalt\n"
+			".pos 0x100\n"
+			"stack:\n",
+			vals[a], vals[b], instr[t]);
+		end_test();
+	    }
+
+    /* Forward tests using iaddq */
+    if (testiaddq) {
+	for (t = 0; t < 8; t++)
+	    for (a = 0; a < 2; a++)
+		for (b = 0; b < 2; b++) {
+		    sprintf(tname, "ji-%s-%d-%d", instr[t], vals[a], vals[b]);
+		    new_test(JTEST, tname);
+		    fprintf(yfile,
+			    "\tirmovq stack, %%rsp\n"
+			    "\tirmovq $1, %%rsi\n"
+			    "\tirmovq $2, %%rdi\n"
+			    "\tirmovq $4, %%rbp\n"
+			    "\tirmovq $%d, %%rax\n"
+			    "\tiaddq $-%d,%%rax\n"
+			    "\t%s target\n"
+			    "\taddq %%rsi,%%rax\n"
+			    "\taddq %%rdi,%%rax\n"
+			    "\taddq %%rbp,%%rax\n"
+			    "\thalt\n"
+			    "target:\n"
+			    "\taddq %%rsi,%%rdx\n"
+			    "\taddq %%rdi,%%rdx\n"
+			    "\taddq %%rbp,%%rdx\n"
+			    "\tnop\n\tnop\n\thalt\n"
+			    ".pos 0x100\n"
+			    "stack:\n",
+			    vals[a], vals[b], instr[t]);
+		    end_test();
+		}
+    }
+}
+
+/* ctest.pl: Test pipeline control combinations.  Each template gives
+   four instruction slots separated by '|' */
+static char *ctemplates[] = {
+    "||jne target\n\thalt\ntarget:|",       /* M */
+    "|||ret",                               /* R */
+    "||mrmovq (%rax),%rsp|ret",             /* G1a */
+    "|mrmovq (%rax),%rsp||ret",             /* G1b */
+    "mrmovq (%rax),%rsp|||ret",             /* G1c */
+    "||irmovq $3,%rax|rrmovq %rax,%rdx",    /* G2a */
+    "|irmovq $3,%rax||rrmovq %rax,%rdx",    /* G2b */
+    "irmovq $3,%rax|||rrmovq %rax,%rdx",    /* G2c */
+};
+
+/* Split template into its four slots, pointing into buf */
+static void split_template(char *template, char *buf, char *slot[4])
+{
+    int i;
+    char *s = strcpy(buf, template);
+    for (i = 0; i < 4; i++) {
+	slot[i] = s;
+	if (s) {
+	    s = strchr(s, '|');
+	    if (s)
+		*s++ = '\0';
+	} else {
+	    slot[i] = "";
+	}
+    }
+}
+
+static void ctest()
+{
+    int n = sizeof(ctemplates)/sizeof(char *);
+    int testcnt = 0;
+    int i1, i2, i;
+    char buf1[MAXBUF], buf2[MAXBUF], tname[MAXBUF];
+    char *t1[4], *t2[4], *t[4];
+
+    for (i1 = 0; i1 < n; i1++)
+	for (i2 = i1+1; i2 < n; i2++) {
+	    bool_t ok = TRUE;
+	    split_template(ctemplates[i1], buf1, t1);
+	    split_template(ctemplates[i2], buf2, t2);
+	    /* Combine slots, unless both templates use the same slot */
+	    for (i = 0; i < 4; i++) {
+		if (!*t1[i])
+		    t[i] = *t2[i] ? t2[i] : "nop";
+		else if (!*t2[i] || !strcmp(t1[i], t2[i]))
+		    t[i] = t1[i];
+		else
+		    ok = FALSE;
+	    }
+	    if (!ok)
+		continue;
+	    sprintf(tname, "c-%d", testcnt++);
+	    new_test(CTEST, tname);
+	    fprintf(yfile,
+		    "\tirmovq Stack1,%%rsp\n"
+		    "\tirmovq rtnpt,%%rdx\n"
+		    "\trmmovq %%rdx,(%%rsp)   # Put return point on top of Stack1\n"
+		    "\tirmovq Stack2,%%rax\n"
+		    "\trmmovq %%rsp,(%%rax)   # Put Stack1 on top of Stack2\n"
+		    "\tirmovq Stack3,%%rsp   # Point to Stack3\n"
+		    "\tpushq %%rdx\n"
+		    "\trrmovq %%rsp,%%rbp\n"
+		    "\tirmovq $3,%%rdx       # Initialize\n"
+		    "\txorq   %%rbx,%%rbx     # Set condition codes to ZF=1,SF=0,OF=0\n"
+		    "#       Here's where the 4 instruction sequence goes\n"
+		    "\t%s\n\t%s\n\t%s\n\t%s\n"
+		    "#\tNow finish things off\n"
+		    "\tirmovq $3,%%rbx       # Not reached when sequence ends with ret\n"
+		    "\thalt\n"
+		    "rtnpt:  irmovq $5,%%rsi       # Return point\n"
+		    "\thalt\n"
+		    ".pos 0x60\n"
+		    "Stack1:\n"
+		    ".pos 0x68\n"
+		    "Stack2:\n"
+		    ".pos 0x70\n"
+		    "Stack3:\n"
+		    "\thalt\n",
+		    t[0], t[1], t[2], t[3]);
+	    end_test();
+	}
+}
+
+/* etest.pl: Test exception followed by state-setting instruction */
+static void etest()
+{
+    static char *stateset[] = {
+	"andq %rcx,%rcx",                  /* Set condition codes */
+	"rmmovq %rcx,(%rax)"               /* Write to memory */
+    };
+    static char *exceptset[] = {
+	"halt",
+	".byte 0xFF",                      /* Invalid instruction */
+	"rmmovq %rax,0xF0000000(%rax)"     /* Invalid write address */
+    };
+    char tname[MAXBUF];
+    int ei, si, n;
+
+    for (ei = 0; ei < 3; ei++)
+	for (si = 0; si < 2; si++)
+	    /* With 1 nop between the instructions, and in succession */
+	    for (n = 1; n >= 0; n--) {
+		sprintf(tname, "%s-%d-%d", n ? "en" : "e", ei, si);
+		new_test(ETEST, tname);
+		fprintf(yfile,
+			"\t# Preamble.  Initialize memory and registers\n"
+			"\tirmovq $-1,%%rcx    # Create nonzero value\n"
+			"\tirmovq $0x100,%%rax\n"
+			"\txorq %%rdx,%%rdx      # Set Z condition code\n"
+			"\t# Test 3 instruction sequence\n"
+			"\t%s\n\t%s\n\t%s\n"
+			"\t# Complete\n"
+			"\tnop\n\tnop\n\thalt\n",
+			exceptset[ei], n ? "nop" : "", stateset[si]);
+		end_test();
+	    }
+}
+
+/* htest.pl: Test pipeline hazards.  The digit before the colon is the
+   register involved: 1 for %rax, 2 for %rbp, 3 for %rsp */
+static char *hdest[] = {
+    "1:rrmovq %rcx,%rax",
+    "1:irmovq $0x101,%rax",
+    "1:mrmovq 0(%rbp),%rax",
+    "1:addq   %rax,%rax",
+    "1:popq   %rax",
+    "1:cmovne %rcx,%rax",    /* Not taken */
+    "1:cmove  %rcx,%rax",    /* Taken */
+    "2:rrmovq %rax,%rbp",
+    "2:irmovq $0x100,%rbp",
+    "2:mrmovq 4(%rbp),%rbp",
+    "2:addq   %rax,%rbp",
+    "2:popq   %rbp",
+    "2:cmovne %rax,%rbp",    /* Not taken */
+    "2:cmove  %rax,%rbp",    /* Taken */
+    "3:rrmovq %rbp,%rsp",
+    "3:irmovq $0x104,%rsp",
+    "3:mrmovq 4(%rbp),%rsp",
+    "3:addq   %rax,%rsp",
+    "3:popq   %rbp",
+    "3:pushq  %rax",
+    "3:pushq  %rsp",
+    "3:popq   %rsp",
+    "1:cmovne %rbp,%rsp",    /* Not taken */
+    "1:cmove  %rbp,%rsp",    /* Taken */
+    /* With -i */
+    "1:iaddq $0x201,%rax",
+    "2:iaddq $0x4,%rbp",
+    "3:iaddq $0x4,%rsp",
+};
+
+static char *hsrc[] = {
+    "1:rrmovq %rax,%rbp",
+    "1:rmmovq %rax,0(%rbp)",
+    "1:rmmovq %rbp,0(%rax)",
+    "1:mrmovq 4(%rax),%rbp",
+    "1:addq   %rax,%rbp",
+    "1:addq   %rbp,%rax",
+    "1:addq   %rax,%rax",
+    "1:pushq  %rax",
+    "2:rrmovq %rbp,%rbp",
+    "2:rmmovq %rbp,4(%rbp)",
+    "2:rmmovq %rax,0(%rbp)",
+    "2:mrmovq 8(%rbp),%rax",
+    "2:addq   %rbp,%rax",
+    "2:addq   %rax,%rbp",
+    "2:addq   %rbp,%rbp",
+    "2:pushq  %rbp",
+    "3:rrmovq %rsp,%rbp",
+    "3:rmmovq %rsp,4(%rbp)",
+    "3:rmmovq %rax,-4(%rsp)",
+    "3:mrmovq 4(%rsp),%rax",
+    "3:addq   %rsp,%rax",
+    "3:addq   %rax,%rsp",
+    "3:addq   %rsp,%rsp",
+    "3:pushq  %rsp",
+    "3:ret",
+    /* With -i */
+    "1:iaddq $0x301,%rax",
+    "2:iaddq $0x8,%rbp",
+    "3:iaddq $0x8,%rsp",
+};
+
+/* Number of entries in hdest and hsrc without iaddq */
+#define HDEST_CNT 24
+#define HSRC_CNT 25
+
+static char *hpreamble =
+    "\t# Preamble.  Initialize memory and registers\n"
+    "\tirmovq $0xf5,%rax\n"
+    "\tirmovq $0,%rbp\n"
+    "\trmmovq %rax,0xe0(%rbp)\n"
+    "\tirmovq $0xf7,%rax\n"
+    "\trmmovq %rax,0xe8(%rbp)\n"
+    "\tirmovq $0xfb,%rax\n"
+    "\trmmovq %rax,0xf0(%rbp)\n"
+    "\tirmovq $0xff,%rax\n"
+    "\trmmovq %rax,0xf8(%rbp)\n"
+    "\tirmovq $0x100,%rbp\n"
+    "\tirmovq $0x10c,%rsp\n"
+    "\txorq %rax,%rax      # Set Z condition code\n"
+    "\tirmovq $0x80,%rax\n"
+    "\t# Test 4 instruction sequence\n";
+
+static char *htail =
+    "\t# Put in another instruction\n"
+    "\trrmovq %rsp,%rbp\n"
+    "\t# Complete\n"
+    "\thalt\n"
+    "\n"
+    ".pos 0x08\n"
+    "\t.quad pos01\n\t.quad pos02\n\t.quad pos03\n"
+    "\t.quad pos04\n\t.quad pos05\n\t.quad pos06\n"
+    "pos01:\n\thalt\npos02:\n\thalt\npos03:\n\thalt\n"
+    "pos04:\n\thalt\npos05:\n\thalt\npos06:\n\thalt\n"
+    "\thalt\n\thalt\n\thalt\n\thalt\n\thalt\n\thalt\n\thalt\n"
+    "\thalt\n\thalt\n\thalt\n\thalt\n\thalt\n\thalt\n\thalt\n"
+    "\n"
+    ".pos 0x100\n"
+    "\t.quad pos11\n\t.quad pos12\n\t.quad pos13\n"
+    "\t.quad pos14\n\t.quad pos15\n\t.quad pos16\n"
+    "pos11:\n\thalt\npos12:\n\thalt\npos13:\n\thalt\n"
+    "pos14:\n\thalt\npos15:\n\thalt\npos16:\n\thalt\n"
+    "\thalt\n\thalt\n\thalt\n\thalt\n\thalt\n\thalt\n\thalt\n"
+    "\thalt\n\thalt\n"
+    "\n"
+    ".pos 0x180\n"
+    "\t.quad pos21\n\t.quad pos22\n\t.quad pos23\n"
+    "\t.quad pos24\n\t.quad pos25\n\t.quad pos26\n"
+    "pos21:\n\thalt\npos22:\n\thalt\npos23:\n\thalt\n"
+    "pos24:\n\thalt\npos25:\n\thalt\npos26:\n\thalt\n"
+    "\thalt\n\thalt\n\thalt\n\thalt\n\thalt\n\thalt\n\thalt\n"
+    "\thalt\n\thalt\n";
+
+static void htest()
+{
+    static char *pad[3][2] = { { "nop", "nop" }, { "nop", "" }, { "", "" } };
+    static char *prefix[3] = { "hnn", "hn", "h" };
+    int ndest = testiaddq ? sizeof(hdest)/sizeof(char *) : HDEST_CNT;
+    int nsrc = testiaddq ? sizeof(hsrc)/sizeof(char *) : HSRC_CNT;
+    char tname[MAXBUF];
+    int di, si, p;
+
+    for (di = 0; di < ndest; di++)
+	for (si = 0; si < nsrc; si++) {
+	    if (hdest[di][0] != hsrc[si][0])
+		continue;
+	    /* Two instructions with 2 nops, 1 nop, or none between them */
+	    for (p = 0; p < 3; p++) {
+		sprintf(tname, "%s-%d-%d", prefix[p], di, si);
+		new_test(HTEST, tname);
+		fputs(hpreamble, yfile);
+		fprintf(yfile, "\t%s\n\t%s\n\t%s\n\t%s\n",
+			hdest[di]+2, pad[p][0], pad[p][1], hsrc[si]+2);
+		fputs(htail, yfile);
+		end_test();
+	    }
+	}
+}
+
+
+/*****************************************************************
+ * Part 2: Running the tests.  The yas core keeps its state in
+ * globals, so every test is assembled first.  Then threads take
+ * tests in order, each simulating in its own context, and keep what
+ * the ISA check reports for the report.
+ *****************************************************************/
+
+/* Assemble a test into its object code */
+static void assemble_test(test_ptr t)
+{
+    FILE *in, *out;
+    int err;
+
+    in = fmemopen(t->src, t->len, "r");
+    out = open_memstream(&t->obj, &t->objlen);
+    err = assemble(in, out);
+    fclose(in);
+    fclose(out);
+    if (err) {
+	free(t->obj);
+	t->obj = NULL;
+    }
+}
+
+/* Simulate one test, checking it against the ISA */
+static void run_test(sim_ctx_t *ctx, test_ptr t)
+{
+    FILE *in;
+    int err;
+    byte_t run_status = STAT_AOK;
+    cc_t result_cc = 0;
+
+    t->ok = FALSE;
+    if (!t->obj)
+	return;
+
+    sim_reset(ctx);
+    clear_mem(ctx->mem);
+    in = fmemopen(t->obj, t->objlen, "r");
+    err = load_mem(ctx->mem, in, 1) == 0;
+    fclose(in);
+    if (err)
+	return;
+
+    ctx->isa_state = new_state(0);
+    free_mem(ctx->isa_state->r);
+    free_mem(ctx->isa_state->m);
+    ctx->isa_state->m = copy_mem(ctx->mem);
+    ctx->isa_state->r = copy_mem(ctx->reg);
+    ctx->isa_state->cc = ctx->cc;
+    ctx->check_ok = TRUE;
+    ctx->check_out = open_memstream(&t->log, &t->loglen);
+
+#ifdef SEQ
+    t->cycles = t->instructions =
+	sim_run(ctx, instr_limit, &run_status, &result_cc);
+#else
+    sim_run_pipe(ctx, instr_limit, 5*instr_limit, &run_status, &result_cc);
+    t->cycles = ctx->cycles;
+    t->instructions = ctx->instructions;
+#endif
+
+    t->ok = ctx->check_ok &&
+	!diff_reg(ctx->isa_state->r, ctx->reg, NULL) &&
+	!diff_mem(ctx->isa_state->m, ctx->mem, NULL) &&
+	ctx->isa_state->cc == result_cc;
+    fclose(ctx->check_out);
+    ctx->check_out = stdout;
+    free_state(ctx->isa_state);
+    ctx->isa_state = NULL;
+}
+
+static void *run_thread(void *arg)
+{
+    sim_ctx_t *ctx = sim_new();
+    int i;
+    for (;;) {
+	pthread_mutex_lock(&test_lock);
+	i = next_test++;
+	pthread_mutex_unlock(&test_lock);
+	if (i >= test_cnt)
+	    break;
+	run_test(ctx, &tests[i]);
+    }
+    sim_free(ctx);
+    return NULL;
+}
+
+static void run_tests()
+{
+    pthread_t *tids;
+    int i, t;
+
+    for (i = 0; i < test_cnt; i++)
+	assemble_test(&tests[i]);
+
+    if (jobs > test_cnt)
+	jobs = test_cnt > 0 ? test_cnt : 1;
+    tids = (pthread_t *) malloc(jobs * sizeof(pthread_t));
+    if (!tids) {
+	perror("malloc error");
+	exit(1);
+    }
+    for (t = 0; t < jobs; t++)
+	if (pthread_create(&tids[t], NULL, run_thread, NULL)) {
+	    fprintf(stderr, "Couldn't create thread\n");
+	    exit(1);
+	}
+    for (t = 0; t < jobs; t++)
+	pthread_join(tids[t], NULL);
+    free(tids);
+}
+
+
+/*****************************************************************
+ * Part 3: Reporting, in the format of tester.pm
+ *****************************************************************/
+
+/* Leave source of failing test in outputdir */
+static void save_test(test_ptr t)
+{
+    char fname[MAXBUF];
+    FILE *fp;
+    snprintf(fname, MAXBUF, "%s/%s.ys", outputdir, t->name);
+    fp = fopen(fname, "w");
+    if (!fp) {
+	fprintf(stderr, "Can't write to %s\n", fname);
+	return;
+    }
+    fwrite(t->src, 1, t->len, fp);
+    fclose(fp);
+}
+
+/* Find target cycle count for test in perf_file.  Return -1 if none */
+static word_t perf_target(char *tname)
+{
+    char buf[MAXBUF];
+    size_t len = strlen(tname);
+    word_t pcycles = -1;
+    FILE *fp = fopen(perf_file, "r");
+    if (!fp) {
+	fprintf(stderr, "Couldn't open file %s\n", perf_file);
+	exit(1);
+    }
+    while (fgets(buf, MAXBUF, fp)) {
+	if (!strncmp(buf, tname, len) && buf[len] == ':') {
+	    pcycles = atoll(buf+len+1);
+	    break;
+	}
+    }
+    fclose(fp);
+    return pcycles;
+}
+
+static void report_suite(suite_t suite)
+{
+    int i;
+    int tcount = 0, ecount = 0, pecount = 0;
+
+    printf("Simulating with %s\n", simname);
+    for (i = 0; i < test_cnt; i++) {
+	test_ptr t = &tests[i];
+	if (t->suite != suite)
+	    continue;
+	if (!t->ok) {
+	    printf("Test %s failed\n", t->name);
+	    if (t->loglen > 0)
+		fwrite(t->log, 1, t->loglen, stdout);
+	    ecount++;
+	    save_test(t);
+	}
+	if (gen_perf)
+	    printf("%s:%lld:%lld\n", t->name, t->cycles, t->instructions);
+	if (perf_file) {
+	    word_t pcycles = perf_target(t->name);
+	    if (t->cycles != pcycles) {
+		pecount++;
+		printf("Test %s.\tMeasured cycles=%lld != Target cycles=%lld\n",
+		       t->name, t->cycles, pcycles);
+	    }
+	}
+	tcount++;
+    }
+    if (ecount == 0)
+	printf("  All %d ISA Checks Succeed\n", tcount);
+    else
+	printf("  %d/%d ISA Checks Failed\n", ecount, tcount);
+    if (perf_file) {
+	if (pecount == 0)
+	    printf("  All %d Performance Checks Succeed\n", tcount);
+	else
+	    printf("   %d/%d Performance Checks Failed\n", pecount, tcount);
+    }
+}
+
+static void usage(char *name)
+{
+    printf("Usage: %s [-hiP] [-d dir] [-p pfile] [-j n] [-t tests]\n", name);
+    printf("   -h       Print this message\n");
+    printf("   -i       Test iaddq instruction\n");
+    printf("   -d dir   Specify directory for counterexamples\n");
+    printf("   -P       Generate performance data\n");
+    printf("   -p pfile Check using performance file pfile\n");
+    printf("   -j n     Run n worker threads (default: number of CPUs)\n");
+    printf("   -t tests Comma-separated tests to run, from op,j,c,e,h (default op,j,c,h)\n");
+    exit(0);
+}
+
+/* Select tests listed in comma-separated list */
+static void set_suites(char *list, char *name)
+{
+    char buf[MAXBUF];
+    char *s;
+    int i;
+    for (i = 0; i < NSUITE; i++)
+	run_suite[i] = FALSE;
+    strncpy(buf, list, MAXBUF-1);
+    buf[MAXBUF-1] = '\0';
+    for (s = strtok(buf, ","); s; s = strtok(NULL, ",")) {
+	for (i = 0; i < NSUITE; i++)
+	    if (!strcmp(s, suite_names[i]))
+		break;
+	if (i == NSUITE) {
+	    printf("Unknown test '%s'\n", s);
+	    usage(name);
+	}
+	run_suite[i] = TRUE;
+    }
+}
+
+/*
+ * sim_main - called from the main() routine in the HCL file, in place
+ * of the simulator's own
+ */
+int sim_main(int argc, char **argv)
+{
+    int c;
+    suite_t s;
+
+    jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs < 1)
+	jobs = 1;
+
+    while ((c = getopt(argc, argv, "hiPp:d:j:t:")) != -1) {
+	switch(c) {
+	case 'h':
+	    usage(argv[0]);
+	    break;
+	case 'i':
+	    testiaddq = TRUE;
+	    break;
+	case 'P':
+	    gen_perf = TRUE;
+	    break;
+	case 'p':
+	    perf_file = optarg;
+	    break;
+	case 'd':
+	    outputdir = optarg;
+	    break;
+	case 'j':
+	    jobs = atoi(optarg);
+	    if (jobs < 1) {
+		printf("Invalid number of jobs %d\n", jobs);
+		usage(argv[0]);
+	    }
+	    break;
+	case 't':
+	    set_suites(optarg, argv[0]);
+	    break;
+	default:
+	    printf("Invalid option '%c'\n", c);
+	    usage(argv[0]);
+	    break;
+	}
+    }
+
+    verbosity = 0;
+    fast_mode = TRUE;
+
+    if (run_suite[OPTEST])
+	optest();
+    if (run_suite[JTEST])
+	jtest();
+    if (run_suite[CTEST])
+	ctest();
+    if (run_suite[ETEST])
+	etest();
+    if (run_suite[HTEST])
+	htest();
+
+    run_tests();
+
+    for (s = 0; s < NSUITE; s++)
+	if (run_suite[s])
+	    report_suite(s);
+    exit(0);
+}
@@ -12,7 +12,7 @@ quote '#include <stdio.h>'
 quote '#include "isa.h"'
 quote '#include "sim.h"'
 quote 'int sim_main(int argc, char *argv[]);'
-quote 'word_t gen_new_pc(){return 0;}'
+quote 'word_t gen_new_pc(sim_ctx_t *ctx){return 0;}'
 quote 'int main(int argc, char *argv[])'
 quote '  {plusmode=1;return sim_main(argc,argv);}'
 
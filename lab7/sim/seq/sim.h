@@ -13,62 +13,99 @@
 /* Determines whether running SEQ or SEQ+ */
 extern int plusmode;
 
-/* Both instruction and data memory */
-extern mem_t mem;
-
-/* Keep track of range of addresses that have been written */
-extern word_t minAddr;
-extern word_t memCnt;
-
-/* Register file */
-extern mem_t reg;
-/* Condition code register */
-extern cc_t cc;
-/* Program counter */
-extern word_t pc;
-
-/* For seq+ */
-/* Results computed by previous instruction.
-   Used to compute PC in current instruction */
-extern byte_t prev_icode;
-extern byte_t prev_ifun;
-extern word_t prev_valc;
-extern word_t prev_valm;
-extern word_t prev_valp;
-extern bool_t prev_bcond;
-
-/* Intermdiate stage values that must be used by control functions */
-extern byte_t imem_icode;
-extern byte_t imem_ifun;
-extern byte_t icode;
-extern word_t ifun;
-extern word_t ra;
-extern word_t rb;
-extern word_t valc;
-extern word_t valp;
-extern bool_t imem_error;
-extern bool_t instr_valid;
-extern word_t vala;
-extern word_t valb;
-extern word_t vale;
-extern bool_t bcond;
-extern bool_t cond;
-extern word_t valm;
-extern bool_t dmem_error;
-extern byte_t status;
-
-/* Log file */
-extern FILE *dumpfile;
+
+/************ Simulator state ****************/
+
+/* Everything one simulation changes as it runs.  Several contexts can
+   be simulated at once, e.g., by different threads */
+typedef struct sim_ctx {
+    /* Both instruction and data memory */
+    mem_t mem;
+    /* Keep track of range of addresses that have been written */
+    word_t minAddr;
+    word_t memCnt;
+
+    /* Register file */
+    mem_t reg;
+    /* Condition code register */
+    cc_t cc;
+    cc_t cc_in;		/* Input to condition code register */
+    /* Program counter */
+    word_t pc;
+    word_t pc_in;	/* Input to program counter */
+
+    /* For seq+ */
+    /* Results computed by previous instruction.
+       Used to compute PC in current instruction */
+    byte_t prev_icode;
+    byte_t prev_ifun;
+    word_t prev_valc;
+    word_t prev_valm;
+    word_t prev_valp;
+    bool_t prev_bcond;
+
+    byte_t prev_icode_in;
+    byte_t prev_ifun_in;
+    word_t prev_valc_in;
+    word_t prev_valm_in;
+    word_t prev_valp_in;
+    bool_t prev_bcond_in;
+
+    /* Intermdiate stage values that must be used by control functions */
+    byte_t imem_icode;
+    byte_t imem_ifun;
+    byte_t icode;
+    word_t ifun;
+    byte_t instr;
+    word_t ra;
+    word_t rb;
+    word_t valc;
+    word_t valp;
+    bool_t imem_error;
+    bool_t instr_valid;
+
+    word_t srcA;
+    word_t srcB;
+    word_t destE;
+    word_t destM;
+    word_t vala;
+    word_t valb;
+    word_t vale;
+
+    bool_t bcond;
+    bool_t cond;
+    word_t valm;
+    bool_t dmem_error;
+
+    bool_t mem_write;
+    word_t mem_addr;
+    word_t mem_data;
+    byte_t status;
+
+    /* With -t, YIS executes each instruction as SEQ completes it */
+    state_ptr isa_state;
+    bool_t check_ok;		/* No difference found so far? */
+    FILE *check_out;		/* Where differences are reported, stdout by default */
+    retire_rec retiring;	/* Last instruction, until it is checked */
+    bool_t retire_pending;
+    word_t retire_cycle;
+
+    /* Log file */
+    FILE *dumpfile;
+} sim_ctx_t;
 
 
 /* Sets the simulator name (called from main routine in HCL file) */
 void set_simname(char *name);
 
-/* Initialize simulator */
-void sim_init();
+/* Create simulator with cleared memory */
+sim_ctx_t *sim_new();
+
+/* Free simulator and everything it holds other than isa_state */
+void sim_free(sim_ctx_t *ctx);
 
 /* Reset simulator state, including register, instruction, and data memories */
-void sim_reset();
+void sim_reset(sim_ctx_t *ctx);
 
 /*
   Run processor until one of following occurs:
@@ -79,16 +116,19 @@ void sim_reset();
   if statusp nonnull, then will be set to status of final instruction
   if ccp nonnull, then will be set to condition codes of final instruction
 */
-word_t sim_run(word_t max_instr, byte_t *statusp, cc_t *ccp);
+word_t sim_run(sim_ctx_t *ctx, word_t max_instr, byte_t *statusp, cc_t *ccp);
 
 /* If dumpfile set nonNULL, lots of status info printed out */
-void sim_set_dumpfile(FILE *file);
+void sim_set_dumpfile(sim_ctx_t *ctx, FILE *file);
 
 /*
  * sim_log dumps a formatted string to the dumpfile, if it exists
  * accepts variable argument list
  */
-void sim_log( const char *format, ... );
+void sim_log(sim_ctx_t *ctx, const char *format, ... );
+
+/* Don't even evaluate the arguments when there is no dumpfile */
+#define sim_log(ctx, ...) ((ctx)->dumpfile ? sim_log(ctx, __VA_ARGS__) : (void) 0)
 
 
 /******************* GUI Interface Functions **********************/
@@ -102,7 +142,39 @@ void report_state(char *id, char *txt);
 
 void show_cc(cc_t cc);
 
-void create_memory_display();
-void set_memory(word_t addr, word_t val);
+void create_memory_display(sim_ctx_t *ctx);
+void set_memory(sim_ctx_t *ctx, word_t addr, word_t val);
 #endif
-								       
+
+/************ Names used by the HCL code ****************/
+
+/* hcl2c -c defines HCL_CTX, and passes each generated function the
+   context it evaluates as ctx.  The quoted C code in the HCL file
+   reaches the state of that context through these names */
+#ifdef HCL_CTX
+#define pc (ctx->pc)
+#define prev_icode (ctx->prev_icode)
+#define prev_ifun (ctx->prev_ifun)
+#define prev_valc (ctx->prev_valc)
+#define prev_valm (ctx->prev_valm)
+#define prev_valp (ctx->prev_valp)
+#define prev_bcond (ctx->prev_bcond)
+#define imem_icode (ctx->imem_icode)
+#define imem_ifun (ctx->imem_ifun)
+#define icode (ctx->icode)
+#define ifun (ctx->ifun)
+#define ra (ctx->ra)
+#define rb (ctx->rb)
+#define valc (ctx->valc)
+#define valp (ctx->valp)
+#define imem_error (ctx->imem_error)
+#define instr_valid (ctx->instr_valid)
+#define vala (ctx->vala)
+#define valb (ctx->valb)
+#define vale (ctx->vale)
+#define bcond (ctx->bcond)
+#define cond (ctx->cond)
+#define valm (ctx->valm)
+#define dmem_error (ctx->dmem_error)
+#define status (ctx->status)
+#endif /* HCL_CTX */
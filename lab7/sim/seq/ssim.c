@@ -42,6 +42,12 @@ FILE *object_file;       /* Input file handle */
 bool_t verbosity = 2;    /* Verbosity level [TTY only] (-v) */ 
 word_t instr_limit = 10000; /* Instruction limit [TTY only] (-l) */
 bool_t do_check = FALSE; /* Test with YIS? [TTY only] (-t) */
+bool_t fast_mode = FALSE; /* Run without tracing or reporting? [TTY only] (-f) */
+
+/* Context of the simulation run by the TTY and GUI front ends */
+#ifndef SIM_LIB
+static sim_ctx_t *main_ctx = NULL;
+#endif /* SIM_LIB */
 
 /************* 
  * End Globals 
@@ -52,8 +58,10 @@ bool_t do_check = FALSE; /* Test with YIS? [TTY only] (-t) */
  * Begin function prototypes 
  ***************************/
 
+#ifndef SIM_LIB
 static void usage(char *name);           /* Print helpful usage message */
 static void run_tty_sim();               /* Run simulator in TTY mode */
+#endif /* SIM_LIB */
 
 #ifdef HAS_GUI
 void addAppCommands(Tcl_Interp *interp); /* Add application-dependent commands */
@@ -71,6 +79,10 @@ void addAppCommands(Tcl_Interp *interp); /* Add application-dependent commands *
  * simulation.
  *******************************************************************/
 
+/* With SIM_LIB defined, the simulator is linked into a program such as
+   ptest/ptest.c, which provides sim_main itself */
+#ifndef SIM_LIB
+
 /* 
  * sim_main - main simulator routine. This function is called from the
  * main() routine in the HCL file.
@@ -81,9 +93,10 @@ int sim_main(int argc, char **argv)
     int c;
     char *myargv[MAXARGS];
 
+    main_ctx = sim_new();
     
     /* Parse the command line arguments */
-    while ((c = getopt(argc, argv, "htgl:v:")) != -1) {
+    while ((c = getopt(argc, argv, "htgfl:v:")) != -1) {
 	switch(c) {
 	case 'h':
 	    usage(argv[0]);
@@ -104,6 +117,9 @@ int sim_main(int argc, char **argv)
 	case 'g':
 	    gui_mode = TRUE;
 	    break;
+	case 'f':
+	    fast_mode = TRUE;
+	    break;
 	default:
 	    printf("Invalid option '%c'\n", c);
 	    usage(argv[0]);
@@ -112,6 +128,10 @@ int sim_main(int argc, char **argv)
     }
 
 
+    /* Fast mode only reports the final results */
+    if (fast_mode)
+	verbosity = 0;
+
     /* Do we have too many arguments? */
     if (optind < argc - 1) {
 	printf("Too many command line arguments:");
@@ -192,12 +212,12 @@ int sim_main(int argc, char **argv)
  */
 static void run_tty_sim() 
 {
+    sim_ctx_t *ctx = main_ctx;
     word_t icount = 0;
-    status = STAT_AOK;
+    ctx->status = STAT_AOK;
     cc_t result_cc = 0;
     word_t byte_cnt = 0;
     mem_t mem0, reg0;
-    state_ptr isa_state = NULL;
 
 
     /* In TTY mode, the default object file comes from stdin */
@@ -207,13 +227,12 @@ static void run_tty_sim()
 
     /* Initializations */
     if (verbosity >= 2)
-	sim_set_dumpfile(stdout);
-    sim_init();
+	sim_set_dumpfile(ctx, stdout);
 
     /* Emit simulator name */
     printf("%s\n", simname);
 
-    byte_cnt = load_mem(mem, object_file, 1);
+    byte_cnt = load_mem(ctx->mem, object_file, 1);
     if (byte_cnt == 0) {
 	fprintf(stderr, "No lines of code found\n");
 	exit(1);
@@ -222,56 +241,51 @@ static void run_tty_sim()
     }
     fclose(object_file);
     if (do_check) {
-	isa_state = new_state(0);
-	free_mem(isa_state->r);
-	free_mem(isa_state->m);
-	isa_state->m = copy_mem(mem);
-	isa_state->r = copy_mem(reg);
-	isa_state->cc = cc;
+	ctx->isa_state = new_state(0);
+	free_mem(ctx->isa_state->r);
+	free_mem(ctx->isa_state->m);
+	ctx->isa_state->m = copy_mem(ctx->mem);
+	ctx->isa_state->r = copy_mem(ctx->reg);
+	ctx->isa_state->cc = ctx->cc;
     }
 
-    mem0 = copy_mem(mem);
-    reg0 = copy_mem(reg);
+    mem0 = copy_mem(ctx->mem);
+    reg0 = copy_mem(ctx->reg);
     
 
-    icount = sim_run(instr_limit, &status, &result_cc);
+    icount = sim_run(ctx, instr_limit, &ctx->status, &result_cc);
     if (verbosity > 0) {
 	printf("%lld instructions executed\n", icount);
-	printf("Status = %s\n", stat_name(status));
+	printf("Status = %s\n", stat_name(ctx->status));
 	printf("Condition Codes: %s\n", cc_name(result_cc));
 	printf("Changed Register State:\n");
-	diff_reg(reg0, reg, stdout);
+	diff_reg(reg0, ctx->reg, stdout);
 	printf("Changed Memory State:\n");
-	diff_mem(mem0, mem, stdout);
+	diff_mem(mem0, ctx->mem, stdout);
     }
     if (do_check) {
-	byte_t e = STAT_AOK;
-	int step;
-	bool_t match = TRUE;
+	/* isa_state has already executed the same instructions */
+	bool_t match = ctx->check_ok;
 
-	for (step = 0; step < instr_limit && e == STAT_AOK; step++) {
-	    e = step_state(isa_state, stdout);
-	}
-
-	if (diff_reg(isa_state->r, reg, NULL)) {
+	if (diff_reg(ctx->isa_state->r, ctx->reg, NULL)) {
 	    match = FALSE;
 	    if (verbosity > 0) {
 		printf("ISA Register != Pipeline Register File\n");
-		diff_reg(isa_state->r, reg, stdout);
+		diff_reg(ctx->isa_state->r, ctx->reg, stdout);
 	    }
 	}
-	if (diff_mem(isa_state->m, mem, NULL)) {
+	if (diff_mem(ctx->isa_state->m, ctx->mem, NULL)) {
 	    match = FALSE;
 	    if (verbosity > 0) {
 		printf("ISA Memory != Pipeline Memory\n");
-		diff_mem(isa_state->m, mem, stdout);
+		diff_mem(ctx->isa_state->m, ctx->mem, stdout);
 	    }
 	}
-	if (isa_state->cc != result_cc) {
+	if (ctx->isa_state->cc != result_cc) {
 	    match = FALSE;
 	    if (verbosity > 0) {
 		printf("ISA Cond. Codes (%s) != Pipeline Cond. Codes (%s)\n",
-		       cc_name(isa_state->cc), cc_name(result_cc));
+		       cc_name(ctx->isa_state->cc), cc_name(result_cc));
 	    }
 	}
 	if (match) {
@@ -289,15 +303,17 @@ static void run_tty_sim()
  */
 static void usage(char *name)
 {
-    printf("Usage: %s [-htg] [-l m] [-v n] file.yo\n", name);
+    printf("Usage: %s [-htgf] [-l m] [-v n] file.yo\n", name);
     printf("file.yo required in GUI mode, optional in TTY mode (default stdin)\n");
     printf("   -h     Print this message\n");
     printf("   -g     Run in GUI mode instead of TTY mode (default TTY)\n");  
     printf("   -l m   Set instruction limit to m [TTY mode only] (default %lld)\n", instr_limit);
     printf("   -v n   Set verbosity level to 0 <= n <= 2 [TTY mode only] (default %d)\n", verbosity);
+    printf("   -f     Fast mode: no tracing, only final results [TTY mode only]\n");
     printf("   -t     Test result against ISA simulator (yis) [TTY mode only]\n");
     exit(0);
 }
+#endif /* SIM_LIB */
 
 
 
@@ -309,97 +325,29 @@ static void usage(char *name)
  * Begin Part 2 Globals
  **********************/
 
-/*
- * Variables related to hardware units in the processor
- */
-mem_t mem;  /* Instruction and data memory */
-word_t minAddr = 0;
-word_t memCnt = 0;
-
-/* Other processor state */
-mem_t reg;               /* Register file */
-cc_t cc = DEFAULT_CC;    /* Condition code register */
-cc_t cc_in = DEFAULT_CC; /* Input to condition code register */
-
-/* 
- * SEQ+: Results computed by previous instruction.
- * Used to compute PC in current instruction 
- */
-byte_t prev_icode = I_NOP;
-byte_t prev_ifun = 0;
-word_t prev_valc = 0;
-word_t prev_valm = 0;
-word_t prev_valp = 0;
-bool_t prev_bcond = FALSE;
-
-byte_t prev_icode_in = I_NOP;
-byte_t prev_ifun_in = 0;
-word_t prev_valc_in = 0;
-word_t prev_valm_in = 0;
-word_t prev_valp_in = 0;
-bool_t prev_bcond_in = FALSE;
-
-
-/* Program Counter */
-word_t pc = 0; /* Program counter value */
-word_t pc_in = 0;/* Input to program counter */
-
-/* Intermediate values */
-byte_t imem_icode = I_NOP;
-byte_t imem_ifun = F_NONE;
-byte_t icode = I_NOP;
-word_t ifun = 0;
-byte_t instr = HPACK(I_NOP, F_NONE);
-word_t ra = REG_NONE;
-word_t rb = REG_NONE;
-word_t valc = 0;
-word_t valp = 0;
-bool_t imem_error;
-bool_t instr_valid;
-
-word_t srcA = REG_NONE;
-word_t srcB = REG_NONE;
-word_t destE = REG_NONE;
-word_t destM = REG_NONE;
-word_t vala = 0;
-word_t valb = 0;
-word_t vale = 0;
-
-bool_t bcond = FALSE;
-bool_t cond = FALSE;
-word_t valm = 0;
-bool_t dmem_error;
-
-bool_t mem_write = FALSE;
-word_t mem_addr = 0;
-word_t mem_data = 0;
-byte_t status = STAT_AOK;
-
+/* The state of each simulation is held in its sim_ctx_t */
 
 /* Values computed by control logic */
-word_t gen_pc();  /* SEQ+ */
-word_t gen_icode();
-word_t gen_ifun();
-word_t gen_need_regids();
-word_t gen_need_valC();
-word_t gen_instr_valid();
-word_t gen_srcA();
-word_t gen_srcB();
-word_t gen_dstE();
-word_t gen_dstM();
-word_t gen_aluA();
-word_t gen_aluB();
-word_t gen_alufun();
-word_t gen_set_cc();
-word_t gen_mem_addr();
-word_t gen_mem_data();
-word_t gen_mem_read();
-word_t gen_mem_write();
-word_t gen_Stat();
-word_t gen_new_pc();
-
-/* Log file */
-FILE *dumpfile = NULL;
+word_t gen_pc(sim_ctx_t *ctx);  /* SEQ+ */
+word_t gen_icode(sim_ctx_t *ctx);
+word_t gen_ifun(sim_ctx_t *ctx);
+word_t gen_need_regids(sim_ctx_t *ctx);
+word_t gen_need_valC(sim_ctx_t *ctx);
+word_t gen_instr_valid(sim_ctx_t *ctx);
+word_t gen_srcA(sim_ctx_t *ctx);
+word_t gen_srcB(sim_ctx_t *ctx);
+word_t gen_dstE(sim_ctx_t *ctx);
+word_t gen_dstM(sim_ctx_t *ctx);
+word_t gen_aluA(sim_ctx_t *ctx);
+word_t gen_aluB(sim_ctx_t *ctx);
+word_t gen_alufun(sim_ctx_t *ctx);
+word_t gen_set_cc(sim_ctx_t *ctx);
+word_t gen_mem_addr(sim_ctx_t *ctx);
+word_t gen_mem_data(sim_ctx_t *ctx);
+word_t gen_mem_read(sim_ctx_t *ctx);
+word_t gen_mem_write(sim_ctx_t *ctx);
+word_t gen_Stat(sim_ctx_t *ctx);
+word_t gen_new_pc(sim_ctx_t *ctx);
 
 #ifdef HAS_GUI
 /* Representations of digits */
@@ -432,355 +380,420 @@ void wstring(uword_t x, int bpd, int bpw, char *str)
 static char status_msg[128];
 
 /* SEQ+ */
-static char *format_prev()
+static char *format_prev(sim_ctx_t *ctx)
 {
     char istring[17];
     char mstring[17];
     char pstring[17];
-    wstring(prev_valc, 4, 64, istring);
-    wstring(prev_valm, 4, 64, mstring);
-    wstring(prev_valp, 4, 64, pstring);
+    wstring(ctx->prev_valc, 4, 64, istring);
+    wstring(ctx->prev_valm, 4, 64, mstring);
+    wstring(ctx->prev_valp, 4, 64, pstring);
     sprintf(status_msg, "%c %s %s %s %s",
-	    prev_bcond ? 'Y' : 'N',
-	    iname(HPACK(prev_icode, prev_ifun)),
+	    ctx->prev_bcond ? 'Y' : 'N',
+	    iname(HPACK(ctx->prev_icode, ctx->prev_ifun)),
 	    istring, mstring, pstring);
 
     return status_msg;
 }
 
-static char *format_pc()
+static char *format_pc(sim_ctx_t *ctx)
 {
     char pstring[17];
-    wstring(pc, 4, 64, pstring);
+    wstring(ctx->pc, 4, 64, pstring);
     sprintf(status_msg, "%s", pstring);
     return status_msg;
 }
 
-static char *format_f()
+static char *format_f(sim_ctx_t *ctx)
 {
     char valcstring[17];
     char valpstring[17];
-    wstring(valc, 4, 64, valcstring);
-    wstring(valp, 4, 64, valpstring);
+    wstring(ctx->valc, 4, 64, valcstring);
+    wstring(ctx->valp, 4, 64, valpstring);
     sprintf(status_msg, "%s %s %s %s %s", 
-	    iname(HPACK(icode, ifun)),
-	    reg_name(ra),
-	    reg_name(rb),
+	    iname(HPACK(ctx->icode, ctx->ifun)),
+	    reg_name(ctx->ra),
+	    reg_name(ctx->rb),
 	    valcstring,
 	    valpstring);
     return status_msg;
 }
 
-static char *format_d()
+static char *format_d(sim_ctx_t *ctx)
 {
     char valastring[17];
     char valbstring[17];
-    wstring(vala, 4, 64, valastring);
-    wstring(valb, 4, 64, valbstring);
+    wstring(ctx->vala, 4, 64, valastring);
+    wstring(ctx->valb, 4, 64, valbstring);
     sprintf(status_msg, "%s %s %s %s %s %s",
 	    valastring,
 	    valbstring,
-	    reg_name(destE),
-	    reg_name(destM),
-	    reg_name(srcA),
-	    reg_name(srcB));
+	    reg_name(ctx->destE),
+	    reg_name(ctx->destM),
+	    reg_name(ctx->srcA),
+	    reg_name(ctx->srcB));
 
     return status_msg;
 }
 
-static char *format_e()
+static char *format_e(sim_ctx_t *ctx)
 {
     char valestring[17];
-    wstring(vale, 4, 64, valestring);
+    wstring(ctx->vale, 4, 64, valestring);
     sprintf(status_msg, "%c %s",
-	    bcond ? 'Y' : 'N',
+	    ctx->bcond ? 'Y' : 'N',
 	    valestring);
     return status_msg;
 }
 
-static char *format_m()
+static char *format_m(sim_ctx_t *ctx)
 {
     char valmstring[17];
-    wstring(valm, 4, 64, valmstring);
+    wstring(ctx->valm, 4, 64, valmstring);
     sprintf(status_msg, "%s", valmstring);
     return status_msg;
 }
 
-static char *format_npc()
+static char *format_npc(sim_ctx_t *ctx)
 {
     char npcstring[17];
-    wstring(pc_in, 4, 64, npcstring);
+    wstring(ctx->pc_in, 4, 64, npcstring);
     sprintf(status_msg, "%s", npcstring);
     return status_msg;
 }
 #endif /* HAS_GUI */
 
 /* Report system state */
-static void sim_report() {
+static void sim_report(sim_ctx_t *ctx) {
 
 #ifdef HAS_GUI
     if (gui_mode) {
-	report_pc(pc);
+	report_pc(ctx->pc);
 	if (plusmode) {
-	    report_state("PREV", format_prev());
-	    report_state("PC", format_pc());
+	    report_state("PREV", format_prev(ctx));
+	    report_state("PC", format_pc(ctx));
 	} else {
-	    report_state("OPC", format_pc());
+	    report_state("OPC", format_pc(ctx));
 	}
-	report_state("F", format_f());
-	report_state("D", format_d());
-	report_state("E", format_e());
-	report_state("M", format_m());
+	report_state("F", format_f(ctx));
+	report_state("D", format_d(ctx));
+	report_state("E", format_e(ctx));
+	report_state("M", format_m(ctx));
 	if (!plusmode) {
-	    report_state("NPC", format_npc());
+	    report_state("NPC", format_npc(ctx));
 	}
-	show_cc(cc);
+	show_cc(ctx->cc);
     }
 #endif /* HAS_GUI */
 
 }
 
-static int initialized = 0;
-void sim_init()
+sim_ctx_t *sim_new()
 {
+    sim_ctx_t *ctx = (sim_ctx_t *) calloc(1, sizeof(sim_ctx_t));
+
+    if (!ctx) {
+	perror("calloc error");
+	exit(1);
+    }
+    ctx->check_ok = TRUE;
+    ctx->check_out = stdout;
+    ctx->status = STAT_AOK;
 
     /* Create memory and register files */
-    initialized = 1;
-    mem = init_mem(MEM_SIZE);
-    reg = init_reg();
-    sim_reset();
-    clear_mem(mem);
+    ctx->mem = init_mem(MEM_SIZE);
+    ctx->reg = init_reg();
+    sim_reset(ctx);
+    clear_mem(ctx->mem);
+    return ctx;
 }
 
-void sim_reset()
+void sim_free(sim_ctx_t *ctx)
 {
-    if (!initialized)
-	sim_init();
-    clear_mem(reg);
-    minAddr = 0;
-    memCnt = 0;
+    free_mem(ctx->mem);
+    free_reg(ctx->reg);
+    free(ctx);
+}
+
+void sim_reset(sim_ctx_t *ctx)
+{
+    clear_mem(ctx->reg);
+    ctx->minAddr = 0;
+    ctx->memCnt = 0;
 
 #ifdef HAS_GUI
     if (gui_mode) {
 	signal_register_clear();
-	create_memory_display();
-	sim_report();
+	create_memory_display(ctx);
+	sim_report(ctx);
     }
 #endif
 
     if (plusmode) {
-	prev_icode = prev_icode_in = I_NOP;
-	prev_ifun = prev_ifun_in = 0;
-	prev_valc = prev_valc_in = 0;
-	prev_valm = prev_valm_in = 0;
-	prev_valp = prev_valp_in = 0;
-	prev_bcond = prev_bcond_in = FALSE;
-	pc = 0;
+	ctx->prev_icode = ctx->prev_icode_in = I_NOP;
+	ctx->prev_ifun = ctx->prev_ifun_in = 0;
+	ctx->prev_valc = ctx->prev_valc_in = 0;
+	ctx->prev_valm = ctx->prev_valm_in = 0;
+	ctx->prev_valp = ctx->prev_valp_in = 0;
+	ctx->prev_bcond = ctx->prev_bcond_in = FALSE;
+	ctx->pc = 0;
     } else {
-	pc_in = 0;
+	ctx->pc_in = 0;
     }
-    cc = DEFAULT_CC;
-    cc_in = DEFAULT_CC;
-    destE = REG_NONE;
-    destM = REG_NONE;
-    mem_write = FALSE;
-    mem_addr = 0;
-    mem_data = 0;
+    ctx->cc = DEFAULT_CC;
+    ctx->cc_in = DEFAULT_CC;
+    ctx->destE = REG_NONE;
+    ctx->destM = REG_NONE;
+    ctx->mem_write = FALSE;
+    ctx->mem_addr = 0;
+    ctx->mem_data = 0;
+    ctx->retire_pending = FALSE;
+    ctx->retire_cycle = 0;
 
     /* Reset intermediate values to clear display */
-    icode = I_NOP;
-    ifun = 0;
-    instr = HPACK(I_NOP, F_NONE);
-    ra = REG_NONE;
-    rb = REG_NONE;
-    valc = 0;
-    valp = 0;
-
-    srcA = REG_NONE;
-    srcB = REG_NONE;
-    destE = REG_NONE;
-    destM = REG_NONE;
-    vala = 0;
-    valb = 0;
-    vale = 0;
-
-    cond = FALSE;
-    bcond = FALSE;
-    valm = 0;
-
-    sim_report();
+    ctx->icode = I_NOP;
+    ctx->ifun = 0;
+    ctx->instr = HPACK(I_NOP, F_NONE);
+    ctx->ra = REG_NONE;
+    ctx->rb = REG_NONE;
+    ctx->valc = 0;
+    ctx->valp = 0;
+
+    ctx->srcA = REG_NONE;
+    ctx->srcB = REG_NONE;
+    ctx->destE = REG_NONE;
+    ctx->destM = REG_NONE;
+    ctx->vala = 0;
+    ctx->valb = 0;
+    ctx->vale = 0;
+
+    ctx->cond = FALSE;
+    ctx->bcond = FALSE;
+    ctx->valm = 0;
+
+    sim_report(ctx);
 }
 
 /* Update the processor state */
-static void update_state()
+static void update_state(sim_ctx_t *ctx)
 {
     if (plusmode) {
-	prev_icode = prev_icode_in;
-	prev_ifun  = prev_ifun_in;
-	prev_valc  = prev_valc_in;
-	prev_valm  = prev_valm_in;
-	prev_valp  = prev_valp_in;
-	prev_bcond = prev_bcond_in;
+	ctx->prev_icode = ctx->prev_icode_in;
+	ctx->prev_ifun  = ctx->prev_ifun_in;
+	ctx->prev_valc  = ctx->prev_valc_in;
+	ctx->prev_valm  = ctx->prev_valm_in;
+	ctx->prev_valp  = ctx->prev_valp_in;
+	ctx->prev_bcond = ctx->prev_bcond_in;
     } else {
-	pc = pc_in;
+	ctx->pc = ctx->pc_in;
     }
-    cc = cc_in;
+    ctx->cc = ctx->cc_in;
     /* Writeback */
-    if (destE != REG_NONE)
-	set_reg_val(reg, destE, vale);
-    if (destM != REG_NONE)
-	set_reg_val(reg, destM, valm);
+    if (ctx->destE != REG_NONE)
+	set_reg_val(ctx->reg, ctx->destE, ctx->vale);
+    if (ctx->destM != REG_NONE)
+	set_reg_val(ctx->reg, ctx->destM, ctx->valm);
 
-    if (mem_write) {
+    if (ctx->mem_write) {
       /* Should have already tested this address */
-      set_word_val(mem, mem_addr, mem_data);
-	sim_log("Wrote 0x%llx to address 0x%llx\n", mem_data, mem_addr);
+      set_word_val(ctx->mem, ctx->mem_addr, ctx->mem_data);
+	sim_log(ctx, "Wrote 0x%llx to address 0x%llx\n", ctx->mem_data, ctx->mem_addr);
 #ifdef HAS_GUI
 	    if (gui_mode) {
-		if (mem_addr % 8 != 0) {
+		if (ctx->mem_addr % 8 != 0) {
 		    /* Just did a misaligned write.
 		       Need to display both words */
-		    word_t align_addr = mem_addr & ~0x3;
+		    word_t align_addr = ctx->mem_addr & ~0x3;
 		    word_t val;
-		    get_word_val(mem, align_addr, &val);
-		    set_memory(align_addr, val);
+		    get_word_val(ctx->mem, align_addr, &val);
+		    set_memory(ctx, align_addr, val);
 		    align_addr+=8;
-		    get_word_val(mem, align_addr, &val);
-		    set_memory(align_addr, val);
+		    get_word_val(ctx->mem, align_addr, &val);
+		    set_memory(ctx, align_addr, val);
 		} else {
-		    set_memory(mem_addr, mem_data);
+		    set_memory(ctx, ctx->mem_addr, ctx->mem_data);
 		}
 	    }
 #endif /* HAS_GUI */
     }
 }
 
+/* Lockstep checking with YIS (-t).  An instruction is checked once
+   update_state has written its results, at the start of the next step.
+   A faulting instruction writes nothing, so it is checked right away */
+static void check_step(sim_ctx_t *ctx)
+{
+    if (!check_retire(ctx->isa_state, &ctx->retiring, ctx->check_out)) {
+	fprintf(ctx->check_out, "ISA Check Fails in cycle %lld\n", ctx->retire_cycle);
+	ctx->check_ok = FALSE;
+    }
+    ctx->retire_pending = FALSE;
+    ctx->retire_cycle++;
+}
+
+static void record_step(sim_ctx_t *ctx)
+{
+    ctx->retiring.pc = ctx->pc;
+    ctx->retiring.status = ctx->status;
+    ctx->retiring.dstE = ctx->destE;
+    ctx->retiring.valE = ctx->vale;
+    ctx->retiring.dstM = ctx->destM;
+    ctx->retiring.valM = ctx->valm;
+    ctx->retiring.mem_write = ctx->mem_write;
+    ctx->retiring.mem_addr = ctx->mem_addr;
+    ctx->retiring.mem_data = ctx->mem_data;
+    ctx->retire_pending = TRUE;
+    if (ctx->status != STAT_AOK) {
+	/* The run ends before update_state makes its writes */
+	ctx->retiring.dstE = ctx->retiring.dstM = REG_NONE;
+	ctx->retiring.mem_write = FALSE;
+	check_step(ctx);
+    }
+}
+
 /* Execute one instruction */
 /* Return resulting status */
-static byte_t sim_step()
+/* Fast is a constant in each caller, so the compiler generates one copy
+   of the step with the GUI reporting and one without */
+static inline byte_t sim_step_body(sim_ctx_t *ctx, const bool_t fast)
 {
     word_t aluA;
     word_t aluB;
     word_t alufun;
 
-    status = STAT_AOK;
-    imem_error = dmem_error = FALSE;
+    ctx->status = STAT_AOK;
+    ctx->imem_error = ctx->dmem_error = FALSE;
 
-    update_state(); /* Update state from last cycle */
+    update_state(ctx); /* Update state from last cycle */
+    if (ctx->retire_pending && ctx->check_ok)
+	check_step(ctx);
 
     if (plusmode) {
-	pc = gen_pc();
+	ctx->pc = gen_pc(ctx);
     }
-    valp = pc;
-    instr = HPACK(I_NOP, F_NONE);
-    imem_error = !get_byte_val(mem, valp, &instr);
-    if (imem_error) {
-	sim_log("Couldn't fetch at address 0x%llx\n", valp);
+    ctx->valp = ctx->pc;
+    ctx->instr = HPACK(I_NOP, F_NONE);
+    ctx->imem_error = !get_byte_val(ctx->mem, ctx->valp, &ctx->instr);
+    if (ctx->imem_error) {
+	sim_log(ctx, "Couldn't fetch at address 0x%llx\n", ctx->valp);
     }
-    imem_icode = HI4(instr);
-    imem_ifun = LO4(instr);
-    icode = gen_icode();
-    ifun  = gen_ifun();
-    instr_valid = gen_instr_valid();
-    valp++;
-    if (gen_need_regids()) {
+    ctx->imem_icode = HI4(ctx->instr);
+    ctx->imem_ifun = LO4(ctx->instr);
+    ctx->icode = gen_icode(ctx);
+    ctx->ifun  = gen_ifun(ctx);
+    ctx->instr_valid = gen_instr_valid(ctx);
+    ctx->valp++;
+    if (gen_need_regids(ctx)) {
 	byte_t regids;
-	if (get_byte_val(mem, valp, &regids)) {
-	    ra = GET_RA(regids);
-	    rb = GET_RB(regids);
+	if (get_byte_val(ctx->mem, ctx->valp, &regids)) {
+	    ctx->ra = GET_RA(regids);
+	    ctx->rb = GET_RB(regids);
 	} else {
-	    ra = REG_NONE;
-	    rb = REG_NONE;
-	    status = STAT_ADR;
-	    sim_log("Couldn't fetch at address 0x%llx\n", valp);
+	    ctx->ra = REG_NONE;
+	    ctx->rb = REG_NONE;
+	    ctx->status = STAT_ADR;
+	    sim_log(ctx, "Couldn't fetch at address 0x%llx\n", ctx->valp);
 	}
-	valp++;
+	ctx->valp++;
     } else {
-	ra = REG_NONE;
-	rb = REG_NONE;
+	ctx->ra = REG_NONE;
+	ctx->rb = REG_NONE;
     }
 
-    if (gen_need_valC()) {
-	if (get_word_val(mem, valp, &valc)) {
+    if (gen_need_valC(ctx)) {
+	if (get_word_val(ctx->mem, ctx->valp, &ctx->valc)) {
 	} else {
-	    valc = 0;
-	    status = STAT_ADR;
-	    sim_log("Couldn't fetch at address 0x%llx\n", valp);
+	    ctx->valc = 0;
+	    ctx->status = STAT_ADR;
+	    sim_log(ctx, "Couldn't fetch at address 0x%llx\n", ctx->valp);
 	}
-	valp+=8;
+	ctx->valp+=8;
     } else {
-	valc = 0;
+	ctx->valc = 0;
     }
-    sim_log("IF: Fetched %s at 0x%llx.  ra=%s, rb=%s, valC = 0x%llx\n",
-	    iname(HPACK(icode,ifun)), pc, reg_name(ra), reg_name(rb), valc);
+    sim_log(ctx, "IF: Fetched %s at 0x%llx.  ra=%s, rb=%s, valC = 0x%llx\n",
+	    iname(HPACK(ctx->icode,ctx->ifun)), ctx->pc, reg_name(ctx->ra), reg_name(ctx->rb), ctx->valc);
 
-    if (status == STAT_AOK && icode == I_HALT) {
-	status = STAT_HLT;
+    if (ctx->status == STAT_AOK && ctx->icode == I_HALT) {
+	ctx->status = STAT_HLT;
     }
     
-    srcA = gen_srcA();
-    if (srcA != REG_NONE) {
-	vala = get_reg_val(reg, srcA);
+    ctx->srcA = gen_srcA(ctx);
+    if (ctx->srcA != REG_NONE) {
+	ctx->vala = get_reg_val(ctx->reg, ctx->srcA);
     } else {
-	vala = 0;
+	ctx->vala = 0;
     }
     
-    srcB = gen_srcB();
-    if (srcB != REG_NONE) {
-	valb = get_reg_val(reg, srcB);
+    ctx->srcB = gen_srcB(ctx);
+    if (ctx->srcB != REG_NONE) {
+	ctx->valb = get_reg_val(ctx->reg, ctx->srcB);
     } else {
-	valb = 0;
+	ctx->valb = 0;
     }
 
-    cond = cond_holds(cc, ifun);
+    ctx->cond = cond_holds(ctx->cc, ctx->ifun);
 
-    destE = gen_dstE();
-    destM = gen_dstM();
+    ctx->destE = gen_dstE(ctx);
+    ctx->destM = gen_dstM(ctx);
 
-    aluA = gen_aluA();
-    aluB = gen_aluB();
-    alufun = gen_alufun();
-    vale = compute_alu(alufun, aluA, aluB);
-    cc_in = cc;
-    if (gen_set_cc())
-	cc_in = compute_cc(alufun, aluA, aluB);
+    aluA = gen_aluA(ctx);
+    aluB = gen_aluB(ctx);
+    alufun = gen_alufun(ctx);
+    ctx->vale = compute_alu(alufun, aluA, aluB);
+    ctx->cc_in = ctx->cc;
+    if (gen_set_cc(ctx))
+	ctx->cc_in = compute_cc(alufun, aluA, aluB);
 
-    bcond =  cond && (icode == I_JMP);
+    ctx->bcond =  ctx->cond && (ctx->icode == I_JMP);
 
-    mem_addr = gen_mem_addr();
-    mem_data = gen_mem_data();
+    ctx->mem_addr = gen_mem_addr(ctx);
+    ctx->mem_data = gen_mem_data(ctx);
 
 
-    if (gen_mem_read()) {
-      dmem_error = dmem_error || !get_word_val(mem, mem_addr, &valm);
-      if (dmem_error) {
-	sim_log("Couldn't read at address 0x%llx\n", mem_addr);
+    if (gen_mem_read(ctx)) {
+      ctx->dmem_error = ctx->dmem_error || !get_word_val(ctx->mem, ctx->mem_addr, &ctx->valm);
+      if (ctx->dmem_error) {
+	sim_log(ctx, "Couldn't read at address 0x%llx\n", ctx->mem_addr);
       }
     } else
-      valm = 0;
+      ctx->valm = 0;
 
-    mem_write = gen_mem_write();
-    if (mem_write) {
+    ctx->mem_write = gen_mem_write(ctx);
+    if (ctx->mem_write) {
       /* Do a test read of the data memory to make sure address is OK */
       word_t junk;
-      dmem_error = dmem_error || !get_word_val(mem, mem_addr, &junk);
+      ctx->dmem_error = ctx->dmem_error || !get_word_val(ctx->mem, ctx->mem_addr, &junk);
     }
 
-    status = gen_Stat();
+    ctx->status = gen_Stat(ctx);
 
     if (plusmode) {
-	prev_icode_in = icode;
-	prev_ifun_in = ifun;
-	prev_valc_in = valc;
-	prev_valm_in = valm;
-	prev_valp_in = valp;
-	prev_bcond_in = bcond;
+	ctx->prev_icode_in = ctx->icode;
+	ctx->prev_ifun_in = ctx->ifun;
+	ctx->prev_valc_in = ctx->valc;
+	ctx->prev_valm_in = ctx->valm;
+	ctx->prev_valp_in = ctx->valp;
+	ctx->prev_bcond_in = ctx->bcond;
     } else {
 	/* Update PC */
-	pc_in = gen_new_pc();
+	ctx->pc_in = gen_new_pc(ctx);
     } 
-    sim_report();
-    return status;
+    if (ctx->isa_state && ctx->check_ok)
+	record_step(ctx);
+    if (!fast)
+	sim_report(ctx);
+    return ctx->status;
+}
+
+static byte_t sim_step(sim_ctx_t *ctx)
+{
+    return sim_step_body(ctx, FALSE);
+}
+
+static byte_t sim_step_fast(sim_ctx_t *ctx)
+{
+    return sim_step_body(ctx, TRUE);
 }
 
 /*
@@ -792,12 +805,13 @@ static byte_t sim_step()
   if statusp nonnull, then will be set to status of final instruction
   if ccp nonnull, then will be set to condition codes of final instruction
 */
-word_t sim_run(word_t max_instr, byte_t *statusp, cc_t *ccp)
+word_t sim_run(sim_ctx_t *ctx, word_t max_instr, byte_t *statusp, cc_t *ccp)
 {
     word_t icount = 0;
     byte_t run_status = STAT_AOK;
+    byte_t (*step)(sim_ctx_t *) = fast_mode ? sim_step_fast : sim_step;
     while (icount < max_instr) {
-	run_status = sim_step();
+	run_status = step(ctx);
 	icount++;
 	if (run_status != STAT_AOK)
 	    break;
@@ -805,25 +819,25 @@ word_t sim_run(word_t max_instr, byte_t *statusp, cc_t *ccp)
     if (statusp)
 	*statusp = run_status;
     if (ccp)
-	*ccp = cc;
+	*ccp = ctx->cc;
     return icount;
 }
 
 /* If dumpfile set nonNULL, lots of status info printed out */
-void sim_set_dumpfile(FILE *df)
+void sim_set_dumpfile(sim_ctx_t *ctx, FILE *df)
 {
-    dumpfile = df;
+    ctx->dumpfile = df;
 }
 
 /*
  * sim_log dumps a formatted string to the dumpfile, if it exists
  * accepts variable argument list
  */
-void sim_log( const char *format, ... ) {
-    if (dumpfile) {
+void (sim_log)(sim_ctx_t *ctx, const char *format, ... ) {
+    if (ctx->dumpfile) {
 	va_list arg;
 	va_start( arg, format );
-	vfprintf( dumpfile, format, arg );
+	vfprintf( ctx->dumpfile, format, arg );
 	va_end( arg );
     }
 }
@@ -880,10 +894,10 @@ int simResetCmd(ClientData clientData, Tcl_Interp *interp,
 	interp->result = "No arguments allowed";
 	return TCL_ERROR;
     }
-    sim_reset();
+    sim_reset(main_ctx);
     if (post_load_mem) {
-	free_mem(mem);
-	mem = copy_mem(post_load_mem);
+	free_mem(main_ctx->mem);
+	main_ctx->mem = copy_mem(post_load_mem);
     }
     interp->result = stat_name(STAT_AOK);
     return TCL_OK;
@@ -905,9 +919,9 @@ int simLoadCodeCmd(ClientData clientData, Tcl_Interp *interp,
 	interp->result = tcl_msg;
 	return TCL_ERROR;
     }
-    sim_reset();
-    code_count = load_mem(mem, object_file, 0);
-    post_load_mem = copy_mem(mem);
+    sim_reset(main_ctx);
+    code_count = load_mem(main_ctx->mem, object_file, 0);
+    post_load_mem = copy_mem(main_ctx->mem);
     sprintf(tcl_msg, "%lld", code_count);
     interp->result = tcl_msg;
     fclose(object_file);
@@ -959,7 +973,7 @@ int simRunCmd(ClientData clientData, Tcl_Interp *interp,
 	interp->result = tcl_msg;
 	return TCL_ERROR;
     }
-    sim_run(step_limit, &run_status, &cc);
+    sim_run(main_ctx, step_limit, &run_status, &cc);
     interp->result = stat_name(run_status);
     return TCL_OK;
 }
@@ -997,19 +1011,19 @@ void signal_register_update(reg_id_t r, word_t val) {
 }
 
 /* Provide mechanism for simulator to generate memory display */
-void create_memory_display() {
+void create_memory_display(sim_ctx_t *ctx) {
     int code;
-    sprintf(tcl_msg, "createMem %lld %lld", minAddr, memCnt);
+    sprintf(tcl_msg, "createMem %lld %lld", ctx->minAddr, ctx->memCnt);
     code = Tcl_Eval(sim_interp, tcl_msg);
     if (code != TCL_OK) {
 	fprintf(stderr, "Command '%s' failed\n", tcl_msg);
 	fprintf(stderr, "Error Message was '%s'\n", sim_interp->result);
     } else {
 	word_t i;
-	for (i = 0; i < memCnt && code == TCL_OK; i+=8) {
-	    word_t addr = minAddr+i;
+	for (i = 0; i < ctx->memCnt && code == TCL_OK; i+=8) {
+	    word_t addr = ctx->minAddr+i;
 	    word_t val;
-	    if (!get_word_val(mem, addr, &val)) {
+	    if (!get_word_val(ctx->mem, addr, &val)) {
 		fprintf(stderr, "Out of bounds memory display\n");
 		return;
 	    }
@@ -1024,29 +1038,29 @@ void create_memory_display() {
 }
 
 /* Provide mechanism for simulator to update memory value */
-void set_memory(word_t addr, word_t val) {
+void set_memory(sim_ctx_t *ctx, word_t addr, word_t val) {
     int code;
-    word_t nminAddr = minAddr;
-    word_t nmemCnt = memCnt;
+    word_t nminAddr = ctx->minAddr;
+    word_t nmemCnt = ctx->memCnt;
 
     /* First see if we need to expand memory range */
-    if (memCnt == 0) {
+    if (ctx->memCnt == 0) {
 	nminAddr = addr;
 	nmemCnt = 8;
-    } else if (addr < minAddr) {
+    } else if (addr < ctx->minAddr) {
 	nminAddr = addr;
-	nmemCnt = minAddr + memCnt - addr;
-    } else if (addr >= minAddr+memCnt) {
-	nmemCnt = addr-minAddr+8;
+	nmemCnt = ctx->minAddr + ctx->memCnt - addr;
+    } else if (addr >= ctx->minAddr+ctx->memCnt) {
+	nmemCnt = addr-ctx->minAddr+8;
     }
     /* Now make sure nminAddr & nmemCnt are multiples of 16 */
     nmemCnt = ((nminAddr & 0xF) + nmemCnt + 0xF) & ~0xF;
     nminAddr = nminAddr & ~0xF;
 
-    if (nminAddr != minAddr || nmemCnt != memCnt) {
-	minAddr = nminAddr;
-	memCnt = nmemCnt;
-	create_memory_display();
+    if (nminAddr != ctx->minAddr || nmemCnt != ctx->memCnt) {
+	ctx->minAddr = nminAddr;
+	ctx->memCnt = nmemCnt;
+	create_memory_display(ctx);
     } else {
 	sprintf(tcl_msg, "setMem %lld %lld", addr, val);
 	code = Tcl_Eval(sim_interp, tcl_msg);
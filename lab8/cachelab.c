@@ -1,11 +1,17 @@
 /*
  * cachelab.c - Cache Lab helper functions
  */
+#define _POSIX_C_SOURCE 200112L
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include "cachelab.h"
 #include <time.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 trans_func_t func_list[MAX_TRANS_FUNCS];
 int func_counter = 0; 
@@ -23,6 +29,16 @@ void printSummary(int hits, int misses, int evictions)
     fclose(output_fp);
 }
 
+/* 
+ * printTrafficSummary - Report the memory traffic of a simulation with
+ * write policies.  Not written to .csim_results, which the autograder reads
+ */
+void printTrafficSummary(int dirty_evictions, int mem_reads, int mem_writes)
+{
+    printf("dirty_evictions:%d mem_reads:%d mem_writes:%d\n",
+           dirty_evictions, mem_reads, mem_writes);
+}
+
 /* 
  * initMatrix - Initialize the given matrix 
  */
@@ -81,3 +97,280 @@ void registerTransFunction(void (*trans)(int M, int N, int[N][M], int[M][N]),
     func_list[func_counter].num_evictions =0;
     func_counter++;
 }
+
+/* 
+ * initCacheModel - Allocate an empty cache model
+ */
+void initCacheModel(cache_model_t *cm, int s, int E, int b)
+{
+    cm->s = s;
+    cm->E = E;
+    cm->b = b;
+    cm->tag = calloc((size_t)E << s, sizeof(unsigned long));
+    cm->used = calloc((size_t)E << s, sizeof(unsigned long));
+    assert(cm->tag && cm->used);
+    resetCacheModel(cm);
+}
+
+void resetCacheModel(cache_model_t *cm)
+{
+    memset(cm->used, 0, ((size_t)cm->E << cm->s) * sizeof(unsigned long));
+    cm->clock = 0;
+    cm->hits = cm->misses = cm->evictions = 0;
+}
+
+/* 
+ * cacheModelAccess - Look addr up, replacing the least recently used
+ *     line of its set on a miss.  Invalid lines have used == 0, so
+ *     they are filled first
+ */
+void cacheModelAccess(cache_model_t *cm, unsigned long addr)
+{
+    unsigned long set = (addr >> cm->b) & ((1UL << cm->s) - 1);
+    unsigned long tag = addr >> (cm->s + cm->b);
+    unsigned long *tags = cm->tag + set * cm->E;
+    unsigned long *used = cm->used + set * cm->E;
+    int i, victim = 0;
+
+    cm->clock++;
+    for (i = 0; i < cm->E; i++) {
+        if (used[i] && tags[i] == tag) {
+            cm->hits++;
+            used[i] = cm->clock;
+            return;
+        }
+        if (used[i] < used[victim])
+            victim = i;
+    }
+    cm->misses++;
+    if (used[victim])
+        cm->evictions++;
+    tags[victim] = tag;
+    used[victim] = cm->clock;
+}
+
+void freeCacheModel(cache_model_t *cm)
+{
+    free(cm->tag);
+    free(cm->used);
+}
+
+
+/*
+ * Trace reading.  The whole trace is mapped into memory and scanned in
+ * place, which is many times faster than fscanf on long traces.  Files
+ * that can't be mapped (pipes, empty files) are read into a buffer
+ */
+struct trace_reader{
+    const unsigned char *buf;
+    const unsigned char *pos;
+    const unsigned char *end;
+    size_t len;
+    int mapped;
+    int binary;              /* Starts with TRACE_MAGIC? */
+    unsigned long prev;      /* Last address read from a binary trace */
+};
+
+static const char trace_ops[4] = {'I', 'L', 'S', 'M'};
+
+/* Value of each hex digit, 0xff for other characters */
+static unsigned char hex_value[256];
+
+static void initHexValue(void)
+{
+    int c;
+    for (c = 0; c < 256; c++)
+        hex_value[c] = 0xff;
+    for (c = 0; c < 10; c++)
+        hex_value['0' + c] = c;
+    for (c = 0; c < 6; c++)
+        hex_value['a' + c] = hex_value['A' + c] = 10 + c;
+}
+
+trace_reader_t *openTrace(const char *path)
+{
+    struct stat st;
+    trace_reader_t *tr;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return NULL;
+    if (hex_value['x'] == 0)
+        initHexValue();
+    tr = calloc(1, sizeof(*tr));
+    assert(tr);
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            posix_madvise(p, st.st_size, POSIX_MADV_SEQUENTIAL);
+            tr->buf = p;
+            tr->len = st.st_size;
+            tr->mapped = 1;
+        }
+    }
+    if (!tr->mapped) {
+        size_t cap = 1 << 16;
+        ssize_t n;
+        unsigned char *b = malloc(cap);
+        assert(b);
+        while ((n = read(fd, b + tr->len, cap - tr->len)) > 0) {
+            tr->len += n;
+            if (tr->len == cap) {
+                cap *= 2;
+                b = realloc(b, cap);
+                assert(b);
+            }
+        }
+        tr->buf = b;
+    }
+    close(fd);
+    tr->binary = tr->len >= strlen(TRACE_MAGIC) &&
+        memcmp(tr->buf, TRACE_MAGIC, strlen(TRACE_MAGIC)) == 0;
+    tr->end = tr->buf + tr->len;
+    rewindTrace(tr);
+    return tr;
+}
+
+/* Read a varint at *pp into *v.  Returns 0 if the trace ends first */
+static int readVarint(const unsigned char **pp, const unsigned char *end,
+                      unsigned long *v)
+{
+    const unsigned char *p = *pp;
+    unsigned long x = 0;
+    int shift = 0;
+
+    while (p < end && (*p & 0x80) && shift < 63) {
+        x |= (unsigned long)(*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    if (p == end)
+        return 0;
+    *v = x | (unsigned long)*p++ << shift;
+    *pp = p;
+    return 1;
+}
+
+static int readBinaryTrace(trace_reader_t *tr, trace_rec_t *rec)
+{
+    const unsigned char *p = tr->pos, *end = tr->end;
+    unsigned long zz, size;
+    unsigned head;
+
+    if (p == end)
+        return 0;
+    head = *p++;
+    zz = head >> 5 & 3;
+    if (head & 0x80) {
+        if (!readVarint(&p, end, &zz))
+            return 0;
+        zz = zz << 2 | (head >> 5 & 3);
+    }
+    size = 1UL << (head >> 2 & 7);
+    if ((head >> 2 & 7) == 7 && !readVarint(&p, end, &size))
+        return 0;
+    tr->prev += (zz & 1) ? ~(zz >> 1) : zz >> 1;
+    rec->op = trace_ops[head & 3];
+    rec->addr = tr->prev;
+    rec->size = size;
+    tr->pos = p;
+    return 1;
+}
+
+int readTrace(trace_reader_t *tr, trace_rec_t *rec)
+{
+    const unsigned char *p = tr->pos, *end = tr->end;
+
+    if (tr->binary)
+        return readBinaryTrace(tr, rec);
+
+    while (p < end) {
+        const unsigned char *digits;
+        unsigned long addr = 0;
+        int size = 0;
+        unsigned d;
+
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+            p++;
+        if (p == end)
+            break;
+        rec->op = *p++;
+        while (p < end && *p == ' ')
+            p++;
+        if (p + 1 < end && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+            p += 2;
+        digits = p;
+        while (p < end && (d = hex_value[*p]) < 16) {
+            addr = addr << 4 | d;
+            p++;
+        }
+        if (p > digits && p < end && *p == ',') {
+            for (p++; p < end && (unsigned)(*p - '0') < 10; p++)
+                size = size * 10 + (*p - '0');
+            while (p < end && *p != '\n')
+                p++;
+            rec->addr = addr;
+            rec->size = size;
+            tr->pos = p;
+            return 1;
+        }
+        /* Not a record: skip the rest of the line */
+        while (p < end && *p != '\n')
+            p++;
+    }
+    tr->pos = p;
+    return 0;
+}
+
+void rewindTrace(trace_reader_t *tr)
+{
+    tr->pos = tr->buf + (tr->binary ? strlen(TRACE_MAGIC) : 0);
+    tr->prev = 0;
+}
+
+void closeTrace(trace_reader_t *tr)
+{
+    if (tr->mapped)
+        munmap((void *)tr->buf, tr->len);
+    else
+        free((void *)tr->buf);
+    free(tr);
+}
+
+/*
+ * Binary trace writing
+ */
+static void writeVarint(FILE *fp, unsigned long v)
+{
+    while (v >= 0x80) {
+        putc((v & 0x7f) | 0x80, fp);
+        v >>= 7;
+    }
+    putc(v, fp);
+}
+
+void startBinaryTrace(trace_writer_t *tw, FILE *fp)
+{
+    fputs(TRACE_MAGIC, fp);
+    tw->fp = fp;
+    tw->prev = 0;
+}
+
+void writeBinaryTrace(trace_writer_t *tw, const trace_rec_t *rec)
+{
+    unsigned long delta = rec->addr - tw->prev;
+    /* Zigzag: small changes either way become small numbers */
+    unsigned long zz = (long)delta < 0 ? ~(delta << 1) : delta << 1;
+    const char *op = memchr(trace_ops, rec->op, 4);
+    int code;
+
+    if (op == NULL)
+        return;
+    for (code = 0; code < 7 && rec->size != 1 << code; code++)
+        ;
+    putc((op - trace_ops) | code << 2 | (zz & 3) << 5 | (zz > 3) << 7, tw->fp);
+    if (zz > 3)
+        writeVarint(tw->fp, zz >> 2);
+    if (code == 7)
+        writeVarint(tw->fp, rec->size);
+    tw->prev = rec->addr;
+}
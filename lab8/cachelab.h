@@ -5,6 +5,8 @@
 #ifndef CACHELAB_TOOLS_H
 #define CACHELAB_TOOLS_H
 
+#include <stdio.h>
+
 #define MAX_TRANS_FUNCS 100
 
 typedef struct trans_func{
@@ -24,6 +26,14 @@ void printSummary(int hits,  /* number of  hits */
 				  int misses, /* number of misses */
 				  int evictions); /* number of evictions */
 
+/* 
+ * printTrafficSummary - Report the memory traffic of a simulation with
+ * write policies, after printSummary
+ */ 
+void printTrafficSummary(int dirty_evictions, /* dirty lines written back */
+                         int mem_reads,       /* blocks read from memory */
+                         int mem_writes);     /* writes to memory */
+
 /* Fill the matrix with data */
 void initMatrix(int M, int N, int A[N][M], int B[M][N]);
 
@@ -34,4 +44,76 @@ void correctTrans(int M, int N, int A[N][M], int B[M][N]);
 void registerTransFunction(
     void (*trans)(int M,int N,int[N][M],int[M][N]), char* desc);
 
+/* 
+ * A small LRU cache, like csim-ref's, for counting the misses of
+ * transpose functions without valgrind.  Access sizes are ignored
+ */
+typedef struct cache_model{
+  int s, E, b;
+  unsigned long *tag;      /* tag[set * E + line] */
+  unsigned long *used;     /* Time of last use, 0 for an invalid line */
+  unsigned long clock;
+  unsigned int hits, misses, evictions;
+} cache_model_t;
+
+/* Allocate an empty cache of 2^s sets, each with E lines of 2^b bytes */
+void initCacheModel(cache_model_t *cm, int s, int E, int b);
+
+/* Empty the cache and zero its counts */
+void resetCacheModel(cache_model_t *cm);
+
+/* Simulate one load or store of addr */
+void cacheModelAccess(cache_model_t *cm, unsigned long addr);
+
+/* Free a cache allocated by initCacheModel */
+void freeCacheModel(cache_model_t *cm);
+
+/* One record of a valgrind lackey trace, e.g. " L 7ff000398,8" */
+typedef struct trace_rec{
+  char op;                 /* 'I', 'L', 'S' or 'M' */
+  int size;
+  unsigned long addr;
+} trace_rec_t;
+
+typedef struct trace_reader trace_reader_t;
+
+/* Open a trace file for readTrace.  Returns NULL if it can't be read */
+trace_reader_t *openTrace(const char *path);
+
+/* 
+ * readTrace - Fill in rec from the next record of the trace, skipping
+ * lines that aren't records.  Returns 0 at the end of the trace
+ */
+int readTrace(trace_reader_t *tr, trace_rec_t *rec);
+
+/* Start reading the trace again from its first record */
+void rewindTrace(trace_reader_t *tr);
+
+/* Close a trace opened by openTrace */
+void closeTrace(trace_reader_t *tr);
+
+/* 
+ * Binary traces, which openTrace recognizes by their first 8 bytes.
+ * Each record after that starts with a byte holding
+ *   bits 0-1  op: 0 'I', 1 'L', 2 'S', 3 'M'
+ *   bits 2-4  size code c, the size is 1 << c; 7 means a varint follows
+ *   bits 5-6  low 2 bits of the zigzag-encoded change in address
+ *   bit 7     set when a varint with the rest of that change follows
+ * The address varint comes before the size varint.  Varints hold 7
+ * bits per byte, low bits first, with the top bit set on all but the
+ * last byte
+ */
+#define TRACE_MAGIC "CLTRACE1"
+
+typedef struct trace_writer{
+  FILE *fp;
+  unsigned long prev;      /* Address of the last record written */
+} trace_writer_t;
+
+/* Write the binary trace header to fp, and start a trace_writer on it */
+void startBinaryTrace(trace_writer_t *tw, FILE *fp);
+
+/* Append one record.  Records whose op isn't I, L, S or M are dropped */
+void writeBinaryTrace(trace_writer_t *tw, const trace_rec_t *rec);
+
 #endif /* CACHELAB_TOOLS_H */
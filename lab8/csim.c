@@ -2,10 +2,10 @@
 name: Wang Yixiao
 id: ics522031910732
 */
+#define _POSIX_C_SOURCE 200112L
 #include "cachelab.h"
 #include <ctype.h>
 #include <getopt.h>
-#include <math.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -14,26 +14,106 @@ id: ics522031910732
 #include <unistd.h>
 #include <stdint.h>
 #include <assert.h>
-typedef struct
-{
-    int validBit;
-    int tagBit;
-    int LRU_counter;
-} cache_line;
-cache_line line;
-int s, S, E, b, t;
-int hitCount = 0;
-int missCount = 0;
-int evictionCount = 0;
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_AVX2_MATCH
+#endif
+int s, E, b, t;
+// 模拟时改变的全局量都是每个线程一份，-j的线程各自计数，最后再加起来
+__thread uint64_t timeStamp = 0; // 每条trace记录加一，最小的lastUsed即为LRU行
 char filePath[1000]; // 定义file的路径
 bool haveV = false;
-cache_line **cache;
+bool haveB = false;
+bool haveM = false;
+
+/*
+ * 一级cache。每个set在lines中占一段连续的uint64_t（SoA布局）:
+ *   tags[E]      64位tag
+ *   repl[E]      替换策略的数据，LRU中是最近一次访问的时间戳
+ *   valid[W]     有效位掩码，第i行对应第i位，W = (E + 63) / 64
+ *   dirty[W]     脏位掩码，只在write-back时使用
+ * 所有set放在同一块内存中，第i个set从lines + i * setWords开始
+ */
+typedef struct
+{
+    const char *name; // -v输出中的前缀，只有一级时为""
+    int s, E, b;
+    int W, setWords;
+    int latency;      // 多级cache中访问这一级的周期数
+    uint64_t *lines;
+    int hits, misses, evictions;
+} cache_t;
+#define setTags(c, i) ((c)->lines + (size_t)(i) * (c)->setWords)
+#define setRepl(c, i) (setTags(c, i) + (c)->E)
+#define setValid(c, i) (setTags(c, i) + 2 * (c)->E)
+#define setDirty(c, i) (setValid(c, i) + (c)->W)
+#define isValid(valid, i) (((valid)[(i) >> 6] >> ((i) & 63)) & 1)
+#define setIndexOf(c, addr) (((addr) >> (c)->b) & ((1 << (c)->s) - 1)) // 使用位掩码计算setIndex
+#define tagOf(c, addr) ((addr) >> ((c)->s + (c)->b))
+
+// levels[0]是L1；不用-L或-c时只有-s, -E, -b给出的一级
+#define MAX_LEVELS 4
+cache_t levels[MAX_LEVELS];
+int levelCount = 0;
+const char *levelNames[MAX_LEVELS] = {"L1 ", "L2 ", "L3 ", "L4 "};
+typedef enum
+{
+    INCLUSIVE, // 下一级替换的块也从上面各级中删去
+    EXCLUSIVE, // 一个块只在一级中，L1替换的块放入L2，依此类推
+    NINE       // 各级分别装入和替换
+} inclusion_t;
+const char *inclusionNames[] = {"inclusive", "exclusive", "nine"};
+inclusion_t inclusion = INCLUSIVE;
+int memLatency = 100;
+long totalCycles = 0;  // 所有访问的周期数之和，用于计算AMAT
+long memAccesses = 0;
+
+// 替换策略，各自在repl[]中保存的数据:
+typedef enum
+{
+    POLICY_LRU,   // 最近一次访问的时间戳
+    POLICY_FIFO,  // 装入的时间戳
+    POLICY_LFU,   // 装入以来的访问次数，相同时换掉行号小的
+    POLICY_RANDOM, // 不用
+    POLICY_PLRU,  // 二叉树的E-1个结点，repl[k-1]是结点k指向的一边，E须为2的幂
+    POLICY_SRRIP, // RRPV: 0将很快再被访问，3将很久不被访问
+    POLICY_BRRIP, // 同SRRIP，但大多数行以RRPV 3装入
+    POLICY_OPT    // 下一次访问的序号 (Belady)
+} policy_t;
+const char *policyNames[] = {"lru", "fifo", "lfu", "random", "plru", "srrip", "brrip", "opt"};
+policy_t policy = POLICY_LRU;
+bool writeBack = true;      // 否则write-through
+bool writeAllocate = true;  // 否则no-write-allocate
+bool haveP = false;         // 给了-p, -w或-n时才记录并输出内存流量
+__thread int dirtyEvictionCount = 0;
+__thread int memReadCount = 0;       // 从内存读入的块数
+__thread int memWriteCount = 0;      // 写回内存的次数
+uint64_t randomState = 88172645463325252ULL;
+int brripFills = 0;
+uint64_t *nextUse;          // OPT: 第i次访问的块下一次被访问的序号
+__thread size_t accessIndex = 0;
+int jobs = 1;               // -j: 模拟用的线程数
 void helpInfo()
 {
-    printf("Usage: ./csim-ref [-hv] -s <num> -E <num> -b <num> -t <file>\n");
+    printf("Usage: ./csim-ref [-hvBmn] [-j <num>] [-p <name>] [-w <wb|wt>] -s <num> -E <num> -b <num> -t <file>\n");
+    printf("       ./csim-ref [-hv] [-p <name>] -L <level> [-L <level>...] [-l <num>] [-i <name>] -t <file>\n");
     printf("Options:\n");
     printf("  -h         Print this help message.\n");
     printf("  -v         Optional verbose flag.\n");
+    printf("  -B         Report trace records per second.\n");
+    printf("  -m         Miss-ratio table for every s and E up to the given ones.\n");
+    printf("  -p <name>  Replacement policy: lru (default), fifo, lfu, random,\n");
+    printf("             plru, srrip, brrip or opt.\n");
+    printf("  -w <wb|wt> Write-back (default) or write-through.\n");
+    printf("  -n         No-write-allocate.\n");
+    printf("  -j <num>   Simulate with <num> threads, each owning a range of sets.\n");
+    printf("  -L <s>:<E>:<b>:<cycles>  Add a cache level to a hierarchy, L1 first.\n");
+    printf("  -l <cycles>  Memory latency of a hierarchy (default 100).\n");
+    printf("  -i <name>  Hierarchy inclusion: inclusive (default), exclusive or nine.\n");
+    printf("  -c <file>  Read -L, -l and -i settings from a config file.\n");
     printf("  -s <num>   Number of set index bits.\n");
     printf("  -E <num>   Number of lines per set.\n");
     printf("  -b <num>   Number of block offset bits.\n");
@@ -41,69 +121,851 @@ void helpInfo()
     printf("Examples:\n");
     printf("  linux>  ./csim-ref -s 4 -E 1 -b 4 -t traces/yi.trace\n");
     printf("  linux>  ./csim-ref -v -s 8 -E 2 -b 4 -t traces/yi.trace\n");
+    printf("  linux>  ./csim-ref -L 6:8:6:4 -L 10:8:6:12 -t traces/long.trace\n");
 }
-void updateCacheOnMiss(int setIndex, int addressOfTag);
 
-void dealWithAddress(uint64_t addr)
+// 在一个set中查找有效且tag相同的行，返回行号，没有则返回-1
+int findLineScalar(const uint64_t *tags, const uint64_t *valid, int ways, uint64_t tag)
 {
-    int setIndex = (addr >> b) & ((1 << s) - 1); // 使用位掩码计算setIndex
-    int addressOfTag = addr >> (s + b);
-    for (int i = 0; i < E; i++)
+    for (int i = 0; i < ways; i++)
     {
-        if (cache[setIndex][i].tagBit == addressOfTag && cache[setIndex][i].validBit)
+        if (tags[i] == tag && isValid(valid, i))
+            return i;
+    }
+    return -1;
+}
+
+#ifdef HAVE_AVX2_MATCH
+// 一条指令比较4个tag; 4个一组不会跨过valid中的一个字
+__attribute__((target("avx2"))) int findLineAVX2(const uint64_t *tags, const uint64_t *valid, int ways, uint64_t tag)
+{
+    __m256i key = _mm256_set1_epi64x((long long)tag);
+    int i = 0;
+    for (; i + 4 <= ways; i += 4)
+    {
+        __m256i tagv = _mm256_loadu_si256((const __m256i *)(tags + i));
+        unsigned match = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(tagv, key)));
+        match &= (valid[i >> 6] >> (i & 63)) & 0xf;
+        if (match)
+            return i + __builtin_ctz(match);
+    }
+    for (; i < ways; i++)
+    {
+        if (tags[i] == tag && isValid(valid, i))
+            return i;
+    }
+    return -1;
+}
+#endif
+
+// 启动时根据CPU选择实现
+int (*findLine)(const uint64_t *tags, const uint64_t *valid, int ways, uint64_t tag) = findLineScalar;
+
+double nowSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void printRate(const char *what, long records, double seconds)
+{
+    printf("%s: %ld records in %.3f s (%.1f M records/s)\n", what, records,
+           seconds, seconds > 0 ? records / seconds / 1e6 : 0.0);
+}
+
+// 更新命中行的策略数据
+static inline void touchLine(uint64_t *repl, int way, int ways)
+{
+    if (policy == POLICY_LRU)
+    { // 默认的LRU不经过switch
+        repl[way] = timeStamp;
+        return;
+    }
+    switch (policy)
+    {
+    case POLICY_LFU:
+        repl[way]++;
+        break;
+    case POLICY_SRRIP:
+    case POLICY_BRRIP:
+        repl[way] = 0;
+        break;
+    case POLICY_PLRU:
+        // 从根走到way，每个结点指向另一边
+        for (int node = 1, bit = ways >> 1; bit; bit >>= 1)
         {
-            // Cache hit
-            hitCount++;
-            cache[setIndex][i].LRU_counter = 0;
-            if (haveV)
-                printf(" hit");
-            return;
+            int right = (way & bit) != 0;
+            repl[node - 1] = !right;
+            node = 2 * node + right;
         }
+        break;
+    case POLICY_OPT:
+        repl[way] = nextUse[accessIndex];
+        break;
+    default:
+        break;
+    }
+}
+
+// 设置新装入行的策略数据
+static inline void fillLine(uint64_t *repl, int way, int ways)
+{
+    switch (policy)
+    {
+    case POLICY_FIFO:
+        repl[way] = timeStamp;
+        break;
+    case POLICY_LFU:
+        repl[way] = 1;
+        break;
+    case POLICY_SRRIP:
+        repl[way] = 2;
+        break;
+    case POLICY_BRRIP:
+        repl[way] = ++brripFills % 32 ? 3 : 2;
+        break;
+    default:
+        touchLine(repl, way, ways);
+        break;
+    }
+}
+
+// 所有行都有效时选出被替换的行
+static inline int chooseVictim(uint64_t *repl, int ways)
+{
+    int victim = 0;
+    if (policy == POLICY_LRU)
+    {
+        uint64_t oldest = repl[0];
+        for (int i = 1; i < ways; i++)
+        {
+            if (repl[i] < oldest)
+            {
+                oldest = repl[i];
+                victim = i;
+            }
+        }
+        return victim;
+    }
+    switch (policy)
+    {
+    case POLICY_RANDOM:
+        randomState ^= randomState << 13;
+        randomState ^= randomState >> 7;
+        randomState ^= randomState << 17;
+        return randomState % ways;
+    case POLICY_PLRU:
+    {
+        int node = 1;
+        while (node < ways)
+            node = 2 * node + (int)repl[node - 1];
+        return node - ways;
+    }
+    case POLICY_SRRIP:
+    case POLICY_BRRIP:
+        for (;;)
+        {
+            for (int i = 0; i < ways; i++)
+                if (repl[i] >= 3)
+                    return i;
+            for (int i = 0; i < ways; i++)
+                repl[i]++;
+        }
+    case POLICY_OPT:
+        for (int i = 1; i < ways; i++)
+            if (repl[i] > repl[victim])
+                victim = i;
+        return victim;
+    default:
+        // FIFO和LFU也换掉最小的
+        for (int i = 1; i < ways; i++)
+            if (repl[i] < repl[victim])
+                victim = i;
+        return victim;
+    }
+}
+
+// 在c的一个set中查找，命中时更新替换策略数据并返回true
+static inline bool lookupLine(cache_t *c, int setIndex, uint64_t addressOfTag, bool isWrite)
+{
+    int i = findLine(setTags(c, setIndex), setValid(c, setIndex), c->E, addressOfTag);
+    if (i >= 0)
+    {
+        // Cache hit
+        c->hits++;
+        touchLine(setRepl(c, setIndex), i, c->E);
+        if (isWrite && haveP)
+        {
+            if (writeBack)
+                setDirty(c, setIndex)[i >> 6] |= 1ULL << (i & 63);
+            else
+                memWriteCount++;
+        }
+        if (haveV)
+            printf(" %shit", c->name);
+        return true;
     }
     // Cache miss
-    missCount++;
+    c->misses++;
     if (haveV)
-        printf(" miss");
-    updateCacheOnMiss(setIndex, addressOfTag);
+        printf(" %smiss", c->name);
+    return false;
 }
 
-void updateCacheOnMiss(int setIndex, int addressOfTag)
+// 把块装入c。替换了一个有效行时返回true，*victim为那一行的块地址
+static inline bool updateCacheOnMiss(cache_t *c, int setIndex, uint64_t addressOfTag, bool isWrite, uint64_t *victim)
 {
-    for (int i = 0; i < E; i++)
+    uint64_t *tags = setTags(c, setIndex);
+    uint64_t *repl = setRepl(c, setIndex);
+    uint64_t *valid = setValid(c, setIndex);
+    uint64_t *dirty = setDirty(c, setIndex);
+    bool evicted = false;
+    int i = c->E;
+    memReadCount++;
+    for (int w = 0; w < c->W; w++)
     {
-        if (!cache[setIndex][i].validBit)
+        if (~valid[w])
         { // 查找第一个无效位
-            cache[setIndex][i] = (cache_line){1, addressOfTag, 0};
+            i = w * 64 + __builtin_ctzll(~valid[w]);
+            break;
+        }
+    }
+    if (i >= c->E)
+    {
+        // 若所有行都有效，则执行eviction策略
+        c->evictions++;
+        if (haveV)
+            printf(" %seviction", c->name);
+        i = chooseVictim(repl, c->E);
+        *victim = (tags[i] << (c->s + c->b)) | ((uint64_t)setIndex << c->b);
+        evicted = true;
+        if (haveP && isValid(dirty, i))
+        {
+            dirtyEvictionCount++;
+            memWriteCount++;
+        }
+    }
+    valid[i >> 6] |= 1ULL << (i & 63);
+    if (haveP)
+    {
+        dirty[i >> 6] &= ~(1ULL << (i & 63));
+        if (isWrite)
+        {
+            if (writeBack)
+                dirty[i >> 6] |= 1ULL << (i & 63);
+            else
+                memWriteCount++;
+        }
+    }
+    tags[i] = addressOfTag; // 替换选出的行
+    fillLine(repl, i, c->E);
+    return evicted;
+}
+
+// 单级cache的一次访问
+static inline void dealWithAddress(cache_t *c, uint64_t addr, bool isWrite)
+{
+    int setIndex = setIndexOf(c, addr);
+    uint64_t addressOfTag = tagOf(c, addr);
+    uint64_t victim;
+    if (!lookupLine(c, setIndex, addressOfTag, isWrite))
+    {
+        if (isWrite && !writeAllocate)
+            memWriteCount++;
+        else
+            updateCacheOnMiss(c, setIndex, addressOfTag, isWrite, &victim);
+    }
+    accessIndex++;
+}
+
+// 多级cache用的查找和装入，单级cache的路径不经过它们
+// 在c中查找addr，命中时更新替换策略数据
+bool lookupAddress(cache_t *c, uint64_t addr)
+{
+    return lookupLine(c, setIndexOf(c, addr), tagOf(c, addr), false);
+}
+
+// 把addr所在的块装入c
+bool fillAddress(cache_t *c, uint64_t addr, uint64_t *victim)
+{
+    return updateCacheOnMiss(c, setIndexOf(c, addr), tagOf(c, addr), false, victim);
+}
+
+// 如果c中有addr所在的块，把它删去
+void invalidateAddress(cache_t *c, uint64_t addr)
+{
+    int setIndex = setIndexOf(c, addr);
+    uint64_t *valid = setValid(c, setIndex);
+    int i = findLine(setTags(c, setIndex), valid, c->E, tagOf(c, addr));
+    if (i >= 0)
+        valid[i >> 6] &= ~(1ULL << (i & 63));
+}
+
+/*
+ * 多级cache的一次访问。从L1开始逐级查找，直到命中或到达内存，
+ * 经过的每一级都计入延迟。然后按inclusion把块装入未命中的各级
+ */
+void hierarchyAccess(uint64_t addr)
+{
+    uint64_t victim;
+    int k = 0;
+    while (k < levelCount)
+    {
+        totalCycles += levels[k].latency;
+        if (lookupAddress(&levels[k], addr))
+            break;
+        k++;
+    }
+    if (k == levelCount)
+    {
+        totalCycles += memLatency;
+        memAccesses++;
+    }
+    if (inclusion == EXCLUSIVE)
+    {
+        if (k == 0)
             return;
+        if (k < levelCount)
+            invalidateAddress(&levels[k], addr);
+        // 装入L1，每一级替换出的块放入下一级
+        for (int j = 0; j < levelCount && fillAddress(&levels[j], addr, &victim); j++)
+            addr = victim;
+        return;
+    }
+    // 从下往上装入，这样下一级替换的块在上一级装入之前就已删去
+    for (int j = k - 1; j >= 0; j--)
+    {
+        if (fillAddress(&levels[j], addr, &victim) && inclusion == INCLUSIVE)
+        {
+            for (int u = 0; u < j; u++)
+                invalidateAddress(&levels[u], victim);
         }
     }
-    // 若所有行都有效，则执行eviction策略
-    evictionCount++;
-    if (haveV)
-        printf(" eviction");
-    int leastUsedIndex = 0;
-    for (int i = 1; i < E; i++)
+}
+
+// 为一级cache分配空间
+void initLevel(cache_t *c, const char *name, int ls, int lE, int lb, int latency)
+{
+    c->name = name;
+    c->s = ls;
+    c->E = lE;
+    c->b = lb;
+    c->latency = latency;
+    c->W = (lE + 63) / 64;
+    c->setWords = 2 * lE + 2 * c->W;
+    c->lines = (uint64_t *)calloc((size_t)1 << ls, c->setWords * sizeof(uint64_t)); // 初始化值，全置零
+    assert(c->lines);
+}
+
+// 解析"s:E:b:cycles"，加入一级
+void addLevel(const char *spec)
+{
+    int ls, lE, lb, latency;
+    if (levelCount == MAX_LEVELS || sscanf(spec, "%d:%d:%d:%d", &ls, &lE, &lb, &latency) != 4 ||
+        ls < 0 || ls > 30 || lE < 1 || lb < 0 || ls + lb > 63)
+    {
+        helpInfo();
+        exit(EXIT_FAILURE);
+    }
+    initLevel(&levels[levelCount], levelNames[levelCount], ls, lE, lb, latency);
+    levelCount++;
+}
+
+void setInclusion(const char *name)
+{
+    for (inclusion = 0; inclusion <= NINE && strcmp(name, inclusionNames[inclusion]); inclusion++)
+        ;
+    if (inclusion > NINE)
+    {
+        helpInfo();
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * 读-c给出的配置文件，每行一项，#后为注释:
+ *   level <s> <E> <b> <cycles>
+ *   memory <cycles>
+ *   inclusion <inclusive|exclusive|nine>
+ */
+void readConfig(const char *path)
+{
+    char line[256], key[32], arg[64];
+    int ls, lE, lb, latency;
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        printf("Can't read %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    for (int lineno = 1; fgets(line, sizeof(line), fp); lineno++)
+    {
+        char *hash = strchr(line, '#');
+        if (hash)
+            *hash = '\0';
+        if (sscanf(line, "%31s", key) != 1)
+            continue;
+        if (!strcmp(key, "level") && sscanf(line, "%*s %d %d %d %d", &ls, &lE, &lb, &latency) == 4)
+        {
+            snprintf(arg, sizeof(arg), "%d:%d:%d:%d", ls, lE, lb, latency);
+            addLevel(arg);
+        }
+        else if (!strcmp(key, "memory") && sscanf(line, "%*s %d", &memLatency) == 1)
+            ;
+        else if (!strcmp(key, "inclusion") && sscanf(line, "%*s %63s", arg) == 1)
+            setInclusion(arg);
+        else
+        {
+            printf("%s:%d: can't parse this line\n", path, lineno);
+            exit(EXIT_FAILURE);
+        }
+    }
+    fclose(fp);
+}
+
+/*
+ * -j: set之间互不影响，所以把set分成jobs段，每个线程模拟一段。
+ * 主线程解析trace，按set把每次访问放入对应线程的环形缓冲区
+ * (单生产者单消费者，只用原子的head和tail同步)。每个set的访问顺序不变，
+ * 时间戳只在set内比较，所以结果与单线程完全相同
+ */
+#define RING_SIZE 65536 // 每个缓冲区的项数，须为2的幂
+#define RING_BATCH 256  // 生产者每放入这么多项才公布一次tail
+typedef struct
+{
+    uint64_t addr[RING_SIZE];
+    char op[RING_SIZE]; // 'L', 'S'或'M'
+    char pad0[64];      // head和tail放在不同的cache line中
+    size_t head;        // 消费者处理到的位置
+    char pad1[64];
+    size_t tail;        // 生产者公布的位置
+    bool done;          // 不会再有新的访问
+    char pad2[64];
+    size_t pending;     // 生产者放入的位置，还没公布的部分消费者看不到
+    size_t headSeen;    // 生产者最近读到的head
+    cache_t cache;      // 与levels[0]共用lines，计数器各自独立
+    int dirtyEvictions, memReads, memWrites;
+    pthread_t thread;
+} worker_t;
+
+void *simulateShard(void *arg)
+{
+    worker_t *w = arg;
+    size_t head = 0;
+    for (;;)
+    {
+        size_t tail = __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE);
+        if (head == tail)
+        {
+            // done在最后一次公布tail之后才设置，所以要再读一次tail
+            if (__atomic_load_n(&w->done, __ATOMIC_ACQUIRE) &&
+                head == __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE))
+                break;
+            sched_yield();
+            continue;
+        }
+        for (; head != tail; head++)
+        {
+            size_t k = head & (RING_SIZE - 1);
+            dealWithAddress(&w->cache, w->addr[k], w->op[k] == 'S');
+            if (w->op[k] == 'M')
+                dealWithAddress(&w->cache, w->addr[k], true);
+            timeStamp++;
+        }
+        __atomic_store_n(&w->head, head, __ATOMIC_RELEASE);
+    }
+    w->dirtyEvictions = dirtyEvictionCount;
+    w->memReads = memReadCount;
+    w->memWrites = memWriteCount;
+    return NULL;
+}
+
+static inline void pushAccess(worker_t *w, uint64_t addr, char op)
+{
+    if (w->pending - w->headSeen == RING_SIZE)
+    {
+        __atomic_store_n(&w->tail, w->pending, __ATOMIC_RELEASE);
+        while ((w->headSeen = __atomic_load_n(&w->head, __ATOMIC_ACQUIRE)) + RING_SIZE == w->pending)
+            sched_yield();
+    }
+    size_t k = w->pending & (RING_SIZE - 1);
+    w->addr[k] = addr;
+    w->op[k] = op;
+    if (++w->pending % RING_BATCH == 0)
+        __atomic_store_n(&w->tail, w->pending, __ATOMIC_RELEASE);
+}
+
+// 用jobs个线程模拟levels[0]，返回trace的记录数
+long simulateParallel(trace_reader_t *trace)
+{
+    cache_t *c = &levels[0];
+    int threads = jobs < (1 << c->s) ? jobs : (1 << c->s);
+    worker_t *workers = calloc(threads, sizeof(worker_t));
+    assert(workers);
+    for (int i = 0; i < threads; i++)
     {
-        if (cache[setIndex][i].LRU_counter > cache[setIndex][leastUsedIndex].LRU_counter)
+        workers[i].cache = *c;
+        if (pthread_create(&workers[i].thread, NULL, simulateShard, &workers[i]) != 0)
         {
-            leastUsedIndex = i;
+            printf("Can't create thread\n");
+            exit(EXIT_FAILURE);
         }
     }
-    cache[setIndex][leastUsedIndex] = (cache_line){1, addressOfTag, 0}; // 替换最少使用的行
+
+    trace_rec_t rec;
+    long records = 0;
+    while (readTrace(trace, &rec))
+    {
+        records++;
+        if (rec.op != 'I') // 第i个线程模拟的set满足 set * threads >> s == i
+            pushAccess(&workers[((uint64_t)setIndexOf(c, rec.addr) * threads) >> c->s], rec.addr, rec.op);
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+        __atomic_store_n(&workers[i].tail, workers[i].pending, __ATOMIC_RELEASE);
+        __atomic_store_n(&workers[i].done, true, __ATOMIC_RELEASE);
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        c->hits += workers[i].cache.hits;
+        c->misses += workers[i].cache.misses;
+        c->evictions += workers[i].cache.evictions;
+        dirtyEvictionCount += workers[i].dirtyEvictions;
+        memReadCount += workers[i].memReads;
+        memWriteCount += workers[i].memWrites;
+    }
+    free(workers);
+    return records;
 }
+
+/*
+ * -m: 一遍扫描trace，同时得到所有s <= sMax, E <= eMax的LRU结果
+ * (Mattson stack distance)。LRU中，块x命中当且仅当x上次被访问之后，
+ * 同一set中被访问过的不同块少于E个。这个数就是x的stack distance。
+ *
+ * 每个s、每个set都有自己的时钟，并用一棵树状数组(Fenwick tree)在每个块
+ * 最近一次被访问的时刻上标1 (Bennett-Kruskal)。这样distance就是两次访问
+ * 之间标记的个数，每次访问O(log n)。
+ *
+ * 时钟走到cap时重新编号：只保留最近的eMax个标记，按顺序改为1, 2, ...。
+ * 更早的块之后再被访问时distance必然不小于eMax，不需要再知道准确的值。
+ * 这样树的大小只和E有关，和trace长度无关，时钟也不会溢出。
+ */
+typedef struct
+{
+    int *tree;  // tree[1..cap]
+    int *owner; // owner[t]: 最近一次在时刻t被访问的块id，-1表示没有
+    int cap;    // 2的幂
+    int clock;  // 重新编号后的当前时刻，不超过cap
+    long blocks; // 这个set中出现过的不同块数
+} stack_set;
+
+int sMax, eMax;
+stack_set *stackSets[32];  // stackSets[s][set]
+long *distCount[32];       // distCount[s][d], d == eMax表示不小于eMax或第一次访问
+uint64_t *blockAddr;       // 块号 -> id的开放寻址哈希表
+int *blockId;
+size_t blockSlots, blockCount;
+int *lastClock;            // lastClock[id * (sMax + 1) + s]，0表示还没访问过，-1表示已在最近eMax个块之外
+size_t lastClockIds;
+
+int fenwickSum(stack_set *set, int i)
+{
+    int sum = 0;
+    for (; i > 0; i -= i & -i)
+        sum += set->tree[i];
+    return sum;
+}
+
+void fenwickAdd(stack_set *set, int i, int v)
+{
+    for (; i <= set->cap; i += i & -i)
+        set->tree[i] += v;
+}
+
+// 时钟用完时把第k级的这个set重新编号，标记多于cap的一半时容量翻倍
+void stackCompact(stack_set *set, int k)
+{
+    int marks = fenwickSum(set, set->cap);
+    int drop = marks > eMax ? marks - eMax : 0;
+    int live = 0;
+    for (int i = 1; i <= set->clock; i++)
+    {
+        int id = set->owner[i];
+        if (id < 0)
+            continue;
+        if (drop > 0)
+        {
+            lastClock[(size_t)id * (sMax + 1) + k] = -1;
+            drop--;
+        }
+        else
+        {
+            set->owner[++live] = id;
+            lastClock[(size_t)id * (sMax + 1) + k] = live;
+        }
+    }
+    if (2 * live > set->cap)
+    {
+        set->cap *= 2;
+        set->tree = realloc(set->tree, (set->cap + 1) * sizeof(int));
+        set->owner = realloc(set->owner, (set->cap + 1) * sizeof(int));
+        assert(set->tree && set->owner);
+    }
+    memset(set->owner + live + 1, -1, (set->cap - live) * sizeof(int));
+    // 1..live都标1：tree[i]覆盖(i - lowbit(i), i]
+    for (int i = 1; i <= set->cap; i++)
+    {
+        int lo = i - (i & -i);
+        set->tree[i] = i < live ? i - lo : live > lo ? live - lo : 0;
+    }
+    set->clock = live;
+}
+
+// 返回块号对应的id，第一次出现时分配新的id，依次为0, 1, 2...
+int findBlock(uint64_t block)
+{
+    if (2 * (blockCount + 1) > blockSlots)
+    {
+        uint64_t *oldAddr = blockAddr;
+        int *oldId = blockId;
+        size_t oldSlots = blockSlots;
+        blockSlots = oldSlots ? 2 * oldSlots : 1024;
+        blockAddr = malloc(blockSlots * sizeof(uint64_t));
+        blockId = malloc(blockSlots * sizeof(int));
+        assert(blockAddr && blockId);
+        memset(blockId, -1, blockSlots * sizeof(int));
+        for (size_t i = 0; i < oldSlots; i++)
+        {
+            if (oldId[i] >= 0)
+            {
+                size_t j = (oldAddr[i] * 0x9e3779b97f4a7c15ULL) & (blockSlots - 1);
+                while (blockId[j] >= 0)
+                    j = (j + 1) & (blockSlots - 1);
+                blockAddr[j] = oldAddr[i];
+                blockId[j] = oldId[i];
+            }
+        }
+        free(oldAddr);
+        free(oldId);
+    }
+    size_t j = (block * 0x9e3779b97f4a7c15ULL) & (blockSlots - 1);
+    while (blockId[j] >= 0)
+    {
+        if (blockAddr[j] == block)
+            return blockId[j];
+        j = (j + 1) & (blockSlots - 1);
+    }
+    blockAddr[j] = block;
+    blockId[j] = blockCount;
+    return blockCount++;
+}
+
+void stackAccess(uint64_t addr)
+{
+    uint64_t block = addr >> b;
+    size_t known = blockCount;
+    int id = findBlock(block);
+    if (blockCount != known)
+    { // 新的块
+        if (known == lastClockIds)
+        {
+            lastClockIds = lastClockIds ? 2 * lastClockIds : 1024;
+            lastClock = realloc(lastClock, lastClockIds * (sMax + 1) * sizeof(int));
+            assert(lastClock);
+        }
+        memset(lastClock + known * (sMax + 1), 0, (sMax + 1) * sizeof(int));
+    }
+    for (int k = 0; k <= sMax; k++)
+    {
+        stack_set *set = &stackSets[k][block & ((1ULL << k) - 1)];
+        int *last = &lastClock[(size_t)id * (sMax + 1) + k];
+        if (set->clock == set->cap)
+            stackCompact(set, k);
+        int now = ++set->clock;
+        int d = eMax;
+        if (*last == 0)
+            set->blocks++;
+        else if (*last > 0)
+        {
+            d = fenwickSum(set, now - 1) - fenwickSum(set, *last);
+            if (d > eMax)
+                d = eMax;
+            fenwickAdd(set, *last, -1);
+            set->owner[*last] = -1;
+        }
+        fenwickAdd(set, now, 1);
+        set->owner[now] = id;
+        *last = now;
+        distCount[k][d]++;
+    }
+}
+
+// 输出每个(s, E)的hits/misses/evictions
+void missRatioCurve(trace_reader_t *trace)
+{
+    trace_rec_t rec;
+    sMax = s;
+    eMax = E;
+    for (int k = 0; k <= sMax; k++)
+    {
+        stackSets[k] = calloc((size_t)1 << k, sizeof(stack_set));
+        distCount[k] = calloc(eMax + 1, sizeof(long));
+        assert(stackSets[k] && distCount[k]);
+        for (size_t i = 0; i < (size_t)1 << k; i++)
+        {
+            stackSets[k][i].cap = 16;
+            stackSets[k][i].tree = calloc(17, sizeof(int));
+            stackSets[k][i].owner = malloc(17 * sizeof(int));
+            assert(stackSets[k][i].tree && stackSets[k][i].owner);
+            memset(stackSets[k][i].owner, -1, 17 * sizeof(int));
+        }
+    }
+    while (readTrace(trace, &rec))
+    {
+        if (rec.op != 'I')
+            stackAccess(rec.addr);
+        if (rec.op == 'M')
+            stackAccess(rec.addr);
+    }
+
+    printf("%4s %4s %10s %10s %10s %8s\n", "s", "E", "hits", "misses", "evictions", "miss%");
+    for (int k = 0; k <= sMax; k++)
+    {
+        long hits = 0, accesses = 0;
+        for (int d = 0; d <= eMax; d++)
+            accesses += distCount[k][d];
+        for (int e = 1; e <= eMax; e++)
+        {
+            // 每个set的前min(E, blocks)次miss填入空行，其余都是eviction
+            long fills = 0;
+            hits += distCount[k][e - 1];
+            for (size_t i = 0; i < (size_t)1 << k; i++)
+                fills += stackSets[k][i].blocks < e ? stackSets[k][i].blocks : e;
+            printf("%4d %4d %10ld %10ld %10ld %8.3f\n", k, e, hits, accesses - hits,
+                   accesses - hits - fills, accesses ? 100.0 * (accesses - hits) / accesses : 0.0);
+        }
+        for (size_t i = 0; i < (size_t)1 << k; i++)
+        {
+            free(stackSets[k][i].tree);
+            free(stackSets[k][i].owner);
+        }
+        free(stackSets[k]);
+        free(distCount[k]);
+    }
+    free(blockAddr);
+    free(blockId);
+    free(lastClock);
+}
+
+// OPT要预先知道每次访问的块下一次在第几次访问时再被访问，不再访问时为UINT64_MAX
+void computeNextUse(trace_reader_t *trace)
+{
+    trace_rec_t rec;
+    size_t n = 0, cap = 1024;
+    uint64_t *blocks = malloc(cap * sizeof(uint64_t));
+    assert(blocks);
+    while (readTrace(trace, &rec))
+    {
+        for (int k = (rec.op != 'I') + (rec.op == 'M'); k > 0; k--)
+        {
+            if (n == cap)
+            {
+                cap *= 2;
+                blocks = realloc(blocks, cap * sizeof(uint64_t));
+                assert(blocks);
+            }
+            blocks[n++] = rec.addr >> b;
+        }
+    }
+    rewindTrace(trace);
+
+    uint64_t *seen = NULL;
+    size_t seenIds = 0;
+    nextUse = malloc((n + 1) * sizeof(uint64_t));
+    assert(nextUse);
+    for (size_t i = n; i-- > 0;)
+    { // 倒着扫描，seen[id]是这个块在i之后第一次被访问的序号
+        size_t known = blockCount;
+        int id = findBlock(blocks[i]);
+        if (blockCount != known)
+        {
+            if (known == seenIds)
+            {
+                seenIds = seenIds ? 2 * seenIds : 1024;
+                seen = realloc(seen, seenIds * sizeof(uint64_t));
+                assert(seen);
+            }
+            seen[id] = UINT64_MAX;
+        }
+        nextUse[i] = seen[id];
+        seen[id] = i;
+    }
+    free(blocks);
+    free(seen);
+    free(blockAddr);
+    free(blockId);
+}
+
 int main(int argc, char **argv)
 {
     int opt;
-    while ((opt = getopt(argc, argv, "hvs:E:b:t:")) != -1)
+    while ((opt = getopt(argc, argv, "hvBmnj:p:w:L:l:i:c:s:E:b:t:")) != -1)
     {
         switch (opt)
         {
         case 'v':
             haveV = true;
             break;
+        case 'B':
+            haveB = true;
+            break;
+        case 'm':
+            haveM = true;
+            break;
+        case 'j':
+            jobs = atoi(optarg);
+            break;
+        case 'p':
+            haveP = true;
+            for (policy = 0; policy <= POLICY_OPT && strcmp(optarg, policyNames[policy]); policy++)
+                ;
+            if (policy > POLICY_OPT)
+            {
+                helpInfo();
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'w':
+            haveP = true;
+            if (strcmp(optarg, "wb") && strcmp(optarg, "wt"))
+            {
+                helpInfo();
+                exit(EXIT_FAILURE);
+            }
+            writeBack = strcmp(optarg, "wt") != 0;
+            break;
+        case 'n':
+            haveP = true;
+            writeAllocate = false;
+            break;
+        case 'L':
+            addLevel(optarg);
+            break;
+        case 'l':
+            memLatency = atoi(optarg);
+            break;
+        case 'i':
+            setInclusion(optarg);
+            break;
+        case 'c':
+            readConfig(optarg);
+            break;
         case 's':
             s = atoi(optarg);
-            S = (int)pow(2, s);
             break;
         case 'E':
             E = atoi(optarg);
@@ -121,61 +983,121 @@ int main(int argc, char **argv)
             exit(EXIT_FAILURE);
         }
     }
-    FILE *file = fopen(filePath, "r");
-    assert(file);
-    if (s < 0 || E < 0 || b < 0 || file == NULL)
+    trace_reader_t *trace = openTrace(filePath);
+    if (s < 0 || E < 0 || b < 0 || trace == NULL)
     {
         helpInfo();
         exit(0);
     }
-
-    cache = (cache_line **)malloc(S * sizeof(cache_line));
-    assert(cache);
-
-    for (int i = 0; i < S; i++)
+    if (haveM)
     {
-        cache[i] = (cache_line *)malloc(E * sizeof(cache_line));
-        assert(cache[i]);
-        memset(cache[i], 0, sizeof(cache_line) * E); // 初始化值，全置零
+        if (s > 24 || E < 1)
+        {
+            helpInfo();
+            exit(0);
+        }
+        missRatioCurve(trace);
+        closeTrace(trace);
+        return 0;
     }
 
-    char type;
-    uint64_t address;
-    int size;
-    while (fscanf(file, " %c %lx,%d", &type, &address, &size) > 0)
+    bool hierarchy = levelCount > 0;
+    if (hierarchy)
     {
-        if (haveV)
+        // 写策略只对单级cache建模，OPT的访问序列在L1以下也不再成立
+        if (haveP && (policy == POLICY_OPT || !writeBack || !writeAllocate))
         {
-            printf("%c %lx,%d", type, address, size);
+            printf("A hierarchy can't use -p opt, -w or -n\n");
+            exit(EXIT_FAILURE);
         }
-        if (type != 'I')
+        haveP = false;
+    }
+    else
+        initLevel(&levels[levelCount++], "", s, E, b, 0);
+    for (int k = 0; k < levelCount; k++)
+    {
+        if (policy == POLICY_PLRU && (levels[k].E & (levels[k].E - 1)))
         {
-            dealWithAddress(address);
+            printf("plru needs E to be a power of 2\n");
+            exit(EXIT_FAILURE);
         }
+    }
+    if (policy == POLICY_OPT)
+        computeNextUse(trace);
+#ifdef HAVE_AVX2_MATCH
+    if (__builtin_cpu_supports("avx2"))
+        findLine = findLineAVX2;
+#endif
 
-        if (type == 'M')
-            dealWithAddress(address);
-        if (haveV)
-        {
-            printf("\n");
-        }
-        for (int i = 0; i < S; ++i)
+    trace_rec_t rec;
+    long records = 0;
+    double start;
+    if (haveB)
+    { // 先只解析一遍，单独测量解析速度
+        start = nowSeconds();
+        while (readTrace(trace, &rec))
+            records++;
+        printRate("parse", records, nowSeconds() - start);
+        rewindTrace(trace);
+        records = 0;
+    }
+    // -v要按trace的顺序输出；随机和BRRIP用全局的状态，OPT用全局的访问序号
+    bool parallel = jobs > 1 && !haveV && !hierarchy && policy != POLICY_RANDOM &&
+                    policy != POLICY_BRRIP && policy != POLICY_OPT;
+    start = nowSeconds();
+    if (parallel)
+        records = simulateParallel(trace);
+    else
+    {
+        while (readTrace(trace, &rec))
         {
-            for (int j = 0; j < E; ++j)
+            records++;
+            if (haveV)
             {
-                if (cache[i][j].validBit)
+                printf("%c %lx,%d", rec.op, rec.addr, rec.size);
+            }
+            if (hierarchy)
+            {
+                for (int k = (rec.op != 'I') + (rec.op == 'M'); k > 0; k--)
+                    hierarchyAccess(rec.addr);
+            }
+            else
+            {
+                if (rec.op != 'I')
                 {
-                    cache[i][j].LRU_counter++;
+                    dealWithAddress(&levels[0], rec.addr, rec.op == 'S');
                 }
+
+                if (rec.op == 'M')
+                    dealWithAddress(&levels[0], rec.addr, true);
+            }
+            if (haveV)
+            {
+                printf("\n");
             }
+            // 不再逐行增加计数器：推进时间戳即可，每次访问只需O(E)
+            timeStamp++;
         }
     }
-    fclose(file);
-    for (int i = 0; i < S; ++i)
+    double elapsed = nowSeconds() - start;
+    closeTrace(trace);
+    free(nextUse);
+    if (hierarchy)
     {
-        free(cache[i]);
+        long accesses = levels[0].hits + levels[0].misses;
+        for (int k = 0; k < levelCount; k++)
+            printf("%shits:%d misses:%d evictions:%d\n", levels[k].name,
+                   levels[k].hits, levels[k].misses, levels[k].evictions);
+        printf("memory accesses:%ld\n", memAccesses);
+        printf("AMAT:%.2f cycles\n", accesses ? (double)totalCycles / accesses : 0.0);
     }
-    free(cache);
-    printSummary(hitCount, missCount, evictionCount);
+    else
+        printSummary(levels[0].hits, levels[0].misses, levels[0].evictions);
+    for (int k = 0; k < levelCount; k++)
+        free(levels[k].lines);
+    if (haveP)
+        printTrafficSummary(dirtyEvictionCount, memReadCount, memWriteCount);
+    if (haveB)
+        printRate("simulate", records, elapsed);
     return 0;
 }
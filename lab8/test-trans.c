@@ -14,6 +14,7 @@
 #include "cachelab.h"
 #include <sys/wait.h> // fir WEXITSTATUS
 #include <limits.h> // for INT_MAX
+#include <stdint.h>
 
 /* Maximum array dimension */
 #define MAXN 256
@@ -32,6 +33,10 @@ extern int func_counter;
 /* Globals set on the command line */
 static int M = 0;
 static int N = 0;
+static int binary = 0;  /* Write binary traces, which only ./csim reads */
+#ifdef TRANS_INST
+static int inproc = 0;  /* Simulate in this process instead of with valgrind */
+#endif
 
 /* The correctness and performance for the submitted transpose function */
 struct results {
@@ -57,6 +62,8 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b)
     /* Open the complete trace file */
     FILE* full_trace_fp;  
     FILE* part_trace_fp; 
+    trace_writer_t part_trace;
+    trace_rec_t rec;
 
     /* Evaluate the performance of each registered transpose function */
 
@@ -97,6 +104,8 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b)
         sprintf(filename, "trace.f%d", i);
         part_trace_fp = fopen(filename, "w");
         assert(part_trace_fp);
+        if (binary)
+            startBinaryTrace(&part_trace, part_trace_fp);
     
         /* Locate trace corresponding to the trans function */
         flag = 0;
@@ -121,7 +130,14 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b)
                    eliminate the valgrind stack references while
                    include the student stack references. */
                 if (flag && addr < 0xffffffff) {
-                    fputs(buf, part_trace_fp);
+                    if (binary) {
+                        rec.op = buf[1];
+                        rec.addr = addr;
+                        rec.size = len;
+                        writeBinaryTrace(&part_trace, &rec);
+                    }
+                    else
+                        fputs(buf, part_trace_fp);
                 }
 
                 /* if end marker found, close trace file */
@@ -137,8 +153,8 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b)
         /* Run the reference simulator */
         printf("Step 2: Evaluating performance (s=%d, E=%d, b=%d)\n", s, E, b);
         char cmd[255];
-        sprintf(cmd, "./csim-ref -s %u -E %u -b %u -t trace.f%d > /dev/null", 
-                s, E, b, i);
+        sprintf(cmd, "%s -s %u -E %u -b %u -t trace.f%d > /dev/null", 
+                binary ? "./csim" : "./csim-ref", s, E, b, i);
         system(cmd);
     
         /* Collect results from the reference simulator */
@@ -160,13 +176,162 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b)
   
 }
 
+#ifdef TRANS_INST
+/*
+ * In-process evaluation, only in test-trans-inst. That is built with
+ * -DTRANS_INST and linked with trans-inst.o, which is trans.c compiled
+ * with -fsanitize=thread. The compiler then calls a __tsan_ function
+ * before every load and store. The ThreadSanitizer runtime must not be
+ * linked; the functions below replace it and feed each access straight
+ * into a cache_model_t.
+ */
+
+/* Matrices and markers laid out as in tracegen */
+static volatile char MARKER_START, MARKER_END;
+static int A[MAXN][MAXN];
+static int B[MAXN][MAXN];
+
+static cache_model_t model;
+static int recording = 0;
+static uintptr_t stack_top;    /* Frame that called the transpose function */
+
+/* 
+ * model_access - Simulate one access. Like the valgrind filter in
+ *     eval_perf, ignore the stack, where the locals of the transpose
+ *     function live
+ */
+static void model_access(const volatile void *p)
+{
+    uintptr_t addr = (uintptr_t)p;
+
+    if (recording && !(addr < stack_top && addr > stack_top - (64 << 20)))
+        cacheModelAccess(&model, addr);
+}
+
+#define TSAN_HOOKS(n) \
+    void __tsan_read##n(void *p) { model_access(p); } \
+    void __tsan_write##n(void *p) { model_access(p); } \
+    void __tsan_unaligned_read##n(void *p) { model_access(p); } \
+    void __tsan_unaligned_write##n(void *p) { model_access(p); }
+TSAN_HOOKS(1)
+TSAN_HOOKS(2)
+TSAN_HOOKS(4)
+TSAN_HOOKS(8)
+TSAN_HOOKS(16)
+
+/* A block copy, one access for each 8 bytes */
+static void model_range(void *p, unsigned long size)
+{
+    unsigned long off;
+
+    for (off = 0; off < size; off += 8)
+        model_access((char *)p + off);
+}
+void __tsan_read_range(void *p, unsigned long size) { model_range(p, size); }
+void __tsan_write_range(void *p, unsigned long size) { model_range(p, size); }
+void __tsan_init(void) {}
+void __tsan_func_entry(void *pc) {}
+void __tsan_func_exit(void) {}
+
+/* 
+ * validate - Check B against correctTrans, as tracegen does
+ */
+static int validate(int fn, int M, int N, int A[N][M], int B[M][N])
+{
+    static int C[MAXN * MAXN];
+    int (*c)[N] = (int (*)[N])C;
+    int i, j;
+
+    memset(C, 0, sizeof(C));
+    correctTrans(M, N, A, c);
+    for (i = 0; i < M; i++) {
+        for (j = 0; j < N; j++) {
+            if (B[i][j] != c[i][j]) {
+                printf("Validation failed on function %d! Expected %d but got %d at B[%d][%d]\n",
+                       fn, c[i][j], B[i][j], i, j);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/* 
+ * eval_perf_inproc - Evaluate the registered transpose functions as
+ *     eval_perf does, but without valgrind, trace files or csim-ref
+ */
+void eval_perf_inproc(unsigned int s, unsigned int E, unsigned int b)
+{
+    int i;
+    char frame;
+    void (*func)(int, int, int[N][M], int[M][N]);
+
+    registerFunctions();
+    initCacheModel(&model, s, E, b);
+    stack_top = (uintptr_t)&frame;
+
+    for (i=0; i<func_counter; i++) {
+        if (strcmp(func_list[i].description, SUBMIT_DESCRIPTION) == 0 )
+            results.funcid = i; /* remember which function is the submission */
+
+        printf("\nFunction %d (%d total)\nStep 1: Validating and simulating in-process (s=%d, E=%d, b=%d)\n",
+               i, func_counter, s, E, b);
+        initMatrix(M, N, A, B);
+        resetCacheModel(&model);
+
+        /* tracegen's trace starts with its store to MARKER_START, then
+           loads the function pointer, N and M before the call */
+        recording = 1;
+        model_access(&MARKER_START);
+        MARKER_START = 33;
+        model_access(&func_list[i].func_ptr);
+        func = func_list[i].func_ptr;
+        model_access(&N);
+        model_access(&M);
+        (*func)(M, N, A, B);
+        model_access(&MARKER_END);
+        MARKER_END = 34;
+        recording = 0;
+
+        if (!validate(i, M, N, A, B)) {
+            printf("Validation error at function %d!\nSkipping performance evaluation for this function.\n", i);
+            continue;
+        }
+        func_list[i].correct=1;
+        if (results.funcid == i ) {
+            results.correct = 1;
+        }
+
+        func_list[i].num_hits = model.hits;
+        func_list[i].num_misses = model.misses;
+        func_list[i].num_evictions = model.evictions;
+        printf("func %u (%s): hits:%u, misses:%u, evictions:%u\n",
+               i, func_list[i].description, model.hits, model.misses, model.evictions);
+
+        /* If it is transpose_submit(), record number of misses */
+        if (results.funcid == i) {
+            results.misses = model.misses;
+        }
+    }
+    freeCacheModel(&model);
+}
+#endif /* TRANS_INST */
+
 /*
  * usage - Print usage info
  */
 void usage(char *argv[]){
-    printf("Usage: %s [-h] -M <rows> -N <cols>\n", argv[0]);
+#ifdef TRANS_INST
+    printf("Usage: %s [-hbi] -M <rows> -N <cols>\n", argv[0]);
+#else
+    printf("Usage: %s [-hb] -M <rows> -N <cols>\n", argv[0]);
+#endif
     printf("Options:\n");
     printf("  -h          Print this help message.\n");
+    printf("  -b          Write binary traces, and simulate them with ./csim\n");
+#ifdef TRANS_INST
+    printf("  -i          Simulate in-process instead of running valgrind\n");
+#endif
     printf("  -M <rows>   Number of matrix rows (max %d)\n", MAXN);
     printf("  -N <cols>   Number of  matrix columns (max %d)\n", MAXN);
     printf("Example: %s -M 8 -N 8\n", argv[0]);       
@@ -199,7 +364,11 @@ int main(int argc, char* argv[])
 {
     char c;
 
-    while ((c = getopt(argc,argv,"M:N:h")) != -1) {
+#ifdef TRANS_INST
+    while ((c = getopt(argc,argv,"M:N:hbi")) != -1) {
+#else
+    while ((c = getopt(argc,argv,"M:N:hb")) != -1) {
+#endif
         switch(c) {
         case 'M':
             M = atoi(optarg);
@@ -207,6 +376,14 @@ int main(int argc, char* argv[])
         case 'N':
             N = atoi(optarg);
             break;
+        case 'b':
+            binary = 1;
+            break;
+#ifdef TRANS_INST
+        case 'i':
+            inproc = 1;
+            break;
+#endif
         case 'h':
             usage(argv);
             exit(0);
@@ -243,7 +420,12 @@ int main(int argc, char* argv[])
     alarm(120);
 
     /* Check the performance of the student's transpose function */
-    eval_perf(5, 1, 5);
+#ifdef TRANS_INST
+    if (inproc)
+        eval_perf_inproc(5, 1, 5);
+    else
+#endif
+        eval_perf(5, 1, 5);
   
     /* Emit the results for this particular test */
     if (results.funcid == -1) {
@@ -0,0 +1,87 @@
+/*
+ * trace2bin.c - Converts a valgrind lackey trace to the compact binary
+ * trace format described in cachelab.h, which csim reads directly.
+ * With -d it converts either kind of trace back to text.
+ *
+ * Records are converted one at a time, so traces of any length can be
+ * converted.  Lines that aren't records are dropped.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "cachelab.h"
+
+/*
+ * usage - Print usage info
+ */
+void usage(char *argv[]){
+    printf("Usage: %s [-hd] <infile> <outfile>\n", argv[0]);
+    printf("Options:\n");
+    printf("  -h         Print this help message.\n");
+    printf("  -d         Write a text trace instead.\n");
+    printf("  <outfile>  Output trace, - for stdout.\n");
+    printf("Example: %s traces/long.trace long.bin\n", argv[0]);
+}
+
+int main(int argc, char* argv[]){
+    char c;
+    int decode = 0;
+    long records = 0;
+    trace_reader_t *tr;
+    trace_writer_t tw;
+    trace_rec_t rec;
+    FILE *out;
+
+    while( (c=getopt(argc,argv,"dh")) != -1){
+        switch(c){
+        case 'd':
+            decode = 1;
+            break;
+        case 'h':
+            usage(argv);
+            exit(0);
+        default:
+            usage(argv);
+            exit(1);
+        }
+    }
+    if (argc - optind != 2) {
+        usage(argv);
+        exit(1);
+    }
+
+    tr = openTrace(argv[optind]);
+    if (tr == NULL) {
+        fprintf(stderr, "Can't read %s\n", argv[optind]);
+        exit(1);
+    }
+    if (strcmp(argv[optind+1], "-") == 0)
+        out = stdout;
+    else if ((out = fopen(argv[optind+1], "w")) == NULL) {
+        fprintf(stderr, "Can't write %s\n", argv[optind+1]);
+        exit(1);
+    }
+
+    if (!decode)
+        startBinaryTrace(&tw, out);
+    while (readTrace(tr, &rec)) {
+        if (!decode)
+            writeBinaryTrace(&tw, &rec);
+        else if (rec.op == 'I')
+            fprintf(out, "I  %08lx,%d\n", rec.addr, rec.size);
+        else
+            fprintf(out, " %c %08lx,%d\n", rec.op, rec.addr, rec.size);
+        records++;
+    }
+    closeTrace(tr);
+
+    if (fclose(out) != 0) {
+        fprintf(stderr, "Error writing %s\n", argv[optind+1]);
+        exit(1);
+    }
+    fprintf(stderr, "%ld records\n", records);
+    return 0;
+}
@@ -0,0 +1,626 @@
+/*
+ * transtune.c - Searches blocked transpose kernels for the ones with the
+ * fewest misses on a given cache, and writes the best kernel for each
+ * matrix shape as C code that can be pasted into trans.c.
+ *
+ * The variants differ in block size, the order blocks are visited in,
+ * the order each block is copied in, how the diagonal is handled, and
+ * whether rows are first loaded into 8 locals.  Each one is registered
+ * with registerTransFunction and run on matrices laid out as in
+ * tracegen, with every load and store of A and B counted by a
+ * cache_model_t.
+ *
+ * Only the kernel's own accesses are counted.  test-trans also counts
+ * the few tracegen makes around the call, which depend on how each
+ * program is linked; for a direct-mapped cache they add the same few
+ * misses to every kernel.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "cachelab.h"
+
+/* Maximum array dimension */
+#define MAXN 256
+
+/* Most shapes tuned in one run */
+#define MAXSHAPES 16
+
+/* External variables defined in cachelab.c */
+extern trans_func_t func_list[MAX_TRANS_FUNCS];
+extern int func_counter;
+
+/* How a kernel copies its blocks */
+typedef enum {
+    K_PLAIN,    /* Element by element */
+    K_DIAG,     /* Store the diagonal element after the rest of its row */
+    K_REGS,     /* Load a row of the block into locals, then store it */
+    K_QUAD      /* 8x8 blocks as 4x4 quarters, using B as a buffer */
+} kind_t;
+
+typedef struct {
+    kind_t kind;
+    int rows, cols;     /* Block size, in rows and columns of A */
+    int by_cols;        /* Visit the blocks column by column */
+    int down;           /* Copy each block down A's columns */
+    char desc[80];
+    unsigned int hits, misses, evictions;
+} variant_t;
+
+/* Block sizes tried */
+static const int sizes[] = {2, 3, 4, 5, 6, 7, 8, 10, 12, 14, 16, 17, 18,
+                            19, 20, 21, 22, 23, 24, 28, 32};
+#define NSIZES (int)(sizeof(sizes) / sizeof(sizes[0]))
+
+/* Matrices laid out as in tracegen */
+static int A[MAXN][MAXN];
+static int B[MAXN][MAXN];
+static int M;
+static int N;
+
+static cache_model_t model;
+static const variant_t *current;    /* Variant the kernels run */
+
+/* Every load and store of a matrix is counted through these */
+#define LD(X, i, j) (cacheModelAccess(&model, (unsigned long)&X[i][j]), X[i][j])
+#define ST(X, i, j, v) do { \
+        int v_ = (v); \
+        cacheModelAccess(&model, (unsigned long)&X[i][j]); \
+        X[i][j] = v_; \
+    } while (0)
+
+/*
+ * copy_block - Copy the block of A at (ii, jj) as current says.  The
+ *     accesses must be the ones emit_block's code makes, in order
+ */
+static void copy_block(int M, int N, int A[N][M], int B[M][N], int ii, int jj)
+{
+    const variant_t *v = current;
+    int iend = ii + v->rows < N ? ii + v->rows : N;
+    int jend = jj + v->cols < M ? jj + v->cols : M;
+    int i, j, k, d = 0, t[8];
+
+    switch (v->kind) {
+    case K_PLAIN:
+    case K_DIAG:
+        if (!v->down) {
+            for (i = ii; i < iend; i++) {
+                for (j = jj; j < jend; j++) {
+                    if (v->kind == K_DIAG && i == j)
+                        d = LD(A, i, j);
+                    else
+                        ST(B, j, i, LD(A, i, j));
+                }
+                if (v->kind == K_DIAG && i >= jj && i < jend)
+                    ST(B, i, i, d);
+            }
+        }
+        else {
+            for (j = jj; j < jend; j++) {
+                for (i = ii; i < iend; i++) {
+                    if (v->kind == K_DIAG && i == j)
+                        d = LD(A, i, j);
+                    else
+                        ST(B, j, i, LD(A, i, j));
+                }
+                if (v->kind == K_DIAG && j >= ii && j < iend)
+                    ST(B, j, j, d);
+            }
+        }
+        break;
+    case K_REGS:
+        if (!v->down) {
+            for (i = ii; i < iend; i++) {
+                if (jj + v->cols <= M) {
+                    for (k = 0; k < v->cols; k++)
+                        t[k] = LD(A, i, jj + k);
+                    for (k = 0; k < v->cols; k++)
+                        ST(B, jj + k, i, t[k]);
+                }
+                else {
+                    for (j = jj; j < M; j++)
+                        ST(B, j, i, LD(A, i, j));
+                }
+            }
+        }
+        else {
+            for (j = jj; j < jend; j++) {
+                if (ii + v->rows <= N) {
+                    for (k = 0; k < v->rows; k++)
+                        t[k] = LD(A, ii + k, j);
+                    for (k = 0; k < v->rows; k++)
+                        ST(B, j, ii + k, t[k]);
+                }
+                else {
+                    for (i = ii; i < N; i++)
+                        ST(B, j, i, LD(A, i, j));
+                }
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * kernel_blocks - The transpose function registered for all variants
+ *     but K_QUAD
+ */
+static void kernel_blocks(int M, int N, int A[N][M], int B[M][N])
+{
+    int ii, jj;
+
+    if (current->by_cols) {
+        for (jj = 0; jj < M; jj += current->cols)
+            for (ii = 0; ii < N; ii += current->rows)
+                copy_block(M, N, A, B, ii, jj);
+    }
+    else {
+        for (ii = 0; ii < N; ii += current->rows)
+            for (jj = 0; jj < M; jj += current->cols)
+                copy_block(M, N, A, B, ii, jj);
+    }
+}
+
+/*
+ * quad_block - Copy the 8x8 block at (i, j) as trans.c does for 64x64:
+ *     the left half of A's top rows goes to its place in B and the right
+ *     half to B's top right quarter.  That quarter then moves down while
+ *     the left half of A's bottom rows replaces it, and last the bottom
+ *     right quarter is copied
+ */
+static void quad_block(int M, int N, int A[N][M], int B[M][N], int i, int j)
+{
+    int k, x, t[8];
+
+    for (k = i; k < i + 4; k++) {
+        for (x = 0; x < 8; x++)
+            t[x] = LD(A, k, j + x);
+        for (x = 0; x < 4; x++)
+            ST(B, j + x, k, t[x]);
+        for (x = 0; x < 4; x++)
+            ST(B, j + x, k + 4, t[x + 4]);
+    }
+    for (k = j; k < j + 4; k++) {
+        for (x = 0; x < 4; x++)
+            t[x] = LD(B, k, i + 4 + x);
+        for (x = 0; x < 4; x++)
+            t[x + 4] = LD(A, i + 4 + x, k);
+        for (x = 0; x < 4; x++)
+            ST(B, k, i + 4 + x, t[x + 4]);
+        for (x = 0; x < 4; x++)
+            ST(B, k + 4, i + x, t[x]);
+    }
+    for (k = i + 4; k < i + 8; k++) {
+        for (x = 4; x < 8; x++)
+            t[x] = LD(A, k, j + x);
+        for (x = 4; x < 8; x++)
+            ST(B, j + x, k, t[x]);
+    }
+}
+
+/*
+ * kernel_quad - The transpose function registered for K_QUAD variants.
+ *     M and N must be multiples of 8
+ */
+static void kernel_quad(int M, int N, int A[N][M], int B[M][N])
+{
+    int i, j;
+
+    if (current->by_cols) {
+        for (j = 0; j < M; j += 8)
+            for (i = 0; i < N; i += 8)
+                quad_block(M, N, A, B, i, j);
+    }
+    else {
+        for (i = 0; i < N; i += 8)
+            for (j = 0; j < M; j += 8)
+                quad_block(M, N, A, B, i, j);
+    }
+}
+
+/*
+ * validate - Check B against correctTrans, as tracegen does
+ */
+static int validate(int M, int N, int A[N][M], int B[M][N])
+{
+    static int C[MAXN * MAXN];
+    int (*c)[N] = (int (*)[N])C;
+    int i, j;
+
+    correctTrans(M, N, A, c);
+    for (i = 0; i < M; i++)
+        for (j = 0; j < N; j++)
+            if (B[i][j] != c[i][j])
+                return 0;
+    return 1;
+}
+
+/*
+ * evaluate - Register the variants in batches, run each one on the
+ *     cache model and record its counts.  Variants that don't transpose
+ *     correctly get UINT_MAX misses
+ */
+static void evaluate(variant_t *v, int count)
+{
+    int i, done;
+
+    for (done = 0; done < count; done += func_counter) {
+        func_counter = 0;
+        for (i = done; i < count && func_counter < MAX_TRANS_FUNCS; i++)
+            registerTransFunction(v[i].kind == K_QUAD ? kernel_quad : kernel_blocks,
+                                  v[i].desc);
+
+        for (i = 0; i < func_counter; i++) {
+            current = &v[done + i];
+            initMatrix(M, N, A, B);
+            resetCacheModel(&model);
+            (*func_list[i].func_ptr)(M, N, A, B);
+
+            func_list[i].correct = validate(M, N, A, B);
+            func_list[i].num_hits = model.hits;
+            func_list[i].num_misses = func_list[i].correct ? model.misses : ~0U;
+            func_list[i].num_evictions = model.evictions;
+            v[done + i].hits = func_list[i].num_hits;
+            v[done + i].misses = func_list[i].num_misses;
+            v[done + i].evictions = func_list[i].num_evictions;
+        }
+    }
+    func_counter = 0;
+}
+
+/*
+ * add_variant - Append a variant to v
+ */
+static int add_variant(variant_t *v, int count, kind_t kind, int r, int c,
+                       int by_cols, int down)
+{
+    variant_t *p = &v[count];
+    char extra[32] = "";
+
+    p->kind = kind;
+    p->rows = r;
+    p->cols = c;
+    p->by_cols = by_cols;
+    p->down = down;
+    if (kind == K_DIAG)
+        strcpy(extra, ", diagonal last");
+    else if (kind == K_REGS)
+        sprintf(extra, ", %d locals", down ? r : c);
+    if (kind == K_QUAD)
+        snprintf(p->desc, sizeof(p->desc), "8x8 blocks by %s, as 4x4 quarters",
+                 by_cols ? "columns" : "rows");
+    else
+        snprintf(p->desc, sizeof(p->desc), "%dx%d blocks by %s, copied %s%s",
+                 r, c, by_cols ? "columns" : "rows", down ? "down" : "across",
+                 extra);
+    return count + 1;
+}
+
+/*
+ * covered - Is a smaller size already as large as the dimension?  Then
+ *     sizes[k] gives the same kernel
+ */
+static int covered(int k, int dim)
+{
+    return k > 0 && sizes[k - 1] >= dim;
+}
+
+/*
+ * make_variants - Fill v with every variant for an M x N matrix.  The
+ *     simpler kinds come first, so they win ties
+ */
+static int make_variants(variant_t *v)
+{
+    int count = 0, kind, r, c, by_cols, down;
+
+    for (kind = K_PLAIN; kind <= K_REGS; kind++)
+        for (r = 0; r < NSIZES; r++)
+            for (c = 0; c < NSIZES; c++)
+                for (by_cols = 0; by_cols < 2; by_cols++)
+                    for (down = 0; down < 2; down++) {
+                        if (covered(r, N) || covered(c, M))
+                            continue;
+                        if (kind == K_REGS && (down ? sizes[r] : sizes[c]) > 8)
+                            continue;
+                        count = add_variant(v, count, kind, sizes[r], sizes[c],
+                                            by_cols, down);
+                    }
+    if (M % 8 == 0 && N % 8 == 0)
+        for (by_cols = 0; by_cols < 2; by_cols++)
+            count = add_variant(v, count, K_QUAD, 8, 8, by_cols, 0);
+    return count;
+}
+
+/*
+ * emit - Print one line of generated code, indented depth levels
+ */
+static void emit(FILE *out, int depth, const char *fmt, ...)
+{
+    va_list ap;
+
+    fprintf(out, "%*s", 4 * depth, "");
+    va_start(ap, fmt);
+    vfprintf(out, fmt, ap);
+    va_end(ap);
+    fputc('\n', out);
+}
+
+/*
+ * emit_offset - Format "x" or "x + k"
+ */
+static const char *emit_offset(char *buf, const char *x, int k)
+{
+    if (k)
+        sprintf(buf, "%s + %d", x, k);
+    else
+        strcpy(buf, x);
+    return buf;
+}
+
+/*
+ * emit_block - Print the loops copying one block, as copy_block does
+ */
+static void emit_block(FILE *out, const variant_t *v, int d)
+{
+    const char *o = v->down ? "j" : "i", *in = v->down ? "i" : "j";
+    const char *ob = v->down ? "jj" : "ii", *ib = v->down ? "ii" : "jj";
+    int osize = v->down ? v->cols : v->rows, isize = v->down ? v->rows : v->cols;
+    const char *odim = v->down ? "M" : "N", *idim = v->down ? "N" : "M";
+    char x[32];
+    int k;
+
+    emit(out, d, "for (%s = %s; %s < %s + %d && %s < %s; %s++)", o, ob, o, ob,
+         osize, o, odim, o);
+    emit(out, d, "{");
+    if (v->kind == K_REGS) {
+        emit(out, d + 1, "if (%s + %d <= %s)", ib, isize, idim);
+        emit(out, d + 1, "{");
+        for (k = 0; k < isize; k++) {
+            emit_offset(x, ib, k);
+            if (v->down)
+                emit(out, d + 2, "a%d = A[%s][j];", k + 1, x);
+            else
+                emit(out, d + 2, "a%d = A[i][%s];", k + 1, x);
+        }
+        for (k = 0; k < isize; k++) {
+            emit_offset(x, ib, k);
+            if (v->down)
+                emit(out, d + 2, "B[j][%s] = a%d;", x, k + 1);
+            else
+                emit(out, d + 2, "B[%s][i] = a%d;", x, k + 1);
+        }
+        emit(out, d + 1, "}");
+        emit(out, d + 1, "else");
+        emit(out, d + 1, "{");
+        emit(out, d + 2, "for (%s = %s; %s < %s; %s++)", in, ib, in, idim, in);
+        emit(out, d + 3, "B[j][i] = A[i][j];");
+        emit(out, d + 1, "}");
+    }
+    else {
+        emit(out, d + 1, "for (%s = %s; %s < %s + %d && %s < %s; %s++)", in, ib,
+             in, ib, isize, in, idim, in);
+        emit(out, d + 1, "{");
+        if (v->kind == K_DIAG) {
+            emit(out, d + 2, "if (i == j)");
+            emit(out, d + 3, "d = A[i][j];");
+            emit(out, d + 2, "else");
+            emit(out, d + 3, "B[j][i] = A[i][j];");
+        }
+        else
+            emit(out, d + 2, "B[j][i] = A[i][j];");
+        emit(out, d + 1, "}");
+        if (v->kind == K_DIAG) {
+            emit(out, d + 1, "if (%s >= %s && %s < %s + %d && %s < %s)", o, ib,
+                 o, ib, isize, o, idim);
+            emit(out, d + 2, "B[%s][%s] = d;", o, o);
+        }
+    }
+    emit(out, d, "}");
+}
+
+/*
+ * emit_quad - Print the body of a K_QUAD kernel's loops, as quad_block
+ */
+static void emit_quad(FILE *out, int d)
+{
+    char x[32], y[32];
+    int k;
+
+    emit(out, d, "for (k = i; k < i + 4; k++)");
+    emit(out, d, "{");
+    for (k = 0; k < 8; k++)
+        emit(out, d + 1, "a%d = A[k][%s];", k + 1, emit_offset(x, "j", k));
+    for (k = 0; k < 4; k++)
+        emit(out, d + 1, "B[%s][k] = a%d;", emit_offset(x, "j", k), k + 1);
+    for (k = 0; k < 4; k++)
+        emit(out, d + 1, "B[%s][k + 4] = a%d;", emit_offset(x, "j", k), k + 5);
+    emit(out, d, "}");
+    emit(out, d, "for (k = j; k < j + 4; k++)");
+    emit(out, d, "{");
+    for (k = 0; k < 4; k++)
+        emit(out, d + 1, "a%d = B[k][i + %d];", k + 1, k + 4);
+    for (k = 0; k < 4; k++)
+        emit(out, d + 1, "a%d = A[i + %d][k];", k + 5, k + 4);
+    for (k = 0; k < 4; k++)
+        emit(out, d + 1, "B[k][i + %d] = a%d;", k + 4, k + 5);
+    for (k = 0; k < 4; k++)
+        emit(out, d + 1, "B[k + 4][%s] = a%d;", emit_offset(y, "i", k), k + 1);
+    emit(out, d, "}");
+    emit(out, d, "for (k = i + 4; k < i + 8; k++)");
+    emit(out, d, "{");
+    for (k = 4; k < 8; k++)
+        emit(out, d + 1, "a%d = A[k][j + %d];", k + 1, k);
+    for (k = 4; k < 8; k++)
+        emit(out, d + 1, "B[j + %d][k] = a%d;", k, k + 1);
+    emit(out, d, "}");
+}
+
+/*
+ * emit_kernel - Print the kernel chosen for the current shape
+ */
+static void emit_kernel(FILE *out, const variant_t *v, int s, int E, int b)
+{
+    const char *o = v->by_cols ? "jj" : "ii", *in = v->by_cols ? "ii" : "jj";
+    int k;
+
+    fprintf(out, "/*\n * trans_tuned_%dx%d - %s\n", M, N, v->desc);
+    fprintf(out, " *     (%u misses of its own with s=%d, E=%d, b=%d)\n */\n", v->misses, s, E, b);
+    fprintf(out, "char trans_tuned_%dx%d_desc[] = \"Tuned %dx%d: %s\";\n", M, N, M, N, v->desc);
+    fprintf(out, "void trans_tuned_%dx%d(int M, int N, int A[N][M], int B[M][N])\n{\n", M, N);
+    if (v->kind == K_QUAD) {
+        emit(out, 1, "int a1, a2, a3, a4, a5, a6, a7, a8;");
+        emit(out, 1, "int i, j, k;");
+        emit(out, 1, "for (%s = 0; %s < %s; %s += 8)", v->by_cols ? "j" : "i",
+             v->by_cols ? "j" : "i", v->by_cols ? "M" : "N", v->by_cols ? "j" : "i");
+        emit(out, 1, "{");
+        emit(out, 2, "for (%s = 0; %s < %s; %s += 8)", v->by_cols ? "i" : "j",
+             v->by_cols ? "i" : "j", v->by_cols ? "N" : "M", v->by_cols ? "i" : "j");
+        emit(out, 2, "{");
+        emit_quad(out, 3);
+    }
+    else {
+        if (v->kind == K_REGS) {
+            fprintf(out, "    int ");
+            for (k = 1; k <= (v->down ? v->rows : v->cols); k++)
+                fprintf(out, "a%d, ", k);
+            fprintf(out, "ii, jj, i, j;\n");
+        }
+        else
+            emit(out, 1, v->kind == K_DIAG ? "int ii, jj, i, j, d = 0;" : "int ii, jj, i, j;");
+        emit(out, 1, "for (%s = 0; %s < %s; %s += %d)", o, o, v->by_cols ? "M" : "N",
+             o, v->by_cols ? v->cols : v->rows);
+        emit(out, 1, "{");
+        emit(out, 2, "for (%s = 0; %s < %s; %s += %d)", in, in, v->by_cols ? "N" : "M",
+             in, v->by_cols ? v->rows : v->cols);
+        emit(out, 2, "{");
+        emit_block(out, v, 3);
+    }
+    emit(out, 2, "}");
+    emit(out, 1, "}");
+    fprintf(out, "}\n\n");
+}
+
+/*
+ * emit_dispatch - Print transpose_tuned, which calls the kernel for the
+ *     shape it is given
+ */
+static void emit_dispatch(FILE *out, int shapes[][2], int count)
+{
+    int i;
+
+    fprintf(out, "/*\n * transpose_tuned - Calls the kernel tuned for the shape, or does a\n");
+    fprintf(out, " *     simple transpose for shapes that weren't tuned\n */\n");
+    fprintf(out, "char transpose_tuned_desc[] = \"Tuned transpose\";\n");
+    fprintf(out, "void transpose_tuned(int M, int N, int A[N][M], int B[M][N])\n{\n");
+    emit(out, 1, "int i, j;");
+    for (i = 0; i < count; i++) {
+        emit(out, 1, "%sif (M == %d && N == %d)", i ? "else " : "", shapes[i][0], shapes[i][1]);
+        emit(out, 2, "trans_tuned_%dx%d(M, N, A, B);", shapes[i][0], shapes[i][1]);
+    }
+    emit(out, 1, "else");
+    emit(out, 1, "{");
+    emit(out, 2, "for (i = 0; i < N; i++)");
+    emit(out, 3, "for (j = 0; j < M; j++)");
+    emit(out, 4, "B[j][i] = A[i][j];");
+    emit(out, 1, "}");
+    fprintf(out, "}\n");
+}
+
+/*
+ * usage - Print usage info
+ */
+void usage(char *argv[]){
+    printf("Usage: %s [-h] [-s <num>] [-E <num>] [-b <num>] [-o <file>] [<M>x<N>...]\n", argv[0]);
+    printf("Options:\n");
+    printf("  -h         Print this help message.\n");
+    printf("  -s <num>   Number of set index bits (default 5).\n");
+    printf("  -E <num>   Number of lines per set (default 1).\n");
+    printf("  -b <num>   Number of block offset bits (default 5).\n");
+    printf("  -o <file>  Write the generated C there instead of stdout.\n");
+    printf("  <M>x<N>    Shapes to tune, as for test-trans -M <M> -N <N>\n");
+    printf("             (default 32x32 64x64 61x67).\n");
+    printf("Example: %s -o tuned.c 32x32 64x64 61x67\n", argv[0]);
+}
+
+int main(int argc, char* argv[]){
+    char c;
+    int s = 5, E = 1, b = 5;
+    int shapes[MAXSHAPES][2] = {{32, 32}, {64, 64}, {61, 67}};
+    int count = 3, i, n, best, k;
+    FILE *out = stdout;
+    variant_t *v;
+
+    while( (c=getopt(argc,argv,"hs:E:b:o:")) != -1){
+        switch(c){
+        case 's':
+            s = atoi(optarg);
+            break;
+        case 'E':
+            E = atoi(optarg);
+            break;
+        case 'b':
+            b = atoi(optarg);
+            break;
+        case 'o':
+            if ((out = fopen(optarg, "w")) == NULL) {
+                fprintf(stderr, "Can't write %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'h':
+            usage(argv);
+            exit(0);
+        default:
+            usage(argv);
+            exit(1);
+        }
+    }
+    if (optind < argc)
+        count = 0;
+    for (i = optind; i < argc; i++) {
+        if (count == MAXSHAPES ||
+            sscanf(argv[i], "%dx%d", &shapes[count][0], &shapes[count][1]) != 2 ||
+            shapes[count][0] < 1 || shapes[count][0] > MAXN ||
+            shapes[count][1] < 1 || shapes[count][1] > MAXN) {
+            usage(argv);
+            exit(1);
+        }
+        count++;
+    }
+    if (s < 0 || s > 20 || E < 1 || b < 0 || s + b > 40) {
+        usage(argv);
+        exit(1);
+    }
+
+    v = malloc(3 * NSIZES * NSIZES * 4 * sizeof(variant_t) + 2 * sizeof(variant_t));
+    assert(v);
+    initCacheModel(&model, s, E, b);
+    fprintf(out, "/*\n * Generated by transtune -s %d -E %d -b %d\n */\n\n", s, E, b);
+    for (k = 0; k < count; k++) {
+        M = shapes[k][0];
+        N = shapes[k][1];
+        n = make_variants(v);
+        evaluate(v, n);
+        for (best = 0, i = 1; i < n; i++)
+            if (v[i].misses < v[best].misses)
+                best = i;
+        fprintf(stderr, "%dx%d: %d variants, best %u misses: %s\n", M, N, n,
+                v[best].misses, v[best].desc);
+        emit_kernel(out, &v[best], s, E, b);
+    }
+    emit_dispatch(out, shapes, count);
+
+    freeCacheModel(&model);
+    free(v);
+    if (out != stdout && fclose(out) != 0) {
+        fprintf(stderr, "Error writing the generated code\n");
+        exit(1);
+    }
+    return 0;
+}